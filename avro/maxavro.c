@@ -236,6 +236,119 @@ uint64_t avro_length_double(double val)
     return sizeof(val);
 }
 
+/**
+ * @brief Read an Avro integer from the current data block
+ *
+ * @param file File whose block data is in memory
+ * @param dest Destination where the read value is written
+ * @return True if the value was read, false if the block ended before the
+ * value or the value was too long
+ *
+ * @see maxavro_block_load
+ */
+bool maxavro_block_read_integer(MAXAVRO_FILE* file, uint64_t *dest)
+{
+    const uint8_t *ptr = file->buffer_ptr;
+    const uint8_t *end = file->buffer_end;
+    uint64_t rval = 0;
+    uint8_t nread = 0;
+    uint8_t byte;
+
+    do
+    {
+        if (ptr >= end)
+        {
+            file->last_error = MAXAVRO_ERR_BLOCK_OVERFLOW;
+            return false;
+        }
+        if (nread >= MAX_INTEGER_SIZE)
+        {
+            file->last_error = MAXAVRO_ERR_VALUE_OVERFLOW;
+            return false;
+        }
+        byte = *ptr++;
+        rval |= (uint64_t)(byte & 0x7f) << (nread++ * 7);
+    }
+    while (more_bytes(byte));
+
+    file->buffer_ptr = (uint8_t*)ptr;
+
+    if (dest)
+    {
+        *dest = avro_decode(rval);
+    }
+    return true;
+}
+
+/**
+ * @brief Read an Avro string from the current data block
+ *
+ * The string is not copied or null-terminated, @c str points to the block data
+ * and is valid until the next block is read.
+ *
+ * @param file File whose block data is in memory
+ * @param str Pointer to the string data
+ * @param len Length of the string
+ * @return True if the string was read, false if the block ended before the
+ * string did
+ */
+bool maxavro_block_read_string(MAXAVRO_FILE* file, const char **str, size_t *len)
+{
+    uint64_t slen;
+
+    if (!maxavro_block_read_integer(file, &slen))
+    {
+        return false;
+    }
+
+    if (slen > (uint64_t)(file->buffer_end - file->buffer_ptr))
+    {
+        file->last_error = MAXAVRO_ERR_BLOCK_OVERFLOW;
+        return false;
+    }
+
+    *str = (const char*)file->buffer_ptr;
+    *len = slen;
+    file->buffer_ptr += slen;
+    return true;
+}
+
+/**
+ * @brief Read a fixed size value from the current data block
+ *
+ * @param file File whose block data is in memory
+ * @param dest Destination where the value is copied
+ * @param len Size of the value
+ * @return True if the value was read, false if the block ended before the value
+ */
+bool maxavro_block_read_fixed(MAXAVRO_FILE* file, void *dest, size_t len)
+{
+    if (len > (size_t)(file->buffer_end - file->buffer_ptr))
+    {
+        file->last_error = MAXAVRO_ERR_BLOCK_OVERFLOW;
+        return false;
+    }
+
+    memcpy(dest, file->buffer_ptr, len);
+    file->buffer_ptr += len;
+    return true;
+}
+
+/**
+ * @brief Get the file offset of the read position in the current data block
+ *
+ * @param file File to inspect
+ * @return File offset of the next value
+ */
+long maxavro_block_offset(MAXAVRO_FILE* file)
+{
+    if (file->buffer_ptr)
+    {
+        return file->data_start_pos + (file->buffer_ptr - file->block_data);
+    }
+    return ftell(file->file);
+}
+
 /**
  * @brief Read an Avro map
  *
@@ -19,6 +19,7 @@
 #include <stdbool.h>
 #include <jansson.h>
 #include <buffer.h>
+#include <spinlock.h>
 
 /** File magic and sync marker sizes block sizes */
 #define AVRO_MAGIC_SIZE 4
@@ -49,20 +50,52 @@ typedef struct
     enum maxavro_value_type type;
 } MAXAVRO_SCHEMA_FIELD;
 
+/** Operations of the program that skips over a record */
+enum maxavro_skip_op
+{
+    MAXAVRO_SKIP_INTEGER, /*< Skip @c count variable length integers */
+    MAXAVRO_SKIP_FIXED, /*< Skip @c count bytes */
+    MAXAVRO_SKIP_STRING /*< Skip @c count length-prefixed strings or bytes */
+};
+
+typedef struct
+{
+    enum maxavro_skip_op op;
+    size_t count;
+} MAXAVRO_SKIP_OP;
+
 typedef struct
 {
     MAXAVRO_SCHEMA_FIELD *fields;
     size_t num_fields;
+    MAXAVRO_SKIP_OP *skip_ops; /*< The fields compiled into skip operations,
+                                * consecutive fields of the same kind are merged */
+    size_t num_skip_ops; /*< Number of skip operations */
+    bool skippable; /*< False if a field type has no skip operation */
 } MAXAVRO_SCHEMA;
 
+/** Block compression codecs */
+enum maxavro_codec
+{
+    MAXAVRO_CODEC_UNKNOWN = -1,
+    MAXAVRO_CODEC_NULL,
+    MAXAVRO_CODEC_DEFLATE,
+    MAXAVRO_CODEC_SNAPPY
+};
+
 enum maxavro_error
 {
     MAXAVRO_ERR_NONE,
     MAXAVRO_ERR_IO,
     MAXAVRO_ERR_MEMORY,
-    MAXAVRO_ERR_VALUE_OVERFLOW
+    MAXAVRO_ERR_VALUE_OVERFLOW,
+    MAXAVRO_ERR_BLOCK_OVERFLOW,
+    MAXAVRO_ERR_CODEC
 };
 
+struct maxavro_json_encoder;
+struct maxavro_block_cache;
+
 typedef struct
 {
     FILE* file;
@@ -86,6 +119,25 @@ typedef struct
                          * to know when to read it and when not to.  */
     enum maxavro_error last_error; /*< Last error */
     uint8_t sync[SYNC_MARKER_SIZE];
+    enum maxavro_codec codec; /*< The block compression codec of the file */
+    uint8_t *compressed; /*< Compressed block data */
+    size_t compressed_size; /*< Size of the compressed data buffer */
+    void *codec_state; /*< Decompression state kept between blocks */
+
+    /** The data of the current block is read into memory and decompressed
+     * when the first record of the block is read. The records are decoded
+     * from memory. */
+    uint8_t *buffer; /*< Block data buffer */
+    size_t buffer_size; /*< Size of the block data buffer */
+    uint8_t *buffer_ptr; /*< Read position in the block, NULL if the block
+                          * is not in memory */
+    uint8_t *buffer_end; /*< End of the block data */
+    uint8_t *block_data; /*< Start of the block data in memory */
+    struct maxavro_block_cache *block_cache; /*< Shared cache of blocks, NULL if
+                                              * the blocks are read from the file */
+    GWBUF *cached_block; /*< The current block if it was found in the cache */
+    struct maxavro_json_encoder *json_encoder; /*< JSON encoder compiled from the
+                                                * schema, created on first use */
 } MAXAVRO_FILE;
 
 /** A record field value */
@@ -115,6 +167,104 @@ typedef struct
     MAXAVRO_FILE *avrofile; /*< The current open file */
 } MAXAVRO_DATABLOCK;
 
+/** A JSON encoded string */
+typedef struct
+{
+    char *str;
+    size_t len;
+} MAXAVRO_JSON_STRING;
+
+/** Comparison operators of record filters */
+enum maxavro_compare
+{
+    MAXAVRO_CMP_EQ,
+    MAXAVRO_CMP_NE,
+    MAXAVRO_CMP_LT,
+    MAXAVRO_CMP_LE,
+    MAXAVRO_CMP_GT,
+    MAXAVRO_CMP_GE
+};
+
+/** Comparison of a field with a constant value */
+typedef struct
+{
+    char *field; /*< Name of the compared field */
+    enum maxavro_compare op; /*< Comparison operator */
+    char *value; /*< The constant as text */
+} MAXAVRO_CONDITION;
+
+/**
+ * A record filter. Only the records that match all of the conditions are
+ * encoded and only the listed fields of them are encoded.
+ */
+typedef struct
+{
+    char **fields; /*< Fields to encode or NULL for all fields */
+    size_t num_fields; /*< Number of fields */
+    MAXAVRO_CONDITION *conditions; /*< Conditions the records must match */
+    size_t num_conditions; /*< Number of conditions */
+} MAXAVRO_FILTER;
+
+/** A condition compiled against the type of the field */
+typedef struct
+{
+    enum maxavro_compare op; /*< Comparison operator */
+    uint64_t integer; /*< Constant for integer, boolean and enum fields */
+    double real; /*< Constant for floating point fields */
+    char *str; /*< Constant for string and bytes fields */
+    size_t len; /*< Length of @c str */
+} MAXAVRO_JSON_CONDITION;
+
+/**
+ * A schema compiled into JSON text fragments. Records are encoded directly from
+ * the Avro data into an output buffer that is reused between records.
+ */
+typedef struct maxavro_json_encoder
+{
+    MAXAVRO_SCHEMA *schema; /*< The schema the encoder was compiled from */
+    MAXAVRO_JSON_STRING *keys; /*< Encoded field names with the separators */
+    MAXAVRO_JSON_STRING **symbols; /*< Encoded enum symbols of each field */
+    size_t *num_symbols; /*< Number of enum symbols of each field */
+    uint64_t *integers; /*< Integer values of the last encoded record */
+    const MAXAVRO_FILTER *filter; /*< The filter the encoder was compiled with */
+    bool *skip; /*< Fields that are read but not encoded */
+    MAXAVRO_JSON_CONDITION **conditions; /*< Compiled conditions of each field */
+    size_t *num_conditions; /*< Number of conditions of each field */
+    bool match_none; /*< A condition can never match in this schema */
+    char *buffer; /*< Output buffer */
+    size_t buffer_size; /*< Size of the output buffer */
+    size_t length; /*< Length of the encoded data in the output buffer */
+} MAXAVRO_JSON_ENCODER;
+
+/** A complete data block in the block cache */
+typedef struct maxavro_cached_block
+{
+    char *filename; /*< Name of the file without the directory */
+    long pos; /*< Offset of the block in the file */
+    GWBUF *block; /*< The block as stored in the file, with the sync marker */
+    struct maxavro_cached_block *hash_next; /*< Next block in the same bucket */
+    struct maxavro_cached_block *next; /*< Next newer block */
+} MAXAVRO_CACHED_BLOCK;
+
+/** Number of hash buckets in a block cache */
+#define MAXAVRO_BLOCK_CACHE_BUCKETS 1024
+
+/**
+ * Recently written data blocks shared by all readers of the files. The oldest
+ * blocks are removed when the size limit is reached.
+ */
+typedef struct maxavro_block_cache
+{
+    SPINLOCK lock;
+    MAXAVRO_CACHED_BLOCK *buckets[MAXAVRO_BLOCK_CACHE_BUCKETS];
+    MAXAVRO_CACHED_BLOCK *oldest; /*< The block that is removed next */
+    MAXAVRO_CACHED_BLOCK *newest; /*< The last added block */
+    size_t size; /*< Total size of the cached blocks */
+    size_t max_size; /*< Maximum size of the cached blocks */
+    uint64_t hits; /*< Number of blocks found in the cache */
+    uint64_t misses; /*< Number of blocks read from the files */
+} MAXAVRO_BLOCK_CACHE;
+
 typedef struct avro_map_value
 {
     char* key;
@@ -144,6 +294,13 @@ bool maxavro_skip_string(MAXAVRO_FILE* file);
 bool maxavro_read_float(MAXAVRO_FILE *file, float *dest);
 bool maxavro_read_double(MAXAVRO_FILE *file, double *dest);
 
+/** Reading primitives from the current data block */
+bool maxavro_block_load(MAXAVRO_FILE *file);
+bool maxavro_block_read_integer(MAXAVRO_FILE *file, uint64_t *val);
+bool maxavro_block_read_string(MAXAVRO_FILE *file, const char **str, size_t *len);
+bool maxavro_block_read_fixed(MAXAVRO_FILE *file, void *dest, size_t len);
+long maxavro_block_offset(MAXAVRO_FILE *file);
+
 /** Reading complex types */
 MAXAVRO_MAP* maxavro_map_read(MAXAVRO_FILE *file);
 void maxavro_map_free(MAXAVRO_MAP *value);
@@ -155,6 +312,26 @@ bool maxavro_record_seek(MAXAVRO_FILE *file, uint64_t offset);
 bool maxavro_record_set_pos(MAXAVRO_FILE *file, long pos);
 bool maxavro_next_block(MAXAVRO_FILE *file);
 
+/** Encoding records as JSON text */
+MAXAVRO_JSON_ENCODER* maxavro_json_encoder_alloc(MAXAVRO_SCHEMA *schema);
+void maxavro_json_encoder_free(MAXAVRO_JSON_ENCODER *encoder);
+MAXAVRO_JSON_ENCODER* maxavro_file_json_encoder(MAXAVRO_FILE *file);
+int maxavro_json_encoder_field(MAXAVRO_JSON_ENCODER *encoder, const char *name);
+bool maxavro_record_encode_json(MAXAVRO_FILE *file, MAXAVRO_JSON_ENCODER *encoder);
+bool maxavro_json_encoder_set_filter(MAXAVRO_JSON_ENCODER *encoder, const MAXAVRO_FILTER *filter);
+void maxavro_filter_free(MAXAVRO_FILTER *filter);
+GWBUF* maxavro_json_encoder_flush(MAXAVRO_JSON_ENCODER *encoder);
+
+/** Sharing recently written blocks between readers */
+MAXAVRO_BLOCK_CACHE* maxavro_block_cache_alloc(size_t max_size);
+void maxavro_block_cache_free(MAXAVRO_BLOCK_CACHE *cache);
+GWBUF* maxavro_block_cache_get(MAXAVRO_BLOCK_CACHE *cache, const char *filename, long pos);
+int maxavro_block_cache_fill(MAXAVRO_BLOCK_CACHE *cache, MAXAVRO_FILE *file);
+
+/** Block compression */
+enum maxavro_codec maxavro_codec_from_string(const char *name);
+const char* maxavro_codec_to_string(enum maxavro_codec codec);
+
 /** File operations */
 MAXAVRO_FILE* maxavro_file_open(const char* filename);
 void maxavro_file_close(MAXAVRO_FILE *file);
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file maxavro_cache.c - Shared cache of recently written data blocks
+ *
+ * The writer of the files reads each new data block once and adds it to the
+ * cache. Readers that have the cache set look up each block they read from the
+ * cache and only read the blocks that are not in it from the file. The blocks
+ * are stored as they are in the file, with the sync marker, and readers get
+ * clones of the cached buffers so the data is never copied.
+ */
+
+#include "maxavro.h"
+#include <string.h>
+#include <skygw_utils.h>
+#include <log_manager.h>
+
+bool maxavro_read_datablock_start(MAXAVRO_FILE *file);
+
+/**
+ * @brief Allocate a block cache
+ *
+ * @param max_size Maximum total size of the cached blocks in bytes
+ * @return New block cache or NULL if memory allocation failed
+ */
+MAXAVRO_BLOCK_CACHE* maxavro_block_cache_alloc(size_t max_size)
+{
+    MAXAVRO_BLOCK_CACHE *cache = calloc(1, sizeof(MAXAVRO_BLOCK_CACHE));
+
+    if (cache)
+    {
+        spinlock_init(&cache->lock);
+        cache->max_size = max_size;
+    }
+    else
+    {
+        MXS_ERROR("Memory allocation failed.");
+    }
+
+    return cache;
+}
+
+static void free_block(MAXAVRO_CACHED_BLOCK *block)
+{
+    gwbuf_free(block->block);
+    free(block->filename);
+    free(block);
+}
+
+/**
+ * @brief Free a block cache
+ *
+ * The cloned buffers the readers have are not affected.
+ *
+ * @param cache Cache to free
+ */
+void maxavro_block_cache_free(MAXAVRO_BLOCK_CACHE *cache)
+{
+    if (cache)
+    {
+        while (cache->oldest)
+        {
+            MAXAVRO_CACHED_BLOCK *block = cache->oldest;
+            cache->oldest = block->next;
+            free_block(block);
+        }
+        free(cache);
+    }
+}
+
+/** Files are identified by their names so that the directory part of the path
+ * does not need to be the same for all readers */
+static inline const char* base_name(const char *filename)
+{
+    const char *name = strrchr(filename, '/');
+    return name ? name + 1 : filename;
+}
+
+static inline unsigned int block_hash(const char *name, long pos)
+{
+    return (simple_str_hash((char*)name) ^ (unsigned int)pos) % MAXAVRO_BLOCK_CACHE_BUCKETS;
+}
+
+/**
+ * @brief Remove the oldest blocks until the cache is below its size limit
+ *
+ * The cache lock must be held when calling this function.
+ *
+ * @param cache Cache to trim
+ */
+static void trim_cache(MAXAVRO_BLOCK_CACHE *cache)
+{
+    while (cache->size > cache->max_size && cache->oldest)
+    {
+        MAXAVRO_CACHED_BLOCK *block = cache->oldest;
+        MAXAVRO_CACHED_BLOCK **ptr = &cache->buckets[block_hash(block->filename, block->pos)];
+
+        while (*ptr != block)
+        {
+            ptr = &(*ptr)->hash_next;
+        }
+
+        *ptr = block->hash_next;
+        cache->oldest = block->next;
+
+        if (cache->oldest == NULL)
+        {
+            cache->newest = NULL;
+        }
+
+        cache->size -= GWBUF_LENGTH(block->block);
+        free_block(block);
+    }
+}
+
+/**
+ * @brief Add a block to the cache
+ *
+ * @param cache Cache to use
+ * @param filename Name of the file
+ * @param pos Offset of the block in the file
+ * @param buffer The complete block, freed by the cache
+ */
+static void add_block(MAXAVRO_BLOCK_CACHE *cache, const char *filename, long pos, GWBUF *buffer)
+{
+    MAXAVRO_CACHED_BLOCK *block = calloc(1, sizeof(MAXAVRO_CACHED_BLOCK));
+    const char *name = base_name(filename);
+
+    if (block == NULL || (block->filename = strdup(name)) == NULL)
+    {
+        MXS_ERROR("Memory allocation failed.");
+        free(block);
+        gwbuf_free(buffer);
+        return;
+    }
+
+    block->pos = pos;
+    block->block = buffer;
+    unsigned int hash = block_hash(name, pos);
+
+    spinlock_acquire(&cache->lock);
+
+    block->hash_next = cache->buckets[hash];
+    cache->buckets[hash] = block;
+
+    if (cache->newest)
+    {
+        cache->newest->next = block;
+    }
+    else
+    {
+        cache->oldest = block;
+    }
+
+    cache->newest = block;
+    cache->size += GWBUF_LENGTH(buffer);
+    trim_cache(cache);
+
+    spinlock_release(&cache->lock);
+}
+
+/**
+ * @brief Find a block in the cache
+ *
+ * @param cache Cache to use
+ * @param filename Name of the file, the directory part is ignored
+ * @param pos Offset of the block in the file
+ * @return A clone of the cached block or NULL if the block is not in the cache
+ */
+GWBUF* maxavro_block_cache_get(MAXAVRO_BLOCK_CACHE *cache, const char *filename, long pos)
+{
+    const char *name = base_name(filename);
+    GWBUF *rval = NULL;
+
+    spinlock_acquire(&cache->lock);
+
+    for (MAXAVRO_CACHED_BLOCK *block = cache->buckets[block_hash(name, pos)]; block;
+         block = block->hash_next)
+    {
+        if (block->pos == pos && strcmp(block->filename, name) == 0)
+        {
+            rval = gwbuf_clone(block->block);
+            break;
+        }
+    }
+
+    if (rval)
+    {
+        cache->hits++;
+    }
+    else
+    {
+        cache->misses++;
+    }
+
+    spinlock_release(&cache->lock);
+
+    return rval;
+}
+
+/**
+ * @brief Add the new blocks of a file to the cache
+ *
+ * All complete blocks from the current position of the file to the end of the
+ * file are read and added to the cache. The file must not use the cache itself.
+ *
+ * @param cache Cache to use
+ * @param file File to read from
+ * @return Number of blocks added to the cache
+ */
+int maxavro_block_cache_fill(MAXAVRO_BLOCK_CACHE *cache, MAXAVRO_FILE *file)
+{
+    ss_dassert(file->block_cache == NULL);
+    int n = 0;
+
+    while (file->last_error == MAXAVRO_ERR_NONE &&
+           (file->metadata_read || maxavro_read_datablock_start(file)))
+    {
+        long pos = file->block_start_pos;
+        GWBUF *block = maxavro_record_read_binary(file);
+
+        if (block == NULL)
+        {
+            break;
+        }
+
+        add_block(cache, file->filename, pos, block);
+        n++;
+    }
+
+    return n;
+}
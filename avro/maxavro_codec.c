@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file maxavro_codec.c - Decompression of Avro data blocks
+ *
+ * The deflate codec stores the block data as raw deflate data without a zlib
+ * header. The snappy codec stores the snappy compressed data followed by the
+ * big-endian CRC32 of the uncompressed data. The snappy codec is only
+ * available if MaxScale is built with WITH_SNAPPY.
+ */
+
+#include "maxavro.h"
+#include <string.h>
+#include <zlib.h>
+#include <log_manager.h>
+#include <maxscale_crc32.h>
+
+#ifdef HAVE_SNAPPY
+#include <snappy-c.h>
+#endif
+
+bool maxavro_block_reserve(MAXAVRO_FILE *file, uint8_t **buffer, size_t *size, size_t needed);
+
+static inline bool reserve_buffer(MAXAVRO_FILE *file, size_t size)
+{
+    return maxavro_block_reserve(file, &file->buffer, &file->buffer_size, size);
+}
+
+static const char *codec_names[] =
+{
+    "null",
+    "deflate",
+    "snappy"
+};
+
+/**
+ * @brief Convert a codec name to a codec
+ *
+ * @param name Name of the codec as stored in the avro.codec metadata
+ * @return The codec or MAXAVRO_CODEC_UNKNOWN if the codec is not supported
+ */
+enum maxavro_codec maxavro_codec_from_string(const char *name)
+{
+    if (name == NULL || strcmp(name, "null") == 0)
+    {
+        return MAXAVRO_CODEC_NULL;
+    }
+    else if (strcmp(name, "deflate") == 0)
+    {
+        return MAXAVRO_CODEC_DEFLATE;
+    }
+#ifdef HAVE_SNAPPY
+    else if (strcmp(name, "snappy") == 0)
+    {
+        return MAXAVRO_CODEC_SNAPPY;
+    }
+#endif
+
+    return MAXAVRO_CODEC_UNKNOWN;
+}
+
+/**
+ * @brief Convert a codec to its name
+ *
+ * @param codec Codec to convert
+ * @return Name of the codec
+ */
+const char* maxavro_codec_to_string(enum maxavro_codec codec)
+{
+    if (codec >= MAXAVRO_CODEC_NULL && codec <= MAXAVRO_CODEC_SNAPPY)
+    {
+        return codec_names[codec];
+    }
+    return "unknown";
+}
+
+static bool inflate_block(MAXAVRO_FILE *file, uint8_t *data, size_t len, size_t *size)
+{
+    z_stream *stream = file->codec_state;
+
+    if (stream == NULL)
+    {
+        if ((stream = calloc(1, sizeof(z_stream))) == NULL ||
+            inflateInit2(stream, -MAX_WBITS) != Z_OK)
+        {
+            MXS_ERROR("Failed to initialize inflate stream.");
+            free(stream);
+            file->last_error = MAXAVRO_ERR_MEMORY;
+            return false;
+        }
+        file->codec_state = stream;
+    }
+    else
+    {
+        inflateReset(stream);
+    }
+
+    /** Most rows compress to less than a quarter of their size */
+    if (!reserve_buffer(file, len * 4))
+    {
+        return false;
+    }
+
+    stream->next_in = data;
+    stream->avail_in = len;
+    stream->next_out = file->buffer;
+    stream->avail_out = file->buffer_size;
+
+    int rc;
+
+    while ((rc = inflate(stream, Z_FINISH)) != Z_STREAM_END)
+    {
+        if ((rc != Z_BUF_ERROR && rc != Z_OK) || stream->avail_out != 0)
+        {
+            MXS_ERROR("Failed to inflate data block in '%s': %s", file->filename,
+                      stream->msg ? stream->msg : "truncated data");
+            file->last_error = MAXAVRO_ERR_CODEC;
+            return false;
+        }
+
+        /** Grow the buffer and continue where the output stopped */
+        size_t used = file->buffer_size - stream->avail_out;
+
+        if (!reserve_buffer(file, file->buffer_size * 2))
+        {
+            return false;
+        }
+
+        stream->next_out = file->buffer + used;
+        stream->avail_out = file->buffer_size - used;
+    }
+
+    *size = file->buffer_size - stream->avail_out;
+    return true;
+}
+
+#ifdef HAVE_SNAPPY
+static bool snappy_block(MAXAVRO_FILE *file, uint8_t *data, size_t len, size_t *size)
+{
+    size_t ulen;
+
+    if (len < 4 || snappy_uncompressed_length((char*)data, len - 4, &ulen) != SNAPPY_OK)
+    {
+        MXS_ERROR("Corrupted snappy data block in '%s'.", file->filename);
+        file->last_error = MAXAVRO_ERR_CODEC;
+        return false;
+    }
+
+    if (!reserve_buffer(file, ulen > 0 ? ulen : 1))
+    {
+        return false;
+    }
+
+    if (snappy_uncompress((char*)data, len - 4, (char*)file->buffer, &ulen) != SNAPPY_OK)
+    {
+        MXS_ERROR("Failed to uncompress snappy data block in '%s'.", file->filename);
+        file->last_error = MAXAVRO_ERR_CODEC;
+        return false;
+    }
+
+    uint8_t *p = data + len - 4;
+    uint32_t crc = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+
+    if (mxs_crc32(0, file->buffer, ulen) != crc)
+    {
+        MXS_ERROR("Checksum mismatch in snappy data block in '%s'.", file->filename);
+        file->last_error = MAXAVRO_ERR_CODEC;
+        return false;
+    }
+
+    *size = ulen;
+    return true;
+}
+#endif
+
+/**
+ * @brief Decompress a data block into the block buffer
+ *
+ * @param file File being read
+ * @param data Compressed block data
+ * @param len Length of the compressed data
+ * @param size Size of the uncompressed data
+ * @return True if the block was decompressed
+ */
+bool maxavro_block_decompress(MAXAVRO_FILE *file, uint8_t *data, size_t len, size_t *size)
+{
+    switch (file->codec)
+    {
+        case MAXAVRO_CODEC_DEFLATE:
+            return inflate_block(file, data, len, size);
+
+#ifdef HAVE_SNAPPY
+        case MAXAVRO_CODEC_SNAPPY:
+            return snappy_block(file, data, len, size);
+#endif
+
+        default:
+            MXS_ERROR("Unsupported codec '%s' in '%s'.",
+                      maxavro_codec_to_string(file->codec), file->filename);
+            file->last_error = MAXAVRO_ERR_CODEC;
+            return false;
+    }
+}
+
+/**
+ * @brief Free the decompression state of a file
+ *
+ * @param file File being closed
+ */
+void maxavro_codec_free(MAXAVRO_FILE *file)
+{
+    if (file->codec_state && file->codec == MAXAVRO_CODEC_DEFLATE)
+    {
+        inflateEnd((z_stream*)file->codec_state);
+    }
+    free(file->codec_state);
+    file->codec_state = NULL;
+}
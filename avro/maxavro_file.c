@@ -16,6 +16,8 @@
 #include <string.h>
 #include <log_manager.h>
 
+bool maxavro_block_decompress(MAXAVRO_FILE *file, uint8_t *data, size_t len, size_t *size);
+void maxavro_codec_free(MAXAVRO_FILE *file);
 
 static bool maxavro_read_sync(FILE *file, uint8_t* sync)
 {
@@ -62,11 +64,67 @@ bool maxavro_verify_block(MAXAVRO_FILE *file)
     return true;
 }
 
+/**
+ * @brief Start reading a block from the block cache
+ *
+ * The file position is moved past the block so that the next block is read
+ * from the right position if it is not in the cache.
+ *
+ * @param file File being read
+ * @return True if the block was found in the cache
+ */
+static bool read_cached_block_start(MAXAVRO_FILE *file)
+{
+    GWBUF *block = maxavro_block_cache_get(file->block_cache, file->filename,
+                                           file->block_start_pos);
+
+    if (block == NULL)
+    {
+        return false;
+    }
+
+    uint64_t records, bytes;
+    file->cached_block = block;
+    file->buffer_ptr = GWBUF_DATA(block);
+    file->buffer_end = file->buffer_ptr + GWBUF_LENGTH(block);
+
+    /** The header is decoded like the block data */
+    if (!maxavro_block_read_integer(file, &records) || !maxavro_block_read_integer(file, &bytes))
+    {
+        MXS_ERROR("Corrupted data block in cache for '%s'.", file->filename);
+        gwbuf_free(file->cached_block);
+        file->cached_block = NULL;
+        file->buffer_ptr = NULL;
+        file->buffer_end = NULL;
+        return false;
+    }
+
+    file->block_size = bytes;
+    file->records_in_block = records;
+    file->records_read_from_block = 0;
+    file->data_start_pos = file->block_start_pos + (file->buffer_ptr - (uint8_t*)GWBUF_DATA(block));
+    file->buffer_ptr = NULL;
+    file->buffer_end = NULL;
+    file->metadata_read = true;
+    fseek(file->file, file->block_start_pos + GWBUF_LENGTH(block), SEEK_SET);
+    return true;
+}
+
 bool maxavro_read_datablock_start(MAXAVRO_FILE* file)
 {
     /** The actual start of the binary block */
     file->block_start_pos = ftell(file->file);
     file->metadata_read = false;
+    file->buffer_ptr = NULL;
+    file->buffer_end = NULL;
+    gwbuf_free(file->cached_block);
+    file->cached_block = NULL;
+
+    if (file->block_cache && read_cached_block_start(file))
+    {
+        return true;
+    }
+
     uint64_t records, bytes;
     bool rval = maxavro_read_integer(file, &records) && maxavro_read_integer(file, &bytes);
 
@@ -90,6 +148,118 @@ bool maxavro_read_datablock_start(MAXAVRO_FILE* file)
     return rval;
 }
 
+/**
+ * @brief Make sure a buffer is large enough
+ *
+ * @param file File being read
+ * @param buffer Buffer to grow
+ * @param size Current size of the buffer
+ * @param needed Required size
+ * @return True if the buffer is large enough
+ */
+bool maxavro_block_reserve(MAXAVRO_FILE *file, uint8_t **buffer, size_t *size, size_t needed)
+{
+    if (needed > *size)
+    {
+        uint8_t *newbuf = realloc(*buffer, needed);
+
+        if (newbuf == NULL)
+        {
+            MXS_ERROR("Failed to allocate %lu bytes for data block.", needed);
+            file->last_error = MAXAVRO_ERR_MEMORY;
+            return false;
+        }
+
+        *buffer = newbuf;
+        *size = needed;
+    }
+    return true;
+}
+
+/**
+ * @brief Read the data of the current block into memory
+ *
+ * The data is read when the first record of the block is needed and compressed
+ * blocks are decompressed. If the whole block is not yet in the file, the file
+ * position is restored so that the block can be read again once the rest of
+ * the data has been written. A block found in the block cache is not read from
+ * the file.
+ *
+ * @param file File to read from
+ * @return True if the block data is in memory
+ */
+bool maxavro_block_load(MAXAVRO_FILE *file)
+{
+    if (file->buffer_ptr)
+    {
+        return true;
+    }
+
+    bool compressed = file->codec != MAXAVRO_CODEC_NULL;
+
+    if (file->cached_block)
+    {
+        /** The block data is used directly from the cached buffer */
+        uint8_t *data = (uint8_t*)GWBUF_DATA(file->cached_block) +
+                        (file->data_start_pos - file->block_start_pos);
+        size_t datasize = file->block_size;
+
+        if (compressed)
+        {
+            if (!maxavro_block_decompress(file, data, file->block_size, &datasize))
+            {
+                return false;
+            }
+            data = file->buffer;
+        }
+
+        file->block_data = data;
+        file->buffer_ptr = data;
+        file->buffer_end = data + datasize;
+        return true;
+    }
+
+    uint8_t **dest = compressed ? &file->compressed : &file->buffer;
+    size_t *size = compressed ? &file->compressed_size : &file->buffer_size;
+
+    if (!maxavro_block_reserve(file, dest, size, file->block_size))
+    {
+        return false;
+    }
+
+    size_t nread = fread(*dest, 1, file->block_size, file->file);
+
+    if (nread != file->block_size)
+    {
+        if (ferror(file->file))
+        {
+            MXS_ERROR("Failed to read %lu bytes from '%s': %d, %s", file->block_size,
+                      file->filename, errno, strerror(errno));
+            file->last_error = MAXAVRO_ERR_IO;
+        }
+        else
+        {
+            /** A partially written block */
+            clearerr(file->file);
+            fseek(file->file, file->data_start_pos, SEEK_SET);
+        }
+        return false;
+    }
+
+    size_t datasize = file->block_size;
+
+    if (compressed && !maxavro_block_decompress(file, file->compressed,
+                                                file->block_size, &datasize))
+    {
+        return false;
+    }
+
+    file->block_data = file->buffer;
+    file->buffer_ptr = file->buffer;
+    file->buffer_end = file->buffer + datasize;
+    return true;
+}
+
 /** The header metadata is encoded as an Avro map with @c bytes encoded
  * key-value pairs. A @c bytes value is written as a length encoded string
  * where the length of the value is stored as a @c long followed by the
@@ -100,12 +270,23 @@ static char* read_schema(MAXAVRO_FILE* file)
     MAXAVRO_MAP* head = maxavro_map_read(file);
     MAXAVRO_MAP* map = head;
 
+    file->codec = MAXAVRO_CODEC_NULL;
+
     while (map)
     {
         if (strcmp(map->key, "avro.schema") == 0)
         {
+            free(rval);
             rval = strdup(map->value);
-            break;
+        }
+        else if (strcmp(map->key, "avro.codec") == 0)
+        {
+            file->codec = maxavro_codec_from_string(map->value);
+
+            if (file->codec == MAXAVRO_CODEC_UNKNOWN)
+            {
+                MXS_ERROR("Unsupported codec '%s' in '%s'.", map->value, file->filename);
+            }
         }
         map = map->next;
     }
@@ -114,6 +295,11 @@ static char* read_schema(MAXAVRO_FILE* file)
     {
         MXS_ERROR("No schema found from Avro header.");
     }
+    else if (file->codec == MAXAVRO_CODEC_UNKNOWN)
+    {
+        free(rval);
+        rval = NULL;
+    }
 
     maxavro_map_free(head);
     return rval;
@@ -168,11 +354,13 @@ MAXAVRO_FILE* maxavro_file_open(const char* filename)
             !maxavro_read_datablock_start(avrofile))
         {
             MXS_ERROR("Failed to initialize avrofile.");
-            free(avrofile->schema);
-            free(avrofile);
+            maxavro_file_close(avrofile);
             avrofile = NULL;
         }
-        avrofile->header_end_pos = avrofile->block_start_pos;
+        else
+        {
+            avrofile->header_end_pos = avrofile->block_start_pos;
+        }
         free(schema);
     }
     else
@@ -213,6 +401,12 @@ const char* maxavro_get_error_string(MAXAVRO_FILE *file)
         case MAXAVRO_ERR_VALUE_OVERFLOW:
             return "MAXAVRO_ERR_VALUE_OVERFLOW";
 
+        case MAXAVRO_ERR_BLOCK_OVERFLOW:
+            return "MAXAVRO_ERR_BLOCK_OVERFLOW";
+
+        case MAXAVRO_ERR_CODEC:
+            return "MAXAVRO_ERR_CODEC";
+
         case MAXAVRO_ERR_NONE:
             return "MAXAVRO_ERR_NONE";
 
@@ -231,7 +425,12 @@ void maxavro_file_close(MAXAVRO_FILE *file)
     {
         fclose(file->file);
         free(file->filename);
+        maxavro_json_encoder_free(file->json_encoder);
         maxavro_schema_free(file->schema);
+        maxavro_codec_free(file);
+        gwbuf_free(file->cached_block);
+        free(file->compressed);
+        free(file->buffer);
         free(file);
     }
 }
@@ -0,0 +1,1024 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file maxavro_json.c - Encoding Avro records as JSON text
+ *
+ * The schema is compiled once into pre-encoded field names and enum symbols.
+ * Records are then encoded straight from the block data into a reusable output
+ * buffer without building a JSON object for each record. The output is
+ * identical to what json_dumps() produces with JSON_PRESERVE_ORDER for the
+ * object returned by maxavro_record_read_json().
+ *
+ * A record filter is compiled into the encoder as a list of fields that are only
+ * read past and conditions that are checked as soon as the field is read. The
+ * rest of a record that does not match is skipped without encoding it.
+ */
+
+#include "maxavro.h"
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <skygw_debug.h>
+#include <log_manager.h>
+
+bool maxavro_read_datablock_start(MAXAVRO_FILE *file);
+const char* type_to_string(enum maxavro_value_type type);
+
+/** Initial size of the output buffer */
+#define JSON_BUFFER_SIZE 4096
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/**
+ * @brief Make sure the output buffer has room for more data
+ *
+ * @param encoder Encoder to use
+ * @param len Number of bytes that will be added
+ * @return True if the buffer has enough space
+ */
+static inline bool json_reserve(MAXAVRO_JSON_ENCODER *encoder, size_t len)
+{
+    if (encoder->length + len > encoder->buffer_size)
+    {
+        size_t size = encoder->buffer_size * 2;
+
+        while (size < encoder->length + len)
+        {
+            size *= 2;
+        }
+
+        char *buffer = realloc(encoder->buffer, size);
+
+        if (buffer == NULL)
+        {
+            return false;
+        }
+
+        encoder->buffer = buffer;
+        encoder->buffer_size = size;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Escape a string into a JSON string
+ *
+ * Quotes, backslashes and control characters are escaped like jansson does.
+ * Other bytes are copied as-is.
+ *
+ * @param dest Destination with room for at least 6 * @c len + 2 bytes
+ * @param src String to escape
+ * @param len Length of @c src
+ * @return Number of bytes written to @c dest
+ */
+static size_t json_escape(char *dest, const char *src, size_t len)
+{
+    char *ptr = dest;
+    const char *end = src + len;
+
+    *ptr++ = '"';
+
+    while (src < end)
+    {
+        /** Copy the bytes that need no escaping in one go */
+        const char *start = src;
+
+        while (src < end && (unsigned char)*src >= 0x20 && *src != '"' && *src != '\\')
+        {
+            src++;
+        }
+
+        memcpy(ptr, start, src - start);
+        ptr += src - start;
+
+        if (src < end)
+        {
+            unsigned char c = *src++;
+            *ptr++ = '\\';
+
+            switch (c)
+            {
+                case '"':
+                case '\\':
+                    *ptr++ = c;
+                    break;
+
+                case '\b':
+                    *ptr++ = 'b';
+                    break;
+
+                case '\f':
+                    *ptr++ = 'f';
+                    break;
+
+                case '\n':
+                    *ptr++ = 'n';
+                    break;
+
+                case '\r':
+                    *ptr++ = 'r';
+                    break;
+
+                case '\t':
+                    *ptr++ = 't';
+                    break;
+
+                default:
+                    *ptr++ = 'u';
+                    *ptr++ = '0';
+                    *ptr++ = '0';
+                    *ptr++ = hex_digits[c >> 4];
+                    *ptr++ = hex_digits[c & 0xf];
+                    break;
+            }
+        }
+    }
+
+    *ptr++ = '"';
+    return ptr - dest;
+}
+
+/**
+ * @brief Create an encoded JSON string
+ *
+ * @param dest Where the string is stored
+ * @param prefix Text before the string
+ * @param str String to encode
+ * @param suffix Text after the string
+ * @return True if memory allocation was successful
+ */
+static bool json_string_alloc(MAXAVRO_JSON_STRING *dest, const char *prefix,
+                              const char *str, const char *suffix)
+{
+    size_t len = strlen(str);
+    dest->str = malloc(strlen(prefix) + len * 6 + 2 + strlen(suffix) + 1);
+
+    if (dest->str)
+    {
+        char *ptr = dest->str;
+        strcpy(ptr, prefix);
+        ptr += strlen(prefix);
+        ptr += json_escape(ptr, str, len);
+        strcpy(ptr, suffix);
+        dest->len = ptr - dest->str + strlen(suffix);
+    }
+
+    return dest->str != NULL;
+}
+
+/**
+ * @brief Encode the field names
+ *
+ * The first encoded field has no separator before it. The fields that are not
+ * encoded get the separator of the next encoded field.
+ *
+ * @param encoder Encoder to use
+ * @return True if memory allocation was successful
+ */
+static bool compile_keys(MAXAVRO_JSON_ENCODER *encoder)
+{
+    bool first = true;
+
+    for (size_t i = 0; i < encoder->schema->num_fields; i++)
+    {
+        free(encoder->keys[i].str);
+
+        if (!json_string_alloc(&encoder->keys[i], first ? "" : ", ",
+                               encoder->schema->fields[i].name, ": "))
+        {
+            return false;
+        }
+
+        if (encoder->skip == NULL || !encoder->skip[i])
+        {
+            first = false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Compile a schema into a JSON encoder
+ *
+ * @param schema Schema of the records. The schema must not be freed before the
+ * encoder is freed.
+ * @return New encoder or NULL if memory allocation failed
+ */
+MAXAVRO_JSON_ENCODER* maxavro_json_encoder_alloc(MAXAVRO_SCHEMA *schema)
+{
+    MAXAVRO_JSON_ENCODER *encoder = calloc(1, sizeof(MAXAVRO_JSON_ENCODER));
+    size_t n = schema->num_fields > 0 ? schema->num_fields : 1;
+
+    if (encoder == NULL ||
+        (encoder->keys = calloc(n, sizeof(MAXAVRO_JSON_STRING))) == NULL ||
+        (encoder->symbols = calloc(n, sizeof(MAXAVRO_JSON_STRING*))) == NULL ||
+        (encoder->num_symbols = calloc(n, sizeof(size_t))) == NULL ||
+        (encoder->integers = calloc(n, sizeof(uint64_t))) == NULL ||
+        (encoder->buffer = malloc(JSON_BUFFER_SIZE)) == NULL)
+    {
+        MXS_ERROR("Memory allocation failed.");
+        maxavro_json_encoder_free(encoder);
+        return NULL;
+    }
+
+    encoder->schema = schema;
+    encoder->buffer_size = JSON_BUFFER_SIZE;
+
+    if (!compile_keys(encoder))
+    {
+        MXS_ERROR("Memory allocation failed.");
+        maxavro_json_encoder_free(encoder);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < schema->num_fields; i++)
+    {
+        MAXAVRO_SCHEMA_FIELD *field = &schema->fields[i];
+
+        if (field->type == MAXAVRO_TYPE_ENUM)
+        {
+            json_t *arr = field->extra;
+            ss_dassert(json_is_array(arr));
+            size_t nsym = json_array_size(arr);
+
+            if ((encoder->symbols[i] = calloc(nsym > 0 ? nsym : 1, sizeof(MAXAVRO_JSON_STRING))) == NULL)
+            {
+                MXS_ERROR("Memory allocation failed.");
+                maxavro_json_encoder_free(encoder);
+                return NULL;
+            }
+
+            encoder->num_symbols[i] = nsym;
+
+            for (size_t j = 0; j < nsym; j++)
+            {
+                json_t *symbol = json_array_get(arr, j);
+                ss_dassert(json_is_string(symbol));
+
+                if (!json_string_alloc(&encoder->symbols[i][j], "", json_string_value(symbol), ""))
+                {
+                    MXS_ERROR("Memory allocation failed.");
+                    maxavro_json_encoder_free(encoder);
+                    return NULL;
+                }
+            }
+        }
+    }
+
+    return encoder;
+}
+
+/**
+ * @brief Remove the compiled filter of an encoder
+ *
+ * @param encoder Encoder to use
+ */
+static void clear_filter(MAXAVRO_JSON_ENCODER *encoder)
+{
+    if (encoder->conditions)
+    {
+        for (size_t i = 0; i < encoder->schema->num_fields; i++)
+        {
+            for (size_t j = 0; encoder->conditions[i] && j < encoder->num_conditions[i]; j++)
+            {
+                free(encoder->conditions[i][j].str);
+            }
+            free(encoder->conditions[i]);
+        }
+    }
+
+    free(encoder->skip);
+    free(encoder->conditions);
+    free(encoder->num_conditions);
+    encoder->skip = NULL;
+    encoder->conditions = NULL;
+    encoder->num_conditions = NULL;
+    encoder->filter = NULL;
+    encoder->match_none = false;
+}
+
+/**
+ * @brief Free a JSON encoder
+ *
+ * @param encoder Encoder to free
+ */
+void maxavro_json_encoder_free(MAXAVRO_JSON_ENCODER *encoder)
+{
+    if (encoder)
+    {
+        for (size_t i = 0; encoder->schema && i < encoder->schema->num_fields; i++)
+        {
+            if (encoder->keys)
+            {
+                free(encoder->keys[i].str);
+            }
+
+            if (encoder->symbols && encoder->symbols[i])
+            {
+                for (size_t j = 0; j < encoder->num_symbols[i]; j++)
+                {
+                    free(encoder->symbols[i][j].str);
+                }
+                free(encoder->symbols[i]);
+            }
+        }
+
+        clear_filter(encoder);
+        free(encoder->keys);
+        free(encoder->symbols);
+        free(encoder->num_symbols);
+        free(encoder->integers);
+        free(encoder->buffer);
+        free(encoder);
+    }
+}
+
+/**
+ * @brief Get the JSON encoder of a file
+ *
+ * The encoder is compiled from the file schema when it is first requested and
+ * it is freed when the file is closed.
+ *
+ * @param file Avro file
+ * @return The encoder or NULL if memory allocation failed
+ */
+MAXAVRO_JSON_ENCODER* maxavro_file_json_encoder(MAXAVRO_FILE *file)
+{
+    if (file->json_encoder == NULL)
+    {
+        file->json_encoder = maxavro_json_encoder_alloc(file->schema);
+    }
+
+    return file->json_encoder;
+}
+
+/**
+ * @brief Find the index of a field
+ *
+ * The integer value of the field in the last encoded record is in
+ * @c encoder->integers at the returned index.
+ *
+ * @param encoder Encoder to use
+ * @param name Name of the field
+ * @return Index of the field or -1 if the schema has no such field
+ */
+int maxavro_json_encoder_field(MAXAVRO_JSON_ENCODER *encoder, const char *name)
+{
+    for (size_t i = 0; i < encoder->schema->num_fields; i++)
+    {
+        if (strcmp(encoder->schema->fields[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Compile a condition against the type of the field
+ *
+ * A comparison with an enum symbol that the field does not have never matches
+ * an equality comparison.
+ *
+ * @param field The compared field
+ * @param cond Condition to compile
+ * @param dest Where the compiled condition is stored
+ * @return True if the constant is valid for the field type
+ */
+static bool compile_condition(MAXAVRO_SCHEMA_FIELD *field, const MAXAVRO_CONDITION *cond,
+                              MAXAVRO_JSON_CONDITION *dest)
+{
+    char *end = NULL;
+    dest->op = cond->op;
+
+    switch (field->type)
+    {
+        case MAXAVRO_TYPE_BOOL:
+            if (strcmp(cond->value, "true") == 0 || strcmp(cond->value, "1") == 0)
+            {
+                dest->integer = 1;
+            }
+            else if (strcmp(cond->value, "false") == 0 || strcmp(cond->value, "0") == 0)
+            {
+                dest->integer = 0;
+            }
+            else
+            {
+                MXS_ERROR("Invalid boolean value for field '%s': %s", field->name, cond->value);
+                return false;
+            }
+            break;
+
+        case MAXAVRO_TYPE_INT:
+        case MAXAVRO_TYPE_LONG:
+            errno = 0;
+            dest->integer = strtoll(cond->value, &end, 10);
+
+            if (*cond->value == '\0' || *end != '\0' || errno == ERANGE)
+            {
+                MXS_ERROR("Invalid integer value for field '%s': %s", field->name, cond->value);
+                return false;
+            }
+            break;
+
+        case MAXAVRO_TYPE_FLOAT:
+        case MAXAVRO_TYPE_DOUBLE:
+            dest->real = strtod(cond->value, &end);
+
+            if (*cond->value == '\0' || *end != '\0')
+            {
+                MXS_ERROR("Invalid numeric value for field '%s': %s", field->name, cond->value);
+                return false;
+            }
+            break;
+
+        case MAXAVRO_TYPE_ENUM:
+        {
+            if (cond->op != MAXAVRO_CMP_EQ && cond->op != MAXAVRO_CMP_NE)
+            {
+                MXS_ERROR("Enum field '%s' can only be compared for equality.", field->name);
+                return false;
+            }
+
+            json_t *arr = field->extra;
+            size_t nsym = json_array_size(arr);
+            dest->integer = nsym;
+
+            for (size_t i = 0; i < nsym; i++)
+            {
+                if (strcmp(json_string_value(json_array_get(arr, i)), cond->value) == 0)
+                {
+                    dest->integer = i;
+                    break;
+                }
+            }
+        }
+        break;
+
+        case MAXAVRO_TYPE_BYTES:
+        case MAXAVRO_TYPE_STRING:
+            if ((dest->str = strdup(cond->value)) == NULL)
+            {
+                MXS_ERROR("Memory allocation failed.");
+                return false;
+            }
+            dest->len = strlen(dest->str);
+            break;
+
+        default:
+            MXS_ERROR("Field '%s' of type '%s' cannot be compared.",
+                      field->name, type_to_string(field->type));
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Compile a record filter into an encoder
+ *
+ * The filter is compiled into a list of fields that are skipped and a list of
+ * conditions for each field. The skipped fields are read but not encoded. Listed
+ * fields that the schema does not have are ignored. If a condition refers to a
+ * field that the schema does not have, no records match the filter.
+ *
+ * The integer values of the skipped fields and of the records that do not
+ * match the filter are still stored in @c encoder->integers.
+ *
+ * @param encoder Encoder to use
+ * @param filter Filter to compile or NULL to remove the current filter. The
+ * filter must not be freed before the encoder is freed.
+ * @return True if the filter was compiled, false if a condition has an invalid
+ * constant or memory allocation failed
+ */
+bool maxavro_json_encoder_set_filter(MAXAVRO_JSON_ENCODER *encoder, const MAXAVRO_FILTER *filter)
+{
+    MAXAVRO_SCHEMA *schema = encoder->schema;
+    size_t n = schema->num_fields > 0 ? schema->num_fields : 1;
+    bool rval = true;
+
+    clear_filter(encoder);
+
+    if (filter == NULL)
+    {
+        return compile_keys(encoder);
+    }
+
+    if ((filter->fields && (encoder->skip = calloc(n, sizeof(bool))) == NULL) ||
+        (encoder->conditions = calloc(n, sizeof(MAXAVRO_JSON_CONDITION*))) == NULL ||
+        (encoder->num_conditions = calloc(n, sizeof(size_t))) == NULL)
+    {
+        MXS_ERROR("Memory allocation failed.");
+        clear_filter(encoder);
+        return false;
+    }
+
+    encoder->filter = filter;
+
+    for (size_t i = 0; i < schema->num_fields; i++)
+    {
+        if (encoder->skip)
+        {
+            encoder->skip[i] = true;
+
+            for (size_t j = 0; j < filter->num_fields; j++)
+            {
+                if (strcmp(schema->fields[i].name, filter->fields[j]) == 0)
+                {
+                    encoder->skip[i] = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (size_t j = 0; j < filter->num_conditions && rval; j++)
+    {
+        const MAXAVRO_CONDITION *cond = &filter->conditions[j];
+        int i = maxavro_json_encoder_field(encoder, cond->field);
+
+        if (i < 0)
+        {
+            encoder->match_none = true;
+            continue;
+        }
+
+        MAXAVRO_JSON_CONDITION *conds = realloc(encoder->conditions[i], (encoder->num_conditions[i] + 1) *
+                                                sizeof(MAXAVRO_JSON_CONDITION));
+
+        if (conds == NULL)
+        {
+            MXS_ERROR("Memory allocation failed.");
+            rval = false;
+            break;
+        }
+
+        encoder->conditions[i] = conds;
+        MAXAVRO_JSON_CONDITION *dest = &conds[encoder->num_conditions[i]];
+        memset(dest, 0, sizeof(*dest));
+
+        if ((rval = compile_condition(&schema->fields[i], cond, dest)))
+        {
+            encoder->num_conditions[i]++;
+        }
+    }
+
+    if (!rval || !compile_keys(encoder))
+    {
+        clear_filter(encoder);
+        compile_keys(encoder);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Free a record filter
+ *
+ * @param filter Filter to free
+ */
+void maxavro_filter_free(MAXAVRO_FILTER *filter)
+{
+    if (filter)
+    {
+        for (size_t i = 0; i < filter->num_fields; i++)
+        {
+            free(filter->fields[i]);
+        }
+
+        for (size_t i = 0; i < filter->num_conditions; i++)
+        {
+            free(filter->conditions[i].field);
+            free(filter->conditions[i].value);
+        }
+
+        free(filter->fields);
+        free(filter->conditions);
+        free(filter);
+    }
+}
+
+/** A value read from the block data */
+typedef struct
+{
+    uint64_t integer; /*< Integer, boolean and enum values */
+    double real; /*< Floating point values */
+    const char *str; /*< String and bytes values, points into the block data */
+    size_t len; /*< Length of @c str */
+} json_value_t;
+
+/**
+ * @brief Read a single value
+ *
+ * @param file File to read from
+ * @param encoder Encoder to use
+ * @param i Field index in the schema
+ * @param value Where the value is stored
+ * @return True if the value was read
+ */
+static inline bool read_value(MAXAVRO_FILE *file, MAXAVRO_JSON_ENCODER *encoder, size_t i,
+                              json_value_t *value)
+{
+    switch (encoder->schema->fields[i].type)
+    {
+        case MAXAVRO_TYPE_BOOL:
+        {
+            uint8_t b = 0;
+            if (!maxavro_block_read_fixed(file, &b, 1))
+            {
+                return false;
+            }
+            value->integer = b;
+        }
+        break;
+
+        case MAXAVRO_TYPE_INT:
+        case MAXAVRO_TYPE_LONG:
+            if (!maxavro_block_read_integer(file, &value->integer))
+            {
+                return false;
+            }
+            encoder->integers[i] = value->integer;
+            break;
+
+        case MAXAVRO_TYPE_ENUM:
+            if (!maxavro_block_read_integer(file, &value->integer) ||
+                value->integer >= encoder->num_symbols[i])
+            {
+                return false;
+            }
+            break;
+
+        case MAXAVRO_TYPE_FLOAT:
+        {
+            float f = 0;
+            if (!maxavro_block_read_fixed(file, &f, sizeof(f)))
+            {
+                return false;
+            }
+            value->real = f;
+        }
+        break;
+
+        case MAXAVRO_TYPE_DOUBLE:
+            if (!maxavro_block_read_fixed(file, &value->real, sizeof(value->real)))
+            {
+                return false;
+            }
+            break;
+
+        case MAXAVRO_TYPE_BYTES:
+        case MAXAVRO_TYPE_STRING:
+            return maxavro_block_read_string(file, &value->str, &value->len);
+
+        case MAXAVRO_TYPE_NULL:
+            break;
+
+        default:
+            MXS_ERROR("Unimplemented type: %d", encoder->schema->fields[i].type);
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Encode a floating point value
+ *
+ * The value is formatted like jansson formats real numbers.
+ *
+ * @param encoder Encoder to use
+ * @param d Value to encode
+ */
+static void encode_double(MAXAVRO_JSON_ENCODER *encoder, double d)
+{
+    char *ptr = encoder->buffer + encoder->length;
+
+    if (isfinite(d))
+    {
+        int len = sprintf(ptr, "%.17g", d);
+
+        if (strpbrk(ptr, ".eE") == NULL)
+        {
+            strcpy(ptr + len, ".0");
+            len += 2;
+        }
+
+        encoder->length += len;
+    }
+    else
+    {
+        /** JSON has no representation for these */
+        memcpy(ptr, "null", 4);
+        encoder->length += 4;
+    }
+}
+
+/**
+ * @brief Encode a single value
+ *
+ * @param encoder Encoder to use
+ * @param i Field index in the schema
+ * @param value Value to encode
+ * @return True if the value was encoded
+ */
+static bool encode_value(MAXAVRO_JSON_ENCODER *encoder, size_t i, const json_value_t *value)
+{
+    MAXAVRO_JSON_STRING *symbol;
+    enum maxavro_value_type type = encoder->schema->fields[i].type;
+
+    switch (type)
+    {
+        case MAXAVRO_TYPE_BYTES:
+        case MAXAVRO_TYPE_STRING:
+            if (!json_reserve(encoder, value->len * 6 + 2))
+            {
+                return false;
+            }
+            encoder->length += json_escape(encoder->buffer + encoder->length, value->str, value->len);
+            return true;
+
+        case MAXAVRO_TYPE_ENUM:
+            symbol = &encoder->symbols[i][value->integer];
+
+            if (!json_reserve(encoder, symbol->len))
+            {
+                return false;
+            }
+
+            memcpy(encoder->buffer + encoder->length, symbol->str, symbol->len);
+            encoder->length += symbol->len;
+            return true;
+
+        default:
+            break;
+    }
+
+    /** Room for any other value */
+    if (!json_reserve(encoder, 64))
+    {
+        return false;
+    }
+
+    char *ptr = encoder->buffer + encoder->length;
+
+    switch (type)
+    {
+        case MAXAVRO_TYPE_BOOL:
+            encoder->length += value->integer ? sprintf(ptr, "true") : sprintf(ptr, "false");
+            break;
+
+        case MAXAVRO_TYPE_INT:
+        case MAXAVRO_TYPE_LONG:
+            encoder->length += sprintf(ptr, "%lld", (long long)value->integer);
+            break;
+
+        case MAXAVRO_TYPE_FLOAT:
+        case MAXAVRO_TYPE_DOUBLE:
+            encode_double(encoder, value->real);
+            break;
+
+        default:
+            memcpy(ptr, "null", 4);
+            encoder->length += 4;
+            break;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Check if a value matches the conditions of a field
+ *
+ * @param encoder Encoder to use
+ * @param i Field index in the schema
+ * @param value Value to check
+ * @return True if the value matches all conditions
+ */
+static bool match_conditions(MAXAVRO_JSON_ENCODER *encoder, size_t i, const json_value_t *value)
+{
+    enum maxavro_value_type type = encoder->schema->fields[i].type;
+
+    for (size_t j = 0; j < encoder->num_conditions[i]; j++)
+    {
+        MAXAVRO_JSON_CONDITION *cond = &encoder->conditions[i][j];
+        int cmp;
+
+        if (type == MAXAVRO_TYPE_STRING || type == MAXAVRO_TYPE_BYTES)
+        {
+            cmp = memcmp(value->str, cond->str, value->len < cond->len ? value->len : cond->len);
+
+            if (cmp == 0)
+            {
+                cmp = (value->len > cond->len) - (value->len < cond->len);
+            }
+        }
+        else if (type == MAXAVRO_TYPE_FLOAT || type == MAXAVRO_TYPE_DOUBLE)
+        {
+            if (isnan(value->real))
+            {
+                /** NaN is not equal to, less than or greater than anything */
+                if (cond->op != MAXAVRO_CMP_NE)
+                {
+                    return false;
+                }
+                continue;
+            }
+
+            cmp = (value->real > cond->real) - (value->real < cond->real);
+        }
+        else
+        {
+            int64_t a = (int64_t)value->integer;
+            int64_t b = (int64_t)cond->integer;
+            cmp = (a > b) - (a < b);
+        }
+
+        bool match;
+
+        switch (cond->op)
+        {
+            case MAXAVRO_CMP_EQ:
+                match = cmp == 0;
+                break;
+
+            case MAXAVRO_CMP_NE:
+                match = cmp != 0;
+                break;
+
+            case MAXAVRO_CMP_LT:
+                match = cmp < 0;
+                break;
+
+            case MAXAVRO_CMP_LE:
+                match = cmp <= 0;
+                break;
+
+            case MAXAVRO_CMP_GT:
+                match = cmp > 0;
+                break;
+
+            default:
+                match = cmp >= 0;
+                break;
+        }
+
+        if (!match)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Read a record and encode it as JSON text
+ *
+ * The record is appended to the output buffer of the encoder. No separator is
+ * added between records. If the encoder has a filter, a record that does not
+ * match the filter is read but nothing is appended to the output buffer.
+ *
+ * @param file File to read from
+ * @param encoder Encoder compiled from the schema of @c file
+ * @return True if a record was read, false if the end of the current block
+ * was reached or an error occurred
+ */
+bool maxavro_record_encode_json(MAXAVRO_FILE *file, MAXAVRO_JSON_ENCODER *encoder)
+{
+    if (!file->metadata_read && !maxavro_read_datablock_start(file))
+    {
+        return false;
+    }
+
+    if (file->records_read_from_block >= file->records_in_block ||
+        !maxavro_block_load(file))
+    {
+        return false;
+    }
+
+    size_t start = encoder->length;
+    bool match = !encoder->match_none;
+
+    if (!json_reserve(encoder, 1))
+    {
+        file->last_error = MAXAVRO_ERR_MEMORY;
+        return false;
+    }
+
+    encoder->buffer[encoder->length++] = '{';
+
+    for (size_t i = 0; i < encoder->schema->num_fields; i++)
+    {
+        json_value_t value;
+
+        if (!read_value(file, encoder, i, &value))
+        {
+            long pos = maxavro_block_offset(file);
+            MXS_ERROR("Failed to read field value '%s', type '%s' at "
+                      "file offset %ld, record numer %lu.",
+                      encoder->schema->fields[i].name,
+                      type_to_string(encoder->schema->fields[i].type),
+                      pos, file->records_read);
+            encoder->length = start;
+            return false;
+        }
+
+        if (!match)
+        {
+            /** The rest of the record is only read past */
+            continue;
+        }
+
+        if (encoder->conditions && encoder->num_conditions[i] &&
+            !match_conditions(encoder, i, &value))
+        {
+            match = false;
+            encoder->length = start;
+            continue;
+        }
+
+        if (encoder->skip == NULL || !encoder->skip[i])
+        {
+            MAXAVRO_JSON_STRING *key = &encoder->keys[i];
+
+            if (!json_reserve(encoder, key->len))
+            {
+                file->last_error = MAXAVRO_ERR_MEMORY;
+                encoder->length = start;
+                return false;
+            }
+
+            memcpy(encoder->buffer + encoder->length, key->str, key->len);
+            encoder->length += key->len;
+
+            if (!encode_value(encoder, i, &value))
+            {
+                file->last_error = MAXAVRO_ERR_MEMORY;
+                encoder->length = start;
+                return false;
+            }
+        }
+    }
+
+    if (match)
+    {
+        if (!json_reserve(encoder, 1))
+        {
+            file->last_error = MAXAVRO_ERR_MEMORY;
+            encoder->length = start;
+            return false;
+        }
+
+        encoder->buffer[encoder->length++] = '}';
+    }
+    else
+    {
+        encoder->length = start;
+    }
+
+    file->records_read_from_block++;
+    file->records_read++;
+
+    return true;
+}
+
+/**
+ * @brief Move the encoded records into a buffer
+ *
+ * The output buffer of the encoder is emptied and reused for the next records.
+ *
+ * @param encoder Encoder to flush
+ * @return Buffer with the encoded records or NULL if there was nothing to flush
+ * or memory allocation failed
+ */
+GWBUF* maxavro_json_encoder_flush(MAXAVRO_JSON_ENCODER *encoder)
+{
+    GWBUF *rval = NULL;
+
+    if (encoder->length > 0)
+    {
+        if ((rval = gwbuf_alloc_and_load(encoder->length, encoder->buffer)) == NULL)
+        {
+            MXS_ERROR("Failed to allocate %lu bytes for JSON data.", encoder->length);
+        }
+        encoder->length = 0;
+    }
+
+    return rval;
+}
@@ -23,11 +23,9 @@ bool maxavro_verify_block(MAXAVRO_FILE *file);
 const char* type_to_string(enum maxavro_value_type type);
 
 /**
- * @brief Read a single value from a file
+ * @brief Read a single value from the current data block
  * @param file File to read from
- * @param name Name of the field
- * @param type Type of the field
- * @param field_num Field index in the schema
+ * @param field The schema field of the value
  * @return JSON object or NULL if an error occurred
  */
 static json_t* read_and_pack_value(MAXAVRO_FILE *file, MAXAVRO_SCHEMA_FIELD *field)
@@ -37,10 +35,10 @@ static json_t* read_and_pack_value(MAXAVRO_FILE *file, MAXAVRO_SCHEMA_FIELD *fie
     {
         case MAXAVRO_TYPE_BOOL:
         {
-            int i = 0;
-            if (fread(&i, 1, 1, file->file) == 1)
+            uint8_t b = 0;
+            if (maxavro_block_read_fixed(file, &b, 1))
             {
-                value = json_pack("b", i);
+                value = json_pack("b", b);
             }
         }
         break;
@@ -49,22 +47,22 @@ static json_t* read_and_pack_value(MAXAVRO_FILE *file, MAXAVRO_SCHEMA_FIELD *fie
         case MAXAVRO_TYPE_LONG:
         {
             uint64_t val = 0;
-            maxavro_read_integer(file, &val);
-            json_int_t jsonint = val;
-            value = json_pack("I", jsonint);
+            if (maxavro_block_read_integer(file, &val))
+            {
+                json_int_t jsonint = val;
+                value = json_pack("I", jsonint);
+            }
         }
         break;
 
         case MAXAVRO_TYPE_ENUM:
         {
             uint64_t val = 0;
-            maxavro_read_integer(file, &val);
-
             json_t *arr = field->extra;
             ss_dassert(arr);
             ss_dassert(json_is_array(arr));
 
-            if (json_array_size(arr) >= val)
+            if (maxavro_block_read_integer(file, &val) && val < json_array_size(arr))
             {
                 json_t * symbol = json_array_get(arr, val);
                 ss_dassert(json_is_string(symbol));
@@ -74,65 +72,46 @@ static json_t* read_and_pack_value(MAXAVRO_FILE *file, MAXAVRO_SCHEMA_FIELD *fie
         break;
 
         case MAXAVRO_TYPE_FLOAT:
-        case MAXAVRO_TYPE_DOUBLE:
-        {
-            double d = 0;
-            maxavro_read_double(file, &d);
-            value = json_pack("f",  d);
-        }
-        break;
-
-        case MAXAVRO_TYPE_BYTES:
-        case MAXAVRO_TYPE_STRING:
         {
-            char *str = maxavro_read_string(file);
-            if (str)
+            float f = 0;
+            if (maxavro_block_read_fixed(file, &f, sizeof(f)))
             {
-                value = json_string(str);
-                free(str);
+                value = json_pack("f", f);
             }
         }
         break;
 
-        default:
-            MXS_ERROR("Unimplemented type: %d", field->type);
-            break;
-    }
-    return value;
-}
-
-static void skip_value(MAXAVRO_FILE *file, enum maxavro_value_type type)
-{
-    switch (type)
-    {
-        case MAXAVRO_TYPE_INT:
-        case MAXAVRO_TYPE_LONG:
-        case MAXAVRO_TYPE_ENUM:
-        {
-            uint64_t val = 0;
-            maxavro_read_integer(file, &val);
-        }
-        break;
-
-        case MAXAVRO_TYPE_FLOAT:
         case MAXAVRO_TYPE_DOUBLE:
         {
             double d = 0;
-            maxavro_read_double(file, &d);
+            if (maxavro_block_read_fixed(file, &d, sizeof(d)))
+            {
+                value = json_pack("f", d);
+            }
         }
         break;
 
         case MAXAVRO_TYPE_BYTES:
         case MAXAVRO_TYPE_STRING:
         {
-            maxavro_skip_string(file);
+            const char *str;
+            size_t len;
+            if (maxavro_block_read_string(file, &str, &len))
+            {
+                value = json_stringn(str, len);
+            }
         }
         break;
 
+        case MAXAVRO_TYPE_NULL:
+            value = json_null();
+            break;
+
         default:
-            MXS_ERROR("Unimplemented type: %d - %s", type, type_to_string(type));
+            MXS_ERROR("Unimplemented type: %d", field->type);
             break;
     }
+    return value;
 }
 
 /**
@@ -151,7 +130,8 @@ json_t* maxavro_record_read_json(MAXAVRO_FILE *file)
 
     json_t* object = NULL;
 
-    if (file->records_read_from_block < file->records_in_block)
+    if (file->records_read_from_block < file->records_in_block &&
+        maxavro_block_load(file))
     {
         object = json_object();
 
@@ -166,7 +146,7 @@ json_t* maxavro_record_read_json(MAXAVRO_FILE *file)
                 }
                 else
                 {
-                    long pos = ftell(file->file);
+                    long pos = maxavro_block_offset(file);
                     MXS_ERROR("Failed to read field value '%s', type '%s' at "
                               "file offset %ld, record numer %lu.",
                               file->schema->fields[i].name,
@@ -185,20 +165,88 @@ json_t* maxavro_record_read_json(MAXAVRO_FILE *file)
     return object;
 }
 
-static void skip_record(MAXAVRO_FILE *file)
+/**
+ * @brief Skip a record by running the skip program of the schema
+ *
+ * @param file File to read from
+ * @return True if the record was skipped
+ */
+static bool skip_record(MAXAVRO_FILE *file)
 {
-    for (size_t i = 0; i < file->schema->num_fields; i++)
+    if (!file->schema->skippable || !maxavro_block_load(file))
     {
-        skip_value(file, file->schema->fields[i].type);
+        return false;
     }
+
+    const uint8_t *ptr = file->buffer_ptr;
+    const uint8_t *end = file->buffer_end;
+
+    for (size_t i = 0; i < file->schema->num_skip_ops; i++)
+    {
+        MAXAVRO_SKIP_OP *op = &file->schema->skip_ops[i];
+
+        switch (op->op)
+        {
+            case MAXAVRO_SKIP_INTEGER:
+                for (size_t n = 0; n < op->count; n++)
+                {
+                    while (ptr < end && (*ptr & 0x80))
+                    {
+                        ptr++;
+                    }
+
+                    if (ptr++ >= end)
+                    {
+                        file->last_error = MAXAVRO_ERR_BLOCK_OVERFLOW;
+                        return false;
+                    }
+                }
+                break;
+
+            case MAXAVRO_SKIP_FIXED:
+                if (op->count > (size_t)(end - ptr))
+                {
+                    file->last_error = MAXAVRO_ERR_BLOCK_OVERFLOW;
+                    return false;
+                }
+                ptr += op->count;
+                break;
+
+            case MAXAVRO_SKIP_STRING:
+                for (size_t n = 0; n < op->count; n++)
+                {
+                    uint64_t len;
+                    file->buffer_ptr = (uint8_t*)ptr;
+
+                    if (!maxavro_block_read_integer(file, &len))
+                    {
+                        return false;
+                    }
+
+                    ptr = file->buffer_ptr;
+
+                    if (len > (uint64_t)(end - ptr))
+                    {
+                        file->last_error = MAXAVRO_ERR_BLOCK_OVERFLOW;
+                        return false;
+                    }
+                    ptr += len;
+                }
+                break;
+        }
+    }
+
+    file->buffer_ptr = (uint8_t*)ptr;
     file->records_read_from_block++;
     file->records_read++;
+    return true;
 }
 
 /**
  * @brief Read next data block
  *
- * This seeks past any unread data from the current block
+ * This skips any unread data of the current block by using the byte count of
+ * the block.
  * @param file File to read from
  * @return True if reading the next block was successfully read
  */
@@ -209,13 +257,22 @@ bool maxavro_next_block(MAXAVRO_FILE *file)
         if (file->records_read_from_block < file->records_in_block)
         {
             file->records_read += file->records_in_block - file->records_read_from_block;
-            long curr_pos = ftell(file->file);
-            long offset = (long) file->block_size - (curr_pos - file->data_start_pos);
+            file->records_read_from_block = file->records_in_block;
+        }
 
-            if (offset > 0)
-            {
-                fseek(file->file, offset, SEEK_CUR);
-            }
+        if (file->cached_block)
+        {
+            /** The file is already at the next block and the sync marker was
+             * checked when the block was added to the cache */
+            file->blocks_read++;
+            file->bytes_read += file->block_size;
+            return maxavro_read_datablock_start(file);
+        }
+
+        /** If the block is in memory, the file is already at the end of it */
+        if (file->buffer_ptr == NULL)
+        {
+            fseek(file->file, file->data_start_pos + file->block_size, SEEK_SET);
         }
 
         return maxavro_verify_block(file) && maxavro_read_datablock_start(file);
@@ -226,44 +283,27 @@ bool maxavro_next_block(MAXAVRO_FILE *file)
 /**
  * @brief Seek to a position in the Avro file
  *
- * This moves the current position of the file, skipping data blocks if necessary.
+ * This moves the current position of the file. Whole blocks are skipped by
+ * their record counts and byte sizes without reading their data.
  *
- * @param file
- * @param position
- * @return
+ * @param file File to seek
+ * @param offset Number of records to skip
+ * @return True if the seek was successful
  */
 bool maxavro_record_seek(MAXAVRO_FILE *file, uint64_t offset)
 {
     bool rval = true;
 
-    if (offset < file->records_in_block - file->records_read_from_block)
+    /** Skip the blocks that don't have the position we want */
+    while (rval && offset > file->records_in_block - file->records_read_from_block)
     {
-        /** Seek to the end of the block or to the position we want */
-        while (offset-- > 0)
-        {
-            skip_record(file);
-        }
+        offset -= file->records_in_block - file->records_read_from_block;
+        rval = maxavro_next_block(file);
     }
-    else
-    {
-        /** We're seeking past a block boundary */
-        offset -= (file->records_in_block - file->records_read_from_block);
-        maxavro_next_block(file);
-
-        while (offset > file->records_in_block)
-        {
-            /** Skip full blocks that don't have the position we want */
-            offset -= file->records_in_block;
-            fseek(file->file, file->block_size, SEEK_CUR);
-            maxavro_next_block(file);
-        }
-
-        ss_dassert(offset <= file->records_in_block);
 
-        while (offset-- > 0)
-        {
-            skip_record(file);
-        }
+    while (rval && offset-- > 0)
+    {
+        rval = skip_record(file);
     }
 
     return rval;
@@ -290,7 +330,8 @@ bool maxavro_record_set_pos(MAXAVRO_FILE *file, long pos)
  * @brief Read native Avro data
  *
  * This function reads a complete Avro data block from the disk and returns
- * the read data in its native Avro format.
+ * the read data in its native Avro format. A block found in the block cache is
+ * returned as a clone of the cached buffer.
  *
  * @param file File to read from
  * @return Buffer containing the complete binary data block or NULL if an error
@@ -307,6 +348,13 @@ GWBUF* maxavro_record_read_binary(MAXAVRO_FILE *file)
             return NULL;
         }
 
+        if (file->cached_block)
+        {
+            GWBUF *block = gwbuf_clone(file->cached_block);
+            maxavro_next_block(file);
+            return block;
+        }
+
         long data_size = (file->data_start_pos - file->block_start_pos) + file->block_size;
         ss_dassert(data_size > 0);
         rval = gwbuf_alloc(data_size + SYNC_MARKER_SIZE);
@@ -78,6 +78,11 @@ static enum maxavro_value_type unpack_to_type(json_t *object,
     enum maxavro_value_type rval = MAXAVRO_TYPE_UNKNOWN;
     json_t* type = NULL;
 
+    if (json_is_string(object))
+    {
+        type = object;
+    }
+
     if (json_is_object(object))
     {
         json_t *tmp = NULL;
@@ -109,6 +114,89 @@ static enum maxavro_value_type unpack_to_type(json_t *object,
     return rval;
 }
 
+/**
+ * @brief Add an operation to the skip program
+ *
+ * Consecutive operations of the same kind are merged into one.
+ *
+ * @param schema Schema being compiled
+ * @param op The operation
+ * @param count Number of values or bytes to skip
+ */
+static void add_skip_op(MAXAVRO_SCHEMA *schema, enum maxavro_skip_op op, size_t count)
+{
+    if (schema->num_skip_ops > 0 && schema->skip_ops[schema->num_skip_ops - 1].op == op)
+    {
+        schema->skip_ops[schema->num_skip_ops - 1].count += count;
+    }
+    else
+    {
+        schema->skip_ops[schema->num_skip_ops].op = op;
+        schema->skip_ops[schema->num_skip_ops].count = count;
+        schema->num_skip_ops++;
+    }
+}
+
+/**
+ * @brief Compile the schema fields into a skip program
+ *
+ * The program is used to skip over records without decoding them.
+ *
+ * @param schema Schema to compile
+ * @return True if all fields could be compiled
+ */
+static bool compile_skip_ops(MAXAVRO_SCHEMA *schema)
+{
+    schema->num_skip_ops = 0;
+    schema->skippable = false;
+
+    if ((schema->skip_ops = malloc(sizeof(MAXAVRO_SKIP_OP) * (schema->num_fields + 1))) == NULL)
+    {
+        MXS_ERROR("Memory allocation failed.");
+        return false;
+    }
+
+    for (size_t i = 0; i < schema->num_fields; i++)
+    {
+        switch (schema->fields[i].type)
+        {
+            case MAXAVRO_TYPE_INT:
+            case MAXAVRO_TYPE_LONG:
+            case MAXAVRO_TYPE_ENUM:
+                add_skip_op(schema, MAXAVRO_SKIP_INTEGER, 1);
+                break;
+
+            case MAXAVRO_TYPE_BOOL:
+                add_skip_op(schema, MAXAVRO_SKIP_FIXED, 1);
+                break;
+
+            case MAXAVRO_TYPE_FLOAT:
+                add_skip_op(schema, MAXAVRO_SKIP_FIXED, sizeof(float));
+                break;
+
+            case MAXAVRO_TYPE_DOUBLE:
+                add_skip_op(schema, MAXAVRO_SKIP_FIXED, sizeof(double));
+                break;
+
+            case MAXAVRO_TYPE_STRING:
+            case MAXAVRO_TYPE_BYTES:
+                add_skip_op(schema, MAXAVRO_SKIP_STRING, 1);
+                break;
+
+            case MAXAVRO_TYPE_NULL:
+                break;
+
+            default:
+                MXS_ERROR("Field '%s' has an unsupported type: %s", schema->fields[i].name,
+                          type_to_string(schema->fields[i].type));
+                return false;
+        }
+    }
+
+    schema->skippable = true;
+    return true;
+}
+
 /**
  * @brief Create a new Avro schema from JSON
  * @param json JSON from which the schema is created from
@@ -116,7 +204,7 @@ static enum maxavro_value_type unpack_to_type(json_t *object,
  */
 MAXAVRO_SCHEMA* maxavro_schema_alloc(const char* json)
 {
-    MAXAVRO_SCHEMA* rval = malloc(sizeof(MAXAVRO_SCHEMA));
+    MAXAVRO_SCHEMA* rval = calloc(1, sizeof(MAXAVRO_SCHEMA));
 
     if (rval)
     {
@@ -142,6 +230,8 @@ MAXAVRO_SCHEMA* maxavro_schema_alloc(const char* json)
                 rval->fields[i].type = unpack_to_type(value_obj, &rval->fields[i]);
             }
 
+            compile_skip_ops(rval);
+
             json_decref(schema);
         }
         else
@@ -181,6 +271,7 @@ void maxavro_schema_free(MAXAVRO_SCHEMA* schema)
             maxavro_schema_field_free(&schema->fields[i]);
         }
         free(schema->fields);
+        free(schema->skip_ops);
         free(schema);
     }
 }
@@ -0,0 +1,636 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * Test that the JSON encoder produces the same output as json_dumps() for the
+ * records read with maxavro_record_read_json(), that a record filter selects the
+ * right records and fields, that records read through the block cache are the
+ * same as the ones read from the file and that seeking to a record finds the
+ * right record. The tests are run for both uncompressed and deflate
+ * compressed files. Print the file size, the number of rows per second for JSON
+ * objects, the JSON encoder and binary Avro streaming and the time taken by seeks.
+ *
+ * Usage: test_json [rows]
+ */
+
+#include <maxavro.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+const char *testfile = "test_json.avro";
+const char *testschema = "{\"namespace\": \"MaxScaleChangeDataSchema.avro\", "
+                         "\"type\": \"record\", \"name\": \"ChangeRecord\", \"fields\": ["
+                         "{\"name\": \"domain\", \"type\": \"int\"}, "
+                         "{\"name\": \"server_id\", \"type\": \"int\"}, "
+                         "{\"name\": \"sequence\", \"type\": \"int\"}, "
+                         "{\"name\": \"event_number\", \"type\": \"int\"}, "
+                         "{\"name\": \"timestamp\", \"type\": \"int\"}, "
+                         "{\"name\": \"event_type\", \"type\": {\"type\": \"enum\", "
+                         "\"name\": \"EVENT_TYPES\", \"symbols\": [\"insert\", "
+                         "\"update_before\", \"update_after\", \"delete\"]}}, "
+                         "{\"name\": \"id\", \"type\": \"long\"}, "
+                         "{\"name\": \"name\", \"type\": \"string\"}, "
+                         "{\"name\": \"comment\", \"type\": \"string\"}, "
+                         "{\"name\": \"price\", \"type\": \"double\"}]}";
+
+#define ROWS_PER_BLOCK 1000
+
+static const uint8_t sync_marker[SYNC_MARKER_SIZE] =
+{
+    0x0c, 0x1d, 0x2e, 0x3f, 0x40, 0x51, 0x62, 0x73,
+    0x84, 0x95, 0xa6, 0xb7, 0xc8, 0xd9, 0xea, 0xfb
+};
+
+static size_t encode_integer(uint8_t *dest, int64_t val)
+{
+    uint64_t encval = ((uint64_t)val << 1) ^ (uint64_t)(val >> 63);
+    size_t n = 0;
+
+    while (encval & ~0x7fUL)
+    {
+        dest[n++] = 0x80 | (encval & 0x7f);
+        encval >>= 7;
+    }
+
+    dest[n++] = encval;
+    return n;
+}
+
+static size_t encode_string(uint8_t *dest, const char *str)
+{
+    size_t len = strlen(str);
+    size_t n = encode_integer(dest, len);
+    memcpy(dest + n, str, len);
+    return n + len;
+}
+
+static int64_t row_id(int row)
+{
+    return (int64_t)row * 1000003 - 5000;
+}
+
+static size_t encode_row(uint8_t *dest, int row)
+{
+    static const char *comments[] =
+    {
+        "A \"quoted\" comment",
+        "Line 1\nLine 2\tand a tab",
+        "Backslash \\ and a control character \x01",
+        ""
+    };
+    char name[64];
+    double price = row * 0.25;
+    size_t n = 0;
+
+    snprintf(name, sizeof(name), "Product number %d", row);
+
+    n += encode_integer(dest + n, 0);
+    n += encode_integer(dest + n, 3000);
+    n += encode_integer(dest + n, row / 10 + 1);
+    n += encode_integer(dest + n, row % 10 + 1);
+    n += encode_integer(dest + n, 1470000000 + row);
+    n += encode_integer(dest + n, row % 4);
+    n += encode_integer(dest + n, row_id(row));
+    n += encode_string(dest + n, name);
+    n += encode_string(dest + n, comments[row % 4]);
+    memcpy(dest + n, &price, sizeof(price));
+    n += sizeof(price);
+
+    return n;
+}
+
+/** Compress a data block with raw deflate, as done by the Avro C library */
+static size_t deflate_block(uint8_t *dest, size_t destlen, uint8_t *src, size_t len)
+{
+    z_stream stream = {0};
+    size_t rval = 0;
+
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                     8, Z_DEFAULT_STRATEGY) == Z_OK)
+    {
+        stream.next_in = src;
+        stream.avail_in = len;
+        stream.next_out = dest;
+        stream.avail_out = destlen;
+
+        if (deflate(&stream, Z_FINISH) == Z_STREAM_END)
+        {
+            rval = stream.total_out;
+        }
+        deflateEnd(&stream);
+    }
+
+    return rval;
+}
+
+static bool write_file(int rows, const char *codec)
+{
+    FILE *file = fopen(testfile, "wb");
+
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    bool compress = strcmp(codec, "deflate") == 0;
+    uint8_t *block = malloc(ROWS_PER_BLOCK * 256);
+    uint8_t *zblock = malloc(ROWS_PER_BLOCK * 256 + 1024);
+    uint8_t *header = malloc(strlen(testschema) + 128);
+    size_t n = 0;
+
+    /** Header: magic, metadata map and the sync marker */
+    memcpy(header, avro_magic, AVRO_MAGIC_SIZE);
+    n += AVRO_MAGIC_SIZE;
+    n += encode_integer(header + n, 2);
+    n += encode_string(header + n, "avro.codec");
+    n += encode_string(header + n, codec);
+    n += encode_string(header + n, "avro.schema");
+    n += encode_string(header + n, testschema);
+    n += encode_integer(header + n, 0);
+    memcpy(header + n, sync_marker, SYNC_MARKER_SIZE);
+    n += SYNC_MARKER_SIZE;
+    fwrite(header, 1, n, file);
+
+    for (int row = 0; row < rows; row += ROWS_PER_BLOCK)
+    {
+        int count = rows - row < ROWS_PER_BLOCK ? rows - row : ROWS_PER_BLOCK;
+        size_t size = 0;
+        uint8_t buf[20];
+
+        for (int i = 0; i < count; i++)
+        {
+            size += encode_row(block + size, row + i);
+        }
+
+        uint8_t *data = block;
+
+        if (compress)
+        {
+            size = deflate_block(zblock, ROWS_PER_BLOCK * 256 + 1024, block, size);
+            data = zblock;
+        }
+
+        fwrite(buf, 1, encode_integer(buf, count), file);
+        fwrite(buf, 1, encode_integer(buf, size), file);
+        fwrite(data, 1, size, file);
+        fwrite(sync_marker, 1, SYNC_MARKER_SIZE, file);
+    }
+
+    free(zblock);
+    free(header);
+    free(block);
+    return fclose(file) == 0;
+}
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/** Compare the encoder output to the JSON objects */
+static int test_output()
+{
+    MAXAVRO_FILE *objects = maxavro_file_open(testfile);
+    MAXAVRO_FILE *text = maxavro_file_open(testfile);
+    MAXAVRO_JSON_ENCODER *encoder = text ? maxavro_file_json_encoder(text) : NULL;
+    int seq = encoder ? maxavro_json_encoder_field(encoder, "sequence") : -1;
+    int rval = 0;
+    uint64_t rows = 0;
+
+    if (!objects || !encoder || seq < 0)
+    {
+        printf("Failed to open %s\n", testfile);
+        rval = 1;
+    }
+    else
+    {
+        do
+        {
+            json_t *row;
+
+            while ((row = maxavro_record_read_json(objects)))
+            {
+                char *expected = json_dumps(row, JSON_PRESERVE_ORDER);
+
+                if (!maxavro_record_encode_json(text, encoder))
+                {
+                    printf("Failed to encode row %lu\n", rows);
+                    rval = 1;
+                }
+                else if (encoder->length != strlen(expected) ||
+                         memcmp(encoder->buffer, expected, encoder->length) != 0)
+                {
+                    printf("Row %lu differs:\nExpected: %s\nGot:      %.*s\n", rows,
+                           expected, (int)encoder->length, encoder->buffer);
+                    rval = 1;
+                }
+                else if (encoder->integers[seq] !=
+                         json_integer_value(json_object_get(row, "sequence")))
+                {
+                    printf("Wrong sequence for row %lu\n", rows);
+                    rval = 1;
+                }
+
+                encoder->length = 0;
+                free(expected);
+                json_decref(row);
+                rows++;
+            }
+        }
+        while (rval == 0 && maxavro_next_block(objects) && maxavro_next_block(text));
+
+        if (rval == 0 && rows != objects->records_read)
+        {
+            printf("Compared %lu rows out of %lu\n", rows, objects->records_read);
+            rval = 1;
+        }
+    }
+
+    maxavro_file_close(objects);
+    maxavro_file_close(text);
+    return rval;
+}
+
+/** Check that a filtered encoder outputs the matching records and fields */
+static int test_filter()
+{
+    char *fields[] = {"id", "name", "no_such_field", "event_type"};
+    MAXAVRO_CONDITION conditions[] =
+    {
+        {"event_type", MAXAVRO_CMP_EQ, "update_after"},
+        {"id", MAXAVRO_CMP_GT, "0"},
+        {"name", MAXAVRO_CMP_NE, "Product number 42"},
+        {"price", MAXAVRO_CMP_LE, "1000"}
+    };
+    MAXAVRO_FILTER filter = {fields, 4, conditions, 4};
+    MAXAVRO_FILE *objects = maxavro_file_open(testfile);
+    MAXAVRO_FILE *text = maxavro_file_open(testfile);
+    MAXAVRO_JSON_ENCODER *encoder = text ? maxavro_file_json_encoder(text) : NULL;
+    int evnum = encoder ? maxavro_json_encoder_field(encoder, "event_number") : -1;
+    int rval = 0;
+    uint64_t rows = 0;
+    uint64_t matched = 0;
+
+    if (!objects || !encoder || evnum < 0 || !maxavro_json_encoder_set_filter(encoder, &filter))
+    {
+        printf("Failed to open %s\n", testfile);
+        rval = 1;
+    }
+    else
+    {
+        do
+        {
+            json_t *row;
+
+            while (rval == 0 && (row = maxavro_record_read_json(objects)))
+            {
+                json_int_t id = json_integer_value(json_object_get(row, "id"));
+                const char *name = json_string_value(json_object_get(row, "name"));
+                bool match = strcmp(json_string_value(json_object_get(row, "event_type")),
+                                    "update_after") == 0 && id > 0 &&
+                    strcmp(name, "Product number 42") != 0 &&
+                    json_real_value(json_object_get(row, "price")) <= 1000;
+                char *expected = NULL;
+
+                if (match)
+                {
+                    json_t *proj = json_object();
+                    json_object_set(proj, "event_type", json_object_get(row, "event_type"));
+                    json_object_set(proj, "id", json_object_get(row, "id"));
+                    json_object_set(proj, "name", json_object_get(row, "name"));
+                    expected = json_dumps(proj, JSON_PRESERVE_ORDER);
+                    json_decref(proj);
+                    matched++;
+                }
+
+                if (!maxavro_record_encode_json(text, encoder))
+                {
+                    printf("Failed to encode row %lu\n", rows);
+                    rval = 1;
+                }
+                else if (!match && encoder->length != 0)
+                {
+                    printf("Row %lu should not match: %.*s\n", rows,
+                           (int)encoder->length, encoder->buffer);
+                    rval = 1;
+                }
+                else if (match && (encoder->length != strlen(expected) ||
+                                   memcmp(encoder->buffer, expected, encoder->length) != 0))
+                {
+                    printf("Row %lu differs:\nExpected: %s\nGot:      %.*s\n", rows,
+                           expected, (int)encoder->length, encoder->buffer);
+                    rval = 1;
+                }
+                else if (encoder->integers[evnum] !=
+                         json_integer_value(json_object_get(row, "event_number")))
+                {
+                    printf("Wrong event number for row %lu\n", rows);
+                    rval = 1;
+                }
+
+                encoder->length = 0;
+                free(expected);
+                json_decref(row);
+                rows++;
+            }
+        }
+        while (rval == 0 && maxavro_next_block(objects) && maxavro_next_block(text));
+
+        if (rval == 0 && (rows != objects->records_read || matched == 0))
+        {
+            printf("Compared %lu rows out of %lu, %lu matched\n", rows,
+                   objects->records_read, matched);
+            rval = 1;
+        }
+    }
+
+    maxavro_file_close(objects);
+    maxavro_file_close(text);
+    return rval;
+}
+
+/** Read a file through a block cache and compare it to reading the file */
+static int test_cache(int rows, size_t cache_size)
+{
+    MAXAVRO_BLOCK_CACHE *cache = maxavro_block_cache_alloc(cache_size);
+    MAXAVRO_FILE *writer = maxavro_file_open(testfile);
+    MAXAVRO_FILE *cached = maxavro_file_open(testfile);
+    MAXAVRO_FILE *direct = maxavro_file_open(testfile);
+    MAXAVRO_FILE *binary = maxavro_file_open(testfile);
+    MAXAVRO_FILE *binary_direct = maxavro_file_open(testfile);
+    int blocks = (rows + ROWS_PER_BLOCK - 1) / ROWS_PER_BLOCK;
+    int rval = 0;
+
+    if (!cache || !writer || !cached || !direct || !binary || !binary_direct)
+    {
+        printf("Failed to open %s\n", testfile);
+        rval = 1;
+    }
+    else if (maxavro_block_cache_fill(cache, writer) != blocks)
+    {
+        printf("Expected %d blocks in the cache\n", blocks);
+        rval = 1;
+    }
+    else
+    {
+        /** The first block was read when the files were opened */
+        cached->block_cache = cache;
+        binary->block_cache = cache;
+        MAXAVRO_JSON_ENCODER *enc1 = maxavro_file_json_encoder(cached);
+        MAXAVRO_JSON_ENCODER *enc2 = maxavro_file_json_encoder(direct);
+
+        do
+        {
+            while (maxavro_record_encode_json(cached, enc1) && maxavro_record_encode_json(direct, enc2))
+            {
+            }
+
+            if (enc1->length != enc2->length || memcmp(enc1->buffer, enc2->buffer, enc1->length) != 0)
+            {
+                printf("Block %lu differs when read from the cache\n", direct->blocks_read);
+                rval = 1;
+            }
+
+            enc1->length = 0;
+            enc2->length = 0;
+        }
+        while (rval == 0 && maxavro_next_block(cached) && maxavro_next_block(direct));
+
+        GWBUF *b1, *b2;
+
+        while (rval == 0 && (b1 = maxavro_record_read_binary(binary)))
+        {
+            if ((b2 = maxavro_record_read_binary(binary_direct)) == NULL ||
+                GWBUF_LENGTH(b1) != GWBUF_LENGTH(b2) ||
+                memcmp(GWBUF_DATA(b1), GWBUF_DATA(b2), GWBUF_LENGTH(b1)) != 0)
+            {
+                printf("Binary block %lu differs when read from the cache\n",
+                       binary_direct->blocks_read);
+                rval = 1;
+            }
+
+            gwbuf_free(b1);
+            gwbuf_free(b2);
+        }
+
+        if (rval == 0 && (cached->records_read != rows || binary->blocks_read != blocks))
+        {
+            printf("Read %lu rows and %lu blocks through the cache, expected %d and %d\n",
+                   cached->records_read, binary->blocks_read, rows, blocks);
+            rval = 1;
+        }
+
+        if (rval == 0 && cache_size > 0 && cache->hits != 2 * (blocks - 1))
+        {
+            printf("Expected %d cache hits, got %lu\n", 2 * (blocks - 1), cache->hits);
+            rval = 1;
+        }
+    }
+
+    maxavro_file_close(writer);
+    maxavro_file_close(cached);
+    maxavro_file_close(direct);
+    maxavro_file_close(binary);
+    maxavro_file_close(binary_direct);
+    maxavro_block_cache_free(cache);
+    return rval;
+}
+
+/** Seek to records and check that the right record is read next */
+static int test_seek(int rows)
+{
+    int offsets[] = {0, 1, ROWS_PER_BLOCK - 2, ROWS_PER_BLOCK - 1, ROWS_PER_BLOCK,
+                     rows / 2, rows - ROWS_PER_BLOCK, rows - 2
+                    };
+    int rval = 0;
+
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++)
+    {
+        if (offsets[i] < 0 || offsets[i] + 1 >= rows)
+        {
+            continue;
+        }
+
+        MAXAVRO_FILE *file = maxavro_file_open(testfile);
+        MAXAVRO_JSON_ENCODER *encoder = maxavro_file_json_encoder(file);
+        int id = maxavro_json_encoder_field(encoder, "id");
+
+        /** Read one record first so that the seek starts inside a block. A seek
+         * can end at the end of a block in which case the next block is read. */
+        if (!maxavro_record_encode_json(file, encoder) ||
+            !maxavro_record_seek(file, offsets[i]) ||
+            (!maxavro_record_encode_json(file, encoder) &&
+             !(maxavro_next_block(file) && maxavro_record_encode_json(file, encoder))))
+        {
+            printf("Failed to seek to row %d\n", offsets[i] + 1);
+            rval = 1;
+        }
+        else if ((int64_t)encoder->integers[id] != row_id(offsets[i] + 1))
+        {
+            printf("Seek to row %d read row with id %ld\n", offsets[i] + 1,
+                   (long)encoder->integers[id]);
+            rval = 1;
+        }
+
+        maxavro_file_close(file);
+    }
+
+    return rval;
+}
+
+static void bench_seek(int rows)
+{
+    struct timespec start;
+    int seeks = 100;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < seeks; i++)
+    {
+        MAXAVRO_FILE *file = maxavro_file_open(testfile);
+        maxavro_record_seek(file, (uint64_t)(i + 1) * (rows - 1) / seeks);
+        maxavro_file_close(file);
+    }
+
+    printf("Seek:         %d seeks, %.3f ms per seek\n", seeks,
+           elapsed(&start) * 1000 / seeks);
+}
+
+static void bench_objects()
+{
+    MAXAVRO_FILE *file = maxavro_file_open(testfile);
+    struct timespec start;
+    size_t bytes = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    do
+    {
+        json_t *row;
+
+        while ((row = maxavro_record_read_json(file)))
+        {
+            char *json = json_dumps(row, JSON_PRESERVE_ORDER);
+            GWBUF *buf = gwbuf_alloc_and_load(strlen(json), json);
+            bytes += GWBUF_LENGTH(buf);
+            gwbuf_free(buf);
+            free(json);
+            json_decref(row);
+        }
+    }
+    while (maxavro_next_block(file));
+
+    double secs = elapsed(&start);
+    printf("JSON objects: %lu rows, %lu bytes, %.0f rows/s\n",
+           file->records_read, bytes, file->records_read / secs);
+    maxavro_file_close(file);
+}
+
+static void bench_encoder()
+{
+    MAXAVRO_FILE *file = maxavro_file_open(testfile);
+    MAXAVRO_JSON_ENCODER *encoder = maxavro_file_json_encoder(file);
+    struct timespec start;
+    size_t bytes = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    do
+    {
+        while (maxavro_record_encode_json(file, encoder))
+        {
+            if (encoder->length >= 64 * 1024)
+            {
+                GWBUF *buf = maxavro_json_encoder_flush(encoder);
+                bytes += GWBUF_LENGTH(buf);
+                gwbuf_free(buf);
+            }
+        }
+
+        GWBUF *buf = maxavro_json_encoder_flush(encoder);
+
+        if (buf)
+        {
+            bytes += GWBUF_LENGTH(buf);
+            gwbuf_free(buf);
+        }
+    }
+    while (maxavro_next_block(file));
+
+    double secs = elapsed(&start);
+    printf("JSON encoder: %lu rows, %lu bytes, %.0f rows/s\n",
+           file->records_read, bytes, file->records_read / secs);
+    maxavro_file_close(file);
+}
+
+static void bench_binary()
+{
+    MAXAVRO_FILE *file = maxavro_file_open(testfile);
+    struct timespec start;
+    size_t bytes = 0;
+    GWBUF *buf;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while ((buf = maxavro_record_read_binary(file)))
+    {
+        bytes += GWBUF_LENGTH(buf);
+        gwbuf_free(buf);
+    }
+
+    double secs = elapsed(&start);
+    printf("Binary Avro:  %lu rows, %lu bytes, %.0f rows/s\n",
+           file->records_read, bytes, file->records_read / secs);
+    maxavro_file_close(file);
+}
+
+int main(int argc, char** argv)
+{
+    int rows = argc > 1 ? atoi(argv[1]) : 100000;
+    const char *codecs[] = {"null", "deflate"};
+    int rval = 0;
+
+    for (int i = 0; i < sizeof(codecs) / sizeof(codecs[0]) && rval == 0; i++)
+    {
+        struct stat st;
+
+        if (rows < 1 || !write_file(rows, codecs[i]) || stat(testfile, &st) != 0)
+        {
+            printf("Failed to create %s\n", testfile);
+            return 1;
+        }
+
+        printf("Codec %s: %ld bytes\n", codecs[i], (long)st.st_size);
+        rval = test_output() || test_filter() || test_cache(rows, 1024 * 1024 * 1024) ||
+            test_cache(rows, 0) || test_seek(rows);
+
+        if (rval == 0)
+        {
+            bench_objects();
+            bench_encoder();
+            bench_binary();
+            bench_seek(rows);
+        }
+
+        remove(testfile);
+    }
+
+    return rval;
+}
@@ -24,6 +24,9 @@ set(BUILD_BINLOG TRUE CACHE BOOL "Build binlog router")
 # Build the Avro router
 set(BUILD_AVRO FALSE CACHE BOOL "Build Avro router")
 
+# Support the snappy codec in Avro files
+set(WITH_SNAPPY FALSE CACHE BOOL "Support the snappy codec in Avro files")
+
 # Build the multimaster monitor
 set(BUILD_MMMON TRUE CACHE BOOL "Build multimaster monitor")
 
@@ -38,6 +38,7 @@ typedef struct consumer_t
     char *hostname, *vhost, *user, *passwd, *queue, *dbserver, *dbname, *dbuser, *dbpasswd;
     DELIVERY* query_stack;
     int port, dbport;
+    int batch_size; /**Number of messages inserted in one transaction*/
 } CONSUMER;
 
 static int all_ok;
@@ -114,6 +115,10 @@ int handler(void* user, const char* section, const char* name,
         {
             out_fd = fopen(value, "ab");
         }
+        else if (strcmp(name, "batch_size") == 0)
+        {
+            c_inst->batch_size = atoi(value);
+        }
 
     }
 
@@ -392,6 +397,29 @@ int sendToServer(MYSQL* server, amqp_message_t* a, amqp_message_t* b)
     free(qstr);
     return 1;
 }
+/**
+ * Commit the messages inserted in the current transaction and acknowledge them
+ * to the RabbitMQ server. If the commit fails, the messages are returned to
+ * the queue.
+ * @param server SQL server
+ * @param conn RabbitMQ connection
+ * @param channel RabbitMQ channel
+ * @param dtag Delivery tag of the last message in the batch
+ * @return 0 on success, 1 if the commit failed
+ */
+int commitBatch(MYSQL* server, amqp_connection_state_t conn, int channel, uint64_t dtag)
+{
+    if (mysql_query(server, "COMMIT"))
+    {
+        fprintf(stderr, "Could not commit batch to SQL server:%s\n", mysql_error(server));
+        amqp_basic_nack(conn, channel, dtag, 1, 1);
+        return 1;
+    }
+
+    amqp_basic_ack(conn, channel, dtag, 1);
+    return 0;
+}
+
 int main(int argc, char** argv)
 {
     int channel = 1, status = AMQP_STATUS_OK, cnfnlen;
@@ -402,6 +430,8 @@ int main(int argc, char** argv)
     amqp_frame_t frame;
     struct timeval timeout;
     MYSQL db_inst;
+    int n_batch = 0;
+    uint64_t last_dtag = 0;
     char ch, *cnfname = NULL, *cnfpath = NULL;
     static const char* fname = "consumer.cnf";
     const char* default_path = "@CMAKE_INSTALL_PREFIX@/etc";
@@ -527,6 +557,12 @@ int main(int argc, char** argv)
         fprintf(stderr, "Error: Cannot allocate enough memory.\n");
         goto error;
     }
+    if (c_inst->batch_size > 1)
+    {
+        /**Only fetch as many unacknowledged messages as fit in one batch*/
+        amqp_basic_qos(conn, channel, 0, c_inst->batch_size, 0);
+    }
+
     amqp_basic_consume(conn, channel, amqp_cstring_bytes(c_inst->queue), amqp_empty_bytes, 0, 0, 0,
                        amqp_empty_table);
 
@@ -538,6 +574,11 @@ int main(int argc, char** argv)
         /**No frames to read from server, possibly out of messages*/
         if (status == AMQP_STATUS_TIMEOUT)
         {
+            if (n_batch > 0)
+            {
+                commitBatch(&db_inst, conn, channel, last_dtag);
+                n_batch = 0;
+            }
             sleep(timeout.tv_sec);
             continue;
         }
@@ -549,6 +590,11 @@ int main(int argc, char** argv)
 
             amqp_read_message(conn, channel, reply, 0);
 
+            if (c_inst->batch_size > 1 && n_batch == 0)
+            {
+                mysql_query(&db_inst, "START TRANSACTION");
+            }
+
             if (sendMessage(&db_inst, reply))
             {
 
@@ -556,6 +602,20 @@ int main(int argc, char** argv)
                 amqp_basic_reject(conn, channel, decoded->delivery_tag, 0);
                 amqp_destroy_message(reply);
 
+            }
+            else if (c_inst->batch_size > 1)
+            {
+
+                /**Acknowledged when the batch is committed*/
+                last_dtag = decoded->delivery_tag;
+                amqp_destroy_message(reply);
+
+                if (++n_batch >= c_inst->batch_size)
+                {
+                    commitBatch(&db_inst, conn, channel, last_dtag);
+                    n_batch = 0;
+                }
+
             }
             else
             {
@@ -576,6 +636,11 @@ int main(int argc, char** argv)
 
     }
 
+    if (n_batch > 0)
+    {
+        commitBatch(&db_inst, conn, channel, last_dtag);
+    }
+
     fprintf(out_fd, "Shutting down...\n");
 error:
 
@@ -167,6 +167,8 @@ static char *monitor_params[] =
     "events",
     "mysql51_replication",
     "monitor_interval",
+    "probe_threads",
+    "liveness_interval",
     "detect_replication_lag",
     "detect_stale_master",
     "disable_master_failback",
@@ -2596,6 +2598,26 @@ int create_new_monitor(CONFIG_CONTEXT *context, CONFIG_CONTEXT *obj, HASHTABLE*
                        "using default value of 10000 milliseconds.", obj->object);
         }
 
+        char *probe_threads = config_get_value(obj->parameters, "probe_threads");
+        if (probe_threads)
+        {
+            if (!monitorSetProbeThreads(obj->element, atoi(probe_threads)))
+            {
+                MXS_ERROR("Failed to set probe_threads");
+                error_count++;
+            }
+        }
+
+        char *liveness_interval = config_get_value(obj->parameters, "liveness_interval");
+        if (liveness_interval)
+        {
+            if (!monitorSetLivenessInterval(obj->element, strtoul(liveness_interval, NULL, 10)))
+            {
+                MXS_ERROR("Failed to set liveness_interval");
+                error_count++;
+            }
+        }
+
         char *connect_timeout = config_get_value(obj->parameters, "backend_connect_timeout");
         if (connect_timeout)
         {
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file lfqueue.c - A bounded lock-free queue
+ *
+ * Each cell of the ring has a sequence number that tells whether the cell
+ * is free for the push with the same position or holds an item for the pop
+ * with the same position. Threads claim positions by advancing the head or
+ * the tail with a compare-and-swap and publish the cell by updating its
+ * sequence number.
+ */
+
+#include <lfqueue.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/** Keep the producer and consumer positions on separate cache lines */
+#define LFQUEUE_CACHE_LINE 64
+
+typedef struct lfqueue_cell
+{
+    size_t sequence;
+    void *item;
+} LFQUEUE_CELL;
+
+struct lfqueue
+{
+    LFQUEUE_CELL *cells;
+    size_t mask;
+    char pad1[LFQUEUE_CACHE_LINE];
+    size_t tail; /*< Position of the next push */
+    char pad2[LFQUEUE_CACHE_LINE];
+    size_t head; /*< Position of the next pop */
+    char pad3[LFQUEUE_CACHE_LINE];
+};
+
+LFQUEUE* lfqueue_alloc(size_t size)
+{
+    size_t capacity = 2;
+
+    while (capacity < size)
+    {
+        capacity <<= 1;
+    }
+
+    LFQUEUE *queue = calloc(1, sizeof(LFQUEUE));
+    LFQUEUE_CELL *cells = malloc(capacity * sizeof(LFQUEUE_CELL));
+
+    if (queue == NULL || cells == NULL)
+    {
+        free(queue);
+        free(cells);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < capacity; i++)
+    {
+        cells[i].sequence = i;
+        cells[i].item = NULL;
+    }
+
+    queue->cells = cells;
+    queue->mask = capacity - 1;
+    return queue;
+}
+
+void lfqueue_free(LFQUEUE* queue)
+{
+    if (queue)
+    {
+        free(queue->cells);
+        free(queue);
+    }
+}
+
+bool lfqueue_push(LFQUEUE* queue, void* item)
+{
+    size_t pos = *(volatile size_t*)&queue->tail;
+    LFQUEUE_CELL *cell;
+
+    while (true)
+    {
+        cell = &queue->cells[pos & queue->mask];
+        size_t sequence = *(volatile size_t*)&cell->sequence;
+        __sync_synchronize();
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+        if (diff == 0)
+        {
+            if (__sync_bool_compare_and_swap(&queue->tail, pos, pos + 1))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            /** The cell still holds an item from the previous lap */
+            return false;
+        }
+
+        pos = *(volatile size_t*)&queue->tail;
+    }
+
+    cell->item = item;
+    __sync_synchronize();
+    *(volatile size_t*)&cell->sequence = pos + 1;
+    return true;
+}
+
+void* lfqueue_pop(LFQUEUE* queue)
+{
+    size_t pos = *(volatile size_t*)&queue->head;
+    LFQUEUE_CELL *cell;
+
+    while (true)
+    {
+        cell = &queue->cells[pos & queue->mask];
+        size_t sequence = *(volatile size_t*)&cell->sequence;
+        __sync_synchronize();
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+        if (diff == 0)
+        {
+            if (__sync_bool_compare_and_swap(&queue->head, pos, pos + 1))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            /** The cell has not been filled yet */
+            return NULL;
+        }
+
+        pos = *(volatile size_t*)&queue->head;
+    }
+
+    void *item = cell->item;
+    __sync_synchronize();
+    *(volatile size_t*)&cell->sequence = pos + queue->mask + 1;
+    return item;
+}
+
+size_t lfqueue_capacity(const LFQUEUE* queue)
+{
+    return queue->mask + 1;
+}
@@ -377,6 +377,18 @@ unregister_module(const char *module)
         }
     }
 
+    /*
+     * If the module has a ModuleFini function call it before the
+     * module is closed.
+     */
+    void *sym = dlsym(mod->handle, "ModuleFini");
+
+    if (sym)
+    {
+        void (*ModuleFini)() = sym;
+        ModuleFini();
+    }
+
     /*<
      * The module is now not in the linked list and all
      * memory related to it can be freed
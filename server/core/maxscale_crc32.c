@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file maxscale_crc32.c - CRC32 checksums of the binary log events
+ *
+ * The checksum uses the same reflected polynomial (0xEDB88320) as zlib's
+ * crc32(). Note that the SSE4.2 crc32 instruction can't be used as it
+ * implements the Castagnoli polynomial.
+ *
+ * The PCLMULQDQ implementation follows the Intel white paper "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+ */
+
+#include <maxscale_crc32.h>
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define CRC32_HAVE_CLMUL 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CRC32_LITTLE_ENDIAN 1
+#endif
+
+#define CRC32_POLYNOMIAL 0xedb88320
+
+typedef uint32_t (*crc32_func_t)(uint32_t crc, const uint8_t *buf, size_t len);
+
+static uint32_t crc_table[8][256];
+static crc32_func_t crc32_func;
+static const char *crc32_name;
+static pthread_once_t crc32_init_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Calculate the checksum one byte at a time
+ *
+ * @param crc Inverted checksum
+ * @param buf Data
+ * @param len Length of data
+ * @return Inverted checksum
+ */
+static inline uint32_t crc32_bytes(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    while (len--)
+    {
+        crc = crc_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+/**
+ * Calculate the checksum eight bytes at a time with the slicing-by-8 tables
+ */
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    crc = ~crc;
+
+#ifdef CRC32_LITTLE_ENDIAN
+    while (len && ((uintptr_t)buf & 7))
+    {
+        crc = crc_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+
+    while (len >= 8)
+    {
+        uint32_t one, two;
+        memcpy(&one, buf, sizeof(one));
+        memcpy(&two, buf + 4, sizeof(two));
+        one ^= crc;
+
+        crc = crc_table[7][one & 0xff] ^
+              crc_table[6][(one >> 8) & 0xff] ^
+              crc_table[5][(one >> 16) & 0xff] ^
+              crc_table[4][one >> 24] ^
+              crc_table[3][two & 0xff] ^
+              crc_table[2][(two >> 8) & 0xff] ^
+              crc_table[1][(two >> 16) & 0xff] ^
+              crc_table[0][two >> 24];
+
+        buf += 8;
+        len -= 8;
+    }
+#endif
+
+    return ~crc32_bytes(crc, buf, len);
+}
+
+#ifdef CRC32_HAVE_CLMUL
+
+/**
+ * Fold 16 byte blocks with carry-less multiplication
+ *
+ * @param buf Data, at least 64 bytes
+ * @param len Length of data, a multiple of 16
+ * @param crc Inverted checksum
+ * @return Inverted checksum
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_fold(const uint8_t *buf, size_t len, uint32_t crc)
+{
+    /** The constants for the reflected polynomial from the white paper */
+    static const uint64_t k1k2[] __attribute__((aligned(16))) = {0x0154442bd4, 0x01c6e41596};
+    static const uint64_t k3k4[] __attribute__((aligned(16))) = {0x01751997d0, 0x00ccaa009e};
+    static const uint64_t k5k0[] __attribute__((aligned(16))) = {0x0163cd6124, 0x0000000000};
+    static const uint64_t poly[] __attribute__((aligned(16))) = {0x01db710641, 0x01f7011641};
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((__m128i *)(buf + 0x00));
+    x2 = _mm_loadu_si128((__m128i *)(buf + 0x10));
+    x3 = _mm_loadu_si128((__m128i *)(buf + 0x20));
+    x4 = _mm_loadu_si128((__m128i *)(buf + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_load_si128((__m128i *)k1k2);
+
+    buf += 64;
+    len -= 64;
+
+    /** Fold four blocks in parallel */
+    while (len >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((__m128i *)(buf + 0x00));
+        y6 = _mm_loadu_si128((__m128i *)(buf + 0x10));
+        y7 = _mm_loadu_si128((__m128i *)(buf + 0x20));
+        y8 = _mm_loadu_si128((__m128i *)(buf + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        buf += 64;
+        len -= 64;
+    }
+
+    /** Fold the four blocks into one */
+    x0 = _mm_load_si128((__m128i *)k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /** Fold the remaining 16 byte blocks */
+    while (len >= 16)
+    {
+        x2 = _mm_loadu_si128((__m128i *)buf);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        buf += 16;
+        len -= 16;
+    }
+
+    /** Fold 128 bits to 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((__m128i *)k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /** Barrett reduction to 32 bits */
+    x0 = _mm_load_si128((__m128i *)poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return _mm_extract_epi32(x1, 1);
+}
+
+/**
+ * Calculate the checksum with PCLMULQDQ folding. Buffers shorter than 64
+ * bytes and the tail of the buffer are handled with the table implementation.
+ */
+static uint32_t crc32_clmul(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    if (len >= 64)
+    {
+        size_t n = len & ~(size_t)15;
+        crc = ~crc32_fold(buf, n, ~crc);
+        buf += n;
+        len -= n;
+    }
+
+    return len ? crc32_slice8(crc, buf, len) : crc;
+}
+
+static int cpu_has_clmul()
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+           (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+}
+
+#endif
+
+/**
+ * Build the lookup tables and select the implementation
+ */
+static void crc32_init()
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t c = n;
+
+        for (int k = 0; k < 8; k++)
+        {
+            c = c & 1 ? CRC32_POLYNOMIAL ^ (c >> 1) : c >> 1;
+        }
+
+        crc_table[0][n] = c;
+    }
+
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        for (int k = 1; k < 8; k++)
+        {
+            uint32_t c = crc_table[k - 1][n];
+            crc_table[k][n] = crc_table[0][c & 0xff] ^ (c >> 8);
+        }
+    }
+
+    crc32_func = crc32_slice8;
+    crc32_name = "slicing-by-8";
+
+#ifdef CRC32_HAVE_CLMUL
+    if (cpu_has_clmul())
+    {
+        crc32_func = crc32_clmul;
+        crc32_name = "pclmulqdq";
+    }
+#endif
+}
+
+uint32_t mxs_crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    pthread_once(&crc32_init_once, crc32_init);
+
+    if (buf == NULL)
+    {
+        return 0;
+    }
+
+    return crc32_func(crc, buf, len);
+}
+
+uint32_t mxs_crc32_slice8(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    pthread_once(&crc32_init_once, crc32_init);
+
+    if (buf == NULL)
+    {
+        return 0;
+    }
+
+    return crc32_slice8(crc, buf, len);
+}
+
+const char* mxs_crc32_implementation()
+{
+    pthread_once(&crc32_init_once, crc32_init);
+    return crc32_name;
+}
@@ -25,6 +25,12 @@
  */
 
 #include <maxscale_pcre2.h>
+#include <platform.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 
 /**
  * Utility wrapper for PCRE2 library function call pcre2_substitute.
@@ -132,3 +138,544 @@ mxs_pcre2_result_t mxs_pcre2_simple_match(const char* pattern, const char* subje
     }
     return rval;
 }
+
+/** Initial and maximum size of the JIT stack used by the pattern sets */
+#define MXS_PCRE2_SET_JIT_STACK_START (32 * 1024)
+#define MXS_PCRE2_SET_JIT_STACK_MAX   (1024 * 1024)
+
+struct mxs_pcre2_set
+{
+    int options; /*< PCRE2 compilation options */
+    char** patterns; /*< The patterns */
+    pcre2_code** codes; /*< The patterns compiled one by one */
+    bool* combined; /*< Whether the pattern is a part of combined_code */
+    int n_patterns; /*< Number of patterns */
+    int n_combined; /*< Number of patterns in combined_code */
+    pcre2_code* combined_code; /*< Alternation of the combinable patterns */
+};
+
+struct mxs_pcre2_set_state
+{
+    pcre2_match_data* mdata; /*< Match data for all patterns */
+    pcre2_match_context* mcontext; /*< Match context with the callout */
+    pcre2_jit_stack* jit_stack; /*< JIT stack for the combined pattern */
+    bool* matched; /*< Whether each pattern matched */
+    int size; /*< Size of the matched array */
+    int n_matched; /*< Number of matched patterns */
+    int n_combined; /*< Number of patterns in the combined pattern */
+};
+
+/**
+ * Allocate a new pattern set
+ *
+ * @param options PCRE2 compilation options used for all patterns
+ * @return New pattern set or NULL if memory allocation failed
+ */
+MXS_PCRE2_SET* mxs_pcre2_set_alloc(int options)
+{
+    MXS_PCRE2_SET* set = calloc(1, sizeof(MXS_PCRE2_SET));
+
+    if (set)
+    {
+        set->options = options;
+    }
+
+    return set;
+}
+
+/**
+ * Free a pattern set
+ *
+ * @param set Set to free
+ */
+void mxs_pcre2_set_free(MXS_PCRE2_SET* set)
+{
+    if (set)
+    {
+        for (int i = 0; i < set->n_patterns; i++)
+        {
+            free(set->patterns[i]);
+            pcre2_code_free(set->codes[i]);
+        }
+
+        pcre2_code_free(set->combined_code);
+        free(set->patterns);
+        free(set->codes);
+        free(set->combined);
+        free(set);
+    }
+}
+
+/**
+ * Add a pattern to a set
+ *
+ * The pattern is compiled immediately so that errors are reported for the
+ * pattern that caused them. The set must be compiled with
+ * mxs_pcre2_set_compile() after all patterns have been added.
+ *
+ * @param set Set where the pattern is added
+ * @param pattern Pattern to add
+ * @param error The PCRE2 error code is stored here if the pattern is invalid,
+ * 0 if memory allocation failed
+ * @param erroffset The offset of the error in the pattern is stored here
+ * @return The ID of the pattern or -1 on error. The IDs are assigned in the
+ * order the patterns are added, starting from zero.
+ */
+int mxs_pcre2_set_add(MXS_PCRE2_SET* set, const char* pattern, int* error, size_t* erroffset)
+{
+    int n = set->n_patterns;
+    pcre2_code* code = pcre2_compile((PCRE2_SPTR) pattern, PCRE2_ZERO_TERMINATED,
+                                     set->options, error, erroffset, NULL);
+
+    if (code == NULL)
+    {
+        return -1;
+    }
+
+    char** patterns = realloc(set->patterns, (n + 1) * sizeof(char*));
+
+    if (patterns)
+    {
+        set->patterns = patterns;
+    }
+
+    pcre2_code** codes = realloc(set->codes, (n + 1) * sizeof(pcre2_code*));
+
+    if (codes)
+    {
+        set->codes = codes;
+    }
+
+    bool* combined = realloc(set->combined, (n + 1) * sizeof(bool));
+
+    if (combined)
+    {
+        set->combined = combined;
+    }
+
+    if (patterns == NULL || codes == NULL || combined == NULL ||
+        (patterns[n] = strdup(pattern)) == NULL)
+    {
+        pcre2_code_free(code);
+        *error = 0;
+        return -1;
+    }
+
+    pcre2_jit_compile(code, PCRE2_JIT_COMPLETE);
+    codes[n] = code;
+    combined[n] = false;
+    set->n_patterns++;
+
+    return n;
+}
+
+/**
+ * Check whether a pattern can be a part of the combined pattern
+ *
+ * Backtracking control verbs could prevent the other patterns from being
+ * tried and the callouts of the pattern would be mixed with the callouts of
+ * the set. Such patterns are matched on their own.
+ *
+ * @param pattern Pattern to check
+ * @return True if the pattern can be combined with other patterns
+ */
+static bool set_pattern_combinable(const char* pattern)
+{
+    return strstr(pattern, "(*") == NULL && strstr(pattern, "(?C") == NULL;
+}
+
+/**
+ * Compile a pattern set
+ *
+ * The patterns are combined into one alternation where each pattern is an
+ * atomic group followed by a callout. The callout records the matching pattern
+ * and then forces the matching to continue with the other patterns. This finds
+ * all matching patterns with one scan of the subject. A branch reset group
+ * keeps the numbering of the capturing groups of each pattern unchanged.
+ *
+ * If the combined pattern cannot be compiled, the patterns are matched one
+ * at a time. The set can still be used in that case.
+ *
+ * @param set Set to compile
+ * @return True if the patterns were combined
+ */
+bool mxs_pcre2_set_compile(MXS_PCRE2_SET* set)
+{
+    size_t len = sizeof("(?|)");
+
+    pcre2_code_free(set->combined_code);
+    set->combined_code = NULL;
+    set->n_combined = 0;
+
+    for (int i = 0; i < set->n_patterns; i++)
+    {
+        /** (?>pattern)(?C{<id>})| */
+        len += strlen(set->patterns[i]) + sizeof("(?C{})") + 12 + sizeof("(?>)|");
+    }
+
+    char* combined = malloc(len);
+
+    if (combined == NULL)
+    {
+        return false;
+    }
+
+    char* ptr = combined;
+    ptr += sprintf(ptr, "(?|");
+
+    for (int i = 0; i < set->n_patterns; i++)
+    {
+        set->combined[i] = set_pattern_combinable(set->patterns[i]);
+
+        if (set->combined[i])
+        {
+            ptr += sprintf(ptr, "%s(?>%s)(?C{%d})", set->n_combined > 0 ? "|" : "",
+                           set->patterns[i], i);
+            set->n_combined++;
+        }
+    }
+
+    sprintf(ptr, ")");
+
+    if (set->n_combined > 1)
+    {
+        int err;
+        size_t erroff;
+
+        if ((set->combined_code = pcre2_compile((PCRE2_SPTR) combined, PCRE2_ZERO_TERMINATED,
+                                                set->options, &err, &erroff, NULL)))
+        {
+            pcre2_jit_compile(set->combined_code, PCRE2_JIT_COMPLETE);
+        }
+    }
+
+    if (set->combined_code == NULL)
+    {
+        set->n_combined = 0;
+        memset(set->combined, 0, set->n_patterns * sizeof(bool));
+    }
+
+    free(combined);
+    return set->combined_code != NULL;
+}
+
+/**
+ * Get the number of patterns in a set
+ *
+ * @param set Pattern set
+ * @return Number of patterns
+ */
+int mxs_pcre2_set_size(const MXS_PCRE2_SET* set)
+{
+    return set->n_patterns;
+}
+
+/**
+ * Allocate a matching state for pattern sets
+ *
+ * @return New state or NULL if memory allocation failed
+ */
+MXS_PCRE2_SET_STATE* mxs_pcre2_set_state_alloc()
+{
+    MXS_PCRE2_SET_STATE* state = calloc(1, sizeof(MXS_PCRE2_SET_STATE));
+
+    if (state)
+    {
+        state->mdata = pcre2_match_data_create(1, NULL);
+        state->mcontext = pcre2_match_context_create(NULL);
+
+        if (state->mdata == NULL || state->mcontext == NULL)
+        {
+            mxs_pcre2_set_state_free(state);
+            state = NULL;
+        }
+        else if ((state->jit_stack = pcre2_jit_stack_create(MXS_PCRE2_SET_JIT_STACK_START,
+                                                            MXS_PCRE2_SET_JIT_STACK_MAX, NULL)))
+        {
+            /** A NULL JIT stack is not an error, it means that JIT is not available */
+            pcre2_jit_stack_assign(state->mcontext, NULL, state->jit_stack);
+        }
+    }
+
+    return state;
+}
+
+/**
+ * Free a matching state
+ *
+ * @param state State to free
+ */
+void mxs_pcre2_set_state_free(MXS_PCRE2_SET_STATE* state)
+{
+    if (state)
+    {
+        pcre2_match_data_free(state->mdata);
+        pcre2_match_context_free(state->mcontext);
+        pcre2_jit_stack_free(state->jit_stack);
+        free(state->matched);
+        free(state);
+    }
+}
+
+/**
+ * The callout of the combined pattern
+ *
+ * The callout is reached when a pattern has matched. It records the match and
+ * fails the current branch so that the other patterns are tried. Once all
+ * patterns have matched, the matching is aborted.
+ *
+ * A callout before each pattern could skip the patterns that have already
+ * matched but calling it for every pattern at every starting position costs
+ * more than it saves.
+ */
+static int set_callout(pcre2_callout_block* block, void* data)
+{
+    MXS_PCRE2_SET_STATE* state = (MXS_PCRE2_SET_STATE*) data;
+    int rval = 1;
+
+    if (block->callout_string)
+    {
+        int id = atoi((const char*) block->callout_string);
+
+        if (!state->matched[id])
+        {
+            state->matched[id] = true;
+            state->n_matched++;
+
+            if (state->n_matched == state->n_combined)
+            {
+                rval = PCRE2_ERROR_CALLOUT;
+            }
+        }
+    }
+
+    return rval;
+}
+
+/**
+ * Match a subject against all patterns of a set
+ *
+ * Use mxs_pcre2_set_matched() to check which patterns matched.
+ *
+ * @param set Pattern set
+ * @param state Matching state
+ * @param subject Subject to match
+ * @param length Length of the subject
+ * @return Number of matching patterns or -1 if memory allocation failed
+ */
+int mxs_pcre2_set_match(const MXS_PCRE2_SET* set, MXS_PCRE2_SET_STATE* state,
+                        const char* subject, size_t length)
+{
+    if (state->size < set->n_patterns)
+    {
+        bool* matched = realloc(state->matched, set->n_patterns * sizeof(bool));
+
+        if (matched == NULL)
+        {
+            return -1;
+        }
+
+        state->matched = matched;
+        state->size = set->n_patterns;
+    }
+
+    memset(state->matched, 0, set->n_patterns * sizeof(bool));
+    state->n_matched = 0;
+    state->n_combined = set->n_combined;
+
+    bool combined_done = false;
+
+    if (set->combined_code)
+    {
+        pcre2_set_callout(state->mcontext, set_callout, state);
+        int rc = pcre2_match(set->combined_code, (PCRE2_SPTR) subject, length, 0, 0,
+                             state->mdata, state->mcontext);
+        pcre2_set_callout(state->mcontext, NULL, NULL);
+
+        if (rc == PCRE2_ERROR_NOMATCH || rc == PCRE2_ERROR_CALLOUT)
+        {
+            combined_done = true;
+        }
+        else
+        {
+            /** A resource limit was hit, match the patterns one at a time */
+            memset(state->matched, 0, set->n_patterns * sizeof(bool));
+            state->n_matched = 0;
+        }
+    }
+
+    for (int i = 0; i < set->n_patterns; i++)
+    {
+        if (!combined_done || !set->combined[i])
+        {
+            /** The match data has room for one pair which makes the return value
+             * zero for a match */
+            if (pcre2_match(set->codes[i], (PCRE2_SPTR) subject, length, 0, 0,
+                            state->mdata, state->mcontext) >= 0)
+            {
+                state->matched[i] = true;
+                state->n_matched++;
+            }
+        }
+    }
+
+    return state->n_matched;
+}
+
+/**
+ * Check whether a pattern matched in the latest match
+ *
+ * @param state Matching state used in mxs_pcre2_set_match()
+ * @param id ID of the pattern
+ * @return True if the pattern matched
+ */
+bool mxs_pcre2_set_matched(const MXS_PCRE2_SET_STATE* state, int id)
+{
+    return id < state->size && state->matched[id];
+}
+
+/**
+ * Compile a pattern and JIT-compile it if JIT is available
+ *
+ * @param pattern Pattern to compile
+ * @param options PCRE2 compilation options
+ * @param error The PCRE2 error code is stored here if the pattern is invalid
+ * @param erroffset The offset of the error in the pattern is stored here
+ * @return The compiled pattern or NULL on error
+ */
+pcre2_code* mxs_pcre2_compile(const char* pattern, int options, int* error, size_t* erroffset)
+{
+    pcre2_code* code = pcre2_compile((PCRE2_SPTR) pattern, PCRE2_ZERO_TERMINATED,
+                                     options, error, erroffset, NULL);
+
+    if (code)
+    {
+        /** Failure to JIT-compile only means that the interpreter is used */
+        pcre2_jit_compile(code, PCRE2_JIT_COMPLETE);
+    }
+
+    return code;
+}
+
+/** The match data of the current thread and the number of pairs it holds */
+static thread_local pcre2_match_data* thread_match_data = NULL;
+static thread_local uint32_t thread_match_pairs = 0;
+
+/**
+ * Get the match data of the calling thread
+ *
+ * The match data is shared by all patterns matched by the thread and it is
+ * grown to fit the capturing groups of the largest pattern. The data is only
+ * valid until the thread matches the next pattern.
+ *
+ * @param code Pattern that is about to be matched
+ * @return Match data or NULL if memory allocation failed
+ */
+pcre2_match_data* mxs_pcre2_thread_match_data(const pcre2_code* code)
+{
+    uint32_t captures = 0;
+    pcre2_pattern_info(code, PCRE2_INFO_CAPTURECOUNT, &captures);
+
+    if (captures + 1 > thread_match_pairs)
+    {
+        pcre2_match_data* mdata = pcre2_match_data_create(captures + 1, NULL);
+
+        if (mdata)
+        {
+            pcre2_match_data_free(thread_match_data);
+            thread_match_data = mdata;
+            thread_match_pairs = captures + 1;
+        }
+        /** If the allocation failed, the old match data can still be used.
+         * The return value of pcre2_match is zero on a match in that case. */
+    }
+
+    return thread_match_data;
+}
+
+/** The shortest literal worth searching for before matching a pattern */
+#define MXS_PCRE2_MIN_LITERAL 3
+
+/**
+ * Extract the literal text every match of a pattern must begin with
+ *
+ * The literal is taken from the start of the pattern up to the first
+ * character with a special meaning. Patterns with alternations and patterns
+ * compiled with extended syntax have no usable literal. If the pattern does
+ * not contain the literal, the pattern cannot match the subject and the more
+ * expensive matching can be skipped.
+ *
+ * @param pattern Pattern to inspect
+ * @param options PCRE2 compilation options of the pattern
+ * @return The literal or NULL if the pattern has no literal long enough to
+ * be worth searching for. The caller must free the returned string.
+ */
+char* mxs_pcre2_literal_prefix(const char* pattern, int options)
+{
+    if ((options & PCRE2_EXTENDED) || strchr(pattern, '|'))
+    {
+        return NULL;
+    }
+
+    const char* start = *pattern == '^' ? pattern + 1 : pattern;
+    const char* end = start;
+
+    while (*end > ' ' && *end < 0x7f && strchr("\\^$.[]|()?*+{}", *end) == NULL)
+    {
+        end++;
+    }
+
+    if (end > start && (*end == '?' || *end == '*' || *end == '{'))
+    {
+        /** The last character is optional */
+        end--;
+    }
+
+    char* rval = NULL;
+
+    if (end - start >= MXS_PCRE2_MIN_LITERAL && (rval = malloc(end - start + 1)))
+    {
+        memcpy(rval, start, end - start);
+        rval[end - start] = '\0';
+    }
+
+    return rval;
+}
+
+/**
+ * Search for a literal in a subject
+ *
+ * @param literal Literal returned by mxs_pcre2_literal_prefix()
+ * @param caseless Whether the case of ASCII letters is ignored
+ * @param subject Subject to search
+ * @param length Length of the subject
+ * @return True if the subject contains the literal
+ */
+bool mxs_pcre2_literal_search(const char* literal, bool caseless,
+                              const char* subject, size_t length)
+{
+    size_t len = strlen(literal);
+
+    if (!caseless)
+    {
+        return memmem(subject, length, literal, len) != NULL;
+    }
+
+    if (len > length)
+    {
+        return false;
+    }
+
+    int first = tolower((unsigned char)literal[0]);
+
+    for (const char* ptr = subject; ptr <= subject + length - len; ptr++)
+    {
+        if (tolower((unsigned char)*ptr) == first &&
+            strncasecmp(ptr + 1, literal + 1, len - 1) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -30,8 +30,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include <monitor.h>
 #include <spinlock.h>
+#include <atomic.h>
+#include <thread.h>
 #include <modules.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
@@ -59,6 +63,8 @@ static MONITOR  *allMonitors = NULL;
 static SPINLOCK monLock = SPINLOCK_INIT;
 
 static void monitor_servers_free(MONITOR_SERVERS *servers);
+static void monitor_probe_pool_free(MONITOR *mon);
+static void monitor_run_probes(MONITOR *mon, monitor_probe_fn probe, bool timed);
 
 /**
  * Allocate a new monitor, load the associated module for the monitor
@@ -95,6 +101,10 @@ monitor_alloc(char *name, char *module)
     mon->write_timeout = DEFAULT_WRITE_TIMEOUT;
     mon->connect_timeout = DEFAULT_CONNECT_TIMEOUT;
     mon->interval = MONITOR_INTERVAL;
+    mon->probe_threads = MONITOR_DEFAULT_PROBE_THREADS;
+    mon->probe_pool = NULL;
+    mon->liveness_interval = 0;
+    mon->probe_requested = 0;
     mon->parameters = NULL;
     spinlock_init(&mon->lock);
     spinlock_acquire(&monLock);
@@ -117,6 +127,7 @@ monitor_free(MONITOR *mon)
     MONITOR *ptr;
 
     mon->module->stopMonitor(mon);
+    monitor_probe_pool_free(mon);
     mon->state = MONITOR_STATE_FREED;
     spinlock_acquire(&monLock);
     if (allMonitors == mon)
@@ -197,6 +208,7 @@ monitorStop(MONITOR *monitor)
     {
         monitor->state = MONITOR_STATE_STOPPING;
         monitor->module->stopMonitor(monitor);
+        monitor_probe_pool_free(monitor);
         monitor->state = MONITOR_STATE_STOPPED;
 
         MONITOR_SERVERS* db = monitor->databases;
@@ -255,6 +267,9 @@ monitorAddServer(MONITOR *mon, SERVER *server)
     db->mon_prev_status = -1;
     /* pending status is updated by get_replication_tree */
     db->pending_status = 0;
+    db->probe_time = 0;
+    db->probe_time_max = 0;
+    db->probe_requested_at = 0;
 
     spinlock_acquire(&mon->lock);
 
@@ -338,6 +353,20 @@ monitorShow(DCB *dcb, MONITOR *monitor)
 
     dcb_printf(dcb, "Monitor: %p\n", monitor);
     dcb_printf(dcb, "\tName:                   %s\n", monitor->name);
+    dcb_printf(dcb, "\tProbe threads:          %d\n", monitor->probe_threads);
+
+    if (monitor->liveness_interval)
+    {
+        dcb_printf(dcb, "\tLiveness interval:      %lu ms\n", monitor->liveness_interval);
+    }
+
+    for (MONITOR_SERVERS *db = monitor->databases; db; db = db->next)
+    {
+        dcb_printf(dcb, "\tProbe time of %s:%d: %d ms (slowest %d ms)\n",
+                   db->server->name, db->server->port, atomic_add(&db->probe_time, 0),
+                   atomic_add(&db->probe_time_max, 0));
+    }
+
     if (monitor->handle)
     {
         if (monitor->module->diagnostics)
@@ -460,6 +489,167 @@ monitorSetNetworkTimeout(MONITOR *mon, int type, int value)
     return rval;
 }
 
+/**
+ * Set the maximum number of servers a monitor probes concurrently
+ *
+ * @param mon           The monitor instance
+ * @param value         Number of probe threads, 1 probes the servers one at a time
+ * @return True if the value was valid
+ */
+bool
+monitorSetProbeThreads(MONITOR *mon, int value)
+{
+    if (value <= 0)
+    {
+        MXS_ERROR("Invalid value for monitor probe threads: %d", value);
+        return false;
+    }
+
+    mon->probe_threads = value;
+    return true;
+}
+
+/**
+ * Set the interval of the liveness checks done between the full monitoring rounds
+ *
+ * @param mon           The monitor instance
+ * @param value         Interval in milliseconds, 0 disables the liveness checks
+ * @return True if the value was valid
+ */
+bool
+monitorSetLivenessInterval(MONITOR *mon, unsigned long value)
+{
+    if (value != 0 && value < MON_BASE_INTERVAL_MS)
+    {
+        MXS_ERROR("Invalid value for monitor liveness interval: %lu, the minimum is %d milliseconds.",
+                  value, MON_BASE_INTERVAL_MS);
+        return false;
+    }
+
+    mon->liveness_interval = value;
+    return true;
+}
+
+/**
+ * Request an immediate full monitoring round from all monitors of a server
+ *
+ * Routers call this when a connection to the server fails so that the
+ * status of the server is updated without waiting for the next monitor
+ * interval. Requests made before the round starts are merged into one round.
+ * A monitor accepts a request for the same server at most once per liveness
+ * interval, or once per monitor interval if liveness checks are disabled, so
+ * that a burst of failing sessions does not keep the monitor probing.
+ *
+ * @param server The server that failed
+ */
+void
+monitor_request_probe(SERVER *server)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t now_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+    spinlock_acquire(&monLock);
+
+    for (MONITOR *mon = allMonitors; mon; mon = mon->next)
+    {
+        spinlock_acquire(&mon->lock);
+
+        for (MONITOR_SERVERS *db = mon->databases; db; db = db->next)
+        {
+            if (db->server == server)
+            {
+                int64_t min_ms = mon->liveness_interval ? mon->liveness_interval : mon->interval;
+
+                if (db->probe_requested_at == 0 || now_ms - db->probe_requested_at >= min_ms)
+                {
+                    db->probe_requested_at = now_ms;
+                    atomic_add(&mon->probe_requested, 1);
+                }
+                break;
+            }
+        }
+
+        spinlock_release(&mon->lock);
+    }
+
+    spinlock_release(&monLock);
+}
+
+/**
+ * Get the longest interval of the monitors of a server
+ *
+ * The status and the replication lag of the server can be this old.
+ *
+ * @param server The server
+ * @return The interval in milliseconds, 0 if no monitor monitors the server
+ */
+size_t
+monitor_get_server_interval(SERVER *server)
+{
+    size_t interval = 0;
+
+    spinlock_acquire(&monLock);
+
+    for (MONITOR *mon = allMonitors; mon; mon = mon->next)
+    {
+        spinlock_acquire(&mon->lock);
+
+        for (MONITOR_SERVERS *db = mon->databases; db; db = db->next)
+        {
+            if (db->server == server && mon->interval > interval)
+            {
+                interval = mon->interval;
+            }
+        }
+
+        spinlock_release(&mon->lock);
+    }
+
+    spinlock_release(&monLock);
+    return interval;
+}
+
+/**
+ * Check whether a monitor of a server measures its replication lag
+ *
+ * The lag is measured by monitors configured with detect_replication_lag.
+ *
+ * @param server The server
+ * @return True if the lag of the server is measured
+ */
+bool
+monitor_server_detects_lag(SERVER *server)
+{
+    bool detects = false;
+
+    spinlock_acquire(&monLock);
+
+    for (MONITOR *mon = allMonitors; mon && !detects; mon = mon->next)
+    {
+        CONFIG_PARAMETER *param = config_get_param(mon->parameters, "detect_replication_lag");
+
+        if (param && config_truth_value(param->value))
+        {
+            spinlock_acquire(&mon->lock);
+
+            for (MONITOR_SERVERS *db = mon->databases; db; db = db->next)
+            {
+                if (db->server == server)
+                {
+                    detects = true;
+                    break;
+                }
+            }
+
+            spinlock_release(&mon->lock);
+        }
+    }
+
+    spinlock_release(&monLock);
+    return detects;
+}
+
 /**
  * Provide a row to the result set that defines the set of monitors
  *
@@ -1047,3 +1237,340 @@ void mon_log_state_change(MONITOR_SERVERS *ptr)
     free(prev);
     free(next);
 }
+
+struct monitor_probe_pool
+{
+    MONITOR *mon;               /*< The monitor that owns the pool */
+    THREAD *threads;            /*< The worker threads */
+    int n_threads;              /*< Number of worker threads */
+    pthread_mutex_t lock;       /*< Protects the fields below */
+    pthread_cond_t work;        /*< Signaled when a round starts or the pool stops */
+    pthread_cond_t done;        /*< Signaled when all servers of a round are probed */
+    monitor_probe_fn probe;     /*< The probe function of the current round */
+    bool timed;                 /*< Whether the probes of the current round are timed */
+    MONITOR_SERVERS **queue;    /*< The servers of the current round */
+    int queue_size;             /*< Size of the queue array */
+    int n_queued;               /*< Number of servers in the current round */
+    int next;                   /*< Index of the next server to probe */
+    int n_done;                 /*< Number of servers probed in the current round */
+    bool shutdown;              /*< Whether the workers should exit */
+};
+
+/**
+ * Probe one server and record how long the probe took
+ *
+ * @param mon Monitor
+ * @param database Server to probe
+ * @param probe Probe function
+ * @param timed Whether to record the duration of the probe
+ */
+static void monitor_probe_one(MONITOR *mon, MONITOR_SERVERS *database,
+                              monitor_probe_fn probe, bool timed)
+{
+    struct timespec start, end;
+
+    if (!timed)
+    {
+        probe(mon, database);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    probe(mon, database);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    int probe_time = (end.tv_sec - start.tv_sec) * 1000 +
+                     (end.tv_nsec - start.tv_nsec) / 1000000;
+
+    /** Only the thread that probes a server writes its durations and the
+     * rounds of a monitor do not overlap, so there is a single writer at any
+     * time. A store of an aligned int is atomic and the diagnostics read the
+     * values with atomic_add(&value, 0). */
+    database->probe_time = probe_time;
+
+    if (probe_time > database->probe_time_max)
+    {
+        database->probe_time_max = probe_time;
+    }
+}
+
+/**
+ * The main loop of a probe worker thread
+ *
+ * @param data The probe pool
+ */
+static void monitor_probe_worker(void *data)
+{
+    MONITOR_PROBE_POOL *pool = (MONITOR_PROBE_POOL*)data;
+
+    if (mysql_thread_init())
+    {
+        MXS_ERROR("mysql_thread_init failed in the probe thread of monitor '%s'.",
+                  pool->mon->name);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (!pool->shutdown)
+    {
+        if (pool->next < pool->n_queued)
+        {
+            MONITOR_SERVERS *database = pool->queue[pool->next++];
+            monitor_probe_fn probe = pool->probe;
+            bool timed = pool->timed;
+            pthread_mutex_unlock(&pool->lock);
+
+            monitor_probe_one(pool->mon, database, probe, timed);
+
+            pthread_mutex_lock(&pool->lock);
+
+            if (++pool->n_done == pool->n_queued)
+            {
+                pthread_cond_signal(&pool->done);
+            }
+        }
+        else
+        {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    mysql_thread_end();
+}
+
+/**
+ * Create the probe pool of a monitor
+ *
+ * @param mon Monitor
+ * @param n_threads Number of worker threads
+ * @return The pool or NULL if it could not be created
+ */
+static MONITOR_PROBE_POOL* monitor_probe_pool_alloc(MONITOR *mon, int n_threads)
+{
+    MONITOR_PROBE_POOL *pool = calloc(1, sizeof(MONITOR_PROBE_POOL));
+
+    if (pool == NULL || (pool->threads = calloc(n_threads, sizeof(THREAD))) == NULL)
+    {
+        free(pool);
+        return NULL;
+    }
+
+    pool->mon = mon;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        if (thread_start(&pool->threads[i], monitor_probe_worker, pool) == NULL)
+        {
+            MXS_ERROR("Failed to start the probe threads of monitor '%s', "
+                      "probing servers one at a time.", mon->name);
+            break;
+        }
+        pool->n_threads++;
+    }
+
+    if (pool->n_threads < n_threads)
+    {
+        mon->probe_pool = pool;
+        monitor_probe_pool_free(mon);
+        pool = NULL;
+    }
+
+    return pool;
+}
+
+/**
+ * Stop the probe threads of a monitor and free the pool
+ *
+ * @param mon Monitor
+ */
+static void monitor_probe_pool_free(MONITOR *mon)
+{
+    MONITOR_PROBE_POOL *pool = mon->probe_pool;
+
+    if (pool)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->shutdown = true;
+        pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (int i = 0; i < pool->n_threads; i++)
+        {
+            thread_wait(pool->threads[i]);
+        }
+
+        pthread_cond_destroy(&pool->work);
+        pthread_cond_destroy(&pool->done);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->threads);
+        free(pool->queue);
+        free(pool);
+        mon->probe_pool = NULL;
+    }
+}
+
+/**
+ * Probe all servers of a monitor
+ *
+ * The servers are probed concurrently by at most mon->probe_threads worker
+ * threads so that a slow or hung server does not delay the probing of the
+ * other servers. The function returns when all servers have been probed,
+ * which makes the duration of a round that of the slowest probe instead of
+ * the sum of all probes. The duration of each probe is stored in the
+ * probe_time field of the server.
+ *
+ * This must only be called from the monitor thread.
+ *
+ * @param mon Monitor
+ * @param probe Function that probes one server
+ */
+void monitor_probe_all(MONITOR *mon, monitor_probe_fn probe)
+{
+    monitor_run_probes(mon, probe, true);
+}
+
+/**
+ * Run a probe function over all servers of a monitor using the probe pool
+ *
+ * @param mon Monitor
+ * @param probe Function that probes one server
+ * @param timed Whether to record the durations of the probes
+ */
+static void monitor_run_probes(MONITOR *mon, monitor_probe_fn probe, bool timed)
+{
+    int n_servers = 0;
+
+    for (MONITOR_SERVERS *db = mon->databases; db; db = db->next)
+    {
+        n_servers++;
+    }
+
+    int n_threads = MIN(n_servers, mon->probe_threads);
+
+    if (mon->probe_pool && mon->probe_pool->n_threads != n_threads)
+    {
+        /** The number of servers changed */
+        monitor_probe_pool_free(mon);
+    }
+
+    if (n_threads > 1 && mon->probe_pool == NULL)
+    {
+        mon->probe_pool = monitor_probe_pool_alloc(mon, n_threads);
+    }
+
+    MONITOR_PROBE_POOL *pool = mon->probe_pool;
+
+    if (pool && pool->queue_size < n_servers)
+    {
+        MONITOR_SERVERS **queue = realloc(pool->queue, n_servers * sizeof(MONITOR_SERVERS*));
+
+        if (queue)
+        {
+            pool->queue = queue;
+            pool->queue_size = n_servers;
+        }
+        else
+        {
+            pool = NULL;
+        }
+    }
+
+    if (pool == NULL)
+    {
+        for (MONITOR_SERVERS *db = mon->databases; db; db = db->next)
+        {
+            monitor_probe_one(mon, db, probe, timed);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    pool->n_queued = 0;
+
+    for (MONITOR_SERVERS *db = mon->databases; db; db = db->next)
+    {
+        pool->queue[pool->n_queued++] = db;
+    }
+
+    pool->probe = probe;
+    pool->timed = timed;
+    pool->next = 0;
+    pool->n_done = 0;
+    pthread_cond_broadcast(&pool->work);
+
+    while (pool->n_done < pool->n_queued)
+    {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+
+    pool->n_queued = 0;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Check that a running server still responds
+ *
+ * A failed check requests a full monitoring round which updates the status
+ * of the server. Servers that are down are left to the full rounds as
+ * connecting to them can take up to the connect timeout.
+ *
+ * @param mon Monitor
+ * @param database Server to check
+ */
+static void monitor_ping_db(MONITOR *mon, MONITOR_SERVERS *database)
+{
+    if (!SERVER_IN_MAINT(database->server) && SERVER_IS_RUNNING(database->server) &&
+        (database->con == NULL || mysql_ping(database->con) != 0))
+    {
+        MXS_INFO("Liveness check of server %s:%d failed, probing all servers of monitor '%s'.",
+                 database->server->name, database->server->port, mon->name);
+        atomic_add(&mon->probe_requested, 1);
+    }
+}
+
+/**
+ * Check whether a monitor should do a full monitoring round
+ *
+ * The monitors call this every MON_BASE_INTERVAL_MS milliseconds. A full
+ * round is due on the first call, once every monitor interval and whenever
+ * a router or a failed liveness check has requested one. If liveness checks
+ * are enabled, the running servers are pinged every liveness interval
+ * between the full rounds.
+ *
+ * @param mon Monitor
+ * @param nrounds Number of times this has been called
+ * @return True if the monitor should probe its servers
+ */
+bool monitor_round_due(MONITOR *mon, size_t nrounds)
+{
+    size_t elapsed = nrounds * MON_BASE_INTERVAL_MS;
+
+    /** The routers can request probes at any time. Only the requests seen
+     * here are subtracted so that a request made after the read is not lost. */
+    int seen = atomic_add(&mon->probe_requested, 0);
+
+    if (nrounds == 0 || elapsed % mon->interval < MON_BASE_INTERVAL_MS)
+    {
+        atomic_add(&mon->probe_requested, -seen);
+        return true;
+    }
+
+    if (mon->liveness_interval && elapsed % mon->liveness_interval < MON_BASE_INTERVAL_MS)
+    {
+        monitor_run_probes(mon, monitor_ping_db, false);
+        seen = atomic_add(&mon->probe_requested, 0);
+    }
+
+    if (seen)
+    {
+        atomic_add(&mon->probe_requested, -seen);
+        return true;
+    }
+
+    return false;
+}
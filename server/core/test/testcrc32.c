@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file testcrc32.c - Compare mxs_crc32 to zlib's crc32
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+#include <maxscale_crc32.h>
+
+#define test_assert(a, b) if(!(a)){fprintf(stderr, b);return 1;}
+
+#define BUFFER_SIZE (1024 * 1024)
+
+static uint8_t buffer[BUFFER_SIZE + 16];
+
+typedef uint32_t (*crc32_fn)(uint32_t crc, const uint8_t *buf, size_t len);
+
+/** The implementation selected at runtime and the fallback implementation */
+static crc32_fn implementations[] = {mxs_crc32, mxs_crc32_slice8};
+#define N_IMPLEMENTATIONS (sizeof(implementations) / sizeof(implementations[0]))
+
+/**
+ * Test known values
+ */
+static int test1(crc32_fn fn)
+{
+    const char *str = "123456789";
+    test_assert(fn(0, (uint8_t*)str, strlen(str)) == 0xcbf43926, "Check value should match");
+    test_assert(fn(0, NULL, 0) == 0, "Initial value should be zero");
+    test_assert(fn(0, buffer, 0) == 0, "Checksum of an empty buffer should be zero");
+    return 0;
+}
+
+/**
+ * Test all lengths and alignments of short buffers and random lengths of
+ * long buffers
+ */
+static int test2(crc32_fn fn)
+{
+    for (size_t len = 0; len < 1024; len++)
+    {
+        for (size_t offset = 0; offset < 16; offset++)
+        {
+            uint32_t expected = crc32(0, buffer + offset, len);
+            test_assert(fn(0, buffer + offset, len) == expected,
+                        "Checksum of a short buffer should match zlib\n");
+        }
+    }
+
+    for (int i = 0; i < 1000; i++)
+    {
+        size_t offset = random() % 16;
+        size_t len = random() % BUFFER_SIZE;
+        test_assert(fn(0, buffer + offset, len) == crc32(0, buffer + offset, len),
+                    "Checksum of a long buffer should match zlib\n");
+    }
+
+    return 0;
+}
+
+/**
+ * Test that calculating the checksum in pieces gives the same result
+ */
+static int test3(crc32_fn fn)
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        size_t len = random() % (64 * 1024);
+        uint32_t expected = crc32(0, buffer, len);
+        uint32_t crc = 0;
+        size_t pos = 0;
+
+        while (pos < len)
+        {
+            size_t n = random() % 300;
+
+            if (n > len - pos)
+            {
+                n = len - pos;
+            }
+
+            crc = fn(crc, buffer + pos, n);
+            pos += n;
+        }
+
+        test_assert(crc == expected, "Incremental checksum should match zlib\n");
+    }
+
+    return 0;
+}
+
+static double benchmark(size_t len, int use_zlib)
+{
+    struct timespec start, end;
+    size_t total = 256 * 1024 * 1024;
+    uint32_t crc = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (size_t done = 0; done < total; done += len)
+    {
+        crc = use_zlib ? crc32(crc, buffer, len) : mxs_crc32(crc, buffer, len);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    /** Prevent the loop from being optimized away */
+    buffer[BUFFER_SIZE] = crc;
+
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+    return total / secs / (1024 * 1024);
+}
+
+/**
+ * Compare the throughput to zlib with typical binlog event sizes
+ */
+static void test4()
+{
+    size_t sizes[] = {64, 256, 1024, 8192, 65536};
+
+    printf("CRC32 implementation: %s\n", mxs_crc32_implementation());
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        printf("%6lu bytes: zlib %8.1f MB/s, mxs_crc32 %8.1f MB/s\n", sizes[i],
+               benchmark(sizes[i], 1), benchmark(sizes[i], 0));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    srandom(time(NULL));
+
+    for (size_t i = 0; i < sizeof(buffer); i++)
+    {
+        buffer[i] = random();
+    }
+
+    for (size_t i = 0; i < N_IMPLEMENTATIONS; i++)
+    {
+        result += test1(implementations[i]);
+        result += test2(implementations[i]);
+        result += test3(implementations[i]);
+    }
+
+    if (result == 0)
+    {
+        test4();
+    }
+
+    return result;
+}
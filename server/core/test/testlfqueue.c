@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file testlfqueue.c - Test the lock-free queue
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <lfqueue.h>
+
+#define test_assert(a, b) if(!(a)){fprintf(stderr, b);return 1;}
+
+#define N_PRODUCERS 4
+#define N_ITEMS 100000
+
+/**
+ * Test a single thread filling and emptying the queue
+ */
+static int test1()
+{
+    LFQUEUE *queue = lfqueue_alloc(5);
+    test_assert(queue, "Queue allocation should succeed\n");
+    test_assert(lfqueue_capacity(queue) == 8, "Capacity should be rounded up to a power of two\n");
+    test_assert(lfqueue_pop(queue) == NULL, "Empty queue should return NULL\n");
+
+    for (int lap = 0; lap < 3; lap++)
+    {
+        for (intptr_t i = 1; i <= 8; i++)
+        {
+            test_assert(lfqueue_push(queue, (void*)i), "Push to a non-full queue should succeed\n");
+        }
+
+        test_assert(!lfqueue_push(queue, (void*)9), "Push to a full queue should fail\n");
+
+        for (intptr_t i = 1; i <= 8; i++)
+        {
+            test_assert(lfqueue_pop(queue) == (void*)i, "Items should be returned in order\n");
+        }
+
+        test_assert(lfqueue_pop(queue) == NULL, "Emptied queue should return NULL\n");
+    }
+
+    lfqueue_free(queue);
+    return 0;
+}
+
+static LFQUEUE *shared_queue;
+
+static void* producer(void *data)
+{
+    intptr_t id = (intptr_t)data;
+
+    for (intptr_t i = 0; i < N_ITEMS; i++)
+    {
+        /** The item encodes the producer and a sequence number, never NULL */
+        intptr_t item = (i << 8) | (id + 1);
+
+        while (!lfqueue_push(shared_queue, (void*)item))
+        {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Test concurrent producers with a single consumer
+ */
+static int test2()
+{
+    pthread_t threads[N_PRODUCERS];
+    intptr_t next[N_PRODUCERS] = {0};
+    shared_queue = lfqueue_alloc(64);
+    test_assert(shared_queue, "Queue allocation should succeed\n");
+
+    for (intptr_t i = 0; i < N_PRODUCERS; i++)
+    {
+        pthread_create(&threads[i], NULL, producer, (void*)i);
+    }
+
+    for (int received = 0; received < N_PRODUCERS * N_ITEMS;)
+    {
+        intptr_t item = (intptr_t)lfqueue_pop(shared_queue);
+
+        if (item)
+        {
+            int id = (item & 0xff) - 1;
+            test_assert(id >= 0 && id < N_PRODUCERS, "Item should come from a known producer\n");
+            test_assert(item >> 8 == next[id], "Items of one producer should be in order\n");
+            next[id]++;
+            received++;
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+
+    for (int i = 0; i < N_PRODUCERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    test_assert(lfqueue_pop(shared_queue) == NULL, "Queue should be empty\n");
+    lfqueue_free(shared_queue);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    result += test1();
+    result += test2();
+
+    return result;
+}
@@ -95,12 +95,106 @@ static int test2()
     return 0;
 }
 
+/**
+ * Test matching of pattern sets
+ */
+static int test3()
+{
+    const char* patterns[] =
+    {
+        "brown.*fox",
+        "lazy\\s+dog",
+        "(o)\\1",
+        "^the",
+        "cat",
+        "(*COMMIT)quick",
+        "DOG$"
+    };
+    bool expected[] = {true, true, false, true, false, true, true};
+    const char* subject = "The quick brown fox jumps over the lazy dog";
+    int n = sizeof(patterns) / sizeof(patterns[0]);
+    int err;
+    size_t erroff;
+
+    MXS_PCRE2_SET* set = mxs_pcre2_set_alloc(PCRE2_CASELESS);
+    test_assert(set, "Set should be allocated");
+
+    for (int i = 0; i < n; i++)
+    {
+        test_assert(mxs_pcre2_set_add(set, patterns[i], &err, &erroff) == i,
+                    "Pattern IDs should be assigned in order");
+    }
+
+    test_assert(mxs_pcre2_set_add(set, "black.*[dog", &err, &erroff) == -1 && err != 0,
+                "Invalid pattern should not be added");
+    test_assert(mxs_pcre2_set_size(set) == n, "Set should contain all valid patterns");
+    test_assert(mxs_pcre2_set_compile(set), "Patterns should be combined");
+
+    MXS_PCRE2_SET_STATE* state = mxs_pcre2_set_state_alloc();
+    test_assert(state, "State should be allocated");
+    test_assert(mxs_pcre2_set_match(set, state, subject, strlen(subject)) == 5,
+                "Five patterns should match");
+
+    for (int i = 0; i < n; i++)
+    {
+        test_assert(mxs_pcre2_set_matched(state, i) == expected[i],
+                    "Matched patterns should be the expected ones");
+    }
+
+    const char* subject2 = "Good food";
+    test_assert(mxs_pcre2_set_match(set, state, subject2, strlen(subject2)) == 1 &&
+                mxs_pcre2_set_matched(state, 2), "Backreference should match");
+
+    test_assert(mxs_pcre2_set_match(set, state, "", 0) == 0, "Empty subject should not match");
+
+    mxs_pcre2_set_state_free(state);
+    mxs_pcre2_set_free(set);
+    return 0;
+}
+
+/**
+ * Test the literal prefilter and the per-thread match data
+ */
+static int test4()
+{
+    char* literal = mxs_pcre2_literal_prefix("^select.*from", 0);
+    test_assert(literal && strcmp(literal, "select") == 0, "Literal should end at the first metacharacter");
+    test_assert(mxs_pcre2_literal_search(literal, true, "SELECT 1", 8), "Caseless search should match");
+    test_assert(!mxs_pcre2_literal_search(literal, false, "SELECT 1", 8), "Search should honor case");
+    test_assert(!mxs_pcre2_literal_search(literal, true, "SELEC", 5), "Short subject should not match");
+    free(literal);
+
+    literal = mxs_pcre2_literal_prefix("users?", 0);
+    test_assert(literal && strcmp(literal, "user") == 0, "Optional character should not be a part of the literal");
+    free(literal);
+
+    test_assert(mxs_pcre2_literal_prefix("insert|update", 0) == NULL, "Alternation should have no literal");
+    test_assert(mxs_pcre2_literal_prefix("a.*b", 0) == NULL, "Short literal should be ignored");
+    test_assert(mxs_pcre2_literal_prefix("select", PCRE2_EXTENDED) == NULL,
+                "Extended syntax should have no literal");
+
+    int err;
+    size_t erroff;
+    pcre2_code* re = mxs_pcre2_compile("(a)(b)(c)", 0, &err, &erroff);
+    test_assert(re, "Pattern should compile");
+
+    pcre2_match_data* mdata = mxs_pcre2_thread_match_data(re);
+    test_assert(mdata && pcre2_get_ovector_count(mdata) == 4, "Match data should fit all groups");
+    test_assert(pcre2_match(re, (PCRE2_SPTR) "xabc", 4, 0, 0, mdata, NULL) == 4, "Pattern should match");
+    test_assert(mxs_pcre2_thread_match_data(re) == mdata, "Match data should be reused");
+    pcre2_code_free(re);
+
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     int result = 0;
 
     result += test1();
     result += test2();
+    result += test3();
+    result += test4();
 
     return result;
 }
@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file testmonitor.c - Test the probing of the servers of a monitor and the
+ * scheduling of the monitoring rounds
+ *
+ * The test defines its own load_module() and thread_start() which replace the
+ * ones of the core library. The monitor is created without a monitor module
+ * and the starting of the probe threads can be made to fail.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <atomic.h>
+#include <monitor.h>
+#include <modules.h>
+#include <thread.h>
+
+#define test_assert(a, b) if(!(a)){fprintf(stderr, "%s\n", b);return 1;}
+
+/** Duration of a probe in milliseconds */
+#define PROBE_MS 100
+
+#define N_SERVERS 6
+
+static void stop_monitor(void *handle)
+{
+}
+
+static MONITOR_OBJECT monitor_object = {NULL, stop_monitor, NULL};
+
+void *load_module(const char *module, const char *type)
+{
+    return &monitor_object;
+}
+
+/** Number of probe threads that can still be started, -1 for no limit */
+static int threads_left = -1;
+
+THREAD *thread_start(THREAD *thd, void (*entry)(void *), void *arg)
+{
+    if (threads_left == 0 || pthread_create(thd, NULL, (void *(*)(void *))entry, arg) != 0)
+    {
+        return NULL;
+    }
+
+    if (threads_left > 0)
+    {
+        threads_left--;
+    }
+
+    return thd;
+}
+
+/** Number of probes in progress and the largest number seen in a round */
+static int probes_running;
+static int probes_max;
+
+/** Number of probes done by other threads than the monitor thread */
+static int probes_in_workers;
+
+static pthread_t monitor_thread;
+
+static void probe(MONITOR *mon, MONITOR_SERVERS *database)
+{
+    int running = atomic_add(&probes_running, 1) + 1;
+
+    for (int max = probes_max; running > max; max = probes_max)
+    {
+        __sync_bool_compare_and_swap(&probes_max, max, running);
+    }
+
+    if (!pthread_equal(pthread_self(), monitor_thread))
+    {
+        atomic_add(&probes_in_workers, 1);
+    }
+
+    usleep(PROBE_MS * 1000);
+    atomic_add(&probes_running, -1);
+}
+
+static void probe_round(MONITOR *mon)
+{
+    probes_max = 0;
+    probes_in_workers = 0;
+    monitor_probe_all(mon, probe);
+}
+
+/**
+ * The servers are probed concurrently by one worker per server up to the
+ * number of probe threads and the durations of the probes are recorded
+ */
+static int test_pool(SERVER **servers)
+{
+    MONITOR *mon = monitor_alloc("test_pool", "testmon");
+    monitorSetProbeThreads(mon, 4);
+    monitorAddServer(mon, servers[0]);
+    monitorAddServer(mon, servers[1]);
+
+    probe_round(mon);
+    test_assert(probes_max == 2, "Two servers should be probed concurrently");
+    test_assert(probes_in_workers == 2, "The servers should be probed by the workers");
+
+    for (MONITOR_SERVERS *db = mon->databases; db; db = db->next)
+    {
+        test_assert(db->probe_time >= PROBE_MS - 10 && db->probe_time_max >= db->probe_time,
+                    "The duration of the probe should be recorded");
+    }
+
+    /** The pool grows when servers are added, up to the number of threads */
+    for (int i = 2; i < N_SERVERS; i++)
+    {
+        monitorAddServer(mon, servers[i]);
+    }
+
+    probe_round(mon);
+    test_assert(probes_max == 4, "Four servers should be probed concurrently");
+    test_assert(probes_in_workers == N_SERVERS, "All servers should be probed by the workers");
+
+    /** One probe thread probes the servers in the monitor thread */
+    monitorSetProbeThreads(mon, 1);
+    probe_round(mon);
+    test_assert(probes_max == 1, "One server at a time should be probed");
+    test_assert(probes_in_workers == 0, "The servers should be probed by the monitor thread");
+
+    monitor_free(mon);
+    return 0;
+}
+
+/**
+ * If the probe threads cannot be started, the servers are probed one at a
+ * time by the monitor thread
+ */
+static int test_pool_fallback(SERVER **servers)
+{
+    MONITOR *mon = monitor_alloc("test_pool_fallback", "testmon");
+    monitorSetProbeThreads(mon, 4);
+
+    for (int i = 0; i < N_SERVERS; i++)
+    {
+        monitorAddServer(mon, servers[i]);
+    }
+
+    threads_left = 2;
+    probe_round(mon);
+    test_assert(probes_max == 1, "One server at a time should be probed");
+    test_assert(probes_in_workers == 0, "The servers should be probed by the monitor thread");
+
+    threads_left = -1;
+    probe_round(mon);
+    test_assert(probes_max == 4, "The pool should be created once threads can be started");
+
+    monitor_free(mon);
+    return 0;
+}
+
+/**
+ * A full round is due on the first call and once every monitor interval,
+ * requests between the rounds are merged into one round and the full rounds
+ * reset the requests
+ */
+static int test_round_due(SERVER **servers)
+{
+    MONITOR *mon = monitor_alloc("test_round_due", "testmon");
+    monitorSetInterval(mon, 1000);
+    monitorAddServer(mon, servers[0]);
+    monitorAddServer(mon, servers[1]);
+
+    test_assert(monitor_round_due(mon, 0), "The first round should be due");
+    test_assert(!monitor_round_due(mon, 1), "A round should not be due before the interval");
+    test_assert(monitor_round_due(mon, 10), "A round should be due after the interval");
+    test_assert(!monitor_round_due(mon, 11), "A round should not be due after a round");
+
+    monitor_request_probe(servers[0]);
+    monitor_request_probe(servers[1]);
+    test_assert(mon->probe_requested == 2, "The requests should be counted");
+    test_assert(monitor_round_due(mon, 12), "A requested round should be due");
+    test_assert(mon->probe_requested == 0, "The requests should be reset by the round");
+    test_assert(!monitor_round_due(mon, 13), "The requests should be merged into one round");
+
+    /** The requests of both servers are rate-limited by the monitor interval */
+    monitor_request_probe(servers[0]);
+    monitor_request_probe(servers[1]);
+    test_assert(!monitor_round_due(mon, 14), "Repeated requests should be ignored");
+
+    /** A round at the interval consumes the requests made before it */
+    mon->probe_requested = 3;
+    test_assert(monitor_round_due(mon, 20), "A round should be due after the interval");
+    test_assert(mon->probe_requested == 0, "The requests should be reset by the round");
+    test_assert(!monitor_round_due(mon, 21), "A round should not be due after a round");
+
+    monitor_free(mon);
+    return 0;
+}
+
+/**
+ * The requests for a server are accepted once per liveness interval
+ */
+static int test_request_rate(SERVER **servers)
+{
+    MONITOR *mon = monitor_alloc("test_request_rate", "testmon");
+    monitorSetInterval(mon, 10000);
+    monitorSetLivenessInterval(mon, 200);
+    monitorAddServer(mon, servers[0]);
+    monitorAddServer(mon, servers[1]);
+
+    monitor_request_probe(servers[0]);
+    monitor_request_probe(servers[0]);
+    test_assert(mon->probe_requested == 1, "A repeated request should be ignored");
+
+    monitor_request_probe(servers[1]);
+    test_assert(mon->probe_requested == 2, "The requests of other servers should be accepted");
+
+    usleep(250 * 1000);
+    monitor_request_probe(servers[0]);
+    test_assert(mon->probe_requested == 3, "A request after the liveness interval should be accepted");
+
+    test_assert(monitor_round_due(mon, 1), "A requested round should be due");
+    test_assert(mon->probe_requested == 0, "The requests should be reset by the round");
+
+    monitor_free(mon);
+    return 0;
+}
+
+/**
+ * The running servers are checked every liveness interval and a failed check
+ * makes a full round due. The servers that are down or in maintenance are
+ * left to the full rounds. The servers of the test have no connection so the
+ * checks of the running servers fail.
+ */
+static int test_liveness(SERVER **servers)
+{
+    MONITOR *mon = monitor_alloc("test_liveness", "testmon");
+    monitorSetInterval(mon, 10000);
+    monitorSetLivenessInterval(mon, 300);
+    monitorAddServer(mon, servers[0]);
+    monitorAddServer(mon, servers[1]);
+    server_clear_status(servers[0], SERVER_RUNNING);
+    server_clear_status(servers[1], SERVER_RUNNING);
+
+    test_assert(monitor_round_due(mon, 0), "The first round should be due");
+    test_assert(!monitor_round_due(mon, 3), "Servers that are down should not be checked");
+
+    server_set_status(servers[0], SERVER_RUNNING);
+    test_assert(!monitor_round_due(mon, 4), "Servers should not be checked between the liveness ticks");
+    test_assert(monitor_round_due(mon, 6), "A failed check should make a round due");
+    test_assert(mon->probe_requested == 0, "The requests should be reset by the round");
+    test_assert(!monitor_round_due(mon, 7), "A round should not be due after a round");
+
+    server_set_status(servers[0], SERVER_MAINT);
+    test_assert(!monitor_round_due(mon, 9), "Servers in maintenance should not be checked");
+
+    server_clear_status(servers[0], SERVER_MAINT);
+    server_set_status(servers[1], SERVER_RUNNING);
+    monitor_free(mon);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    SERVER *servers[N_SERVERS];
+    int result = 0;
+
+    monitor_thread = pthread_self();
+
+    for (int i = 0; i < N_SERVERS; i++)
+    {
+        servers[i] = server_alloc("127.0.0.1", "MySQLBackend", 3306 + i);
+    }
+
+    result += test_pool(servers);
+    result += test_pool_fallback(servers);
+    result += test_round_due(servers);
+    result += test_request_rate(servers);
+    result += test_liveness(servers);
+
+    return result;
+}
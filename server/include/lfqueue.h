@@ -0,0 +1,72 @@
+#ifndef _LFQUEUE_H
+#define _LFQUEUE_H
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file lfqueue.h - A bounded lock-free queue
+ *
+ * The queue is a fixed size ring of pointers. Any number of threads can push
+ * and pop items concurrently without locks. A thread that loses a race
+ * retries with the next slot, so a push or a pop never waits for another
+ * thread to finish.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct lfqueue LFQUEUE;
+
+/**
+ * @brief Allocate a new queue
+ *
+ * @param size Number of items the queue can hold, rounded up to a power of two
+ * @return New queue or NULL if memory allocation failed
+ */
+LFQUEUE* lfqueue_alloc(size_t size);
+
+/**
+ * @brief Free a queue
+ *
+ * The items still in the queue are not freed.
+ *
+ * @param queue Queue to free
+ */
+void lfqueue_free(LFQUEUE* queue);
+
+/**
+ * @brief Add an item to the end of the queue
+ *
+ * @param queue Queue to add to
+ * @param item Item to add, must not be NULL
+ * @return True if the item was added, false if the queue is full
+ */
+bool lfqueue_push(LFQUEUE* queue, void* item);
+
+/**
+ * @brief Remove the item at the head of the queue
+ *
+ * @param queue Queue to remove from
+ * @return The removed item or NULL if the queue is empty
+ */
+void* lfqueue_pop(LFQUEUE* queue);
+
+/**
+ * @brief Get the number of items the queue can hold
+ *
+ * @param queue Queue to inspect
+ * @return Capacity of the queue
+ */
+size_t lfqueue_capacity(const LFQUEUE* queue);
+
+#endif
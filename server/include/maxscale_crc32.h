@@ -0,0 +1,60 @@
+#ifndef _MAXSCALE_CRC32_H
+#define _MAXSCALE_CRC32_H
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file maxscale_crc32.h - CRC32 checksums compatible with zlib's crc32()
+ *
+ * The implementation is selected at runtime: CPUs with the PCLMULQDQ
+ * instruction use carry-less multiplication folding and other CPUs use a
+ * slicing-by-8 table implementation.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Update a running CRC32 checksum
+ *
+ * The function is a drop-in replacement for zlib's crc32(). The initial
+ * value of the checksum is 0.
+ *
+ * @param crc Current value of the checksum
+ * @param buf Data to add to the checksum
+ * @param len Length of @c buf
+ * @return The updated checksum
+ */
+uint32_t mxs_crc32(uint32_t crc, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Update a running CRC32 checksum with the slicing-by-8 implementation
+ *
+ * This is the implementation mxs_crc32() uses on CPUs without PCLMULQDQ. It
+ * can be called directly on any CPU, which lets the tests check it.
+ *
+ * @param crc Current value of the checksum
+ * @param buf Data to add to the checksum
+ * @param len Length of @c buf
+ * @return The updated checksum
+ */
+uint32_t mxs_crc32_slice8(uint32_t crc, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Get the name of the CRC32 implementation in use
+ *
+ * @return Name of the implementation
+ */
+const char* mxs_crc32_implementation();
+
+#endif
@@ -18,6 +18,8 @@
 #define PCRE2_CODE_UNIT_WIDTH 8
 #endif
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <pcre2.h>
 
 /**
@@ -44,4 +46,33 @@ mxs_pcre2_result_t mxs_pcre2_substitute(pcre2_code *re, const char *subject,
 mxs_pcre2_result_t mxs_pcre2_simple_match(const char* pattern, const char* subject,
                                           int options, int* error);
 
+/**
+ * A set of patterns that is matched against a subject in a single pass. The
+ * result of a match is the set of patterns that matched the subject.
+ */
+typedef struct mxs_pcre2_set MXS_PCRE2_SET;
+
+/**
+ * The matching state of a set. A state can be used with any set but only by
+ * one thread at a time.
+ */
+typedef struct mxs_pcre2_set_state MXS_PCRE2_SET_STATE;
+
+MXS_PCRE2_SET* mxs_pcre2_set_alloc(int options);
+void mxs_pcre2_set_free(MXS_PCRE2_SET* set);
+int mxs_pcre2_set_add(MXS_PCRE2_SET* set, const char* pattern, int* error, size_t* erroffset);
+bool mxs_pcre2_set_compile(MXS_PCRE2_SET* set);
+int mxs_pcre2_set_size(const MXS_PCRE2_SET* set);
+MXS_PCRE2_SET_STATE* mxs_pcre2_set_state_alloc();
+void mxs_pcre2_set_state_free(MXS_PCRE2_SET_STATE* state);
+int mxs_pcre2_set_match(const MXS_PCRE2_SET* set, MXS_PCRE2_SET_STATE* state,
+                        const char* subject, size_t length);
+bool mxs_pcre2_set_matched(const MXS_PCRE2_SET_STATE* state, int id);
+
+pcre2_code* mxs_pcre2_compile(const char* pattern, int options, int* error, size_t* erroffset);
+pcre2_match_data* mxs_pcre2_thread_match_data(const pcre2_code* code);
+char* mxs_pcre2_literal_prefix(const char* pattern, int options);
+bool mxs_pcre2_literal_search(const char* literal, bool caseless,
+                              const char* subject, size_t length);
+
 #endif
@@ -130,6 +130,7 @@ typedef enum
 #define MONITOR_INTERVAL 10000 // in milliseconds
 #define MONITOR_DEFAULT_ID 1UL // unsigned long value
 #define MONITOR_MAX_NUM_SLAVES 20 //number of MySQL slave servers associated to a MySQL master server
+#define MONITOR_DEFAULT_PROBE_THREADS 8 // maximum number of servers probed concurrently
 
 /*
  * Create declarations of the enum for monitor events and also the array of
@@ -162,9 +163,15 @@ typedef struct monitor_servers
     int mon_err_count;
     unsigned int mon_prev_status;
     unsigned int pending_status;  /**< Pending Status flag bitmap */
+    int probe_time;               /**< Duration of the latest probe in milliseconds */
+    int probe_time_max;           /**< Duration of the slowest probe in milliseconds */
+    int64_t probe_requested_at;   /**< Time of the latest accepted probe request in milliseconds */
     struct monitor_servers *next; /**< The next server in the list */
 } MONITOR_SERVERS;
 
+/** The worker threads that probe the servers of a monitor concurrently */
+typedef struct monitor_probe_pool MONITOR_PROBE_POOL;
+
 /**
  * Representation of the running monitor.
  */
@@ -189,9 +196,20 @@ typedef struct monitor
     MONITOR_OBJECT *module;       /**< The "monitor object" */
     void *handle;                 /**< Handle returned from startMonitor */
     size_t interval;              /**< The monitor interval */
+    int probe_threads;            /**< Maximum number of servers probed concurrently */
+    MONITOR_PROBE_POOL *probe_pool; /**< Worker threads for probing, created on first use */
+    size_t liveness_interval;     /**< Interval of the liveness checks, 0 disables them */
+    int probe_requested;          /**< Non-zero if a full round should be done as soon as possible */
     struct monitor *next;         /**< Next monitor in the linked list */
 } MONITOR;
 
+/**
+ * A function that probes one server and updates its pending status. The
+ * function is called concurrently for different servers of the same monitor
+ * so it may only modify the state of the server it is given.
+ */
+typedef void (*monitor_probe_fn)(MONITOR *mon, MONITOR_SERVERS *database);
+
 extern MONITOR *monitor_alloc(char *, char *);
 extern void monitor_free(MONITOR *);
 extern MONITOR *monitor_find(char *);
@@ -207,6 +225,11 @@ extern void monitorShow(DCB *, MONITOR *);
 extern void monitorList(DCB *);
 extern void monitorSetInterval (MONITOR *, unsigned long);
 extern bool monitorSetNetworkTimeout(MONITOR *, int, int);
+extern bool monitorSetProbeThreads(MONITOR *, int);
+extern bool monitorSetLivenessInterval(MONITOR *, unsigned long);
+extern void monitor_request_probe(SERVER *server);
+extern size_t monitor_get_server_interval(SERVER *server);
+extern bool monitor_server_detects_lag(SERVER *server);
 extern RESULTSET *monitorGetList();
 extern bool check_monitor_permissions(MONITOR* monitor, const char* query);
 
@@ -222,5 +245,7 @@ int mon_parse_event_string(bool* events, size_t count, char* string);
 connect_result_t mon_connect_to_db(MONITOR* mon, MONITOR_SERVERS *database);
 void mon_log_connect_error(MONITOR_SERVERS* database, connect_result_t rval);
 void mon_log_state_change(MONITOR_SERVERS *ptr);
+void monitor_probe_all(MONITOR *mon, monitor_probe_fn probe);
+bool monitor_round_due(MONITOR *mon, size_t nrounds);
 
 #endif
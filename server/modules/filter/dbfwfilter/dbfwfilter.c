@@ -79,6 +79,8 @@
 #include <ruleparser.yy.h>
 #include <lex.yy.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
 
 /** Older versions of Bison don't include the parsing function in the header */
 #ifndef dbfw_yyparse
@@ -205,6 +207,41 @@ typedef struct rulelist_t
     struct rulelist_t* next; /*< Next node in the list */
 } RULELIST;
 
+/**
+ * The positions of the column rules that deny a column
+ */
+typedef struct column_rules_t
+{
+    int* rules; /*< Positions of the rules in the rule set */
+    int n_rules; /*< Number of rules */
+} COLUMN_RULES;
+
+/**
+ * A list of rules compiled for matching
+ *
+ * The column rules are indexed by the names of the columns they deny. The
+ * column rules a query can match are found with one hashtable lookup per
+ * column the query uses which keeps the cost of a query independent of the
+ * number of column rules. The patterns of the regex rules are combined into
+ * a pattern set that finds all matching regex rules with one scan of the
+ * query. The rules are referred to by their position in the list so that the
+ * matching order of the original rule list is retained.
+ */
+typedef struct ruleset_t
+{
+    RULE** rules; /*< The rules in matching order */
+    int n_rules; /*< Number of rules */
+    int n_words; /*< Number of words in a bitmap of the rules */
+    uint64_t* others; /*< Bitmap of the rules that are not column or regex rules */
+    uint64_t* column_rules; /*< Bitmap of the column rules */
+    HASHTABLE* columns; /*< COLUMN_RULES keyed by lowercase column names */
+    MXS_PCRE2_SET* regex; /*< Patterns of the regex rules */
+    int* regex_rules; /*< Positions of the regex rules by pattern ID */
+} RULESET;
+
+/** Number of rules in one word of a rule bitmap */
+#define RULESET_WORD_BITS 64
+
 typedef struct user_template
 {
     char *name;
@@ -222,7 +259,9 @@ typedef struct user_t
     RULELIST* rules_and; /*< All of these rules must match for the action to trigger */
     RULELIST* rules_strict_and; /*< rules that skip the rest of the rules if one of them
                  * fails. This is only for rules paired with 'match strict_all'. */
-
+    RULESET set_or; /*< Compiled rules_or */
+    RULESET set_and; /*< Compiled rules_and */
+    RULESET set_strict_and; /*< Compiled rules_strict_and */
 } USER;
 
 /**
@@ -278,8 +317,37 @@ typedef struct
     char* errmsg; /*< Rule specific error message */
     DOWNSTREAM down; /*< Next object in the downstream chain */
     UPSTREAM up; /*< Next object in the upstream chain */
+    MXS_PCRE2_SET_STATE* regex_state; /*< Matching state for the regex rules */
 } FW_SESSION;
 
+/**
+ * The facts about a query that the rules are matched against
+ *
+ * The facts are resolved when a rule first needs them and are then shared by
+ * all the rules that the query is matched against.
+ */
+typedef struct
+{
+    GWBUF* queue; /*< The query */
+    char* sql; /*< The SQL of the query or NULL */
+    bool is_sql; /*< Whether the query is an SQL statement or a prepared statement */
+    bool is_init_db; /*< Whether the query is a COM_INIT_DB */
+    bool parsed; /*< Whether the query has been parsed */
+    qc_parse_result_t parse_result; /*< Result of the parsing */
+    qc_query_op_t optype; /*< Operation of the query */
+    bool is_real; /*< Whether the query is a real query */
+    bool fields_read; /*< Whether the affected fields have been read */
+    char* fields; /*< Lowercase affected fields */
+    char** field_names; /*< The individual fields in @c fields */
+    int n_fields; /*< Number of affected fields */
+    bool wildcard; /*< Whether the affected fields contain a wildcard */
+    int has_clause; /*< Whether the query has a WHERE/HAVING clause, -1 if not known */
+    bool time_read; /*< Whether the current time has been read */
+    time_t time_now; /*< Current time */
+    struct tm tm_now; /*< Current local time */
+    int now_sec; /*< Seconds since local midnight */
+} FW_QUERY;
+
 bool parse_at_times(const char** tok, char** saveptr, RULE* ruledef);
 bool parse_limit_queries(FW_INSTANCE* instance, RULE* ruledef, const char* rule, char** saveptr);
 
@@ -407,10 +475,189 @@ static void* rulelist_free(void* fval)
     return NULL;
 }
 
+static void* column_rules_free(void* fval)
+{
+    COLUMN_RULES* value = (COLUMN_RULES*) fval;
+    free(value->rules);
+    free(value);
+    return NULL;
+}
+
+/**
+ * Free the contents of a compiled rule set
+ * @param set Rule set to free
+ */
+static void ruleset_free(RULESET* set)
+{
+    free(set->rules);
+    free(set->others);
+    free(set->column_rules);
+    free(set->regex_rules);
+    mxs_pcre2_set_free(set->regex);
+
+    if (set->columns)
+    {
+        hashtable_free(set->columns);
+    }
+
+    memset(set, 0, sizeof(*set));
+}
+
+/**
+ * Add a column rule to the column index of a rule set
+ * @param set Rule set
+ * @param column Name of the column the rule denies
+ * @param pos Position of the rule in the rule set
+ * @return True on success, false if memory allocation failed
+ */
+static bool ruleset_add_column(RULESET* set, const char* column, int pos)
+{
+    char key[strlen(column) + 1];
+
+    for (int i = 0; column[i]; i++)
+    {
+        key[i] = tolower(column[i]);
+    }
+
+    key[sizeof(key) - 1] = '\0';
+
+    COLUMN_RULES* value = hashtable_fetch(set->columns, key);
+
+    if (value == NULL)
+    {
+        if ((value = calloc(1, sizeof(COLUMN_RULES))) == NULL)
+        {
+            return false;
+        }
+
+        if (!hashtable_add(set->columns, key, value))
+        {
+            free(value);
+            return false;
+        }
+    }
+
+    int* rules = realloc(value->rules, (value->n_rules + 1) * sizeof(int));
+
+    if (rules == NULL)
+    {
+        return false;
+    }
+
+    rules[value->n_rules++] = pos;
+    value->rules = rules;
+    return true;
+}
+
+/**
+ * Compile a rule list into a rule set
+ * @param set Rule set to initialize
+ * @param list Rule list to compile
+ * @return True on success, false if memory allocation failed
+ */
+static bool ruleset_compile(RULESET* set, RULELIST* list)
+{
+    int n_columns = 0;
+
+    memset(set, 0, sizeof(*set));
+
+    for (RULELIST* ptr = list; ptr; ptr = ptr->next)
+    {
+        set->n_rules++;
+
+        if (ptr->rule->type == RT_COLUMN)
+        {
+            for (STRLINK* col = ptr->rule->data; col; col = col->next)
+            {
+                n_columns++;
+            }
+        }
+    }
+
+    if (set->n_rules == 0)
+    {
+        return true;
+    }
+
+    set->n_words = (set->n_rules + RULESET_WORD_BITS - 1) / RULESET_WORD_BITS;
+    set->rules = malloc(set->n_rules * sizeof(RULE*));
+    set->others = calloc(set->n_words, sizeof(uint64_t));
+    set->column_rules = calloc(set->n_words, sizeof(uint64_t));
+    set->regex_rules = malloc(set->n_rules * sizeof(int));
+
+    if (n_columns > 0 && (set->columns = hashtable_alloc(MAX(n_columns, 10), simple_str_hash, strcmp)))
+    {
+        hashtable_memory_fns(set->columns, (HASHMEMORYFN) strdup, NULL,
+                             (HASHMEMORYFN) free, column_rules_free);
+    }
+
+    bool rval = set->rules && set->others && set->column_rules && set->regex_rules &&
+        (n_columns == 0 || set->columns);
+    int pos = 0;
+
+    for (RULELIST* ptr = list; ptr && rval; ptr = ptr->next, pos++)
+    {
+        set->rules[pos] = ptr->rule;
+
+        if (ptr->rule->type == RT_COLUMN)
+        {
+            set->column_rules[pos / RULESET_WORD_BITS] |= 1ULL << (pos % RULESET_WORD_BITS);
+
+            for (STRLINK* col = ptr->rule->data; col && rval; col = col->next)
+            {
+                rval = ruleset_add_column(set, col->value, pos);
+            }
+        }
+        else if (ptr->rule->type == RT_REGEX)
+        {
+            int err;
+            size_t erroff;
+            int id = -1;
+
+            if (set->regex || (set->regex = mxs_pcre2_set_alloc(0)))
+            {
+                /** The pattern was validated when the rule was defined */
+                id = mxs_pcre2_set_add(set->regex, ptr->rule->data, &err, &erroff);
+            }
+
+            if (id >= 0)
+            {
+                set->regex_rules[id] = pos;
+            }
+            else
+            {
+                rval = false;
+            }
+        }
+        else
+        {
+            set->others[pos / RULESET_WORD_BITS] |= 1ULL << (pos % RULESET_WORD_BITS);
+        }
+    }
+
+    if (rval && set->regex)
+    {
+        /** If the patterns can't be combined, they are matched one at a time */
+        mxs_pcre2_set_compile(set->regex);
+    }
+
+    if (!rval)
+    {
+        MXS_ERROR("dbfwfilter: Memory allocation failed when compiling rules.");
+        ruleset_free(set);
+    }
+
+    return rval;
+}
+
 static void* huserfree(void* fval)
 {
     USER* value = (USER*) fval;
 
+    ruleset_free(&value->set_and);
+    ruleset_free(&value->set_or);
+    ruleset_free(&value->set_strict_and);
+
     rulelist_free(value->rules_and);
     rulelist_free(value->rules_or);
     rulelist_free(value->rules_strict_and);
@@ -925,7 +1172,7 @@ static void free_rules(RULE* rule)
                 break;
 
             case RT_REGEX:
-                pcre2_code_free((pcre2_code*) rule->data);
+                free(rule->data);
                 break;
 
             default:
@@ -1174,13 +1421,26 @@ bool define_regex_rule(void* scanner, char* pattern)
     pcre2_code *re;
     int err;
     size_t offset;
+    char *data = NULL;
+
+    /** The pattern is compiled into the pattern sets of the users after the
+     * whole rule file is parsed. Here it is only validated. */
     if ((re = pcre2_compile(start, PCRE2_ZERO_TERMINATED,
                             0, &err, &offset, NULL)))
     {
-        struct parser_stack* rstack = dbfw_yyget_extra((yyscan_t) scanner);
-        ss_dassert(rstack);
-        rstack->rule->type = RT_REGEX;
-        rstack->rule->data = (void*) re;
+        pcre2_code_free(re);
+
+        if ((data = strdup((const char*) start)))
+        {
+            struct parser_stack* rstack = dbfw_yyget_extra((yyscan_t) scanner);
+            ss_dassert(rstack);
+            rstack->rule->type = RT_REGEX;
+            rstack->rule->data = data;
+        }
+        else
+        {
+            MXS_ERROR("dbfwfilter: Memory allocation failed when adding regex rule.");
+        }
     }
     else
     {
@@ -1190,7 +1450,7 @@ bool define_regex_rule(void* scanner, char* pattern)
                   start, errbuf);
     }
 
-    return re != NULL;
+    return data != NULL;
 }
 
 /**
@@ -1239,11 +1499,8 @@ static bool process_user_templates(FW_INSTANCE *instance, user_template_t *templ
 
         if (user == NULL)
         {
-            if ((user = malloc(sizeof(USER))) && (user->name = strdup(templates->name)))
+            if ((user = calloc(1, sizeof(USER))) && (user->name = strdup(templates->name)))
             {
-                user->rules_and = NULL;
-                user->rules_or = NULL;
-                user->rules_strict_and = NULL;
                 spinlock_init(&user->lock);
                 hashtable_add(instance->htable, user->name, user);
             }
@@ -1306,6 +1563,53 @@ static bool process_user_templates(FW_INSTANCE *instance, user_template_t *templ
     return rval;
 }
 
+/**
+ * Compile the rules of all users into rule sets
+ *
+ * This also gives each query speed rule the unique ID that is used to find
+ * the per-user query speed state of the rule.
+ *
+ * @param instance Filter instance
+ * @param rules List of all rules
+ * @return True on success, false if memory allocation failed
+ */
+static bool compile_rules(FW_INSTANCE *instance, RULE* rules)
+{
+    bool rval = true;
+
+    for (RULE* rule = rules; rule; rule = rule->next)
+    {
+        if (rule->type == RT_THROTTLE)
+        {
+            ((QUERYSPEED*) rule->data)->id = ++instance->idgen;
+        }
+    }
+
+    HASHITERATOR* iter = hashtable_iterator(instance->htable);
+
+    if (iter)
+    {
+        void* key;
+
+        while (rval && (key = hashtable_next(iter)))
+        {
+            USER* user = hashtable_fetch(instance->htable, key);
+            rval = ruleset_compile(&user->set_or, user->rules_or) &&
+                ruleset_compile(&user->set_and, user->rules_and) &&
+                ruleset_compile(&user->set_strict_and, user->rules_strict_and);
+        }
+
+        hashtable_iterator_free(iter);
+    }
+    else
+    {
+        MXS_ERROR("dbfwfilter: Memory allocation failed when compiling rules.");
+        rval = false;
+    }
+
+    return rval;
+}
+
 /**
  * Read a rule file from disk and process it into rule and user definitions
  * @param filename Name of the file
@@ -1339,7 +1643,8 @@ static bool process_rule_file(const char* filename, FW_INSTANCE* instance)
         dbfw_yylex_destroy(scanner);
         fclose(file);
 
-        if (rc == 0 && process_user_templates(instance, pstack.templates, pstack.rule))
+        if (rc == 0 && process_user_templates(instance, pstack.templates, pstack.rule) &&
+            compile_rules(instance, pstack.rule))
         {
             instance->rules = pstack.rule;
         }
@@ -1482,6 +1787,15 @@ newSession(FILTER *instance, SESSION *session)
     {
         return NULL;
     }
+
+    if ((my_session->regex_state = mxs_pcre2_set_state_alloc()) == NULL)
+    {
+        MXS_ERROR("Allocation of matching data for PCRE2 failed."
+                  " This is most likely caused by a lack of memory");
+        free(my_session);
+        return NULL;
+    }
+
     my_session->session = session;
     return my_session;
 }
@@ -1512,6 +1826,7 @@ freeSession(FILTER *instance, void *session)
     {
         free(my_session->errmsg);
     }
+    mxs_pcre2_set_state_free(my_session->regex_state);
     free(my_session);
 }
 
@@ -1588,58 +1903,262 @@ GWBUF* gen_dummy_error(FW_SESSION* session, char* msg)
 }
 
 /**
- * Checks if the timerange object is active.
- * @return Whether the timerange is active
+ * Initialize the facts of a query
+ * @param query Query facts to initialize
+ * @param queue The GWBUF containing the query
+ */
+static void query_init(FW_QUERY* query, GWBUF* queue)
+{
+    memset(query, 0, sizeof(*query));
+    query->queue = queue;
+    query->is_sql = modutil_is_SQL(queue) || modutil_is_SQL_prepare(queue);
+    query->is_init_db = MYSQL_IS_COM_INIT_DB((uint8_t*)GWBUF_DATA(queue));
+    query->optype = QUERY_OP_UNDEFINED;
+    query->has_clause = -1;
+
+    if (query->is_sql || query->is_init_db)
+    {
+        query->sql = modutil_get_SQL(queue);
+    }
+}
+
+/**
+ * Free the facts of a query
+ * @param query Query facts to free
+ */
+static void query_free(FW_QUERY* query)
+{
+    free(query->sql);
+    free(query->fields);
+    free(query->field_names);
+}
+
+/**
+ * Parse the query if it has not yet been parsed
+ * @param query Query facts
+ */
+static void query_parse(FW_QUERY* query)
+{
+    if (!query->parsed)
+    {
+        query->parsed = true;
+
+        if (query->is_sql)
+        {
+            query->parse_result = qc_parse(query->queue);
+
+            if (query->parse_result != QC_QUERY_INVALID)
+            {
+                query->optype = qc_get_operation(query->queue);
+                query->is_real = qc_is_real_query(query->queue);
+            }
+        }
+    }
+}
+
+/**
+ * Check whether a query must be rejected because it could not be parsed
+ * @param query Query facts
+ * @param uses_fields Whether the rule inspects the fields or clauses of the query
+ * @return The reason why the query is rejected or NULL if the rule can be matched
  */
-bool inside_timerange(TIMERANGE* comp)
+static const char* query_parse_error(FW_QUERY* query, bool uses_fields)
 {
+    const char* rval = NULL;
+
+    query_parse(query);
+
+    if (query->is_sql)
+    {
+        if (query->parse_result == QC_QUERY_INVALID)
+        {
+            rval = "tokenized";
+        }
+        else if (query->parse_result != QC_QUERY_PARSED && uses_fields)
+        {
+            switch (query->optype)
+            {
+            case QUERY_OP_SELECT:
+            case QUERY_OP_UPDATE:
+            case QUERY_OP_INSERT:
+            case QUERY_OP_DELETE:
+                // In these cases, we have to be able to trust what qc_get_affected_fields
+                // returns. Unless the query was parsed completely, we cannot do that.
+                rval = "parsed completely";
+                break;
+
+            default:
+                break;
+            }
+        }
+    }
+
+    return rval;
+}
 
-    struct tm tm_now;
-    struct tm tm_before, tm_after;
-    time_t before, after, now, time_now;
-    double to_before, to_after;
+/**
+ * Read the fields affected by the query
+ *
+ * The fields are converted to lowercase so that they can be used as keys
+ * of the column indexes of the rule sets.
+ *
+ * @param query Query facts
+ */
+static void query_read_fields(FW_QUERY* query)
+{
+    if (!query->fields_read)
+    {
+        query->fields_read = true;
 
-    time(&time_now);
-    localtime_r(&time_now, &tm_now);
-    memcpy(&tm_before, &tm_now, sizeof(struct tm));
-    memcpy(&tm_after, &tm_now, sizeof(struct tm));
+        if (query_parse_error(query, true) == NULL && query->is_sql && query->is_real &&
+            (query->fields = qc_get_affected_fields(query->queue)))
+        {
+            query->wildcard = strchr(query->fields, '*') != NULL;
 
+            for (char* ptr = query->fields; *ptr; ptr++)
+            {
+                *ptr = tolower(*ptr);
+            }
 
-    tm_before.tm_sec = comp->start.tm_sec;
-    tm_before.tm_min = comp->start.tm_min;
-    tm_before.tm_hour = comp->start.tm_hour;
-    tm_after.tm_sec = comp->end.tm_sec;
-    tm_after.tm_min = comp->end.tm_min;
-    tm_after.tm_hour = comp->end.tm_hour;
+            char* saveptr;
+            char* tok = strtok_r(query->fields, " ,", &saveptr);
 
+            while (tok)
+            {
+                char** names = realloc(query->field_names, (query->n_fields + 1) * sizeof(char*));
 
-    before = mktime(&tm_before);
-    after = mktime(&tm_after);
-    now = mktime(&tm_now);
-    to_before = difftime(now, before);
-    to_after = difftime(now, after);
+                if (names == NULL)
+                {
+                    MXS_ERROR("dbfwfilter: Memory allocation failed.");
+                    break;
+                }
 
-    if (to_before > 0.0 && to_after < 0.0)
+                names[query->n_fields++] = tok;
+                query->field_names = names;
+                tok = strtok_r(NULL, " ,", &saveptr);
+            }
+        }
+    }
+}
+
+/**
+ * Check whether the query has a WHERE or a HAVING clause
+ * @param query Query facts
+ * @return True if the query has a clause
+ */
+static bool query_has_clause(FW_QUERY* query)
+{
+    if (query->has_clause == -1)
     {
-        return true;
+        query->has_clause = qc_query_has_clause(query->queue) ? 1 : 0;
     }
-    return false;
+
+    return query->has_clause == 1;
+}
+
+/**
+ * Read the current time if it has not yet been read for this query
+ * @param query Query facts
+ */
+static void query_read_time(FW_QUERY* query)
+{
+    if (!query->time_read)
+    {
+        query->time_read = true;
+        time(&query->time_now);
+        localtime_r(&query->time_now, &query->tm_now);
+        query->now_sec = query->tm_now.tm_hour * 3600 + query->tm_now.tm_min * 60 +
+            query->tm_now.tm_sec;
+    }
+}
+
+/**
+ * Mark the column rules that deny any of the fields of the query
+ * @param set Rule set
+ * @param query Query facts
+ * @param bitmap Bitmap where the positions of the matching rules are set
+ */
+static void ruleset_column_hits(RULESET* set, FW_QUERY* query, uint64_t* bitmap)
+{
+    if (set->columns)
+    {
+        query_read_fields(query);
+
+        for (int i = 0; i < query->n_fields; i++)
+        {
+            COLUMN_RULES* value = hashtable_fetch(set->columns, query->field_names[i]);
+
+            for (int j = 0; value && j < value->n_rules; j++)
+            {
+                int pos = value->rules[j];
+                bitmap[pos / RULESET_WORD_BITS] |= 1ULL << (pos % RULESET_WORD_BITS);
+            }
+        }
+    }
+}
+
+/**
+ * Mark the regex rules whose pattern matches the query
+ * @param set Rule set
+ * @param session Fwfilter session
+ * @param query Query facts
+ * @param bitmap Bitmap where the positions of the matching rules are set
+ */
+static void ruleset_regex_hits(RULESET* set, FW_SESSION* session, FW_QUERY* query,
+                               uint64_t* bitmap)
+{
+    if (set->regex && query->sql)
+    {
+        int n = mxs_pcre2_set_match(set->regex, session->regex_state, query->sql,
+                                    strlen(query->sql));
+
+        if (n < 0)
+        {
+            MXS_ERROR("dbfwfilter: Memory allocation failed when matching regex rules.");
+        }
+
+        for (int id = 0; n > 0 && id < mxs_pcre2_set_size(set->regex); id++)
+        {
+            if (mxs_pcre2_set_matched(session->regex_state, id))
+            {
+                int pos = set->regex_rules[id];
+                bitmap[pos / RULESET_WORD_BITS] |= 1ULL << (pos % RULESET_WORD_BITS);
+                n--;
+            }
+        }
+    }
+}
+
+/**
+ * Checks if the timerange object is active.
+ * @param comp Time range to check
+ * @param now Current time in seconds since midnight
+ * @return Whether the timerange is active
+ */
+bool inside_timerange(TIMERANGE* comp, int now)
+{
+    int start = comp->start.tm_hour * 3600 + comp->start.tm_min * 60 + comp->start.tm_sec;
+    int end = comp->end.tm_hour * 3600 + comp->end.tm_min * 60 + comp->end.tm_sec;
+
+    return now > start && now < end;
 }
 
 /**
  * Checks for active timeranges for a given rule.
  * @param rule Pointer to a RULE object
+ * @param query Query facts
  * @return true if the rule is active
  */
-bool rule_is_active(RULE* rule)
+bool rule_is_active(RULE* rule, FW_QUERY* query)
 {
     TIMERANGE* times;
     if (rule->active != NULL)
     {
+        query_read_time(query);
         times = (TIMERANGE*) rule->active;
         while (times)
         {
-            if (inside_timerange(times))
+            if (inside_timerange(times, query->now_sec))
             {
                 return true;
             }
@@ -1698,117 +2217,52 @@ static char* create_parse_error(FW_INSTANCE* my_instance,
  * Check if a query matches a single rule
  * @param my_instance Fwfilter instance
  * @param my_session Fwfilter session
- * @param queue The GWBUF containing the query
- * @param rulelist The rule to check
- * @param query Pointer to the null-terminated query string
+ * @param query Facts of the query
+ * @param user The user whose rule is checked
+ * @param rule The rule to check
+ * @param hit Whether the rule set found the query to use a column denied by
+ * the rule or to match the pattern of the rule
  * @return true if the query matches the rule
  */
 bool rule_matches(FW_INSTANCE* my_instance,
                   FW_SESSION* my_session,
-                  GWBUF *queue,
+                  FW_QUERY* query,
                   USER* user,
-                  RULELIST *rulelist,
-                  char* query)
+                  RULE* rule,
+                  bool hit)
 {
-    char *ptr, *where, *msg = NULL;
+    char *msg = NULL;
     char emsg[512];
-
-    unsigned char* memptr = (unsigned char*) queue->start;
-    bool is_sql, is_real, matches;
-    qc_query_op_t optype = QUERY_OP_UNDEFINED;
-    STRLINK* strln = NULL;
+    bool matches = false;
     QUERYSPEED* queryspeed = NULL;
     QUERYSPEED* rule_qs = NULL;
-    time_t time_now;
-    struct tm tm_now;
-
-    time(&time_now);
-    localtime_r(&time_now, &tm_now);
-
-    matches = false;
-    is_sql = modutil_is_SQL(queue) || modutil_is_SQL_prepare(queue);
-
-    if (is_sql)
-    {
-        qc_parse_result_t parse_result = qc_parse(queue);
-
-        if (parse_result == QC_QUERY_INVALID)
-        {
-            msg = create_parse_error(my_instance, "tokenized", query, &matches);
-            goto queryresolved;
-        }
-        else
-        {
-            optype = qc_get_operation(queue);
-            is_real = qc_is_real_query(queue);
-
-            if (parse_result != QC_QUERY_PARSED)
-            {
-                if ((rulelist->rule->type == RT_COLUMN) ||
-                    (rulelist->rule->type == RT_WILDCARD) ||
-                    (rulelist->rule->type == RT_CLAUSE))
-                {
-                    switch (optype)
-                    {
-                    case QUERY_OP_SELECT:
-                    case QUERY_OP_UPDATE:
-                    case QUERY_OP_INSERT:
-                    case QUERY_OP_DELETE:
-                        // In these cases, we have to be able to trust what qc_get_affected_fields
-                        // returns. Unless the query was parsed completely, we cannot do that.
-                        msg = create_parse_error(my_instance, "parsed completely", query, &matches);
-                        goto queryresolved;
+    const char* parse_error = query_parse_error(query, (rule->type == RT_COLUMN) ||
+                                                (rule->type == RT_WILDCARD) ||
+                                                (rule->type == RT_CLAUSE));
 
-                    default:
-                        break;
-                    }
-                }
-            }
-        }
-    }
-    else
+    if (parse_error)
     {
-        is_real = false;
+        msg = create_parse_error(my_instance, parse_error, query->sql, &matches);
+        goto queryresolved;
     }
 
-    if (rulelist->rule->on_queries == QUERY_OP_UNDEFINED ||
-        rulelist->rule->on_queries & optype ||
-        (MYSQL_IS_COM_INIT_DB((uint8_t*)GWBUF_DATA(queue)) &&
-         rulelist->rule->on_queries & QUERY_OP_CHANGE_DB))
+    if (rule->on_queries == QUERY_OP_UNDEFINED ||
+        rule->on_queries & query->optype ||
+        (query->is_init_db && rule->on_queries & QUERY_OP_CHANGE_DB))
     {
-        switch (rulelist->rule->type)
+        switch (rule->type)
         {
             case RT_UNDEFINED:
                 MXS_ERROR("Undefined rule type found.");
                 break;
 
             case RT_REGEX:
-                if (query)
+                if (hit)
                 {
-                    pcre2_match_data *mdata = pcre2_match_data_create_from_pattern(
-                                                  rulelist->rule->data, NULL);
-
-                    if (mdata)
-                    {
-                        if (pcre2_match((pcre2_code*) rulelist->rule->data,
-                                        (PCRE2_SPTR) query, PCRE2_ZERO_TERMINATED,
-                                        0, 0, mdata, NULL) > 0)
-                        {
-                            matches = true;
-                        }
-                        pcre2_match_data_free(mdata);
-                        if (matches)
-                        {
-                            msg = strdup("Permission denied, query matched regular expression.");
-                            MXS_INFO("dbfwfilter: rule '%s': regex matched on query", rulelist->rule->name);
-                            goto queryresolved;
-                        }
-                    }
-                    else
-                    {
-                        MXS_ERROR("Allocation of matching data for PCRE2 failed."
-                                  " This is most likely caused by a lack of memory");
-                    }
+                    matches = true;
+                    msg = strdup("Permission denied, query matched regular expression.");
+                    MXS_INFO("dbfwfilter: rule '%s': regex matched on query", rule->name);
+                    goto queryresolved;
                 }
                 break;
 
@@ -1817,65 +2271,52 @@ bool rule_matches(FW_INSTANCE* my_instance,
                     matches = true;
                     msg = strdup("Permission denied at this time.");
                     char buffer[32]; // asctime documentation requires 26
-                    asctime_r(&tm_now, buffer);
-                    MXS_INFO("dbfwfilter: rule '%s': query denied at: %s", rulelist->rule->name, buffer);
+                    query_read_time(query);
+                    asctime_r(&query->tm_now, buffer);
+                    MXS_INFO("dbfwfilter: rule '%s': query denied at: %s", rule->name, buffer);
                     goto queryresolved;
                 }
                 break;
 
             case RT_COLUMN:
-                if (is_sql && is_real)
+                if (hit)
                 {
-                    where = qc_get_affected_fields(queue);
-                    if (where != NULL)
+                    /** The column is only looked up for the error message */
+                    const char* column = ((STRLINK*) rule->data)->value;
+
+                    for (STRLINK* strln = rule->data; strln; strln = strln->next)
                     {
-                        char* saveptr;
-                        char* tok = strtok_r(where, " ", &saveptr);
-                        while (tok)
+                        for (int i = 0; i < query->n_fields; i++)
                         {
-                            strln = (STRLINK*) rulelist->rule->data;
-                            while (strln)
+                            if (strcasecmp(query->field_names[i], strln->value) == 0)
                             {
-                                if (strcasecmp(tok, strln->value) == 0)
-                                {
-                                    matches = true;
-
-                                    sprintf(emsg, "Permission denied to column '%s'.", strln->value);
-                                    MXS_INFO("dbfwfilter: rule '%s': query targets forbidden column: %s",
-                                             rulelist->rule->name, strln->value);
-                                    msg = strdup(emsg);
-                                    free(where);
-                                    goto queryresolved;
-                                }
-                                strln = strln->next;
+                                column = strln->value;
+                                break;
                             }
-                            tok = strtok_r(NULL, ",", &saveptr);
                         }
-                        free(where);
                     }
+
+                    matches = true;
+                    snprintf(emsg, sizeof(emsg), "Permission denied to column '%s'.", column);
+                    MXS_INFO("dbfwfilter: rule '%s': query targets forbidden column: %s",
+                             rule->name, column);
+                    msg = strdup(emsg);
+                    goto queryresolved;
                 }
                 break;
 
             case RT_WILDCARD:
-                if (is_sql && is_real)
+                if (query->is_sql && query->is_real)
                 {
-                    char * strptr;
-                    where = qc_get_affected_fields(queue);
+                    query_read_fields(query);
 
-                    if (where != NULL)
+                    if (query->wildcard)
                     {
-                        strptr = where;
-
-                        if (strchr(strptr, '*'))
-                        {
-                            matches = true;
-                            msg = strdup("Usage of wildcard denied.");
-                            MXS_INFO("dbfwfilter: rule '%s': query contains a wildcard.",
-                                     rulelist->rule->name);
-                            free(where);
-                            goto queryresolved;
-                        }
-                        free(where);
+                        matches = true;
+                        msg = strdup("Usage of wildcard denied.");
+                        MXS_INFO("dbfwfilter: rule '%s': query contains a wildcard.",
+                                 rule->name);
+                        goto queryresolved;
                     }
                 }
                 break;
@@ -1885,8 +2326,10 @@ bool rule_matches(FW_INSTANCE* my_instance,
                  * Check if this is the first time this rule is matched and if so, allocate
                  * and initialize a new QUERYSPEED struct for this session.
                  */
+                query_read_time(query);
+
                 spinlock_acquire(&my_instance->lock);
-                rule_qs = (QUERYSPEED*) rulelist->rule->data;
+                rule_qs = (QUERYSPEED*) rule->data;
                 spinlock_release(&my_instance->lock);
 
                 spinlock_acquire(&user->lock);
@@ -1917,15 +2360,15 @@ bool rule_matches(FW_INSTANCE* my_instance,
 
                 if (queryspeed->active)
                 {
-                    if (difftime(time_now, queryspeed->triggered) < queryspeed->cooldown)
+                    if (difftime(query->time_now, queryspeed->triggered) < queryspeed->cooldown)
                     {
 
                         double blocked_for =
-                            queryspeed->cooldown - difftime(time_now, queryspeed->triggered);
+                            queryspeed->cooldown - difftime(query->time_now, queryspeed->triggered);
 
                         sprintf(emsg, "Queries denied for %f seconds", blocked_for);
                         MXS_INFO("dbfwfilter: rule '%s': user denied for %f seconds",
-                                 rulelist->rule->name, blocked_for);
+                                 rule->name, blocked_for);
                         msg = strdup(emsg);
                         matches = true;
                     }
@@ -1939,42 +2382,41 @@ bool rule_matches(FW_INSTANCE* my_instance,
                 {
                     if (queryspeed->count >= queryspeed->limit)
                     {
-                        queryspeed->triggered = time_now;
+                        queryspeed->triggered = query->time_now;
                         matches = true;
                         queryspeed->active = true;
 
                         MXS_INFO("dbfwfilter: rule '%s': query limit triggered (%d queries in %d seconds), "
                                  "denying queries from user for %d seconds.",
-                                 rulelist->rule->name,
+                                 rule->name,
                                  queryspeed->limit,
                                  queryspeed->period,
                                  queryspeed->cooldown);
                         double blocked_for =
-                            queryspeed->cooldown - difftime(time_now, queryspeed->triggered);
+                            queryspeed->cooldown - difftime(query->time_now, queryspeed->triggered);
                         sprintf(emsg, "Queries denied for %f seconds", blocked_for);
                         msg = strdup(emsg);
                     }
                     else if (queryspeed->count > 0 &&
-                             difftime(time_now, queryspeed->first_query) <= queryspeed->period)
+                             difftime(query->time_now, queryspeed->first_query) <= queryspeed->period)
                     {
                         queryspeed->count++;
                     }
                     else
                     {
-                        queryspeed->first_query = time_now;
+                        queryspeed->first_query = query->time_now;
                         queryspeed->count = 1;
                     }
                 }
                 break;
 
             case RT_CLAUSE:
-                if (is_sql && is_real &&
-                    !qc_query_has_clause(queue))
+                if (query->is_sql && query->is_real && !query_has_clause(query))
                 {
                     matches = true;
                     msg = strdup("Required WHERE/HAVING clause is missing.");
                     MXS_INFO("dbfwfilter: rule '%s': query has no where/having "
-                             "clause, query is denied.", rulelist->rule->name);
+                             "clause, query is denied.", rule->name);
                 }
                 break;
 
@@ -1997,7 +2439,7 @@ queryresolved:
 
     if (matches)
     {
-        rulelist->rule->times_matched++;
+        rule->times_matched++;
     }
 
     return matches;
@@ -2005,40 +2447,74 @@ queryresolved:
 
 /**
  * Check if the query matches any of the rules in the user's rulelist.
+ *
+ * Only the rules that are not column or regex rules, the column rules that
+ * deny a column used by the query and the regex rules whose pattern matches
+ * the query are candidates for a match. If the fields of the query are not
+ * known because it was only partially parsed, all column rules are candidates
+ * so that they reject the query. If the query could not be parsed at all, all
+ * rules are candidates so that the first active rule rejects the query.
+ *
  * @param my_instance Fwfilter instance
  * @param my_session Fwfilter session
- * @param queue The GWBUF containing the query
+ * @param query Facts of the query
  * @param user The user whose rulelist is checked
  * @return True if the query matches at least one of the rules otherwise false
  */
 bool check_match_any(FW_INSTANCE* my_instance, FW_SESSION* my_session,
-                     GWBUF *queue, USER* user, char** rulename)
+                     FW_QUERY* query, USER* user, char** rulename)
 {
-    RULELIST* rulelist;
+    RULESET* set = &user->set_or;
     bool rval = false;
 
-    if ((rulelist = user->rules_or) &&
-        (modutil_is_SQL(queue) || modutil_is_SQL_prepare(queue) ||
-         MYSQL_IS_COM_INIT_DB((uint8_t*)GWBUF_DATA(queue))))
+    if (set->n_rules > 0 && (query->is_sql || query->is_init_db))
     {
-        char *fullquery = modutil_get_SQL(queue);
-        while (rulelist)
+        uint64_t candidates[set->n_words];
+
+        if (query_parse_error(query, false))
         {
-            if (!rule_is_active(rulelist->rule))
+            memset(candidates, 0xff, sizeof(candidates));
+        }
+        else
+        {
+            memcpy(candidates, set->others, sizeof(candidates));
+
+            if (query_parse_error(query, true))
             {
-                rulelist = rulelist->next;
-                continue;
+                for (int word = 0; word < set->n_words; word++)
+                {
+                    candidates[word] |= set->column_rules[word];
+                }
             }
-            if (rule_matches(my_instance, my_session, queue, user, rulelist, fullquery))
+            else
             {
-                *rulename = strdup(rulelist->rule->name);
-                rval = true;
-                break;
+                ruleset_column_hits(set, query, candidates);
             }
-            rulelist = rulelist->next;
+
+            ruleset_regex_hits(set, my_session, query, candidates);
         }
 
-        free(fullquery);
+        for (int word = 0; word < set->n_words && !rval; word++)
+        {
+            for (uint64_t bits = candidates[word]; bits && !rval; bits &= bits - 1)
+            {
+                int pos = word * RULESET_WORD_BITS + __builtin_ctzll(bits);
+
+                if (pos >= set->n_rules)
+                {
+                    break;
+                }
+
+                RULE* rule = set->rules[pos];
+
+                if (rule_is_active(rule, query) &&
+                    rule_matches(my_instance, my_session, query, user, rule, true))
+                {
+                    *rulename = strdup(rule->name);
+                    rval = true;
+                }
+            }
+        }
     }
     return rval;
 }
@@ -2083,36 +2559,42 @@ void append_string(char** dest, size_t* size, const char* src)
  * Check if the query matches all rules in the user's rulelist.
  * @param my_instance Fwfilter instance
  * @param my_session Fwfilter session
- * @param queue The GWBUF containing the query
+ * @param query Facts of the query
  * @param user The user whose rulelist is checked
  * @return True if the query matches all of the rules otherwise false
  */
 bool check_match_all(FW_INSTANCE* my_instance, FW_SESSION* my_session,
-                     GWBUF *queue, USER* user, bool strict_all, char** rulename)
+                     FW_QUERY* query, USER* user, bool strict_all, char** rulename)
 {
     bool rval = false;
     bool have_active_rule = false;
-    RULELIST* rulelist = strict_all ? user->rules_strict_and : user->rules_and;
+    RULESET* set = strict_all ? &user->set_strict_and : &user->set_and;
     char *matched_rules = NULL;
     size_t size = 0;
 
-    if (rulelist && (modutil_is_SQL(queue) || modutil_is_SQL_prepare(queue)))
+    if (set->n_rules > 0 && query->is_sql)
     {
-        char *fullquery = modutil_get_SQL(queue);
+        uint64_t hits[set->n_words];
+        memset(hits, 0, sizeof(hits));
+        ruleset_column_hits(set, query, hits);
+        ruleset_regex_hits(set, my_session, query, hits);
         rval = true;
-        while (rulelist)
+
+        for (int pos = 0; pos < set->n_rules; pos++)
         {
-            if (!rule_is_active(rulelist->rule))
+            RULE* rule = set->rules[pos];
+
+            if (!rule_is_active(rule, query))
             {
-                rulelist = rulelist->next;
                 continue;
             }
 
             have_active_rule = true;
+            bool hit = hits[pos / RULESET_WORD_BITS] & (1ULL << (pos % RULESET_WORD_BITS));
 
-            if (rule_matches(my_instance, my_session, queue, user, rulelist, fullquery))
+            if (rule_matches(my_instance, my_session, query, user, rule, hit))
             {
-                append_string(&matched_rules, &size, rulelist->rule->name);
+                append_string(&matched_rules, &size, rule->name);
             }
             else
             {
@@ -2122,8 +2604,6 @@ bool check_match_all(FW_INSTANCE* my_instance, FW_SESSION* my_session,
                     break;
                 }
             }
-
-            rulelist = rulelist->next;
         }
 
         if (!have_active_rule)
@@ -2131,7 +2611,6 @@ bool check_match_all(FW_INSTANCE* my_instance, FW_SESSION* my_session,
             /** No active rules */
             rval = false;
         }
-        free(fullquery);
     }
 
     /** Set the list of matched rule names */
@@ -2211,14 +2690,19 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
         {
             bool match = false;
             char* rname = NULL;
+            FW_QUERY query;
 
-            if (check_match_any(my_instance, my_session, queue, user, &rname) ||
-                check_match_all(my_instance, my_session, queue, user, false, &rname) ||
-                check_match_all(my_instance, my_session, queue, user, true, &rname))
+            query_init(&query, queue);
+
+            if (check_match_any(my_instance, my_session, &query, user, &rname) ||
+                check_match_all(my_instance, my_session, &query, user, false, &rname) ||
+                check_match_all(my_instance, my_session, &query, user, true, &rname))
             {
                 match = true;
             }
 
+            query_free(&query);
+
             switch (my_instance->action)
             {
                 case FW_ACTION_ALLOW:
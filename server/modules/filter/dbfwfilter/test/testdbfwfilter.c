@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * Tests for the compiled rule sets of the database firewall filter. The facts
+ * of the queries are given by the tests so that the matching does not depend
+ * on the query classifier.
+ */
+
+#include "../dbfwfilter.c"
+
+/**
+ * Create a rule
+ * @param name Name of the rule
+ * @param type Type of the rule
+ * @param value Pattern of a regex rule or a space separated list of columns
+ * @return The rule
+ */
+static RULE* test_rule(const char* name, ruletype_t type, const char* value)
+{
+    RULE* rule = calloc(1, sizeof(RULE));
+    rule->name = strdup(name);
+    rule->type = type;
+
+    if (type == RT_REGEX)
+    {
+        rule->data = strdup(value);
+    }
+    else if (type == RT_COLUMN)
+    {
+        char columns[strlen(value) + 1];
+        strcpy(columns, value);
+        char* saveptr;
+
+        for (char* tok = strtok_r(columns, " ", &saveptr); tok; tok = strtok_r(NULL, " ", &saveptr))
+        {
+            rule->data = strlink_push(rule->data, tok);
+        }
+    }
+
+    return rule;
+}
+
+/**
+ * Set the facts of a query
+ * @param query Query facts to initialize
+ * @param sql The SQL of the query
+ * @param result Result of the parsing
+ * @param fields Space separated lowercase fields of the query
+ */
+static void test_query(FW_QUERY* query, const char* sql, qc_parse_result_t result, const char* fields)
+{
+    memset(query, 0, sizeof(*query));
+    query->sql = strdup(sql);
+    query->is_sql = true;
+    query->parsed = true;
+    query->parse_result = result;
+    query->optype = QUERY_OP_SELECT;
+    query->is_real = true;
+    query->has_clause = 1;
+    query->fields_read = true;
+
+    if (result == QC_QUERY_PARSED)
+    {
+        query->fields = strdup(fields);
+        query->wildcard = strchr(fields, '*') != NULL;
+        char* saveptr;
+
+        for (char* tok = strtok_r(query->fields, " ", &saveptr); tok; tok = strtok_r(NULL, " ", &saveptr))
+        {
+            query->field_names = realloc(query->field_names, (query->n_fields + 1) * sizeof(char*));
+            query->field_names[query->n_fields++] = tok;
+        }
+    }
+}
+
+/**
+ * Match a query against the rule set of a user
+ * @param instance Filter instance
+ * @param session Filter session
+ * @param user User whose rules are matched
+ * @param type Matching type
+ * @param sql The SQL of the query
+ * @param result Result of the parsing
+ * @param fields Fields of the query
+ * @param expected The expected matched rule names or NULL if the query should not match
+ * @return 0 on success, 1 on failure
+ */
+static int test_match(FW_INSTANCE* instance, FW_SESSION* session, USER* user, enum match_type type,
+                      const char* sql, qc_parse_result_t result, const char* fields,
+                      const char* expected)
+{
+    FW_QUERY query;
+    char* rulename = NULL;
+    bool match;
+
+    test_query(&query, sql, result, fields);
+
+    switch (type)
+    {
+    case FWTOK_MATCH_ANY:
+        match = check_match_any(instance, session, &query, user, &rulename);
+        break;
+
+    case FWTOK_MATCH_ALL:
+        match = check_match_all(instance, session, &query, user, false, &rulename);
+        break;
+
+    default:
+        match = check_match_all(instance, session, &query, user, true, &rulename);
+        break;
+    }
+
+    int rval = 0;
+
+    if (match != (expected != NULL) || (match && strcmp(rulename, expected) != 0))
+    {
+        fprintf(stderr, "Query '%s' with parse result %d matched '%s', expected '%s'.\n",
+                sql, result, match ? rulename : "", expected ? expected : "");
+        rval = 1;
+    }
+
+    free(rulename);
+    query_free(&query);
+    return rval;
+}
+
+/**
+ * Only the regex and column rules that hit are matched, a column rule rejects
+ * a partially parsed query and a regex rule still needs its pattern to match
+ */
+static int test_match_any(FW_INSTANCE* instance, FW_SESSION* session)
+{
+    USER user = {0};
+    user.rules_or = rulelist_push(user.rules_or, test_rule("no_wildcard", RT_WILDCARD, NULL));
+    user.rules_or = rulelist_push(user.rules_or, test_rule("no_union", RT_REGEX, ".*union.*"));
+    user.rules_or = rulelist_push(user.rules_or, test_rule("no_secret", RT_COLUMN, "secret salary"));
+    ruleset_compile(&user.set_or, user.rules_or);
+
+    USER regex_user = {0};
+    regex_user.rules_or = rulelist_push(regex_user.rules_or, test_rule("no_drop", RT_REGEX, "drop"));
+    regex_user.rules_or = rulelist_push(regex_user.rules_or, test_rule("no_union", RT_REGEX, "union"));
+    ruleset_compile(&regex_user.set_or, regex_user.rules_or);
+
+    int rval = 0;
+    enum match_type any = FWTOK_MATCH_ANY;
+
+    rval += test_match(instance, session, &user, any, "select id from t1",
+                       QC_QUERY_PARSED, "id", NULL);
+    rval += test_match(instance, session, &user, any, "select salary from t1",
+                       QC_QUERY_PARSED, "salary", "no_secret");
+    rval += test_match(instance, session, &user, any, "select id from t1 union select 1",
+                       QC_QUERY_PARSED, "id", "no_union");
+    rval += test_match(instance, session, &user, any, "select * from t1",
+                       QC_QUERY_PARSED, "*", "no_wildcard");
+
+    /** The fields are not known so the column rule rejects the query */
+    rval += test_match(instance, session, &user, any, "select id from t1",
+                       QC_QUERY_PARTIALLY_PARSED, NULL, "no_secret");
+    rval += test_match(instance, session, &user, any, "select id from t1",
+                       QC_QUERY_INVALID, NULL, "no_secret");
+
+    /** The patterns are matched even if the query is only partially parsed */
+    rval += test_match(instance, session, &regex_user, any, "select id from t1",
+                       QC_QUERY_PARTIALLY_PARSED, NULL, NULL);
+    rval += test_match(instance, session, &regex_user, any, "select id from t1 union select 1",
+                       QC_QUERY_PARTIALLY_PARSED, NULL, "no_union");
+    rval += test_match(instance, session, &regex_user, any, "select id from t1",
+                       QC_QUERY_INVALID, NULL, "no_union");
+
+    ruleset_free(&user.set_or);
+    ruleset_free(&regex_user.set_or);
+    rulelist_free(user.rules_or);
+    rulelist_free(regex_user.rules_or);
+    return rval;
+}
+
+/**
+ * All active rules must match, a column rule rejects a partially parsed query
+ * and a regex rule still needs its pattern to match
+ */
+static int test_match_all(FW_INSTANCE* instance, FW_SESSION* session, enum match_type type)
+{
+    USER user = {0};
+    RULELIST** list = type == FWTOK_MATCH_ALL ? &user.rules_and : &user.rules_strict_and;
+    RULESET* set = type == FWTOK_MATCH_ALL ? &user.set_and : &user.set_strict_and;
+    *list = rulelist_push(*list, test_rule("no_union", RT_REGEX, ".*union.*"));
+    *list = rulelist_push(*list, test_rule("no_secret", RT_COLUMN, "secret"));
+    ruleset_compile(set, *list);
+
+    int rval = 0;
+
+    rval += test_match(instance, session, &user, type, "select secret from t1",
+                       QC_QUERY_PARSED, "secret", NULL);
+    rval += test_match(instance, session, &user, type, "select id from t1 union select 1",
+                       QC_QUERY_PARSED, "id", NULL);
+    rval += test_match(instance, session, &user, type, "select secret from t1 union select 1",
+                       QC_QUERY_PARSED, "secret", "no_secret, no_union");
+    rval += test_match(instance, session, &user, type, "select id from t1",
+                       QC_QUERY_PARTIALLY_PARSED, NULL, NULL);
+    rval += test_match(instance, session, &user, type, "select id from t1 union select 1",
+                       QC_QUERY_PARTIALLY_PARSED, NULL, "no_secret, no_union");
+
+    ruleset_free(set);
+    rulelist_free(*list);
+    return rval;
+}
+
+int main(int argc, char** argv)
+{
+    FW_INSTANCE instance = {0};
+    instance.action = FW_ACTION_BLOCK;
+    spinlock_init(&instance.lock);
+
+    FW_SESSION session = {0};
+    session.regex_state = mxs_pcre2_set_state_alloc();
+
+    int rval = 0;
+    rval += test_match_any(&instance, &session);
+    rval += test_match_all(&instance, &session, FWTOK_MATCH_ALL);
+    rval += test_match_all(&instance, &session, FWTOK_MATCH_STRICT_ALL);
+
+    mxs_pcre2_set_state_free(session.regex_state);
+    free(session.errmsg);
+    return rval;
+}
@@ -131,6 +131,7 @@ newSession(FILTER *instance, SESSION *session)
         my_session->request = NULL;
         my_session->stack = NULL;
         my_session->named_hints = NULL;
+        my_session->hint_cache = NULL;
     }
 
     return my_session;
@@ -147,7 +148,6 @@ static void
 closeSession(FILTER *instance, void *session)
 {
     HINT_SESSION *my_session = (HINT_SESSION *)session;
-    NAMEDHINTS* named_hints;
     HINTSTACK* hint_stack;
 
     if (my_session->request)
@@ -156,11 +156,17 @@ closeSession(FILTER *instance, void *session)
     }
 
 
-    /** Free named hints */
-    named_hints = my_session->named_hints;
-
-    while ((named_hints = free_named_hint(named_hints)) != NULL)
-        ;
+    /** Free named and cached hints */
+    if (my_session->named_hints)
+    {
+        hashtable_free(my_session->named_hints);
+        my_session->named_hints = NULL;
+    }
+    if (my_session->hint_cache)
+    {
+        hashtable_free(my_session->hint_cache);
+        my_session->hint_cache = NULL;
+    }
     /** Free stacked hints */
     hint_stack = my_session->stack;
 
@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
+#include <stdbool.h>
 #include <skygw_utils.h>
 #include <log_manager.h>
 #include <filter.h>
@@ -73,6 +74,9 @@ static void create_named_hint(HINT_SESSION *, char *, HINT *);
 static void hint_push(HINT_SESSION *, HINT *);
 static const char* token_get_keyword(HINT_TOKEN* token);
 static void token_free(HINT_TOKEN* token);
+static bool hint_maybe_present(GWBUF *buf, char *ptr, int len);
+static char* hint_comment_text(GWBUF *buf, char *ptr);
+static HASHTABLE* hint_table_alloc();
 
 typedef enum
 {
@@ -144,9 +148,17 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
     GWBUF *buf;
     HINT_TOKEN *tok;
     HINT_MODE mode = HM_EXECUTE;
+    char *cache_key = NULL;
+    bool cacheable = true;
 
     /* First look for any comment in the SQL */
     modutil_MySQL_Query(request, &ptr, &len, &residual);
+
+    if (!hint_maybe_present(request, ptr, len))
+    {
+        goto retblock;
+    }
+
     buf = request;
     found = 0;
     escape = 0;
@@ -230,6 +242,17 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
         goto retblock;
     }
 
+    /*
+     * A comment seen before with only one-off hints in it gives the same
+     * hints again, use the cached result instead of parsing it.
+     */
+    if ((cache_key = hint_comment_text(buf, ptr)) && session->hint_cache &&
+        (rval = hashtable_fetch(session->hint_cache, cache_key)))
+    {
+        rval = hint_dup(rval);
+        goto retblock;
+    }
+
     /*
      * If we have got here then we have a comment, ptr point to
      * the comment character if it is a '#' comment or the second
@@ -286,6 +309,7 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
                     case TOK_STOP:
                         /* Action: pop active hint */
                         hint_pop(session);
+                        cacheable = false;
                         state = HS_INIT;
                         break;
                     case TOK_START:
@@ -440,6 +464,7 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
                 if (lookup_named_hint(session, hintname) != NULL)
                 {
                     /* Error hint with this name already exists */
+                    free(hintname);
                 }
                 else
                 {
@@ -476,6 +501,7 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
             /* We are not starting the hints now, so return an empty
              * hint set.
              */
+            free_hint_list(rval);
             rval = NULL;
             break;
         case HM_EXECUTE:
@@ -483,10 +509,27 @@ hint_parser(HINT_SESSION *session, GWBUF *request)
              * We have a one-off hint for the statement we are
              * currently forwarding.
              */
+            if (cache_key && cacheable && rval &&
+                session->n_cached < HINT_CACHE_SIZE &&
+                (session->hint_cache || (session->hint_cache = hint_table_alloc())))
+            {
+                HINT *copy = hint_dup(rval);
+
+                if (hashtable_add(session->hint_cache, cache_key, copy))
+                {
+                    session->n_cached++;
+                }
+                else
+                {
+                    free_hint_list(copy);
+                }
+            }
             break;
     }
 
 retblock:
+    free(cache_key);
+
     if (rval == NULL)
     {
         /* No new hint parsed in this statement, apply the current
@@ -664,74 +707,167 @@ hint_push(HINT_SESSION *session, HINT *hint)
 static HINT *
 lookup_named_hint(HINT_SESSION *session, char *name)
 {
-    NAMEDHINTS *ptr = session->named_hints;
+    return session->named_hints ? hashtable_fetch(session->named_hints, name) : NULL;
+}
 
-    while (ptr)
+/**
+ * Create a named hint block. A block with the same name is replaced.
+ *
+ * @param session   The filter session
+ * @param name      The name of the block to create, freed by this function
+ * @param hint      The hints themselves
+ */
+static void
+create_named_hint(HINT_SESSION *session, char *name, HINT *hint)
+{
+    if (session->named_hints || (session->named_hints = hint_table_alloc()))
     {
-        if (strcmp(ptr->name, name) == 0)
+        HINT *copy = hint_dup(hint);
+
+        hashtable_delete(session->named_hints, name);
+
+        if (!hashtable_add(session->named_hints, name, copy))
         {
-            return ptr->hints;
+            free_hint_list(copy);
         }
-        ptr = ptr->next;
     }
-    return NULL;
+
+    free(name);
 }
 
 /**
- * Create a named hint block
+ * Allocate a table of hint lists keyed by a string. The table owns
+ * copies of the keys and the hint lists stored in it.
  *
- * @param session   The filter session
- * @param name      The name of the block to ceate
- * @param hint      The hints themselves
+ * @return The new table or NULL if memory allocation failed
  */
-static void
-create_named_hint(HINT_SESSION *session, char *name, HINT *hint)
+static HASHTABLE*
+hint_table_alloc()
 {
-    NAMEDHINTS *block;
+    HASHTABLE *table = hashtable_alloc(HINT_CACHE_SIZE, simple_str_hash, strcmp);
 
-    if ((block = (NAMEDHINTS *)malloc(sizeof(NAMEDHINTS))) == NULL)
+    if (table)
     {
-        return;
+        hashtable_memory_fns(table, (HASHMEMORYFN)strdup, NULL,
+                             (HASHMEMORYFN)free, free_hint_list);
     }
 
-    block->name = name;
-    block->hints = hint_dup(hint);
-    block->next = session->named_hints;
-    session->named_hints = block;
+    return table;
 }
 
 /**
- * Release the given NAMEDHINTS struct and all included hints.
+ * Release a list of hints
  *
- * @param named_hint NAMEDHINTS struct to be released
+ * @param hint The first hint of the list, may be NULL
+ * @return Always NULL
+ */
+void* free_hint_list(void* hint)
+{
+    HINT *ptr = (HINT*)hint;
+
+    while (ptr)
+    {
+        HINT *next = ptr->next;
+        hint_free(ptr);
+        ptr = next;
+    }
+
+    return NULL;
+}
+
+/**
+ * Check whether the SQL can contain a hint. Hints are in comments that start
+ * with the word "maxscale", so a statement without any comment markers or
+ * without that word has no hints. The checks use memchr, which is much
+ * cheaper than the character by character comment parser for statements
+ * without hints.
  *
- * @return pointer to next NAMEDHINTS struct.
+ * @param buf   The request buffer
+ * @param ptr   Start of the SQL in the first buffer
+ * @param len   Length of the SQL in the first buffer
+ * @return False if the SQL has no hints, true if it may have hints
  */
-NAMEDHINTS* free_named_hint(
-    NAMEDHINTS* named_hint)
+static bool
+hint_maybe_present(GWBUF *buf, char *ptr, int len)
 {
-    NAMEDHINTS* next;
+    static const char *word = "maxscale";
+    char *end = ptr + len;
+    char *p;
+    bool comment;
 
-    if (named_hint != NULL)
+    if (buf->next)
     {
-        HINT* hint;
+        /* A comment marker could be split between the buffers */
+        return true;
+    }
 
-        next = named_hint->next;
+    comment = memchr(ptr, '#', len) != NULL;
 
-        while (named_hint->hints != NULL)
+    for (p = ptr; !comment && (p = memchr(p, '-', end - p)) && p + 1 < end; p++)
+    {
+        comment = p[1] == '-';
+    }
+
+    for (p = ptr; !comment && (p = memchr(p, '/', end - p)) && p + 1 < end; p++)
+    {
+        comment = p[1] == '*';
+    }
+
+    if (comment)
+    {
+        for (int i = 0; i < 2; i++)
         {
-            hint = named_hint->hints->next;
-            hint_free(named_hint->hints);
-            named_hint->hints = hint;
+            int first = i == 0 ? 'm' : 'M';
+
+            for (p = ptr; (p = memchr(p, first, end - p)) && end - p >= 8; p++)
+            {
+                if (strncasecmp(p, word, 8) == 0)
+                {
+                    return true;
+                }
+            }
         }
-        free(named_hint->name);
-        free(named_hint);
-        return next;
     }
-    else
+
+    return false;
+}
+
+/**
+ * Get the text of the comment that the parser found. Used as the key of the
+ * parsed hint cache.
+ *
+ * @param buf   The buffer with the comment
+ * @param ptr   The comment character if it is a '#' comment or the second
+ *              character of the comment if it is a -- or \/\* comment
+ * @return The comment text or NULL if it spans multiple buffers
+ */
+static char*
+hint_comment_text(GWBUF *buf, char *ptr)
+{
+    char *start = ptr + 1;
+    char *end = (char*)buf->end;
+    char *text_end;
+
+    if (buf->next || start > end)
     {
         return NULL;
     }
+
+    if (*ptr == '*')
+    {
+        text_end = memmem(start, end - start, "*/", 2);
+    }
+    else
+    {
+        text_end = memchr(start, '\n', end - start);
+    }
+
+    if (text_end == NULL)
+    {
+        text_end = end;
+    }
+
+    return strndup(start, text_end - start);
 }
 
 /**
@@ -34,6 +34,22 @@
  * is defined and valid, the matching entry point function in Lua will be called.
  * The same holds true for session script apart from no calls to createInstance
  * or diagnostic being made for the session script.
+ *
+ * The global script is loaded into one Lua state that all threads take turns in
+ * using. With global_state_per_thread=true, it is instead loaded into one state
+ * per worker thread and each call is made in the state of the calling thread,
+ * so the global variables of the script are not shared between the threads.
+ * Values that need to be seen by all states are exchanged with the following
+ * functions, which copy the values in and out:
+ *  * number shared_incr(string [, number]) - atomically add to a shared counter
+ *  * nil shared_set(string, (nil | bool | number | string)) - store a shared value
+ *  * (nil | bool | number | string) shared_get(string) - fetch a shared value
+ *
+ * By default each session creates its own session script state. With a non-zero
+ * session_pool_size, the states are taken from a pool of initialised states and
+ * are returned to it when the session is freed. A reused state keeps the global
+ * variables of the previous session, so the pool must only be enabled when the
+ * newSession function of the session script initialises all session variables.
  */
 
 #include <skygw_types.h>
@@ -41,9 +57,15 @@
 #include <skygw_debug.h>
 #include <log_manager.h>
 #include <string.h>
+#include <limits.h>
 #include <filter.h>
 #include <session.h>
 #include <modutil.h>
+#include <atomic.h>
+#include <hashtable.h>
+#include <skygw_utils.h>
+#include <platform.h>
+#include <maxconfig.h>
 #include "lua.h"
 #include "lualib.h"
 #include "lauxlib.h"
@@ -112,6 +134,16 @@ GetModuleObject()
 
 static int id_pool = 0;
 
+/** Index of the global script state used by the current thread */
+static thread_local int lua_state_index = -1;
+
+/** Number of threads that have been assigned a state index */
+static int lua_thread_count = 0;
+
+/** Default number of session script states kept for reuse, the reuse is opt-in
+ * as a reused state keeps the global variables of the previous session */
+#define LUA_DEFAULT_SESSION_POOL_SIZE 0
+
 /**
  * Push an unique integer to the Lua state's stack
  * @param state Lua state
@@ -123,15 +155,45 @@ static int id_gen(lua_State* state)
     return 1;
 }
 
+/**
+ * A Lua state of the global script
+ */
+typedef struct
+{
+    lua_State* lua_state;
+    SPINLOCK lock;
+} LUA_GLOBAL_STATE;
+
+/**
+ * A value shared between all Lua states of an instance
+ */
+typedef struct
+{
+    int type; /*< LUA_TBOOLEAN, LUA_TNUMBER or LUA_TSTRING */
+    bool counter; /*< Value is a counter updated with shared_incr */
+    lua_Integer count;
+    lua_Number number;
+    bool boolean;
+    char* string;
+    size_t len;
+} LUA_SHARED_VALUE;
+
 /**
  * The Lua filter instance.
  */
 typedef struct
 {
-    lua_State* global_lua_state;
+    LUA_GLOBAL_STATE* global_states; /*< Global script states, one or one per thread */
+    int n_global_states;
+    bool global_state_per_thread; /*< Whether each thread has its own global state */
     char* global_script;
     char* session_script;
-    SPINLOCK lock;
+    lua_State** session_pool; /*< Session script states ready for reuse */
+    int session_pool_size;
+    int n_pooled;
+    SPINLOCK pool_lock;
+    HASHTABLE* shared; /*< Values shared between all states */
+    SPINLOCK shared_lock;
 } LUA_INSTANCE;
 
 /**
@@ -146,6 +208,369 @@ typedef struct
     UPSTREAM up;
 } LUA_SESSION;
 
+/**
+ * Free a shared value, used as the value free function of the shared table
+ * @param data Shared value
+ * @return Always NULL
+ */
+static void* shared_value_free(void* data)
+{
+    LUA_SHARED_VALUE* value = (LUA_SHARED_VALUE*) data;
+
+    if (value)
+    {
+        free(value->string);
+        free(value);
+    }
+
+    return NULL;
+}
+
+/**
+ * Find a shared value and create it if it does not exist. Must be called with
+ * the shared lock held.
+ * @param my_instance Filter instance
+ * @param name Name of the value
+ * @return The value or NULL if memory allocation failed
+ */
+static LUA_SHARED_VALUE* shared_value_get(LUA_INSTANCE* my_instance, const char* name)
+{
+    LUA_SHARED_VALUE* value = hashtable_fetch(my_instance->shared, (void*) name);
+
+    if (value == NULL && (value = calloc(1, sizeof(LUA_SHARED_VALUE))))
+    {
+        value->type = LUA_TNIL;
+
+        if (!hashtable_add(my_instance->shared, (void*) name, value))
+        {
+            free(value);
+            value = NULL;
+        }
+    }
+
+    return value;
+}
+
+/**
+ * Add to a shared counter. Lua arguments are the name of the counter and an
+ * optional amount which defaults to 1. The new value of the counter is
+ * pushed to the stack.
+ * @param state Lua state
+ * @return Always 1
+ */
+static int shared_incr(lua_State* state)
+{
+    LUA_INSTANCE* my_instance = (LUA_INSTANCE*) lua_touserdata(state, lua_upvalueindex(1));
+    const char* name = luaL_checkstring(state, 1);
+    lua_Integer amount = luaL_optinteger(state, 2, 1);
+    lua_Integer result = 0;
+    bool ok = false;
+
+    spinlock_acquire(&my_instance->shared_lock);
+    LUA_SHARED_VALUE* value = shared_value_get(my_instance, name);
+
+    if (value && (value->type == LUA_TNIL || value->counter))
+    {
+        if (!value->counter)
+        {
+            value->type = LUA_TNUMBER;
+            value->counter = true;
+            value->count = 0;
+        }
+
+        value->count += amount;
+        result = value->count;
+        ok = true;
+    }
+    spinlock_release(&my_instance->shared_lock);
+
+    if (!ok)
+    {
+        return luaL_error(state, "shared value '%s' is not a counter", name);
+    }
+
+    lua_pushinteger(state, result);
+    return 1;
+}
+
+/**
+ * Store a shared value. Lua arguments are the name and the value, which must
+ * be nil, a boolean, a number or a string. A nil value removes the name.
+ * @param state Lua state
+ * @return Always 0
+ */
+static int shared_set(lua_State* state)
+{
+    LUA_INSTANCE* my_instance = (LUA_INSTANCE*) lua_touserdata(state, lua_upvalueindex(1));
+    const char* name = luaL_checkstring(state, 1);
+    int type = lua_type(state, 2);
+    char* string = NULL;
+    size_t len = 0;
+
+    if (type == LUA_TSTRING)
+    {
+        const char* str = lua_tolstring(state, 2, &len);
+
+        if ((string = malloc(len + 1)) == NULL)
+        {
+            return luaL_error(state, "out of memory");
+        }
+
+        memcpy(string, str, len + 1);
+    }
+    else if (type != LUA_TNIL && type != LUA_TNONE &&
+             type != LUA_TBOOLEAN && type != LUA_TNUMBER)
+    {
+        return luaL_error(state, "shared value '%s' must be nil, a boolean, a number or a string",
+                          name);
+    }
+
+    spinlock_acquire(&my_instance->shared_lock);
+
+    if (type == LUA_TNIL || type == LUA_TNONE)
+    {
+        hashtable_delete(my_instance->shared, (void*) name);
+    }
+    else
+    {
+        LUA_SHARED_VALUE* value = shared_value_get(my_instance, name);
+
+        if (value)
+        {
+            free(value->string);
+            value->string = string;
+            value->len = len;
+            value->type = type;
+            value->counter = false;
+            value->number = type == LUA_TNUMBER ? lua_tonumber(state, 2) : 0;
+            value->boolean = type == LUA_TBOOLEAN ? lua_toboolean(state, 2) : false;
+            string = NULL;
+        }
+    }
+
+    spinlock_release(&my_instance->shared_lock);
+    free(string);
+
+    return 0;
+}
+
+/**
+ * Fetch a copy of a shared value. The Lua argument is the name of the value.
+ * The value or nil if the name is not set is pushed to the stack.
+ * @param state Lua state
+ * @return Always 1
+ */
+static int shared_get(lua_State* state)
+{
+    LUA_INSTANCE* my_instance = (LUA_INSTANCE*) lua_touserdata(state, lua_upvalueindex(1));
+    const char* name = luaL_checkstring(state, 1);
+    LUA_SHARED_VALUE copy = {.type = LUA_TNIL};
+
+    spinlock_acquire(&my_instance->shared_lock);
+    LUA_SHARED_VALUE* value = hashtable_fetch(my_instance->shared, (void*) name);
+
+    if (value)
+    {
+        copy = *value;
+
+        if (value->string && (copy.string = malloc(value->len)))
+        {
+            memcpy(copy.string, value->string, value->len);
+        }
+    }
+
+    spinlock_release(&my_instance->shared_lock);
+
+    switch (copy.type)
+    {
+        case LUA_TBOOLEAN:
+            lua_pushboolean(state, copy.boolean);
+            break;
+
+        case LUA_TNUMBER:
+            if (copy.counter)
+            {
+                lua_pushinteger(state, copy.count);
+            }
+            else
+            {
+                lua_pushnumber(state, copy.number);
+            }
+            break;
+
+        case LUA_TSTRING:
+            if (copy.string || copy.len == 0)
+            {
+                lua_pushlstring(state, copy.string ? copy.string : "", copy.len);
+                break;
+            }
+            /** Memory allocation failed, fall through */
+
+        default:
+            lua_pushnil(state);
+            break;
+    }
+
+    free(copy.string);
+    return 1;
+}
+
+/**
+ * Register a C function that takes the instance as an upvalue
+ * @param state Lua state
+ * @param my_instance Filter instance
+ * @param name Name of the Lua global variable
+ * @param fn The function
+ */
+static void register_instance_function(lua_State* state, LUA_INSTANCE* my_instance,
+                                       const char* name, lua_CFunction fn)
+{
+    lua_pushlightuserdata(state, my_instance);
+    lua_pushcclosure(state, fn, 1);
+    lua_setglobal(state, name);
+}
+
+/**
+ * Create a Lua state and execute a script in it
+ * @param my_instance Filter instance
+ * @param script Path to the script
+ * @return New Lua state or NULL on error
+ */
+static lua_State* create_lua_state(LUA_INSTANCE* my_instance, const char* script)
+{
+    lua_State* state = luaL_newstate();
+
+    if (state == NULL)
+    {
+        MXS_ERROR("Unable to initialize new Lua state.");
+        return NULL;
+    }
+
+    luaL_openlibs(state);
+    register_instance_function(state, my_instance, "shared_incr", shared_incr);
+    register_instance_function(state, my_instance, "shared_set", shared_set);
+    register_instance_function(state, my_instance, "shared_get", shared_get);
+
+    if (luaL_dofile(state, script))
+    {
+        MXS_ERROR("luafilter: Failed to execute script at '%s': %s.",
+                  script, lua_tostring(state, -1));
+        lua_close(state);
+        state = NULL;
+    }
+
+    return state;
+}
+
+/**
+ * Create a new session script state
+ * @param my_instance Filter instance
+ * @return New Lua state or NULL on error
+ */
+static lua_State* create_session_state(LUA_INSTANCE* my_instance)
+{
+    lua_State* state = create_lua_state(my_instance, my_instance->session_script);
+
+    if (state)
+    {
+        lua_pushcfunction(state, id_gen);
+        lua_setglobal(state, "id_gen");
+    }
+
+    return state;
+}
+
+/**
+ * Get a session script state from the pool or create a new one if the pool
+ * is empty
+ * @param my_instance Filter instance
+ * @return Lua state or NULL on error
+ */
+static lua_State* session_state_acquire(LUA_INSTANCE* my_instance)
+{
+    lua_State* state = NULL;
+
+    spinlock_acquire(&my_instance->pool_lock);
+    if (my_instance->n_pooled > 0)
+    {
+        state = my_instance->session_pool[--my_instance->n_pooled];
+    }
+    spinlock_release(&my_instance->pool_lock);
+
+    return state ? state : create_session_state(my_instance);
+}
+
+/**
+ * Return a session script state to the pool. If the pool is full, the state
+ * is closed.
+ * @param my_instance Filter instance
+ * @param state Lua state
+ */
+static void session_state_release(LUA_INSTANCE* my_instance, lua_State* state)
+{
+    bool pooled = false;
+
+    lua_settop(state, 0);
+    lua_gc(state, LUA_GCCOLLECT, 0);
+
+    spinlock_acquire(&my_instance->pool_lock);
+    if (my_instance->n_pooled < my_instance->session_pool_size)
+    {
+        my_instance->session_pool[my_instance->n_pooled++] = state;
+        pooled = true;
+    }
+    spinlock_release(&my_instance->pool_lock);
+
+    if (!pooled)
+    {
+        lua_close(state);
+    }
+}
+
+/**
+ * Get the global script state of the current thread
+ * @param my_instance Filter instance
+ * @return The global script state or NULL if there is no global script
+ */
+static LUA_GLOBAL_STATE* global_state(LUA_INSTANCE* my_instance)
+{
+    if (my_instance->n_global_states == 0)
+    {
+        return NULL;
+    }
+
+    if (lua_state_index == -1)
+    {
+        lua_state_index = atomic_add(&lua_thread_count, 1);
+    }
+
+    return &my_instance->global_states[lua_state_index % my_instance->n_global_states];
+}
+
+/**
+ * Call a global script function that takes no arguments and returns nothing
+ * @param my_instance Filter instance
+ * @param name Name of the function
+ */
+static void global_call(LUA_INSTANCE* my_instance, const char* name)
+{
+    LUA_GLOBAL_STATE* global = global_state(my_instance);
+
+    if (global)
+    {
+        spinlock_acquire(&global->lock);
+        lua_getglobal(global->lua_state, name);
+        if (lua_pcall(global->lua_state, 0, 0, 0))
+        {
+            MXS_WARNING("luafilter: Failed to get global variable '%s': '%s'."
+                        " The %s entry point will not be called for the global script.",
+                        name, lua_tostring(global->lua_state, -1), name);
+            lua_pop(global->lua_state, 1);
+        }
+        spinlock_release(&global->lock);
+    }
+}
+
 /**
  * The module initialisation routine, called when the module
  * is first loaded.
@@ -161,8 +586,10 @@ ModuleInit()
 /**
  * Create a new instance of the Lua filter.
  *
- * The global script will be loaded in this function and executed once on a global
- * level before calling the createInstance function in the Lua script.
+ * The global script will be loaded into one Lua state, or into one state per
+ * thread if global_state_per_thread is enabled, and executed once on a global
+ * level before calling the createInstance function in the Lua script of each
+ * state.
  * @param options The options for this filter
  * @param params  Filter parameters
  * @return The instance data for this new instance
@@ -178,7 +605,9 @@ createInstance(char **options, FILTER_PARAMETER **params)
         return NULL;
     }
 
-    spinlock_init(&my_instance->lock);
+    spinlock_init(&my_instance->pool_lock);
+    spinlock_init(&my_instance->shared_lock);
+    my_instance->session_pool_size = LUA_DEFAULT_SESSION_POOL_SIZE;
 
     for (int i = 0; params[i] && !error; i++)
     {
@@ -190,6 +619,26 @@ createInstance(char **options, FILTER_PARAMETER **params)
         {
             error = (my_instance->session_script = strdup(params[i]->value)) == NULL;
         }
+        else if (strcmp(params[i]->name, "global_state_per_thread") == 0)
+        {
+            my_instance->global_state_per_thread = config_truth_value(params[i]->value);
+        }
+        else if (strcmp(params[i]->name, "session_pool_size") == 0)
+        {
+            char* end;
+            long value = strtol(params[i]->value, &end, 10);
+
+            if (*end != '\0' || value < 0 || value > INT_MAX)
+            {
+                MXS_ERROR("luafilter: Invalid value for 'session_pool_size': %s",
+                          params[i]->value);
+                error = true;
+            }
+            else
+            {
+                my_instance->session_pool_size = value;
+            }
+        }
         else if (!filter_standard_parameter(params[i]->name))
         {
             MXS_ERROR("Unexpected parameter '%s'", params[i]->name);
@@ -197,46 +646,96 @@ createInstance(char **options, FILTER_PARAMETER **params)
         }
     }
 
-    if (error)
+    if (!error)
     {
-        free(my_instance->global_script);
-        free(my_instance->session_script);
-        free(my_instance);
-        return NULL;
+        my_instance->shared = hashtable_alloc(100, simple_str_hash, strcmp);
+        my_instance->session_pool = calloc(my_instance->session_pool_size + 1, sizeof(lua_State*));
+
+        if (my_instance->shared && my_instance->session_pool)
+        {
+            hashtable_memory_fns(my_instance->shared, (HASHMEMORYFN) strdup, NULL,
+                                 (HASHMEMORYFN) free, shared_value_free);
+        }
+        else
+        {
+            error = true;
+        }
     }
 
-    if (my_instance->global_script)
+    if (!error && my_instance->global_script)
     {
-        if ((my_instance->global_lua_state = luaL_newstate()))
+        int n_states = my_instance->global_state_per_thread ? config_threadcount() : 1;
+
+        if ((my_instance->global_states = calloc(n_states, sizeof(LUA_GLOBAL_STATE))) == NULL)
         {
-            luaL_openlibs(my_instance->global_lua_state);
+            error = true;
+        }
 
-            if (luaL_dofile(my_instance->global_lua_state, my_instance->global_script))
-            {
-                MXS_ERROR("luafilter: Failed to execute global script at '%s':%s.",
-                          my_instance->global_script, lua_tostring(my_instance->global_lua_state, -1));
-                free(my_instance->global_script);
-                free(my_instance->session_script);
-                free(my_instance);
-                my_instance = NULL;
-            }
-            else if (my_instance->global_lua_state)
+        for (int i = 0; i < n_states && !error; i++)
+        {
+            LUA_GLOBAL_STATE* global = &my_instance->global_states[i];
+            spinlock_init(&global->lock);
+
+            if ((global->lua_state = create_lua_state(my_instance, my_instance->global_script)))
             {
-                lua_getglobal(my_instance->global_lua_state, "createInstance");
-                if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
+                my_instance->n_global_states++;
+                lua_getglobal(global->lua_state, "createInstance");
+                if (lua_pcall(global->lua_state, 0, 0, 0))
                 {
                     MXS_WARNING("luafilter: Failed to get global variable 'createInstance':  %s."
                                 " The createInstance entry point will not be called for the global script.",
-                                lua_tostring(my_instance->global_lua_state, -1));
+                                lua_tostring(global->lua_state, -1));
+                    lua_pop(global->lua_state, 1);
                 }
             }
+            else
+            {
+                error = true;
+            }
         }
-        else
+    }
+
+    /** Prepare one session state per thread so that the first sessions do not
+     * need to create them */
+    if (!error && my_instance->session_script)
+    {
+        int n_states = MIN(config_threadcount(), my_instance->session_pool_size);
+
+        for (int i = 0; i < n_states && !error; i++)
+        {
+            lua_State* state = create_session_state(my_instance);
+
+            if (state)
+            {
+                my_instance->session_pool[my_instance->n_pooled++] = state;
+            }
+            else
+            {
+                error = true;
+            }
+        }
+    }
+
+    if (error)
+    {
+        for (int i = 0; i < my_instance->n_global_states; i++)
+        {
+            lua_close(my_instance->global_states[i].lua_state);
+        }
+        for (int i = 0; i < my_instance->n_pooled; i++)
+        {
+            lua_close(my_instance->session_pool[i]);
+        }
+        if (my_instance->shared)
         {
-            MXS_ERROR("Unable to initialize new Lua state.");
-            free(my_instance);
-            my_instance = NULL;
+            hashtable_free(my_instance->shared);
         }
+        free(my_instance->global_states);
+        free(my_instance->session_pool);
+        free(my_instance->global_script);
+        free(my_instance->session_script);
+        free(my_instance);
+        my_instance = NULL;
     }
 
     return (FILTER *) my_instance;
@@ -248,8 +747,9 @@ createInstance(char **options, FILTER_PARAMETER **params)
  * This function is called for each new client session and it is used to initialize
  * data used for the duration of the session.
  *
- * This function first loads the session script and executes in on a global level.
- * After this, the newSession function in the Lua scripts is called.
+ * This function takes a session script state from the pool, or loads the session
+ * script into a new state if the pool is empty. After this, the newSession
+ * function in the Lua scripts is called.
  *
  * There is a single C function exported as a global variable for the session
  * script named id_gen. The id_gen function returns an integer that is unique for
@@ -273,46 +773,24 @@ static void * newSession(FILTER *instance, SESSION *session)
 
     if (my_instance->session_script)
     {
-        my_session->lua_state = luaL_newstate();
-        luaL_openlibs(my_session->lua_state);
-
-        if (luaL_dofile(my_session->lua_state, my_instance->session_script))
+        if ((my_session->lua_state = session_state_acquire(my_instance)) == NULL)
         {
-            MXS_ERROR("luafilter: Failed to execute session script at '%s': %s.",
-                      my_instance->session_script,
-                      lua_tostring(my_session->lua_state, -1));
-            lua_close(my_session->lua_state);
             free(my_session);
-            my_session = NULL;
+            return NULL;
         }
-        else
-        {
-            lua_pushcfunction(my_session->lua_state, id_gen);
-            lua_setglobal(my_session->lua_state, "id_gen");
-
-            lua_getglobal(my_session->lua_state, "newSession");
-            if (lua_pcall(my_session->lua_state, 0, 0, 0))
-            {
-                MXS_WARNING("luafilter: Failed to get global variable 'newSession': '%s'."
-                            " The newSession entry point will not be called.",
-                            lua_tostring(my_session->lua_state, -1));
-            }
-        }
-    }
 
-    if (my_session && my_instance->global_lua_state)
-    {
-        spinlock_acquire(&my_instance->lock);
-        lua_getglobal(my_instance->global_lua_state, "newSession");
-        if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
+        lua_getglobal(my_session->lua_state, "newSession");
+        if (lua_pcall(my_session->lua_state, 0, 0, 0))
         {
             MXS_WARNING("luafilter: Failed to get global variable 'newSession': '%s'."
-                        " The newSession entry point will not be called for the global script.",
-                        lua_tostring(my_instance->global_lua_state, -1));
+                        " The newSession entry point will not be called.",
+                        lua_tostring(my_session->lua_state, -1));
+            lua_pop(my_session->lua_state, 1);
         }
-        spinlock_release(&my_instance->lock);
     }
 
+    global_call(my_instance, "newSession");
+
     return my_session;
 }
 
@@ -339,34 +817,30 @@ static void closeSession(FILTER *instance, void *session)
             MXS_WARNING("luafilter: Failed to get global variable 'closeSession': '%s'."
                         " The closeSession entry point will not be called.",
                         lua_tostring(my_session->lua_state, -1));
+            lua_pop(my_session->lua_state, 1);
         }
         spinlock_release(&my_session->lock);
     }
 
-    if (my_instance->global_lua_state)
-    {
-        spinlock_acquire(&my_instance->lock);
-        lua_getglobal(my_instance->global_lua_state, "closeSession");
-        if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
-        {
-            MXS_WARNING("luafilter: Failed to get global variable 'closeSession': '%s'."
-                        " The closeSession entry point will not be called for the global script.",
-                        lua_tostring(my_instance->global_lua_state, -1));
-        }
-        spinlock_release(&my_instance->lock);
-    }
+    global_call(my_instance, "closeSession");
 }
 
 /**
  * Free the memory associated with the session
  *
+ * The session script state is returned to the pool of the instance.
  * @param instance The filter instance
  * @param session The filter session
  */
 static void freeSession(FILTER *instance, void *session)
 {
     LUA_SESSION *my_session = (LUA_SESSION *) session;
-    lua_close(my_session->lua_state);
+
+    if (my_session->lua_state)
+    {
+        session_state_release((LUA_INSTANCE*) instance, my_session->lua_state);
+    }
+
     free(my_session);
 }
 
@@ -418,19 +892,23 @@ static int clientReply(FILTER *instance, void *session, GWBUF *queue)
         {
             MXS_ERROR("luafilter: Session scope call to 'clientReply' failed: '%s'.",
                       lua_tostring(my_session->lua_state, -1));
+            lua_pop(my_session->lua_state, 1);
         }
         spinlock_release(&my_session->lock);
     }
-    if (my_instance->global_lua_state)
+    LUA_GLOBAL_STATE* global = global_state(my_instance);
+
+    if (global)
     {
-        spinlock_acquire(&my_instance->lock);
-        lua_getglobal(my_instance->global_lua_state, "clientReply");
-        if (lua_pcall(my_instance->global_lua_state, 0, 0, 0))
+        spinlock_acquire(&global->lock);
+        lua_getglobal(global->lua_state, "clientReply");
+        if (lua_pcall(global->lua_state, 0, 0, 0))
         {
             MXS_ERROR("luafilter: Global scope call to 'clientReply' failed: '%s'.",
-                      lua_tostring(my_session->lua_state, -1));
+                      lua_tostring(global->lua_state, -1));
+            lua_pop(global->lua_state, 1);
         }
-        spinlock_release(&my_instance->lock);
+        spinlock_release(&global->lock);
     }
 
     return my_session->up.clientReply(my_session->up.instance,
@@ -494,36 +972,40 @@ static int routeQuery(FILTER *instance, void *session, GWBUF *queue)
                     route = lua_toboolean(my_session->lua_state, -1);
                 }
             }
+            lua_settop(my_session->lua_state, 0);
             spinlock_release(&my_session->lock);
         }
 
-        if (my_instance->global_lua_state)
+        LUA_GLOBAL_STATE* global = global_state(my_instance);
+
+        if (fullquery && global)
         {
-            spinlock_acquire(&my_instance->lock);
-            lua_getglobal(my_instance->global_lua_state, "routeQuery");
-            lua_pushlstring(my_instance->global_lua_state, fullquery, strlen(fullquery));
-            if (lua_pcall(my_instance->global_lua_state, 1, 0, 0))
+            spinlock_acquire(&global->lock);
+            lua_getglobal(global->lua_state, "routeQuery");
+            lua_pushlstring(global->lua_state, fullquery, strlen(fullquery));
+            if (lua_pcall(global->lua_state, 1, 0, 0))
             {
                 MXS_ERROR("luafilter: Global scope call to 'routeQuery' failed: '%s'.",
-                          lua_tostring(my_session->lua_state, -1));
+                          lua_tostring(global->lua_state, -1));
             }
-            else if (lua_gettop(my_instance->global_lua_state))
+            else if (lua_gettop(global->lua_state))
             {
-                if (lua_isstring(my_instance->global_lua_state, -1))
+                if (lua_isstring(global->lua_state, -1))
                 {
                     if (forward)
                     {
                         gwbuf_free(forward);
                     }
                     forward = modutil_create_query((char*)
-                                                   lua_tostring(my_instance->global_lua_state, -1));
+                                                   lua_tostring(global->lua_state, -1));
                 }
-                else if (lua_isboolean(my_instance->global_lua_state, -1))
+                else if (lua_isboolean(global->lua_state, -1))
                 {
-                    route = lua_toboolean(my_instance->global_lua_state, -1);
+                    route = lua_toboolean(global->lua_state, -1);
                 }
             }
-            spinlock_release(&my_instance->lock);
+            lua_settop(global->lua_state, 0);
+            spinlock_release(&global->lock);
         }
 
         free(fullquery);
@@ -559,25 +1041,28 @@ static void diagnostic(FILTER *instance, void *fsession, DCB *dcb)
 
     if (my_instance)
     {
-        if (my_instance->global_lua_state)
+        LUA_GLOBAL_STATE* global = global_state(my_instance);
+
+        if (global)
         {
-            spinlock_acquire(&my_instance->lock);
-            lua_getglobal(my_instance->global_lua_state, "diagnostic");
-            if (lua_pcall(my_instance->global_lua_state, 0, 1, 0) == 0)
+            spinlock_acquire(&global->lock);
+            lua_getglobal(global->lua_state, "diagnostic");
+            if (lua_pcall(global->lua_state, 0, 1, 0) == 0)
             {
-                lua_gettop(my_instance->global_lua_state);
-                if (lua_isstring(my_instance->global_lua_state, -1))
+                lua_gettop(global->lua_state);
+                if (lua_isstring(global->lua_state, -1))
                 {
-                    dcb_printf(dcb, lua_tostring(my_instance->global_lua_state, -1));
+                    dcb_printf(dcb, lua_tostring(global->lua_state, -1));
                     dcb_printf(dcb, "\n");
                 }
             }
             else
             {
                 dcb_printf(dcb, "Global scope call to 'diagnostic' failed: '%s'.\n",
-                           lua_tostring(my_instance->global_lua_state, -1));
+                           lua_tostring(global->lua_state, -1));
             }
-            spinlock_release(&my_instance->lock);
+            lua_settop(global->lua_state, 0);
+            spinlock_release(&global->lock);
         }
         if (my_instance->global_script)
         {
@@ -586,6 +1071,8 @@ static void diagnostic(FILTER *instance, void *fsession, DCB *dcb)
         if (my_instance->session_script)
         {
             dcb_printf(dcb, "Session script: %s\n", my_instance->session_script);
+            dcb_printf(dcb, "Pooled session states: %d/%d\n",
+                       my_instance->n_pooled, my_instance->session_pool_size);
         }
     }
 }
@@ -46,6 +46,13 @@
  *      ssl_CA_cert     Path to the CA certificate in PEM format
  *      ssl_client_cert Path to the client cerificate in PEM format
  *      ssl_client_key  Path to the client public key in PEM format
+ *      queue_size      Maximum number of messages waiting to be published
+ *      batch_size      Maximum number of messages published at a time
+ *      confirm         Wait for the broker to confirm each batch
+ *
+ * The messages are published by a background thread so that a slow or
+ * unreachable broker does not stall the routing threads. When the message
+ * queue is full, new messages are dropped.
  *
  * The logging trigger levels are:
  *      all     Log everything
@@ -75,7 +82,9 @@
 #include <query_classifier.h>
 #include <spinlock.h>
 #include <session.h>
-#include <housekeeper.h>
+#include <lfqueue.h>
+#include <thread.h>
+#include <skygw_utils.h>
 
 MODULE_INFO info =
 {
@@ -87,7 +96,21 @@ MODULE_INFO info =
 
 static char *version_str = "V1.0.2";
 static int uid_gen;
-static int hktask_id = 0;
+
+/** Default maximum number of messages waiting to be published */
+#define MQ_DEFAULT_QUEUE_SIZE 10000
+
+/** Default maximum number of messages published at a time */
+#define MQ_DEFAULT_BATCH_SIZE 100
+
+/** How long the publisher sleeps when there are no messages */
+#define MQ_PUBLISHER_IDLE_MS 10
+
+/** How long the publisher waits for the broker to confirm a batch */
+#define MQ_CONFIRM_TIMEOUT 5
+
+/** Maximum delay between reconnection attempts in seconds */
+#define MQ_MAX_RECONNECT_INTERVAL 60
 /*
  * The filter entry points
  */
@@ -122,7 +145,7 @@ typedef struct mqmessage_t
 {
     amqp_basic_properties_t *prop;
     char *msg;
-    struct mqmessage_t *next;
+    char *uid; /**Copy of the correlation ID, the session may be freed before publishing*/
 } mqmessage;
 
 /**
@@ -192,6 +215,9 @@ typedef struct mqstats_t
     int n_msg; /*< Total number of messages */
     int n_sent; /*< Number of sent messages */
     int n_queued; /*< Number of unsent messages */
+    int n_dropped; /*< Number of messages dropped because the queue was full */
+    int n_batches; /*< Number of published batches */
+    int n_reconnects; /*< Number of reconnections to the broker */
 } MQSTATS;
 
 /**
@@ -228,8 +254,12 @@ typedef struct
     int rconn_intv; /**delay for reconnects, in seconds*/
     time_t last_rconn; /**last reconnect attempt*/
     SPINLOCK rconn_lock;
-    SPINLOCK msg_lock;
-    mqmessage* messages;
+    LFQUEUE* messages; /**Messages waiting to be published*/
+    int queue_size; /**Maximum number of messages waiting to be published*/
+    int batch_size; /**Maximum number of messages published at a time*/
+    bool confirm; /**Wait for publisher confirms*/
+    uint64_t delivery_tag; /**Delivery tag of the last published message*/
+    THREAD publisher; /**The thread that publishes the messages*/
     enum log_trigger_t trgtype;
     SRC_TRIG* src_trg;
     SHM_TRIG* shm_trg;
@@ -256,7 +286,7 @@ typedef struct
     bool was_query; /**True if the previous routeQuery call had valid content*/
 } MQ_SESSION;
 
-void sendMessage(void* data);
+static void mq_publisher_main(void* data);
 
 /**
  * Implementation of the mandatory version entry point
@@ -445,6 +475,18 @@ init_conn(MQ_INSTANCE *my_instance)
             goto cleanup;
         }
     }
+
+    if (my_instance->confirm)
+    {
+        amqp_confirm_select(my_instance->conn, my_instance->channel);
+        reply = amqp_get_rpc_reply(my_instance->conn);
+        if (reply.reply_type != AMQP_RESPONSE_NORMAL)
+        {
+            MXS_ERROR("Failed to enable publisher confirms.");
+            goto cleanup;
+        }
+        my_instance->delivery_tag = 0;
+    }
     rval = 1;
 
 cleanup:
@@ -508,12 +550,10 @@ createInstance(char **options, FILTER_PARAMETER **params)
     int paramcount = 0, parammax = 64, i = 0, x = 0, arrsize = 0;
     FILTER_PARAMETER** paramlist;
     char** arr = NULL;
-    char taskname[512];
 
     if ((my_instance = calloc(1, sizeof(MQ_INSTANCE))))
     {
         spinlock_init(&my_instance->rconn_lock);
-        spinlock_init(&my_instance->msg_lock);
         uid_gen = 0;
         paramlist = malloc(sizeof(FILTER_PARAMETER*) * 64);
 
@@ -531,6 +571,9 @@ createInstance(char **options, FILTER_PARAMETER **params)
         my_instance->trgtype = TRG_ALL;
         my_instance->log_all = false;
         my_instance->strict_logging = true;
+        my_instance->queue_size = MQ_DEFAULT_QUEUE_SIZE;
+        my_instance->batch_size = MQ_DEFAULT_BATCH_SIZE;
+        my_instance->confirm = true;
 
         for (i = 0; params[i]; i++)
         {
@@ -586,6 +629,28 @@ createInstance(char **options, FILTER_PARAMETER **params)
 
                 my_instance->exchange_type = strdup(params[i]->value);
             }
+            else if (!strcmp(params[i]->name, "queue_size"))
+            {
+                if ((my_instance->queue_size = atoi(params[i]->value)) <= 0)
+                {
+                    MXS_ERROR("Invalid value for 'queue_size': %s. Using the default of %d.",
+                              params[i]->value, MQ_DEFAULT_QUEUE_SIZE);
+                    my_instance->queue_size = MQ_DEFAULT_QUEUE_SIZE;
+                }
+            }
+            else if (!strcmp(params[i]->name, "batch_size"))
+            {
+                if ((my_instance->batch_size = atoi(params[i]->value)) <= 0)
+                {
+                    MXS_ERROR("Invalid value for 'batch_size': %s. Using the default of %d.",
+                              params[i]->value, MQ_DEFAULT_BATCH_SIZE);
+                    my_instance->batch_size = MQ_DEFAULT_BATCH_SIZE;
+                }
+            }
+            else if (!strcmp(params[i]->name, "confirm"))
+            {
+                my_instance->confirm = config_truth_value(params[i]->value);
+            }
             else if (!strcmp(params[i]->name, "logging_trigger"))
             {
 
@@ -785,11 +850,22 @@ createInstance(char **options, FILTER_PARAMETER **params)
             amqp_set_initialize_ssl_library(0);
         }
 
-        /**Connect to the server*/
-        init_conn(my_instance);
+        if ((my_instance->messages = lfqueue_alloc(my_instance->queue_size)) == NULL)
+        {
+            MXS_ERROR("Cannot allocate enough memory.");
+        }
+        else
+        {
+            /**The connection is opened by the publisher thread*/
+            my_instance->conn_stat = AMQP_STATUS_SOCKET_ERROR;
+            my_instance->last_rconn = 0;
+
+            if (thread_start(&my_instance->publisher, mq_publisher_main, my_instance) == NULL)
+            {
+                MXS_ERROR("Failed to start the publisher thread.");
+            }
+        }
 
-        snprintf(taskname, 511, "mqtask%d", atomic_add(&hktask_id, 1));
-        hktask_add(taskname, sendMessage, (void*) my_instance, 5);
         if (arr)
         {
             for (int x = 0; x < arrsize; x++)
@@ -845,132 +921,245 @@ int declareQueue(MQ_INSTANCE *my_instance, MQ_SESSION* my_session, char* qname)
 }
 
 /**
- * Broadcasts a message on the message stack to the RabbitMQ server
- * and frees the allocated memory if successful. This function is only called by
- * the housekeeper thread.
- * @param data MQfilter instance
+ * Free a message and the memory it owns
+ * @param msg Message to free
  */
-void sendMessage(void* data)
+static void mq_message_free(mqmessage* msg)
 {
-    MQ_INSTANCE *instance = (MQ_INSTANCE*) data;
-    mqmessage *tmp;
-    int err_num = AMQP_STATUS_OK;
+    free(msg->prop);
+    free(msg->msg);
+    free(msg->uid);
+    free(msg);
+}
 
-    spinlock_acquire(&instance->rconn_lock);
-    if (instance->conn_stat != AMQP_STATUS_OK)
+/**
+ * Wait until the broker has confirmed the published messages. Must only be
+ * called by the publisher thread.
+ * @param instance MQfilter instance
+ * @param first Delivery tag of the first message of the batch
+ * @return True if all messages were acknowledged, false on a negative
+ * acknowledgement, a timeout or a connection error
+ */
+static bool mq_wait_confirms(MQ_INSTANCE *instance, uint64_t first)
+{
+    uint64_t n_acked = 0, n_total = instance->delivery_tag - first + 1;
+
+    while (n_acked < n_total)
     {
-        if (difftime(time(NULL), instance->last_rconn) > instance->rconn_intv)
+        amqp_frame_t frame;
+        struct timeval timeout = {.tv_sec = MQ_CONFIRM_TIMEOUT};
+        int rc = amqp_simple_wait_frame_noblock(instance->conn, &frame, &timeout);
+
+        if (rc != AMQP_STATUS_OK)
         {
-            instance->last_rconn = time(NULL);
+            MXS_ERROR("Failed to receive publisher confirms: %s", amqp_error_string2(rc));
+            return false;
+        }
 
-            if (init_conn(instance))
-            {
-                instance->rconn_intv = 1.0;
-                instance->conn_stat = AMQP_STATUS_OK;
-            }
-            else
-            {
-                instance->rconn_intv += 5.0;
-                MXS_ERROR("Failed to reconnect to the MQRabbit server ");
-            }
+        if (frame.frame_type != AMQP_FRAME_METHOD)
+        {
+            continue;
+        }
+
+        if (frame.payload.method.id == AMQP_BASIC_ACK_METHOD)
+        {
+            amqp_basic_ack_t *ack = (amqp_basic_ack_t*) frame.payload.method.decoded;
+            n_acked = ack->multiple ? ack->delivery_tag - first + 1 : n_acked + 1;
+        }
+        else if (frame.payload.method.id == AMQP_BASIC_NACK_METHOD)
+        {
+            MXS_ERROR("RabbitMQ server rejected a batch of messages.");
+            return false;
+        }
+        else if (frame.payload.method.id == AMQP_CHANNEL_CLOSE_METHOD ||
+                 frame.payload.method.id == AMQP_CONNECTION_CLOSE_METHOD)
+        {
+            MXS_ERROR("RabbitMQ server closed the connection: %s",
+                      amqp_method_name(frame.payload.method.id));
+            return false;
         }
-        err_num = instance->conn_stat;
     }
-    spinlock_release(&instance->rconn_lock);
+
+    return true;
+}
+
+/**
+ * Publish a batch of messages to the RabbitMQ server. Must only be called by
+ * the publisher thread.
+ * @param instance MQfilter instance
+ * @param batch Messages to publish
+ * @param n Number of messages
+ * @return True if all messages were published (and confirmed if publisher
+ * confirms are enabled)
+ */
+static bool mq_publish_batch(MQ_INSTANCE *instance, mqmessage **batch, int n)
+{
+    uint64_t first = instance->delivery_tag + 1;
+    int err_num = AMQP_STATUS_OK;
+
+    for (int i = 0; i < n && err_num == AMQP_STATUS_OK; i++)
+    {
+        err_num = amqp_basic_publish(instance->conn, instance->channel,
+                                     amqp_cstring_bytes(instance->exchange),
+                                     amqp_cstring_bytes(instance->key),
+                                     0, 0, batch[i]->prop, amqp_cstring_bytes(batch[i]->msg));
+        instance->delivery_tag++;
+    }
 
     if (err_num != AMQP_STATUS_OK)
     {
-        /** No connection to the broker */
-        return;
+        MXS_ERROR("Failed to publish message: %s", amqp_error_string2(err_num));
+        return false;
     }
 
-    spinlock_acquire(&instance->msg_lock);
-    tmp = instance->messages;
+    bool rval = !instance->confirm || mq_wait_confirms(instance, first);
+    amqp_maybe_release_buffers(instance->conn);
+    return rval;
+}
 
-    if (tmp == NULL)
+/**
+ * Open a new connection to the RabbitMQ server. Must only be called by the
+ * publisher thread.
+ * @param instance MQfilter instance
+ */
+static void mq_reconnect(MQ_INSTANCE *instance)
+{
+    spinlock_acquire(&instance->rconn_lock);
+
+    instance->last_rconn = time(NULL);
+
+    if (instance->conn)
     {
-        spinlock_release(&instance->msg_lock);
-        return;
+        amqp_destroy_connection(instance->conn);
     }
 
-    instance->messages = instance->messages->next;
-    spinlock_release(&instance->msg_lock);
+    instance->channel = 1;
 
-    while (tmp)
+    if ((instance->conn = amqp_new_connection()) && init_conn(instance))
     {
-        err_num = amqp_basic_publish(instance->conn, instance->channel,
-                                     amqp_cstring_bytes(instance->exchange),
-                                     amqp_cstring_bytes(instance->key),
-                                     0, 0, tmp->prop, amqp_cstring_bytes(tmp->msg));
+        instance->rconn_intv = 1;
+        instance->conn_stat = AMQP_STATUS_OK;
+        atomic_add(&instance->stats.n_reconnects, 1);
+    }
+    else
+    {
+        instance->rconn_intv = MIN(instance->rconn_intv + 5, MQ_MAX_RECONNECT_INTERVAL);
+        instance->conn_stat = AMQP_STATUS_SOCKET_ERROR;
+        MXS_ERROR("Failed to reconnect to the MQRabbit server, retrying in %d seconds.",
+                  instance->rconn_intv);
+    }
 
-        spinlock_acquire(&instance->rconn_lock);
-        instance->conn_stat = err_num;
-        spinlock_release(&instance->rconn_lock);
+    spinlock_release(&instance->rconn_lock);
+}
 
-        if (err_num == AMQP_STATUS_OK)
-        {
-            /**Message was sent successfully*/
-            free(tmp->prop);
-            free(tmp->msg);
-            free(tmp);
+/**
+ * The publisher thread. Takes messages from the queue and publishes them in
+ * batches to the RabbitMQ server. If a batch fails, the connection is reopened
+ * and the whole batch is published again.
+ * @param data MQfilter instance
+ */
+static void mq_publisher_main(void* data)
+{
+    MQ_INSTANCE *instance = (MQ_INSTANCE*) data;
+    mqmessage **batch = malloc(sizeof(mqmessage*) * instance->batch_size);
+    int n = 0;
 
-            atomic_add(&instance->stats.n_sent, 1);
-            atomic_add(&instance->stats.n_queued, -1);
-            spinlock_acquire(&instance->msg_lock);
-            tmp = instance->messages;
+    if (batch == NULL)
+    {
+        MXS_ERROR("Cannot allocate enough memory.");
+        return;
+    }
 
-            if (tmp == NULL)
+    while (true)
+    {
+        if (instance->conn_stat != AMQP_STATUS_OK)
+        {
+            if (difftime(time(NULL), instance->last_rconn) >= instance->rconn_intv)
+            {
+                mq_reconnect(instance);
+            }
+            else
             {
-                spinlock_release(&instance->msg_lock);
-                return;
+                thread_millisleep(MQ_PUBLISHER_IDLE_MS * 10);
             }
+            continue;
+        }
+
+        mqmessage *msg;
 
-            instance->messages = instance->messages->next;
-            spinlock_release(&instance->msg_lock);
+        while (n < instance->batch_size && (msg = lfqueue_pop(instance->messages)))
+        {
+            batch[n++] = msg;
         }
-        else
+
+        if (n == 0)
+        {
+            thread_millisleep(MQ_PUBLISHER_IDLE_MS);
+            continue;
+        }
+
+        spinlock_acquire(&instance->rconn_lock);
+        bool ok = mq_publish_batch(instance, batch, n);
+
+        if (!ok)
         {
-            spinlock_acquire(&instance->msg_lock);
-            tmp->next = instance->messages;
-            instance->messages = tmp;
-            spinlock_release(&instance->msg_lock);
-            return;
+            instance->conn_stat = AMQP_STATUS_SOCKET_ERROR;
+        }
+        spinlock_release(&instance->rconn_lock);
+
+        if (ok)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                mq_message_free(batch[i]);
+            }
+
+            atomic_add(&instance->stats.n_sent, n);
+            atomic_add(&instance->stats.n_queued, -n);
+            atomic_add(&instance->stats.n_batches, 1);
+            n = 0;
         }
     }
 }
 
 /**
- * Push a new message on the stack to be broadcasted later.
+ * Push a new message to the queue to be published by the publisher thread.
  * The message assumes ownership of the memory allocated to the message content and properties.
+ * If the queue is full, the message is dropped.
  * @param prop Message properties
  * @param msg Message content
  */
 void pushMessage(MQ_INSTANCE *instance, amqp_basic_properties_t* prop, char* msg)
 {
-
     mqmessage* newmsg = calloc(1, sizeof(mqmessage));
-    if (newmsg)
+
+    if (newmsg && prop && msg &&
+        (newmsg->uid = strndup(prop->correlation_id.bytes, prop->correlation_id.len)))
     {
         newmsg->msg = msg;
         newmsg->prop = prop;
+        newmsg->prop->correlation_id = amqp_cstring_bytes(newmsg->uid);
     }
     else
     {
         MXS_ERROR("Cannot allocate enough memory.");
+        free(newmsg);
         free(prop);
         free(msg);
         return;
     }
 
-    spinlock_acquire(&instance->msg_lock);
-
-    newmsg->next = instance->messages;
-    instance->messages = newmsg;
-
-    spinlock_release(&instance->msg_lock);
-
     atomic_add(&instance->stats.n_msg, 1);
-    atomic_add(&instance->stats.n_queued, 1);
+
+    if (instance->messages && lfqueue_push(instance->messages, newmsg))
+    {
+        atomic_add(&instance->stats.n_queued, 1);
+    }
+    else
+    {
+        atomic_add(&instance->stats.n_dropped, 1);
+        mq_message_free(newmsg);
+    }
 }
 
 /**
@@ -1685,11 +1874,14 @@ diagnostic(FILTER *instance, void *fsession, DCB *dcb)
                    my_instance->vhost, my_instance->exchange,
                    my_instance->key, my_instance->queue
                   );
-        dcb_printf(dcb, "%-16s%-16s%-16s\n",
-                   "Messages", "Queued", "Sent");
-        dcb_printf(dcb, "%-16d%-16d%-16d\n",
+        dcb_printf(dcb, "%-16s%-16s%-16s%-16s%-16s%-16s\n",
+                   "Messages", "Queued", "Sent", "Dropped", "Batches", "Reconnects");
+        dcb_printf(dcb, "%-16d%-16d%-16d%-16d%-16d%-16d\n",
                    my_instance->stats.n_msg,
                    my_instance->stats.n_queued,
-                   my_instance->stats.n_sent);
+                   my_instance->stats.n_sent,
+                   my_instance->stats.n_dropped,
+                   my_instance->stats.n_batches,
+                   my_instance->stats.n_reconnects);
     }
 }
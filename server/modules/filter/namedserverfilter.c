@@ -18,7 +18,7 @@
 #include <skygw_utils.h>
 #include <log_manager.h>
 #include <string.h>
-#include <regex.h>
+#include <maxscale_pcre2.h>
 #include <hint.h>
 
 /**
@@ -80,7 +80,9 @@ typedef struct
     char *user; /* User name to restrict matches */
     char *match; /* Regular expression to match */
     char *server; /* Server to route to */
-    regex_t re; /* Compiled regex text */
+    pcre2_code *re; /* Compiled regex text */
+    char *literal; /* Literal text every match starts with, may be NULL */
+    bool caseless; /* Whether the regex ignores case */
 } REGEXHINT_INSTANCE;
 
 /**
@@ -144,7 +146,7 @@ static FILTER *
 createInstance(char **options, FILTER_PARAMETER **params)
 {
     REGEXHINT_INSTANCE *my_instance;
-    int cflags = REG_ICASE;
+    int cflags = PCRE2_CASELESS;
 
     if ((my_instance = malloc(sizeof(REGEXHINT_INSTANCE))) != NULL)
     {
@@ -152,6 +154,8 @@ createInstance(char **options, FILTER_PARAMETER **params)
         my_instance->server = NULL;
         my_instance->source = NULL;
         my_instance->user = NULL;
+        my_instance->re = NULL;
+        my_instance->literal = NULL;
         bool error = false;
 
         for (int i = 0; params && params[i]; i++)
@@ -186,15 +190,15 @@ createInstance(char **options, FILTER_PARAMETER **params)
             {
                 if (!strcasecmp(options[i], "ignorecase"))
                 {
-                    cflags |= REG_ICASE;
+                    cflags |= PCRE2_CASELESS;
                 }
                 else if (!strcasecmp(options[i], "case"))
                 {
-                    cflags &= ~REG_ICASE;
+                    cflags &= ~PCRE2_CASELESS;
                 }
                 else if (!strcasecmp(options[i], "extended"))
                 {
-                    cflags |= REG_EXTENDED;
+                    /** The PCRE2 syntax is a superset of the extended POSIX syntax */
                 }
                 else
                 {
@@ -216,23 +220,32 @@ createInstance(char **options, FILTER_PARAMETER **params)
             MXS_ERROR("namedserverfilter: Missing required parameters 'server'.");
             error = true;
         }
-        if (my_instance->server && my_instance->match &&
-            regcomp(&my_instance->re, my_instance->match, cflags))
+        if (my_instance->server && my_instance->match)
         {
-            MXS_ERROR("namedserverfilter: Invalid regular expression '%s'.\n",
-                      my_instance->match);
-            free(my_instance->match);
-            my_instance->match = NULL;
-            error = true;
+            int errnumber;
+            size_t erroffset;
+
+            if ((my_instance->re = mxs_pcre2_compile(my_instance->match, cflags,
+                                                     &errnumber, &erroffset)) == NULL)
+            {
+                char errbuffer[1024];
+                pcre2_get_error_message(errnumber, (PCRE2_UCHAR*) errbuffer, sizeof(errbuffer));
+                MXS_ERROR("namedserverfilter: Invalid regular expression '%s' at %lu: %s",
+                          my_instance->match, erroffset, errbuffer);
+                error = true;
+            }
+            else
+            {
+                my_instance->literal = mxs_pcre2_literal_prefix(my_instance->match, cflags);
+                my_instance->caseless = cflags & PCRE2_CASELESS;
+            }
         }
 
         if (error)
         {
-            if (my_instance->match)
-            {
-                regfree(&my_instance->re);
-                free(my_instance->match);
-            }
+            pcre2_code_free(my_instance->re);
+            free(my_instance->literal);
+            free(my_instance->match);
             free(my_instance->server);
             free(my_instance->source);
             free(my_instance->user);
@@ -321,6 +334,33 @@ setDownstream(FILTER *instance, void *session, DOWNSTREAM *downstream)
     my_session->down = *downstream;
 }
 
+/**
+ * Check whether the SQL matches the regular expression of the filter
+ *
+ * The SQL is first searched for the literal text the regular expression
+ * starts with. The regular expression is only matched if the literal is
+ * found. The match data of the calling thread is used for the matching.
+ *
+ * @param my_instance The filter instance
+ * @param sql The SQL text
+ * @param len Length of the SQL text
+ * @return True if the SQL matches
+ */
+static bool
+regex_match(REGEXHINT_INSTANCE *my_instance, const char *sql, size_t len)
+{
+    pcre2_match_data *mdata;
+
+    if (my_instance->literal &&
+        !mxs_pcre2_literal_search(my_instance->literal, my_instance->caseless, sql, len))
+    {
+        return false;
+    }
+
+    return (mdata = mxs_pcre2_thread_match_data(my_instance->re)) &&
+           pcre2_match(my_instance->re, (PCRE2_SPTR) sql, len, 0, 0, mdata, NULL) >= 0;
+}
+
 /**
  * The routeQuery entry point. This is passed the query buffer
  * to which the filter should be applied. Once applied the
@@ -350,7 +390,7 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
         }
         if ((sql = modutil_get_SQL(queue)) != NULL)
         {
-            if (regexec(&my_instance->re, sql, 0, NULL, 0) == 0)
+            if (regex_match(my_instance, sql, strlen(sql)))
             {
                 queue->hint = hint_create_route(queue->hint,
                                                 HINT_ROUTE_TO_NAMED_SERVER,
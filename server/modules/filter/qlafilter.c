@@ -26,6 +26,11 @@
  * file to which the queries are logged. A serial number is appended to this
  * name in order that each session logs to a different file.
  *
+ * With log_type=unified the queries of all sessions are logged into one
+ * file. The routing threads push the records into lock-free queues, one for
+ * each routing thread, and a writer thread formats the records and writes
+ * them to the file in large blocks.
+ *
  * Date         Who             Description
  * 03/06/2014   Mark Riddoch    Initial implementation
  * 11/06/2014   Mark Riddoch    Addition of source and match parameters
@@ -36,7 +41,11 @@
 
 #include <stdio.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <errno.h>
+#include <glob.h>
+#include <limits.h>
+#include <sys/stat.h>
 #include <filter.h>
 #include <modinfo.h>
 #include <modutil.h>
@@ -44,9 +53,14 @@
 #include <log_manager.h>
 #include <time.h>
 #include <sys/time.h>
-#include <regex.h>
+#include <maxscale_pcre2.h>
 #include <string.h>
 #include <atomic.h>
+#include <lfqueue.h>
+#include <thread.h>
+#include <spinlock.h>
+#include <platform.h>
+#include <maxconfig.h>
 
 MODULE_INFO info =
 {
@@ -61,6 +75,33 @@ static char *version_str = "V1.1.1";
 /** Formatting buffer size */
 #define QLA_STRING_BUFFER_SIZE 1024
 
+/** Length of a formatted timestamp, YYYY-MM-DD HH:MM:SS */
+#define QLA_TIMESTAMP_LEN 19
+
+/** Size of the fixed part of a binary record */
+#define QLA_BINARY_HEADER_LEN 24
+
+/** Default number of records queued for each routing thread */
+#define QLA_DEFAULT_QUEUE_SIZE 4096
+
+/** Size of the buffer the writer thread fills before writing to the file */
+#define QLA_WRITER_BUFFER_SIZE (256 * 1024)
+
+/** How long the writer thread sleeps when all queues are empty */
+#define QLA_WRITER_IDLE_MS 10
+
+enum qla_log_type
+{
+    QLA_LOG_SESSION, /*< One file per session */
+    QLA_LOG_UNIFIED /*< One file for all sessions */
+};
+
+enum qla_format
+{
+    QLA_FORMAT_TEXT,
+    QLA_FORMAT_BINARY
+};
+
 /*
  * The filter entry points
  */
@@ -86,6 +127,45 @@ static FILTER_OBJECT MyObject =
     diagnostic,
 };
 
+/**
+ * A logged query. The strings are stored after the structure in the order
+ * user, remote, SQL and they are not null-terminated.
+ */
+typedef struct
+{
+    struct timeval time;
+    uint16_t user_len;
+    uint16_t remote_len;
+    uint32_t sql_len;
+    char data[];
+} QLA_RECORD;
+
+/**
+ * The writer of the unified log
+ */
+typedef struct qla_writer
+{
+    char *filename; /*< The file being written */
+    int fd; /*< File descriptor of the file */
+    enum qla_format format; /*< Format of the records */
+    bool block; /*< Wait for space in a full queue instead of dropping the record */
+    size_t rotate_size; /*< Rotate the file when it grows past this, 0 for never */
+    size_t file_size; /*< Bytes written to the current file */
+    int rotations; /*< Number of times the file has been rotated */
+    bool write_failed; /*< Whether the last write failed, used to log each failure once */
+    int n_queues; /*< Number of record queues */
+    LFQUEUE **queues; /*< Record queues of the routing threads */
+    char *buffer; /*< Buffer of formatted records */
+    size_t buffer_len; /*< Bytes used in the buffer */
+    time_t timestamp_sec; /*< Time of the cached timestamp */
+    char timestamp[QLA_TIMESTAMP_LEN + 1]; /*< Cached formatted timestamp */
+    int logged; /*< Number of records written */
+    int dropped; /*< Number of records dropped because a queue was full */
+    int stop; /*< Set at shutdown, the thread writes the queued records and exits */
+    THREAD thread;
+    struct qla_writer *next; /*< Next writer in the list of started writers */
+} QLA_WRITER;
+
 /**
  * A instance structure, the assumption is that the option passed
  * to the filter is simply a base for the filename to which the queries
@@ -101,9 +181,13 @@ typedef struct
     char *source; /* The source of the client connection */
     char *userName; /* The user name to filter on */
     char *match; /* Optional text to match against */
-    regex_t re; /* Compiled regex text */
     char *nomatch; /* Optional text to match against for exclusion */
-    regex_t nore; /* Compiled regex nomatch text */
+    MXS_PCRE2_SET *patterns; /* The match and nomatch patterns */
+    int match_id; /* ID of the match pattern or -1 */
+    int nomatch_id; /* ID of the nomatch pattern or -1 */
+    enum qla_log_type log_type; /* Whether to log into session files or into one file */
+    enum qla_format format; /* Format of the logged records */
+    QLA_WRITER *writer; /* Writer of the unified log */
 } QLA_INSTANCE;
 
 /**
@@ -122,6 +206,7 @@ typedef struct
     int active;
     char *user;
     char *remote;
+    MXS_PCRE2_SET_STATE *match_state; /* State for matching the patterns */
 } QLA_SESSION;
 
 /**
@@ -147,6 +232,33 @@ ModuleInit()
 }
 /*lint +e14 */
 
+static void qla_writer_stop(QLA_WRITER *writer);
+
+/** The started writers of the unified logs */
+static QLA_WRITER *qla_writers = NULL;
+static SPINLOCK qla_writers_lock = SPINLOCK_INIT;
+
+/**
+ * The module finalisation routine, called when the module is unloaded
+ * at shutdown. The routing threads have stopped so the unified logs are
+ * drained and closed here.
+ */
+void
+ModuleFini()
+{
+    spinlock_acquire(&qla_writers_lock);
+    QLA_WRITER *writer = qla_writers;
+    qla_writers = NULL;
+    spinlock_release(&qla_writers_lock);
+
+    while (writer)
+    {
+        QLA_WRITER *next = writer->next;
+        qla_writer_stop(writer);
+        writer = next;
+    }
+}
+
 /**
  * The module entry point routine. It is this routine that
  * must populate the structure that is referred to as the
@@ -161,6 +273,536 @@ GetModuleObject()
     return &MyObject;
 }
 
+/** Index of the record queue used by the current routing thread */
+static thread_local int qla_queue_index = -1;
+
+/** Number of threads that have been assigned a queue index */
+static int qla_thread_count = 0;
+
+/**
+ * Allocate a record of a logged query
+ *
+ * @param my_session The session that executed the query
+ * @param sql The SQL of the query
+ * @return New record or NULL if memory allocation failed
+ */
+static QLA_RECORD* qla_record_alloc(QLA_SESSION *my_session, const char *sql)
+{
+    const char *user = my_session->user ? my_session->user : "";
+    const char *remote = my_session->remote ? my_session->remote : "";
+    size_t user_len = strnlen(user, UINT16_MAX);
+    size_t remote_len = strnlen(remote, UINT16_MAX);
+    size_t sql_len = strlen(sql);
+    QLA_RECORD *record = malloc(sizeof(QLA_RECORD) + user_len + remote_len + sql_len);
+
+    if (record)
+    {
+        gettimeofday(&record->time, NULL);
+        record->user_len = user_len;
+        record->remote_len = remote_len;
+        record->sql_len = sql_len;
+        memcpy(record->data, user, user_len);
+        memcpy(record->data + user_len, remote, remote_len);
+        memcpy(record->data + user_len + remote_len, sql, sql_len);
+    }
+
+    return record;
+}
+
+/**
+ * Get the size of a record in the text format
+ *
+ * @param record Record to inspect
+ * @return Size of the formatted record
+ */
+static size_t qla_text_size(const QLA_RECORD *record)
+{
+    /** The separators ',', '@' and ',' and the newline */
+    return QLA_TIMESTAMP_LEN + record->user_len + record->remote_len + record->sql_len + 4;
+}
+
+/**
+ * Format a record in the text format, the same format the session files use
+ *
+ * @param record Record to format
+ * @param timestamp Formatted time of the record
+ * @param dest Destination with space for qla_text_size() bytes
+ */
+static void qla_text_encode(const QLA_RECORD *record, const char *timestamp, uint8_t *dest)
+{
+    const char *data = record->data;
+
+    memcpy(dest, timestamp, QLA_TIMESTAMP_LEN);
+    dest += QLA_TIMESTAMP_LEN;
+    *dest++ = ',';
+    memcpy(dest, data, record->user_len);
+    dest += record->user_len;
+    data += record->user_len;
+    *dest++ = '@';
+    memcpy(dest, data, record->remote_len);
+    dest += record->remote_len;
+    data += record->remote_len;
+    *dest++ = ',';
+    memcpy(dest, data, record->sql_len);
+    dest += record->sql_len;
+    *dest = '\n';
+}
+
+/**
+ * Get the size of a record in the binary format
+ *
+ * @param record Record to inspect
+ * @return Size of the encoded record
+ */
+static size_t qla_binary_size(const QLA_RECORD *record)
+{
+    return QLA_BINARY_HEADER_LEN + record->user_len + record->remote_len + record->sql_len;
+}
+
+static uint8_t* qla_put_le(uint8_t *dest, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        *dest++ = value >> (i * 8);
+    }
+
+    return dest;
+}
+
+/**
+ * Encode a record in the binary format
+ *
+ * All integers are little-endian. The record is:
+ *
+ * 4 bytes  Length of the rest of the record
+ * 8 bytes  Seconds since the epoch
+ * 4 bytes  Microseconds
+ * 2 bytes  Length of the user name, followed by the user name
+ * 2 bytes  Length of the client address, followed by the address
+ * 4 bytes  Length of the SQL, followed by the SQL
+ *
+ * @param record Record to encode
+ * @param dest Destination with space for qla_binary_size() bytes
+ */
+static void qla_binary_encode(const QLA_RECORD *record, uint8_t *dest)
+{
+    const char *data = record->data;
+
+    dest = qla_put_le(dest, qla_binary_size(record) - 4, 4);
+    dest = qla_put_le(dest, record->time.tv_sec, 8);
+    dest = qla_put_le(dest, record->time.tv_usec, 4);
+    dest = qla_put_le(dest, record->user_len, 2);
+    memcpy(dest, data, record->user_len);
+    dest += record->user_len;
+    data += record->user_len;
+    dest = qla_put_le(dest, record->remote_len, 2);
+    memcpy(dest, data, record->remote_len);
+    dest += record->remote_len;
+    data += record->remote_len;
+    dest = qla_put_le(dest, record->sql_len, 4);
+    memcpy(dest, data, record->sql_len);
+}
+
+/**
+ * Write data to the unified log
+ *
+ * @param writer The writer
+ * @param data Data to write
+ * @param len Length of @c data
+ */
+static void qla_writer_write(QLA_WRITER *writer, const uint8_t *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t rc = write(writer->fd, data, len);
+
+        if (rc == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (!writer->write_failed)
+            {
+                char errbuf[STRERROR_BUFLEN];
+                MXS_ERROR("qlafilter: Failed to write to '%s': %d, %s",
+                          writer->filename, errno,
+                          strerror_r(errno, errbuf, sizeof(errbuf)));
+                writer->write_failed = true;
+            }
+            return;
+        }
+
+        data += rc;
+        len -= rc;
+        writer->file_size += rc;
+    }
+
+    writer->write_failed = false;
+}
+
+/**
+ * Rotate the unified log if it has grown past the rotation size
+ *
+ * The current file is renamed by appending a sequence number to the
+ * name and a new file is opened.
+ *
+ * @param writer The writer
+ */
+static void qla_writer_rotate(QLA_WRITER *writer)
+{
+    if (writer->rotate_size == 0 || writer->file_size < writer->rotate_size)
+    {
+        return;
+    }
+
+    char rotated[strlen(writer->filename) + 20];
+    sprintf(rotated, "%s.%d", writer->filename, ++writer->rotations);
+
+    if (rename(writer->filename, rotated) == -1)
+    {
+        char errbuf[STRERROR_BUFLEN];
+        MXS_ERROR("qlafilter: Failed to rename '%s' to '%s': %d, %s",
+                  writer->filename, rotated, errno,
+                  strerror_r(errno, errbuf, sizeof(errbuf)));
+        writer->rotations--;
+        writer->file_size = 0;
+        return;
+    }
+
+    int fd = open(writer->filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+    if (fd == -1)
+    {
+        char errbuf[STRERROR_BUFLEN];
+        MXS_ERROR("qlafilter: Failed to open '%s', continuing to log into '%s': %d, %s",
+                  writer->filename, rotated, errno,
+                  strerror_r(errno, errbuf, sizeof(errbuf)));
+    }
+    else
+    {
+        close(writer->fd);
+        writer->fd = fd;
+    }
+
+    writer->file_size = 0;
+}
+
+/**
+ * Write the buffered records to the unified log
+ *
+ * @param writer The writer
+ */
+static void qla_writer_flush(QLA_WRITER *writer)
+{
+    if (writer->buffer_len > 0)
+    {
+        qla_writer_write(writer, (uint8_t*)writer->buffer, writer->buffer_len);
+        writer->buffer_len = 0;
+        qla_writer_rotate(writer);
+    }
+}
+
+/**
+ * Format a record into the buffer of the writer
+ *
+ * @param writer The writer
+ * @param record Record to add
+ */
+static void qla_writer_add(QLA_WRITER *writer, const QLA_RECORD *record)
+{
+    size_t len;
+
+    if (writer->format == QLA_FORMAT_BINARY)
+    {
+        len = qla_binary_size(record);
+    }
+    else
+    {
+        len = qla_text_size(record);
+
+        /** The timestamp is formatted once per second */
+        if (record->time.tv_sec != writer->timestamp_sec)
+        {
+            struct tm t;
+            localtime_r(&record->time.tv_sec, &t);
+            strftime(writer->timestamp, sizeof(writer->timestamp), "%F %T", &t);
+            writer->timestamp_sec = record->time.tv_sec;
+        }
+    }
+
+    if (writer->buffer_len + len > QLA_WRITER_BUFFER_SIZE)
+    {
+        qla_writer_flush(writer);
+    }
+
+    uint8_t *dest = (uint8_t*)writer->buffer + writer->buffer_len;
+    uint8_t *tmp = NULL;
+
+    if (len > QLA_WRITER_BUFFER_SIZE && (dest = tmp = malloc(len)) == NULL)
+    {
+        return;
+    }
+
+    if (writer->format == QLA_FORMAT_BINARY)
+    {
+        qla_binary_encode(record, dest);
+    }
+    else
+    {
+        qla_text_encode(record, writer->timestamp, dest);
+    }
+
+    if (tmp)
+    {
+        qla_writer_write(writer, tmp, len);
+        qla_writer_rotate(writer);
+        free(tmp);
+    }
+    else
+    {
+        writer->buffer_len += len;
+    }
+}
+
+/**
+ * The writer thread of the unified log
+ *
+ * The thread empties the queues in turns and writes the records in large
+ * blocks. When all queues are empty, the buffered records are written and
+ * the thread sleeps for a while.
+ *
+ * @param data The writer
+ */
+static void qla_writer_main(void *data)
+{
+    QLA_WRITER *writer = (QLA_WRITER*)data;
+
+    while (true)
+    {
+        /** Read before the queues are emptied so that records queued before
+         * the stop request are written */
+        bool stopping = atomic_add(&writer->stop, 0) != 0;
+        int n_records = 0;
+
+        for (int i = 0; i < writer->n_queues; i++)
+        {
+            size_t capacity = lfqueue_capacity(writer->queues[i]);
+            QLA_RECORD *record;
+
+            /** At most one queue's worth at a time so that a busy thread
+             * does not starve the others */
+            for (size_t j = 0; j < capacity && (record = lfqueue_pop(writer->queues[i])); j++)
+            {
+                qla_writer_add(writer, record);
+                free(record);
+                n_records++;
+            }
+        }
+
+        if (n_records > 0)
+        {
+            atomic_add(&writer->logged, n_records);
+        }
+        else
+        {
+            qla_writer_flush(writer);
+
+            if (stopping)
+            {
+                break;
+            }
+            thread_millisleep(QLA_WRITER_IDLE_MS);
+        }
+    }
+}
+
+/**
+ * Stop the writer thread of the unified log
+ *
+ * The thread writes the records still in the queues before it exits, the
+ * routing threads must not queue records after this. The file is closed.
+ *
+ * @param writer The writer
+ */
+static void qla_writer_stop(QLA_WRITER *writer)
+{
+    atomic_add(&writer->stop, 1);
+    thread_wait(writer->thread);
+
+    if (close(writer->fd) == -1)
+    {
+        char errbuf[STRERROR_BUFLEN];
+        MXS_ERROR("qlafilter: Failed to close '%s': %d, %s", writer->filename,
+                  errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+    }
+    writer->fd = -1;
+}
+
+/**
+ * Find the highest suffix of the rotated files of the unified log
+ *
+ * The rotation numbering continues from it so that a restart does not
+ * overwrite the files rotated before it.
+ *
+ * @param filename The name of the unified log
+ * @return The highest N of the files named <filename>.<N>, 0 if there are none
+ */
+static int qla_writer_last_rotation(const char *filename)
+{
+    char pattern[strlen(filename) + sizeof(".[0-9]*")];
+    sprintf(pattern, "%s.[0-9]*", filename);
+    glob_t files;
+    int last = 0;
+
+    if (glob(pattern, 0, NULL, &files) == 0)
+    {
+        size_t prefix_len = strlen(filename) + 1;
+
+        for (size_t i = 0; i < files.gl_pathc; i++)
+        {
+            const char *suffix = files.gl_pathv[i] + prefix_len;
+            char *end;
+            long n = strtol(suffix, &end, 10);
+
+            if (*end == '\0' && n > last && n <= INT_MAX)
+            {
+                last = n;
+            }
+        }
+    }
+
+    globfree(&files);
+    return last;
+}
+
+/**
+ * Open the unified log and start its writer thread
+ *
+ * @param filebase The filebase parameter of the filter
+ * @param format Format of the records
+ * @param block Whether a full queue blocks the routing thread
+ * @param queue_size Number of records queued for each routing thread
+ * @param rotate_size Size at which the file is rotated, 0 for never
+ * @return The writer or NULL on error
+ */
+static QLA_WRITER* qla_writer_start(const char *filebase, enum qla_format format, bool block,
+                                    int queue_size, size_t rotate_size)
+{
+    QLA_WRITER *writer = calloc(1, sizeof(QLA_WRITER));
+    int n_queues = config_threadcount();
+
+    if (writer == NULL ||
+        (writer->filename = malloc(strlen(filebase) + sizeof(".unified"))) == NULL ||
+        (writer->buffer = malloc(QLA_WRITER_BUFFER_SIZE)) == NULL ||
+        (writer->queues = calloc(n_queues, sizeof(LFQUEUE*))) == NULL)
+    {
+        MXS_ERROR("qlafilter: Memory allocation failed.");
+        goto error;
+    }
+
+    sprintf(writer->filename, "%s.unified", filebase);
+    writer->format = format;
+    writer->block = block;
+    writer->rotate_size = rotate_size;
+    writer->n_queues = n_queues;
+    writer->fd = -1;
+
+    for (int i = 0; i < n_queues; i++)
+    {
+        if ((writer->queues[i] = lfqueue_alloc(queue_size)) == NULL)
+        {
+            MXS_ERROR("qlafilter: Memory allocation failed.");
+            goto error;
+        }
+    }
+
+    /** Continue the log of the previous run, it is rotated as usual */
+    struct stat st;
+
+    if ((writer->fd = open(writer->filename, O_WRONLY | O_CREAT | O_APPEND, 0644)) == -1 ||
+        fstat(writer->fd, &st) == -1)
+    {
+        char errbuf[STRERROR_BUFLEN];
+        MXS_ERROR("qlafilter: Failed to open '%s': %d, %s", writer->filename,
+                  errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+        goto error;
+    }
+
+    writer->file_size = st.st_size;
+    writer->rotations = qla_writer_last_rotation(writer->filename);
+
+    if (thread_start(&writer->thread, qla_writer_main, writer) == NULL)
+    {
+        MXS_ERROR("qlafilter: Failed to start the writer thread for '%s'.",
+                  writer->filename);
+        goto error;
+    }
+
+    spinlock_acquire(&qla_writers_lock);
+    writer->next = qla_writers;
+    qla_writers = writer;
+    spinlock_release(&qla_writers_lock);
+
+    return writer;
+
+error:
+    if (writer)
+    {
+        if (writer->fd != -1)
+        {
+            close(writer->fd);
+        }
+        for (int i = 0; writer->queues && i < n_queues; i++)
+        {
+            lfqueue_free(writer->queues[i]);
+        }
+        free(writer->queues);
+        free(writer->buffer);
+        free(writer->filename);
+        free(writer);
+    }
+    return NULL;
+}
+
+/**
+ * Queue a query for the writer thread of the unified log
+ *
+ * @param writer The writer
+ * @param my_session The session that executed the query
+ * @param sql The SQL of the query
+ */
+static void qla_writer_push(QLA_WRITER *writer, QLA_SESSION *my_session, const char *sql)
+{
+    if (qla_queue_index == -1)
+    {
+        qla_queue_index = atomic_add(&qla_thread_count, 1);
+    }
+
+    /** The queues accept items from any thread so threads beyond the
+     * configured count can share a queue */
+    LFQUEUE *queue = writer->queues[qla_queue_index % writer->n_queues];
+    QLA_RECORD *record = qla_record_alloc(my_session, sql);
+
+    if (record == NULL)
+    {
+        return;
+    }
+
+    while (!lfqueue_push(queue, record))
+    {
+        if (!writer->block)
+        {
+            atomic_add(&writer->dropped, 1);
+            free(record);
+            return;
+        }
+
+        thread_millisleep(1);
+    }
+}
+
 /**
  * Create an instance of the filter for a particular service
  * within MaxScale.
@@ -183,6 +825,13 @@ createInstance(char **options, FILTER_PARAMETER **params)
         my_instance->match = NULL;
         my_instance->nomatch = NULL;
         my_instance->filebase = NULL;
+        my_instance->patterns = NULL;
+        my_instance->log_type = QLA_LOG_SESSION;
+        my_instance->format = QLA_FORMAT_TEXT;
+        my_instance->writer = NULL;
+        bool block = false;
+        int queue_size = QLA_DEFAULT_QUEUE_SIZE;
+        long rotate_size = 0;
         bool error = false;
 
         if (params)
@@ -209,6 +858,81 @@ createInstance(char **options, FILTER_PARAMETER **params)
                 {
                     my_instance->filebase = strdup(params[i]->value);
                 }
+                else if (!strcmp(params[i]->name, "log_type"))
+                {
+                    if (!strcmp(params[i]->value, "session"))
+                    {
+                        my_instance->log_type = QLA_LOG_SESSION;
+                    }
+                    else if (!strcmp(params[i]->value, "unified"))
+                    {
+                        my_instance->log_type = QLA_LOG_UNIFIED;
+                    }
+                    else
+                    {
+                        MXS_ERROR("qlafilter: Invalid value for 'log_type': %s. "
+                                  "Expected 'session' or 'unified'.", params[i]->value);
+                        error = true;
+                    }
+                }
+                else if (!strcmp(params[i]->name, "format"))
+                {
+                    if (!strcmp(params[i]->value, "text"))
+                    {
+                        my_instance->format = QLA_FORMAT_TEXT;
+                    }
+                    else if (!strcmp(params[i]->value, "binary"))
+                    {
+                        my_instance->format = QLA_FORMAT_BINARY;
+                    }
+                    else
+                    {
+                        MXS_ERROR("qlafilter: Invalid value for 'format': %s. "
+                                  "Expected 'text' or 'binary'.", params[i]->value);
+                        error = true;
+                    }
+                }
+                else if (!strcmp(params[i]->name, "overflow"))
+                {
+                    if (!strcmp(params[i]->value, "drop"))
+                    {
+                        block = false;
+                    }
+                    else if (!strcmp(params[i]->value, "block"))
+                    {
+                        block = true;
+                    }
+                    else
+                    {
+                        MXS_ERROR("qlafilter: Invalid value for 'overflow': %s. "
+                                  "Expected 'drop' or 'block'.", params[i]->value);
+                        error = true;
+                    }
+                }
+                else if (!strcmp(params[i]->name, "queue_size"))
+                {
+                    char *end;
+                    queue_size = strtol(params[i]->value, &end, 10);
+
+                    if (*end != '\0' || queue_size <= 0)
+                    {
+                        MXS_ERROR("qlafilter: Invalid value for 'queue_size': %s",
+                                  params[i]->value);
+                        error = true;
+                    }
+                }
+                else if (!strcmp(params[i]->name, "rotate_size"))
+                {
+                    char *end;
+                    rotate_size = strtol(params[i]->value, &end, 10);
+
+                    if (*end != '\0' || rotate_size < 0)
+                    {
+                        MXS_ERROR("qlafilter: Invalid value for 'rotate_size': %s",
+                                  params[i]->value);
+                        error = true;
+                    }
+                }
                 else if (!filter_standard_parameter(params[i]->name))
                 {
                     MXS_ERROR("qlafilter: Unexpected parameter '%s'.",
@@ -218,7 +942,7 @@ createInstance(char **options, FILTER_PARAMETER **params)
             }
         }
 
-        int cflags = REG_ICASE;
+        int cflags = PCRE2_CASELESS;
 
         if (options)
         {
@@ -226,15 +950,15 @@ createInstance(char **options, FILTER_PARAMETER **params)
             {
                 if (!strcasecmp(options[i], "ignorecase"))
                 {
-                    cflags |= REG_ICASE;
+                    cflags |= PCRE2_CASELESS;
                 }
                 else if (!strcasecmp(options[i], "case"))
                 {
-                    cflags &= ~REG_ICASE;
+                    cflags &= ~PCRE2_CASELESS;
                 }
                 else if (!strcasecmp(options[i], "extended"))
                 {
-                    cflags |= REG_EXTENDED;
+                    /** PCRE2 patterns always use the extended syntax */
                 }
                 else
                 {
@@ -252,40 +976,59 @@ createInstance(char **options, FILTER_PARAMETER **params)
         }
 
         my_instance->sessions = 0;
-        if (my_instance->match &&
-            regcomp(&my_instance->re, my_instance->match, cflags))
+        my_instance->match_id = -1;
+        my_instance->nomatch_id = -1;
+
+        /** Both patterns are matched with one scan of the query */
+        if ((my_instance->match || my_instance->nomatch) &&
+            (my_instance->patterns = mxs_pcre2_set_alloc(cflags)) == NULL)
+        {
+            MXS_ERROR("qlafilter: Memory allocation failed.");
+            error = true;
+        }
+
+        int errnumber;
+        size_t erroffset;
+        char errbuffer[1024];
+
+        if (my_instance->patterns && my_instance->match &&
+            (my_instance->match_id = mxs_pcre2_set_add(my_instance->patterns, my_instance->match,
+                                                       &errnumber, &erroffset)) == -1)
         {
+            pcre2_get_error_message(errnumber, (PCRE2_UCHAR*) errbuffer, sizeof(errbuffer));
             MXS_ERROR("qlafilter: Invalid regular expression '%s'"
-                      " for the 'match' parameter.\n",
-                      my_instance->match);
-            free(my_instance->match);
-            my_instance->match = NULL;
+                      " for the 'match' parameter at %lu: %s",
+                      my_instance->match, erroffset, errbuffer);
             error = true;
         }
-        if (my_instance->nomatch &&
-            regcomp(&my_instance->nore, my_instance->nomatch, cflags))
+        if (my_instance->patterns && my_instance->nomatch &&
+            (my_instance->nomatch_id = mxs_pcre2_set_add(my_instance->patterns, my_instance->nomatch,
+                                                         &errnumber, &erroffset)) == -1)
         {
+            pcre2_get_error_message(errnumber, (PCRE2_UCHAR*) errbuffer, sizeof(errbuffer));
             MXS_ERROR("qlafilter: Invalid regular expression '%s'"
-                      " for the 'nomatch' parameter.",
-                      my_instance->nomatch);
-            free(my_instance->nomatch);
-            my_instance->nomatch = NULL;
+                      " for the 'nomatch' parameter at %lu: %s",
+                      my_instance->nomatch, erroffset, errbuffer);
             error = true;
         }
 
-        if (error)
+        if (!error && my_instance->patterns)
         {
-            if (my_instance->match)
-            {
-                free(my_instance->match);
-                regfree(&my_instance->re);
-            }
+            mxs_pcre2_set_compile(my_instance->patterns);
+        }
 
-            if (my_instance->nomatch)
-            {
-                free(my_instance->nomatch);
-                regfree(&my_instance->nore);
-            }
+        if (!error && my_instance->log_type == QLA_LOG_UNIFIED &&
+            (my_instance->writer = qla_writer_start(my_instance->filebase, my_instance->format,
+                                                    block, queue_size, rotate_size)) == NULL)
+        {
+            error = true;
+        }
+
+        if (error)
+        {
+            mxs_pcre2_set_free(my_instance->patterns);
+            free(my_instance->match);
+            free(my_instance->nomatch);
             free(my_instance->filebase);
             free(my_instance->source);
             free(my_instance->userName);
@@ -324,6 +1067,15 @@ newSession(FILTER *instance, SESSION *session)
             free(my_session);
             return NULL;
         }
+
+        if (my_instance->patterns &&
+            (my_session->match_state = mxs_pcre2_set_state_alloc()) == NULL)
+        {
+            MXS_ERROR("qlafilter: Memory allocation for the matching state failed.");
+            free(my_session->filename);
+            free(my_session);
+            return NULL;
+        }
         my_session->active = 1;
 
         remote = session_get_remote(session);
@@ -348,7 +1100,7 @@ newSession(FILTER *instance, SESSION *session)
         // Multiple sessions can try to update my_instance->sessions simultaneously
         atomic_add(&(my_instance->sessions), 1);
 
-        if (my_session->active)
+        if (my_session->active && my_instance->writer == NULL)
         {
             my_session->fp = fopen(my_session->filename, "w");
 
@@ -359,6 +1111,7 @@ newSession(FILTER *instance, SESSION *session)
                           "fileter failed due to %d, %s",
                           errno,
                           strerror_r(errno, errbuf, sizeof(errbuf)));
+                mxs_pcre2_set_state_free(my_session->match_state);
                 free(my_session->filename);
                 free(my_session);
                 my_session = NULL;
@@ -407,6 +1160,7 @@ freeSession(FILTER *instance, void *session)
     QLA_SESSION *my_session = (QLA_SESSION *) session;
 
     free(my_session->filename);
+    mxs_pcre2_set_state_free(my_session->match_state);
     free(session);
     return;
 }
@@ -455,17 +1209,43 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
         }
         if ((ptr = modutil_get_SQL(queue)) != NULL)
         {
-            if ((my_instance->match == NULL ||
-                 regexec(&my_instance->re, ptr, 0, NULL, 0) == 0) &&
-                (my_instance->nomatch == NULL ||
-                 regexec(&my_instance->nore, ptr, 0, NULL, 0) != 0))
+            if (my_instance->patterns == NULL ||
+                (mxs_pcre2_set_match(my_instance->patterns, my_session->match_state,
+                                     ptr, strlen(ptr)) >= 0 &&
+                 (my_instance->match_id == -1 ||
+                  mxs_pcre2_set_matched(my_session->match_state, my_instance->match_id)) &&
+                 (my_instance->nomatch_id == -1 ||
+                  !mxs_pcre2_set_matched(my_session->match_state, my_instance->nomatch_id))))
             {
-                char buffer[QLA_STRING_BUFFER_SIZE];
-                gettimeofday(&tv, NULL);
-                localtime_r(&tv.tv_sec, &t);
-                strftime(buffer, sizeof(buffer), "%F %T", &t);
-                fprintf(my_session->fp, "%s,%s@%s,%s\n", buffer, my_session->user,
-                        my_session->remote, trim(squeeze_whitespace(ptr)));
+                char *sql = trim(squeeze_whitespace(ptr));
+
+                if (my_instance->writer)
+                {
+                    qla_writer_push(my_instance->writer, my_session, sql);
+                }
+                else if (my_instance->format == QLA_FORMAT_BINARY)
+                {
+                    QLA_RECORD *record = qla_record_alloc(my_session, sql);
+                    uint8_t *buffer = record ? malloc(qla_binary_size(record)) : NULL;
+
+                    if (buffer)
+                    {
+                        qla_binary_encode(record, buffer);
+                        fwrite(buffer, 1, qla_binary_size(record), my_session->fp);
+                    }
+
+                    free(buffer);
+                    free(record);
+                }
+                else
+                {
+                    char buffer[QLA_STRING_BUFFER_SIZE];
+                    gettimeofday(&tv, NULL);
+                    localtime_r(&tv.tv_sec, &t);
+                    strftime(buffer, sizeof(buffer), "%F %T", &t);
+                    fprintf(my_session->fp, "%s,%s@%s,%s\n", buffer, my_session->user,
+                            my_session->remote, sql);
+                }
             }
             free(ptr);
         }
@@ -492,7 +1272,16 @@ diagnostic(FILTER *instance, void *fsession, DCB *dcb)
     QLA_INSTANCE *my_instance = (QLA_INSTANCE *) instance;
     QLA_SESSION *my_session = (QLA_SESSION *) fsession;
 
-    if (my_session)
+    if (my_instance->writer)
+    {
+        dcb_printf(dcb, "\t\tLogging to file            %s.\n",
+                   my_instance->writer->filename);
+        dcb_printf(dcb, "\t\tQueries logged             %d\n",
+                   my_instance->writer->logged);
+        dcb_printf(dcb, "\t\tQueries dropped            %d\n",
+                   my_instance->writer->dropped);
+    }
+    else if (my_session)
     {
         dcb_printf(dcb, "\t\tLogging to file            %s.\n",
                    my_session->filename);
@@ -11,7 +11,6 @@
  * Public License.
  */
 
-#define PCRE2_CODE_UNIT_WIDTH 8
 #include <stdio.h>
 #include <filter.h>
 #include <modinfo.h>
@@ -19,7 +18,7 @@
 #include <skygw_utils.h>
 #include <log_manager.h>
 #include <string.h>
-#include <pcre2.h>
+#include <maxscale_pcre2.h>
 #include <atomic.h>
 #include "maxconfig.h"
 
@@ -58,8 +57,8 @@ static void setDownstream(FILTER *instance, void *fsession, DOWNSTREAM *downstre
 static int routeQuery(FILTER *instance, void *fsession, GWBUF *queue);
 static void diagnostic(FILTER *instance, void *fsession, DCB *dcb);
 
-static char *regex_replace(const char *sql, pcre2_code *re, pcre2_match_data *study,
-                           const char *replace);
+static char *regex_replace(const char *sql, size_t len, pcre2_code *re,
+                           const char *literal, bool caseless, const char *replace);
 
 static FILTER_OBJECT MyObject =
 {
@@ -84,7 +83,8 @@ typedef struct
     char *match; /*< Regular expression to match */
     char *replace; /*< Replacement text */
     pcre2_code *re; /*< Compiled regex text */
-    pcre2_match_data *match_data; /*< Matching data used by the compiled regex */
+    char *literal; /*< Literal text every match starts with, may be NULL */
+    bool caseless; /*< Whether the regex ignores case */
     FILE* logfile; /*< Log file */
     bool log_trace; /*< Whether messages should be printed to tracelog */
 } REGEX_INSTANCE;
@@ -154,11 +154,7 @@ void free_instance(REGEX_INSTANCE *instance)
             pcre2_code_free(instance->re);
         }
 
-        if (instance->match_data)
-        {
-            pcre2_match_data_free(instance->match_data);
-        }
-
+        free(instance->literal);
         free(instance->match);
         free(instance->replace);
         free(instance->source);
@@ -268,12 +264,8 @@ createInstance(char **options, FILTER_PARAMETER **params)
             return NULL;
         }
 
-        if ((my_instance->re = pcre2_compile((PCRE2_SPTR) my_instance->match,
-                                             PCRE2_ZERO_TERMINATED,
-                                             cflags,
-                                             &errnumber,
-                                             &erroffset,
-                                             NULL)) == NULL)
+        if ((my_instance->re = mxs_pcre2_compile(my_instance->match, cflags,
+                                                 &errnumber, &erroffset)) == NULL)
         {
             char errbuffer[1024];
             pcre2_get_error_message(errnumber, (PCRE2_UCHAR*) & errbuffer, sizeof(errbuffer));
@@ -283,14 +275,8 @@ createInstance(char **options, FILTER_PARAMETER **params)
             return NULL;
         }
 
-        if ((my_instance->match_data =
-                 pcre2_match_data_create_from_pattern(my_instance->re, NULL)) == NULL)
-        {
-            MXS_ERROR("regexfilter: Failure to create PCRE2 matching data. "
-                      "This is most likely caused by a lack of available memory.");
-            free_instance(my_instance);
-            return NULL;
-        }
+        my_instance->literal = mxs_pcre2_literal_prefix(my_instance->match, cflags);
+        my_instance->caseless = cflags & PCRE2_CASELESS;
     }
     return (FILTER *) my_instance;
 }
@@ -397,9 +383,10 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
         }
         if ((sql = modutil_get_SQL(queue)) != NULL)
         {
-            newsql = regex_replace(sql,
+            newsql = regex_replace(sql, strlen(sql),
                                    my_instance->re,
-                                   my_instance->match_data,
+                                   my_instance->literal,
+                                   my_instance->caseless,
                                    my_instance->replace);
             if (newsql)
             {
@@ -469,37 +456,53 @@ diagnostic(FILTER *instance, void *fsession, DCB *dcb)
 /**
  * Perform a regular expression match and substitution on the SQL
  *
+ * The SQL is first searched for the literal text the regex starts with and
+ * the regex engine is only invoked if the literal is found. The matching
+ * uses the match data of the calling thread so sessions on different threads
+ * never share it.
+ *
  * @param   sql The original SQL text
+ * @param   len Length of the SQL text
  * @param   re  The compiled regular expression
- * @param   match_data The PCRE2 matching data buffer
+ * @param   literal The literal prefix of the regex or NULL if it has none
+ * @param   caseless Whether the regex ignores case
  * @param   replace The replacement text
  * @return  The replaced text or NULL if no replacement was done.
  */
 static char *
-regex_replace(const char *sql, pcre2_code *re, pcre2_match_data *match_data, const char *replace)
+regex_replace(const char *sql, size_t len, pcre2_code *re, const char *literal,
+              bool caseless, const char *replace)
 {
     char *result = NULL;
     size_t result_size;
+    pcre2_match_data *match_data;
+
+    if (literal && !mxs_pcre2_literal_search(literal, caseless, sql, len))
+    {
+        return NULL;
+    }
 
-    /** This should never fail with rc == 0 because we used pcre2_match_data_create_from_pattern() */
-    if (pcre2_match(re, (PCRE2_SPTR) sql, PCRE2_ZERO_TERMINATED, 0, 0, match_data, NULL))
+    if ((match_data = mxs_pcre2_thread_match_data(re)) &&
+        pcre2_match(re, (PCRE2_SPTR) sql, len, 0, 0, match_data, NULL) >= 0)
     {
-        result_size = strlen(sql) + strlen(replace);
-        result = malloc(result_size);
+        size_t size = len + strlen(replace) + 1;
+        result = malloc(size);
+        result_size = size;
 
+        /** pcre2_substitute overwrites result_size so the buffer size is kept separately */
         while (result &&
-               pcre2_substitute(re, (PCRE2_SPTR) sql, PCRE2_ZERO_TERMINATED, 0,
+               pcre2_substitute(re, (PCRE2_SPTR) sql, len, 0,
                                 PCRE2_SUBSTITUTE_GLOBAL, match_data, NULL,
                                 (PCRE2_SPTR) replace, PCRE2_ZERO_TERMINATED,
                                 (PCRE2_UCHAR*) result, (PCRE2_SIZE*) & result_size) == PCRE2_ERROR_NOMEMORY)
         {
             char *tmp;
-            if ((tmp = realloc(result, (result_size *= 1.5))) == NULL)
+            if ((tmp = realloc(result, (size *= 2))) == NULL)
             {
                 free(result);
-                result = NULL;
             }
             result = tmp;
+            result_size = size;
         }
     }
     return result;
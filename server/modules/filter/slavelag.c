@@ -19,7 +19,7 @@
 #include <string.h>
 #include <hint.h>
 #include <query_classifier.h>
-#include <regex.h>
+#include <maxscale_pcre2.h>
 
 /**
  * @file slavelag.c - a very simple filter designed to send queries to the
@@ -36,6 +36,9 @@
  *      match=<regex>               Regex for matching
  *      ignore=<regex>              Regex for ignoring
  *
+ * The regular expressions use the PCRE2 syntax. Before MaxScale 2.0 they used
+ * the POSIX basic syntax where + ? | ( ) { } match themselves.
+ *
  * The filter also has two options:
  *     @c case, which makes the regex case-sensitive, and
  *     @c ignorecase, which does the opposite.
@@ -97,8 +100,11 @@ typedef struct
     int count;       /*< Number of hints to add after each operation
                      * that modifies data. */
     LAGSTATS stats;
-    regex_t re;      /* Compiled regex text of match */
-    regex_t nore;    /* Compiled regex text of ignore */
+    pcre2_code *re;  /* Compiled regex text of match */
+    pcre2_code *nore; /* Compiled regex text of ignore */
+    char *literal;   /* Literal text every match of re starts with, may be NULL */
+    char *noliteral; /* Literal text every match of nore starts with, may be NULL */
+    bool caseless;   /* Whether the regexes ignore case */
 } LAG_INSTANCE;
 
 /**
@@ -205,11 +211,11 @@ createInstance(char **options, FILTER_PARAMETER **params)
             {
                 if (!strcasecmp(options[i], "ignorecase"))
                 {
-                    cflags |= REG_ICASE;
+                    cflags |= PCRE2_CASELESS;
                 }
                 else if (!strcasecmp(options[i], "case"))
                 {
-                    cflags &= ~REG_ICASE;
+                    cflags &= ~PCRE2_CASELESS;
                 }
                 else
                 {
@@ -218,20 +224,48 @@ createInstance(char **options, FILTER_PARAMETER **params)
             }
         }
 
+        int errnumber;
+        size_t erroffset;
+        bool error = false;
+
         if (my_instance->match)
         {
-            if (regcomp(&my_instance->re, my_instance->match, cflags))
+            if ((my_instance->re = mxs_pcre2_compile(my_instance->match, cflags,
+                                                     &errnumber, &erroffset)) == NULL)
             {
-                MXS_ERROR("lagfilter: Failed to compile regex '%s'.", my_instance->match);
+                MXS_ERROR("lagfilter: Failed to compile regex '%s' at %lu.",
+                          my_instance->match, erroffset);
+                error = true;
             }
+
+            my_instance->literal = mxs_pcre2_literal_prefix(my_instance->match, cflags);
         }
 
         if (my_instance->nomatch)
         {
-            if (regcomp(&my_instance->nore, my_instance->nomatch, cflags))
+            if ((my_instance->nore = mxs_pcre2_compile(my_instance->nomatch, cflags,
+                                                       &errnumber, &erroffset)) == NULL)
             {
-                MXS_ERROR("lagfilter: Failed to compile regex '%s'.", my_instance->nomatch);
+                MXS_ERROR("lagfilter: Failed to compile regex '%s' at %lu.",
+                          my_instance->nomatch, erroffset);
+                error = true;
             }
+
+            my_instance->noliteral = mxs_pcre2_literal_prefix(my_instance->nomatch, cflags);
+        }
+
+        my_instance->caseless = cflags & PCRE2_CASELESS;
+
+        if (error)
+        {
+            pcre2_code_free(my_instance->re);
+            pcre2_code_free(my_instance->nore);
+            free(my_instance->literal);
+            free(my_instance->noliteral);
+            free(my_instance->match);
+            free(my_instance->nomatch);
+            free(my_instance);
+            my_instance = NULL;
         }
     }
 
@@ -301,6 +335,34 @@ setDownstream(FILTER *instance, void *session, DOWNSTREAM *downstream)
     my_session->down = *downstream;
 }
 
+/**
+ * Check whether the SQL matches a regular expression
+ *
+ * If the regular expression has a literal prefix, the SQL is searched for it
+ * before the regular expression is matched. The match data of the calling
+ * thread is used for the matching.
+ *
+ * @param re The compiled regular expression
+ * @param literal The literal prefix of the regular expression or NULL
+ * @param caseless Whether the regular expression ignores case
+ * @param sql The SQL text
+ * @param len Length of the SQL text
+ * @return True if the SQL matches
+ */
+static bool
+regex_match(pcre2_code *re, const char *literal, bool caseless, const char *sql, size_t len)
+{
+    pcre2_match_data *mdata;
+
+    if (literal && !mxs_pcre2_literal_search(literal, caseless, sql, len))
+    {
+        return false;
+    }
+
+    return (mdata = mxs_pcre2_thread_match_data(re)) &&
+           pcre2_match(re, (PCRE2_SPTR) sql, len, 0, 0, mdata, NULL) >= 0;
+}
+
 /**
  * The routeQuery entry point. This is passed the query buffer
  * to which the filter should be applied. Once applied the
@@ -334,11 +396,15 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
         {
             if ((sql = modutil_get_SQL(queue)) != NULL)
             {
+                size_t len = strlen(sql);
+
                 if (my_instance->nomatch == NULL ||
-                    (my_instance->nomatch && regexec(&my_instance->nore, sql, 0, NULL, 0) != 0))
+                    !regex_match(my_instance->nore, my_instance->noliteral,
+                                 my_instance->caseless, sql, len))
                 {
                     if (my_instance->match == NULL ||
-                        (my_instance->match && regexec(&my_instance->re, sql, 0, NULL, 0) == 0))
+                        regex_match(my_instance->re, my_instance->literal,
+                                    my_instance->caseless, sql, len))
                     {
                         my_session->hints_left = my_instance->count;
                         my_session->last_modification = now;
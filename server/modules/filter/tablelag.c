@@ -0,0 +1,646 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+#include <stdio.h>
+#include <ctype.h>
+#include <filter.h>
+#include <modinfo.h>
+#include <modutil.h>
+#include <skygw_utils.h>
+#include <log_manager.h>
+#include <string.h>
+#include <hint.h>
+#include <hashtable.h>
+#include <spinlock.h>
+#include <atomic.h>
+#include <hk_heartbeat.h>
+#include <query_classifier.h>
+#include <monitor.h>
+#include <service.h>
+
+/**
+ * @file tablelag.c - a filter that lets reads go to a slave only if the slave
+ * has replicated the latest writes to the tables being read.
+ *
+ * @verbatim
+ *
+ * The filter records the time of the latest write to each table that passes
+ * through the service. The replication lag measured by the monitor is in whole
+ * seconds and can be up to one monitor interval old, and a lag at or below the
+ * interval is reported as zero. A slave whose reported lag is at most max_lag
+ * is therefore known to have applied the writes done more than max_lag seconds
+ * plus two monitor intervals ago.
+ *
+ * A read of a table written to more recently than that is routed to the master.
+ * A read of a table written to less than window seconds ago gets a
+ * max_slave_replication_lag hint of max_lag so that it only goes to slaves
+ * within the lag bound. If the lag of the servers is not measured, all reads
+ * of tables written to within the window are routed to the master.
+ *
+ * Two optional parameters:
+ *
+ *      window=<seconds>    How long writes are tracked, 60 seconds by default
+ *      max_lag=<seconds>   The lag bound of the slaves, 10 seconds by default
+ *
+ * @endverbatim
+ */
+
+MODULE_INFO info =
+{
+    MODULE_API_FILTER,
+    MODULE_GA,
+    FILTER_VERSION,
+    "A routing hint filter that limits the replication lag of slaves based on table writes"
+};
+
+static char *version_str = "V1.0.0";
+
+/** Default number of seconds writes are tracked */
+#define TABLELAG_DEFAULT_WINDOW 60
+
+/** Default replication lag bound in seconds */
+#define TABLELAG_DEFAULT_MAX_LAG 10
+
+/** Number of hkheartbeat ticks in a second */
+#define TABLELAG_TICKS 10
+
+static  FILTER *createInstance(char **options, FILTER_PARAMETER **params);
+static  void   *newSession(FILTER *instance, SESSION *session);
+static  void   closeSession(FILTER *instance, void *session);
+static  void   freeSession(FILTER *instance, void *session);
+static  void   setDownstream(FILTER *instance, void *fsession, DOWNSTREAM *downstream);
+static  int    routeQuery(FILTER *instance, void *fsession, GWBUF *queue);
+static  void   diagnostic(FILTER *instance, void *fsession, DCB *dcb);
+
+
+static FILTER_OBJECT MyObject =
+{
+    createInstance,
+    newSession,
+    closeSession,
+    freeSession,
+    setDownstream,
+    NULL,               // No Upstream requirement
+    routeQuery,
+    NULL,
+    diagnostic,
+};
+
+/**
+ * The latest write to a table
+ */
+typedef struct table_write
+{
+    long               last_write; /*< The hkheartbeat of the latest write */
+    struct table_write *next;      /*< The next expired entry waiting to be freed */
+} TABLE_WRITE;
+
+typedef struct tablelagstats
+{
+    int n_writes;      /*< No. of writes recorded */
+    int n_lag_hints;   /*< No. of reads limited to slaves with a small enough lag */
+    int n_master;      /*< No. of reads routed to the master */
+    int n_unhinted;    /*< No. of reads without recent writes to their tables */
+} TABLELAGSTATS;
+
+/**
+ * Instance structure
+ */
+typedef struct
+{
+    HASHTABLE   *tables;       /*< Table name to TABLE_WRITE */
+    SPINLOCK    lock;          /*< Serializes the writers of the tables */
+    int         window;        /*< Seconds after a write during which reads are hinted */
+    int         max_lag;       /*< Replication lag bound of the slaves in seconds */
+    int         warned;        /*< Whether the missing lag detection has been logged */
+    long        expire_ticks;  /*< Writes this old no longer affect any read */
+    long        next_prune;    /*< The hkheartbeat of the next removal of old writes */
+    TABLE_WRITE *expired;      /*< Removed entries that readers may still be using */
+    TABLELAGSTATS stats;
+} TABLELAG_INSTANCE;
+
+/**
+ * The session structure for this filter
+ */
+typedef struct
+{
+    DOWNSTREAM down;              /*< The downstream filter */
+    SERVICE    *service;          /*< The service of the session, NULL if unknown */
+    long       master_ticks;      /*< Reads of tables written this recently go to the master */
+} TABLELAG_SESSION;
+
+/**
+ * Implementation of the mandatory version entry point
+ *
+ * @return version string of the module
+ */
+char *
+version()
+{
+    return version_str;
+}
+
+/**
+ * The module initialisation routine, called when the module
+ * is first loaded.
+ * @see function load_module in load_utils.c for explanation of lint
+ */
+/*lint -e14 */
+void
+ModuleInit()
+{
+}
+/*lint +e14 */
+
+/**
+ * The module entry point routine. It is this routine that
+ * must populate the structure that is referred to as the
+ * "module object", this is a structure with the set of
+ * external entry points for this module.
+ *
+ * @return The module object
+ */
+FILTER_OBJECT *
+GetModuleObject()
+{
+    return &MyObject;
+}
+
+/**
+ * Create an instance of the filter for a particular service
+ * within MaxScale.
+ *
+ * @param options   The options for this filter
+ * @param params    The array of name/value pair parameters for the filter
+ *
+ * @return The instance data for this new instance
+ */
+static FILTER *
+createInstance(char **options, FILTER_PARAMETER **params)
+{
+    TABLELAG_INSTANCE *my_instance;
+
+    if ((my_instance = calloc(1, sizeof(TABLELAG_INSTANCE))) != NULL)
+    {
+        bool error = false;
+        my_instance->window = TABLELAG_DEFAULT_WINDOW;
+        my_instance->max_lag = TABLELAG_DEFAULT_MAX_LAG;
+        spinlock_init(&my_instance->lock);
+
+        for (int i = 0; params && params[i]; i++)
+        {
+            if (!strcmp(params[i]->name, "window"))
+            {
+                my_instance->window = atoi(params[i]->value);
+
+                if (my_instance->window <= 0)
+                {
+                    MXS_ERROR("tablelag: Invalid value for 'window': %s", params[i]->value);
+                    error = true;
+                }
+            }
+            else if (!strcmp(params[i]->name, "max_lag"))
+            {
+                my_instance->max_lag = atoi(params[i]->value);
+
+                if (my_instance->max_lag <= 0)
+                {
+                    MXS_ERROR("tablelag: Invalid value for 'max_lag': %s", params[i]->value);
+                    error = true;
+                }
+            }
+            else if (!filter_standard_parameter(params[i]->name))
+            {
+                MXS_ERROR("tablelag: Unexpected parameter '%s'.", params[i]->name);
+                error = true;
+            }
+        }
+
+        if ((my_instance->tables = hashtable_alloc(100, simple_str_hash, strcmp)) == NULL)
+        {
+            error = true;
+        }
+        else
+        {
+            /** The values are freed by prune_writes() */
+            hashtable_memory_fns(my_instance->tables, (HASHMEMORYFN)strdup, NULL,
+                                 (HASHMEMORYFN)free, NULL);
+        }
+
+        my_instance->expire_ticks = (long)my_instance->window * TABLELAG_TICKS;
+        my_instance->next_prune = hkheartbeat + my_instance->expire_ticks;
+
+        if (error)
+        {
+            hashtable_free(my_instance->tables);
+            free(my_instance);
+            my_instance = NULL;
+        }
+    }
+
+    return (FILTER *)my_instance;
+}
+
+/**
+ * Associate a new session with this instance of the filter.
+ *
+ * The time during which reads of written tables are routed to the master is
+ * calculated from the monitor intervals of the servers of the service. If a
+ * server's replication lag is not measured, a warning is logged once.
+ *
+ * @param instance  The filter instance data
+ * @param session   The session itself
+ *
+ * @return Session specific data for this session
+ */
+static void *
+newSession(FILTER *instance, SESSION *session)
+{
+    TABLELAG_INSTANCE *my_instance = (TABLELAG_INSTANCE *)instance;
+    TABLELAG_SESSION *my_session = calloc(1, sizeof(TABLELAG_SESSION));
+
+    if (my_session)
+    {
+        size_t interval = 0;
+
+        my_session->service = session->service;
+
+        for (SERVER_REF *ref = session->service ? session->service->dbref : NULL; ref; ref = ref->next)
+        {
+            size_t server_interval = monitor_get_server_interval(ref->server);
+
+            if (server_interval > interval)
+            {
+                interval = server_interval;
+            }
+
+            if (!monitor_server_detects_lag(ref->server) &&
+                atomic_add(&my_instance->warned, 1) == 0)
+            {
+                MXS_WARNING("tablelag: The replication lag of server '%s' of service '%s' "
+                            "is not measured. Reads of tables written to within the window "
+                            "are routed to the master. Enable detect_replication_lag in "
+                            "the monitor of the server.",
+                            ref->server->unique_name, session->service->name);
+            }
+        }
+
+        /** One second is added for the rounding of the lag to whole seconds */
+        my_session->master_ticks = (long)(my_instance->max_lag + 1) * TABLELAG_TICKS +
+                                   2 * interval * TABLELAG_TICKS / 1000;
+
+        spinlock_acquire(&my_instance->lock);
+
+        if (my_session->master_ticks > my_instance->expire_ticks)
+        {
+            my_instance->expire_ticks = my_session->master_ticks;
+        }
+
+        spinlock_release(&my_instance->lock);
+    }
+
+    return my_session;
+}
+
+/**
+ * Close a session with the filter, this is the mechanism
+ * by which a filter may cleanup data structure etc.
+ *
+ * @param instance  The filter instance data
+ * @param session   The session being closed
+ */
+static  void
+closeSession(FILTER *instance, void *session)
+{
+}
+
+/**
+ * Free the memory associated with this filter session.
+ *
+ * @param instance  The filter instance data
+ * @param session   The session being closed
+ */
+static void
+freeSession(FILTER *instance, void *session)
+{
+    free(session);
+}
+
+/**
+ * Set the downstream component for this filter.
+ *
+ * @param instance    The filter instance data
+ * @param session     The session being closed
+ * @param downstream  The downstream filter or router
+ */
+static void
+setDownstream(FILTER *instance, void *session, DOWNSTREAM *downstream)
+{
+    TABLELAG_SESSION *my_session = (TABLELAG_SESSION *)session;
+
+    my_session->down = *downstream;
+}
+
+/**
+ * Convert a table name to lower case
+ *
+ * Tables with the same name in different databases and tables whose names
+ * differ only by case share the same entry. This only makes the routing more
+ * conservative.
+ *
+ * @param name Table name to convert
+ */
+static void
+table_name_normalize(char *name)
+{
+    for (char *ptr = name; *ptr; ptr++)
+    {
+        *ptr = tolower((unsigned char)*ptr);
+    }
+}
+
+/**
+ * Remove the tables whose latest write no longer affects any read
+ *
+ * Readers use the entries without the lock, so a removed entry is freed only
+ * on the next pruning, which is at least one window later. The caller must
+ * hold the instance lock.
+ *
+ * @param my_instance The filter instance
+ * @param now The current hkheartbeat
+ */
+static void
+prune_writes(TABLELAG_INSTANCE *my_instance, long now)
+{
+    while (my_instance->expired)
+    {
+        TABLE_WRITE *table = my_instance->expired;
+        my_instance->expired = table->next;
+        free(table);
+    }
+
+    int n_tables = hashtable_size(my_instance->tables);
+    char **names = n_tables > 0 ? malloc(n_tables * sizeof(char*)) : NULL;
+    HASHITERATOR *iter = names ? hashtable_iterator(my_instance->tables) : NULL;
+    int n_names = 0;
+
+    if (iter)
+    {
+        char *name;
+
+        while (n_names < n_tables && (name = hashtable_next(iter)))
+        {
+            TABLE_WRITE *table = hashtable_fetch(my_instance->tables, name);
+
+            if (table && now - table->last_write >= my_instance->expire_ticks)
+            {
+                names[n_names++] = strdup(name);
+            }
+        }
+
+        hashtable_iterator_free(iter);
+    }
+
+    for (int i = 0; i < n_names; i++)
+    {
+        TABLE_WRITE *table = hashtable_fetch(my_instance->tables, names[i]);
+
+        if (table && hashtable_delete(my_instance->tables, names[i]))
+        {
+            table->next = my_instance->expired;
+            my_instance->expired = table;
+        }
+
+        free(names[i]);
+    }
+
+    free(names);
+    my_instance->next_prune = now + my_instance->expire_ticks;
+}
+
+/**
+ * Record a write to the tables of a query
+ *
+ * The writes are serialized so that an entry is never updated while it is
+ * being removed.
+ *
+ * @param my_instance The filter instance
+ * @param names Names of the tables
+ * @param n_names Number of names
+ */
+static void
+record_write(TABLELAG_INSTANCE *my_instance, char **names, int n_names)
+{
+    long now = hkheartbeat;
+
+    spinlock_acquire(&my_instance->lock);
+
+    if (now >= my_instance->next_prune)
+    {
+        prune_writes(my_instance, now);
+    }
+
+    for (int i = 0; i < n_names; i++)
+    {
+        TABLE_WRITE *table = hashtable_fetch(my_instance->tables, names[i]);
+
+        if (table == NULL && (table = malloc(sizeof(TABLE_WRITE))) != NULL)
+        {
+            table->last_write = now;
+            table->next = NULL;
+
+            if (!hashtable_add(my_instance->tables, names[i], table))
+            {
+                free(table);
+                table = NULL;
+            }
+        }
+
+        if (table)
+        {
+            table->last_write = now;
+        }
+    }
+
+    spinlock_release(&my_instance->lock);
+
+    atomic_add(&my_instance->stats.n_writes, 1);
+}
+
+/**
+ * Check whether the replication lag of all servers of a service is measured
+ *
+ * A server whose lag is not measured, or could not be measured in the
+ * latest monitoring round, has a negative lag and passes any lag limit in
+ * the router.
+ *
+ * @param service The service, NULL if unknown
+ * @return True if the lag of all servers is measured
+ */
+static bool
+lag_measured(SERVICE *service)
+{
+    bool measured = service && service->dbref;
+
+    for (SERVER_REF *ref = service ? service->dbref : NULL; ref && measured; ref = ref->next)
+    {
+        if (ref->server->rlag < 0)
+        {
+            measured = false;
+        }
+    }
+
+    return measured;
+}
+
+/**
+ * Add a routing hint to a read based on the latest writes to its tables
+ *
+ * @param my_instance The filter instance
+ * @param my_session The filter session
+ * @param queue The read
+ * @param names Names of the tables
+ * @param n_names Number of names
+ */
+static void
+add_lag_hint(TABLELAG_INSTANCE *my_instance, TABLELAG_SESSION *my_session, GWBUF *queue,
+             char **names, int n_names)
+{
+    long now = hkheartbeat;
+    long last_write = -1;
+
+    for (int i = 0; i < n_names; i++)
+    {
+        TABLE_WRITE *table = hashtable_fetch(my_instance->tables, names[i]);
+
+        if (table && table->last_write > last_write)
+        {
+            last_write = table->last_write;
+        }
+    }
+
+    /** Reads are never left unhinted while the write can still be missing
+     * from slaves within the lag bound, even with a short window */
+    long window = (long)my_instance->window * TABLELAG_TICKS;
+
+    if (window < my_session->master_ticks)
+    {
+        window = my_session->master_ticks;
+    }
+
+    if (last_write < 0 || now - last_write >= window)
+    {
+        atomic_add(&my_instance->stats.n_unhinted, 1);
+        return;
+    }
+
+    if (now - last_write < my_session->master_ticks || !lag_measured(my_session->service))
+    {
+        queue->hint = hint_create_route(queue->hint, HINT_ROUTE_TO_MASTER, NULL);
+        atomic_add(&my_instance->stats.n_master, 1);
+    }
+    else
+    {
+        char value[32];
+        snprintf(value, sizeof(value), "%d", my_instance->max_lag);
+        queue->hint = hint_create_parameter(queue->hint, "max_slave_replication_lag", value);
+        atomic_add(&my_instance->stats.n_lag_hints, 1);
+    }
+}
+
+/**
+ * The routeQuery entry point. This is passed the query buffer
+ * to which the filter should be applied. Once applied the
+ * query should normally be passed to the downstream component
+ * (filter or router) in the filter chain.
+ *
+ * Writes update the write times of their tables and reads get a hint that
+ * limits the replication lag of the slave they can be routed to.
+ *
+ * @param instance  The filter instance data
+ * @param session   The filter session
+ * @param queue     The query data
+ */
+static int
+routeQuery(FILTER *instance, void *session, GWBUF *queue)
+{
+    TABLELAG_INSTANCE *my_instance = (TABLELAG_INSTANCE *)instance;
+    TABLELAG_SESSION  *my_session = (TABLELAG_SESSION *)session;
+
+    if (modutil_is_SQL(queue))
+    {
+        if (queue->next != NULL)
+        {
+            queue = gwbuf_make_contiguous(queue);
+        }
+
+        uint32_t type = qc_get_type(queue);
+        bool is_write = QUERY_IS_TYPE(type, QUERY_TYPE_WRITE);
+
+        if (is_write || QUERY_IS_TYPE(type, QUERY_TYPE_READ))
+        {
+            int n_names = 0;
+            char **names = qc_get_table_names(queue, &n_names, false);
+
+            for (int i = 0; i < n_names; i++)
+            {
+                table_name_normalize(names[i]);
+            }
+
+            if (is_write)
+            {
+                record_write(my_instance, names, n_names);
+            }
+            else
+            {
+                add_lag_hint(my_instance, my_session, queue, names, n_names);
+            }
+
+            for (int i = 0; i < n_names; i++)
+            {
+                free(names[i]);
+            }
+            free(names);
+        }
+    }
+
+    return my_session->down.routeQuery(my_session->down.instance,
+                                       my_session->down.session,
+                                       queue);
+}
+
+/**
+ * Diagnostics routine
+ *
+ * If fsession is NULL then print diagnostics on the filter
+ * instance as a whole, otherwise print diagnostics for the
+ * particular session.
+ *
+ * @param instance  The filter instance
+ * @param fsession  Filter session, may be NULL
+ * @param dcb       The DCB for diagnostic output
+ */
+static void
+diagnostic(FILTER *instance, void *fsession, DCB *dcb)
+{
+    TABLELAG_INSTANCE *my_instance = (TABLELAG_INSTANCE *)instance;
+
+    dcb_printf(dcb, "\t\tWindow: %d seconds\n", my_instance->window);
+    dcb_printf(dcb, "\t\tMaximum replication lag: %d seconds\n", my_instance->max_lag);
+    dcb_printf(dcb, "\t\tNo. of tables written to: %d\n", hashtable_size(my_instance->tables));
+    dcb_printf(dcb, "\t\tNo. of writes: %d\n", my_instance->stats.n_writes);
+    dcb_printf(dcb, "\t\tNo. of reads with a replication lag hint: %d\n",
+               my_instance->stats.n_lag_hints);
+    dcb_printf(dcb, "\t\tNo. of reads routed to the master: %d\n", my_instance->stats.n_master);
+    dcb_printf(dcb, "\t\tNo. of reads without a hint: %d\n", my_instance->stats.n_unhinted);
+}
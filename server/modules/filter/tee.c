@@ -29,6 +29,11 @@
  *          of the request (optional)
  * user     A user name to match against. If present only requests that
  *          originate from this user will be duplciated (optional)
+ * async    Do not wait for the branch to reply before replying to the
+ *          client. The duplicates are queued for the branch and sent one
+ *          at a time (optional)
+ * queue_size Number of duplicates queued for the branch in async mode
+ *          before new duplicates are dropped (optional)
  *
  * Revision History
  * ================
@@ -49,7 +54,7 @@
 #include <skygw_utils.h>
 #include <log_manager.h>
 #include <sys/time.h>
-#include <regex.h>
+#include <maxscale_pcre2.h>
 #include <string.h>
 #include <service.h>
 #include <router.h>
@@ -75,6 +80,9 @@
 #define PARENT                          0
 #define CHILD                           1
 
+/** Default number of duplicates queued for the branch in async mode */
+#define TEE_DEFAULT_QUEUE_SIZE          100
+
 #ifdef SS_DEBUG
 static int debug_seq = 0;
 #endif
@@ -139,9 +147,13 @@ typedef struct
     char *source; /* The source of the client connection */
     char *userName; /* The user name to filter on */
     char *match; /* Optional text to match against */
-    regex_t re; /* Compiled regex text */
     char *nomatch; /* Optional text to match against for exclusion */
-    regex_t nore; /* Compiled regex nomatch text */
+    MXS_PCRE2_SET *patterns; /* The match and nomatch patterns */
+    int match_id; /* ID of the match pattern or -1 */
+    int nomatch_id; /* ID of the nomatch pattern or -1 */
+    bool async; /* Reply to the client without waiting for the branch */
+    int queue_size; /* Maximum number of queued duplicates in async mode */
+    int n_dropped; /* Number of duplicates dropped in all sessions */
 } TEE_INSTANCE;
 
 /**
@@ -177,6 +189,12 @@ typedef struct
     GWBUF* queue;
     SPINLOCK tee_lock;
     DCB* client_dcb;
+    MXS_PCRE2_SET_STATE *match_state; /* State for matching the patterns */
+    GWBUF* branch_queue; /* Duplicates waiting to be sent to the branch in async mode */
+    int n_branch_queued; /* Number of duplicates in branch_queue */
+    int n_dropped; /* Number of duplicates dropped because the queue was full */
+    unsigned char branch_command; /* Command the branch is executing in async mode */
+    bool branch_stopped; /* Duplication stopped after a session command was dropped */
 
 #ifdef SS_DEBUG
     long d_id;
@@ -207,7 +225,11 @@ int route_single_query(TEE_INSTANCE* my_instance,
                        GWBUF* buffer,
                        GWBUF* clone);
 int reset_session_state(TEE_SESSION* my_session, GWBUF* buffer);
+void reset_branch_state(TEE_SESSION* my_session, int branch, unsigned char command);
 void create_orphan(SESSION* ses);
+static GWBUF* branch_enqueue(TEE_SESSION* my_session, GWBUF* clone);
+static GWBUF* branch_next(TEE_SESSION* my_session);
+static void branch_route(TEE_SESSION* my_session, GWBUF* buffer);
 
 static void
 orphan_free(void* data)
@@ -370,6 +392,7 @@ createInstance(char **options, FILTER_PARAMETER **params)
         my_instance->userName = NULL;
         my_instance->match = NULL;
         my_instance->nomatch = NULL;
+        my_instance->queue_size = TEE_DEFAULT_QUEUE_SIZE;
         if (params)
         {
             for (i = 0; params[i]; i++)
@@ -398,6 +421,20 @@ createInstance(char **options, FILTER_PARAMETER **params)
                 {
                     my_instance->userName = strdup(params[i]->value);
                 }
+                else if (!strcmp(params[i]->name, "async"))
+                {
+                    my_instance->async = config_truth_value(params[i]->value);
+                }
+                else if (!strcmp(params[i]->name, "queue_size"))
+                {
+                    if ((my_instance->queue_size = atoi(params[i]->value)) <= 0)
+                    {
+                        MXS_ERROR("tee: Invalid value for 'queue_size': %s. "
+                                  "Using the default of %d.", params[i]->value,
+                                  TEE_DEFAULT_QUEUE_SIZE);
+                        my_instance->queue_size = TEE_DEFAULT_QUEUE_SIZE;
+                    }
+                }
                 else if (!filter_standard_parameter(params[i]->name))
                 {
                     MXS_ERROR("tee: Unexpected parameter '%s'.",
@@ -406,7 +443,7 @@ createInstance(char **options, FILTER_PARAMETER **params)
             }
         }
 
-        int cflags = REG_ICASE;
+        int cflags = PCRE2_CASELESS;
 
         if (options)
         {
@@ -414,15 +451,15 @@ createInstance(char **options, FILTER_PARAMETER **params)
             {
                 if (!strcasecmp(options[i], "ignorecase"))
                 {
-                    cflags |= REG_ICASE;
+                    cflags |= PCRE2_CASELESS;
                 }
                 else if (!strcasecmp(options[i], "case"))
                 {
-                    cflags &= ~REG_ICASE;
+                    cflags &= ~PCRE2_CASELESS;
                 }
                 else if (!strcasecmp(options[i], "extended"))
                 {
-                    cflags |= REG_EXTENDED;
+                    /** PCRE2 patterns always use the extended syntax */
                 }
                 else
                 {
@@ -440,34 +477,56 @@ createInstance(char **options, FILTER_PARAMETER **params)
             return NULL;
         }
 
-        if (my_instance->match &&
-            regcomp(&my_instance->re, my_instance->match, cflags))
+        my_instance->match_id = -1;
+        my_instance->nomatch_id = -1;
+
+        int errnumber;
+        size_t erroffset;
+        char errbuffer[1024];
+        bool error = false;
+
+        /** Both patterns are matched with one scan of the query */
+        if ((my_instance->match || my_instance->nomatch) &&
+            (my_instance->patterns = mxs_pcre2_set_alloc(cflags)) == NULL)
         {
+            MXS_ERROR("tee: Memory allocation failed.");
+            error = true;
+        }
+        else if (my_instance->match &&
+                 (my_instance->match_id = mxs_pcre2_set_add(my_instance->patterns, my_instance->match,
+                                                            &errnumber, &erroffset)) == -1)
+        {
+            pcre2_get_error_message(errnumber, (PCRE2_UCHAR*) errbuffer, sizeof(errbuffer));
             MXS_ERROR("tee: Invalid regular expression '%s'"
-                      " for the match parameter.",
-                      my_instance->match);
-            free(my_instance->match);
-            free(my_instance->nomatch);
-            free(my_instance->source);
-            free(my_instance);
-            return NULL;
+                      " for the match parameter at %lu: %s",
+                      my_instance->match, erroffset, errbuffer);
+            error = true;
         }
-        if (my_instance->nomatch &&
-            regcomp(&my_instance->nore, my_instance->nomatch, cflags))
+        else if (my_instance->nomatch &&
+                 (my_instance->nomatch_id = mxs_pcre2_set_add(my_instance->patterns, my_instance->nomatch,
+                                                              &errnumber, &erroffset)) == -1)
         {
+            pcre2_get_error_message(errnumber, (PCRE2_UCHAR*) errbuffer, sizeof(errbuffer));
             MXS_ERROR("tee: Invalid regular expression '%s'"
-                      " for the nomatch paramter.\n",
-                      my_instance->nomatch);
-            if (my_instance->match)
-            {
-                regfree(&my_instance->re);
-                free(my_instance->match);
-            }
+                      " for the nomatch paramter at %lu: %s",
+                      my_instance->nomatch, erroffset, errbuffer);
+            error = true;
+        }
+
+        if (error)
+        {
+            mxs_pcre2_set_free(my_instance->patterns);
+            free(my_instance->match);
             free(my_instance->nomatch);
             free(my_instance->source);
             free(my_instance);
             return NULL;
         }
+
+        if (my_instance->patterns)
+        {
+            mxs_pcre2_set_compile(my_instance->patterns);
+        }
     }
     return (FILTER *) my_instance;
 }
@@ -724,6 +783,11 @@ freeSession(FILTER *instance, void *session)
     {
         gwbuf_free(my_session->tee_replybuf);
     }
+    if (my_session->branch_queue)
+    {
+        gwbuf_free(my_session->branch_queue);
+    }
+    mxs_pcre2_set_state_free(my_session->match_state);
     free(session);
 
     orphan_free(NULL);
@@ -835,9 +899,7 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
     }
 
     /** Route query downstream */
-    spinlock_acquire(&my_session->tee_lock);
     rval = route_single_query(my_instance, my_session, buffer, clone);
-    spinlock_release(&my_session->tee_lock);
 
     return rval;
 }
@@ -945,7 +1007,6 @@ clientReply(FILTER* instance, void *session, GWBUF *reply)
     int more_results = 0;
 
     spinlock_acquire(&my_session->tee_lock);
-    int min_eof = my_session->command != 0x04 ? 2 : 1;
 
     if (!my_session->active)
     {
@@ -956,6 +1017,24 @@ clientReply(FILTER* instance, void *session, GWBUF *reply)
     }
 
     branch = instance == NULL ? CHILD : PARENT;
+    bool async = my_session->instance->async;
+
+    /** In async mode the branch executes a different query than the parent */
+    unsigned char command = async && branch == CHILD ?
+                            my_session->branch_command : my_session->command;
+    int min_eof = command != 0x04 ? 2 : 1;
+
+    GWBUF* branch_query = NULL;
+
+    if (async && branch == PARENT)
+    {
+        /** The reply is only followed to know when the next queued client
+         * query can be routed, it is not held back */
+        GWBUF* clone = gwbuf_clone_all(reply);
+        rc = my_session->up.clientReply(my_session->up.instance,
+                                        my_session->up.session, reply);
+        reply = clone;
+    }
 
     my_session->tee_partials[branch] = gwbuf_append(my_session->tee_partials[branch], reply);
     my_session->tee_partials[branch] = gwbuf_make_contiguous(my_session->tee_partials[branch]);
@@ -1016,7 +1095,7 @@ clientReply(FILTER* instance, void *session, GWBUF *reply)
         }
     }
 
-    if (branch == PARENT)
+    if (branch == PARENT && !async)
     {
         my_session->tee_replybuf = gwbuf_append(my_session->tee_replybuf, complete);
     }
@@ -1027,6 +1106,16 @@ clientReply(FILTER* instance, void *session, GWBUF *reply)
 
     my_session->replies[branch]++;
 
+    if (async)
+    {
+        if (branch == CHILD && !my_session->waiting[CHILD])
+        {
+            branch_query = branch_next(my_session);
+        }
+
+        route = false;
+    }
+
     if (my_session->tee_replybuf == NULL ||
         (!my_session->waiting[PARENT] && my_session->waiting[CHILD]) ||
         ((my_session->multipacket[PARENT] || my_session->multipacket[CHILD]) &&
@@ -1058,17 +1147,19 @@ clientReply(FILTER* instance, void *session, GWBUF *reply)
 
     if (my_session->queue &&
         !my_session->waiting[PARENT] &&
-        !my_session->waiting[CHILD])
+        (!my_session->waiting[CHILD] || async))
     {
         GWBUF* buffer = modutil_get_next_MySQL_packet(&my_session->queue);
         GWBUF* clone = clone_query(my_session->instance, my_session, buffer);
         reset_session_state(my_session, buffer);
         spinlock_release(&my_session->tee_lock);
+        branch_route(my_session, branch_query);
         MXS_INFO("tee: routing queued query");
         return route_single_query(my_session->instance, my_session, buffer, clone);
     }
 
     spinlock_release(&my_session->tee_lock);
+    branch_route(my_session, branch_query);
     return rc;
 }
 
@@ -1111,12 +1202,26 @@ diagnostic(FILTER *instance, void *fsession, DCB *dcb)
         dcb_printf(dcb, "\t\tExclude queries that match		%s\n",
                    my_instance->nomatch);
     }
+    if (my_instance->async)
+    {
+        dcb_printf(dcb, "\t\tAsynchronous, queue size		%d\n",
+                   my_instance->queue_size);
+        dcb_printf(dcb, "\t\tNo. of statements dropped:	%d.\n",
+                   my_instance->n_dropped);
+    }
     if (my_session)
     {
         dcb_printf(dcb, "\t\tNo. of statements duplicated:	%d.\n",
                    my_session->n_duped);
         dcb_printf(dcb, "\t\tNo. of statements rejected:	%d.\n",
                    my_session->n_rejected);
+        if (my_instance->async)
+        {
+            dcb_printf(dcb, "\t\tNo. of statements dropped:	%d.\n",
+                       my_session->n_dropped);
+            dcb_printf(dcb, "\t\tNo. of statements queued:	%d.\n",
+                       my_session->n_branch_queued);
+        }
     }
 }
 
@@ -1207,6 +1312,36 @@ int internal_route(DCB* dcb)
     return routeQuery((FILTER*) session->instance, session, buffer);
 }
 
+/**
+ * Check if a query matches the match pattern and does not match the nomatch pattern
+ *
+ * @param my_instance Tee instance
+ * @param my_session Tee session
+ * @param sql SQL of the query
+ * @return True if the query should be duplicated
+ */
+static bool query_matches(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, const char* sql)
+{
+    if (my_instance->patterns == NULL)
+    {
+        return true;
+    }
+
+    /** The state is allocated here because newSession has many error paths */
+    if (my_session->match_state == NULL &&
+        (my_session->match_state = mxs_pcre2_set_state_alloc()) == NULL)
+    {
+        MXS_ERROR("tee: Memory allocation for the matching state failed.");
+        return false;
+    }
+
+    return mxs_pcre2_set_match(my_instance->patterns, my_session->match_state, sql, strlen(sql)) >= 0 &&
+        (my_instance->match_id == -1 ||
+         mxs_pcre2_set_matched(my_session->match_state, my_instance->match_id)) &&
+        (my_instance->nomatch_id == -1 ||
+         !mxs_pcre2_set_matched(my_session->match_state, my_instance->nomatch_id));
+}
+
 /**
  *
  * @param my_instance
@@ -1240,10 +1375,7 @@ GWBUF* clone_query(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF* bu
         }
         else if (my_session->active && (ptr = modutil_get_SQL(buffer)) != NULL)
         {
-            if ((my_instance->match == NULL ||
-                 regexec(&my_instance->re, ptr, 0, NULL, 0) == 0) &&
-                (my_instance->nomatch == NULL ||
-                 regexec(&my_instance->nore, ptr, 0, NULL, 0) != 0))
+            if (query_matches(my_instance, my_session, ptr))
             {
                 clone = gwbuf_clone_all(buffer);
                 my_session->residual = residual;
@@ -1262,6 +1394,11 @@ GWBUF* clone_query(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF* bu
  * Route the main query downstream along the main filter chain and possibly route
  * a clone of the buffer to the branch session. If the clone buffer is NULL, nothing
  * is routed to the branch session.
+ *
+ * Must be called without the session lock. The lock is only held while the
+ * session state is updated so that a reply generated during routing can be
+ * processed.
+ *
  * @param my_instance Tee instance
  * @param my_session Tee session
  * @param buffer Main buffer
@@ -1271,16 +1408,24 @@ GWBUF* clone_query(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF* bu
 int route_single_query(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF* buffer, GWBUF* clone)
 {
     int rval = 0;
+
+    spinlock_acquire(&my_session->tee_lock);
+
     if (!my_session->active ||
         my_session->branch_session == NULL ||
         my_session->branch_session->state != SESSION_STATE_ROUTER_READY)
     {
         rval = 0;
         my_session->active = 0;
+        spinlock_release(&my_session->tee_lock);
         return rval;
     }
 
-    if (clone == NULL)
+    if (clone == NULL && my_instance->async)
+    {
+        my_session->n_rejected++;
+    }
+    else if (clone == NULL)
     {
         /** We won't be expecting any response from the child branch */
         my_session->waiting[CHILD] = false;
@@ -1289,21 +1434,38 @@ int route_single_query(TEE_INSTANCE* my_instance, TEE_SESSION* my_session, GWBUF
         my_session->n_rejected++;
     }
 
+    spinlock_release(&my_session->tee_lock);
+
     rval = my_session->down.routeQuery(my_session->down.instance,
                                        my_session->down.session,
                                        buffer);
-    if (clone)
+    if (clone && my_instance->async)
     {
+        spinlock_acquire(&my_session->tee_lock);
+        GWBUF* branch_query = branch_enqueue(my_session, clone);
+        spinlock_release(&my_session->tee_lock);
+        branch_route(my_session, branch_query);
+    }
+    else if (clone)
+    {
+        spinlock_acquire(&my_session->tee_lock);
         my_session->n_duped++;
+        bool ready = my_session->branch_session->state == SESSION_STATE_ROUTER_READY;
+
+        if (!ready)
+        {
+            /** Close tee session */
+            my_session->active = 0;
+        }
+
+        spinlock_release(&my_session->tee_lock);
 
-        if (my_session->branch_session->state == SESSION_STATE_ROUTER_READY)
+        if (ready)
         {
             SESSION_ROUTE_QUERY(my_session->branch_session, clone);
         }
         else
         {
-            /** Close tee session */
-            my_session->active = 0;
             rval = 0;
             MXS_INFO("Closed tee filter session: Child session in invalid state.");
             gwbuf_free(clone);
@@ -1328,31 +1490,146 @@ int reset_session_state(TEE_SESSION* my_session, GWBUF* buffer)
 
     unsigned char command = *((unsigned char*) buffer->start + 4);
 
+    if (command == 0x1b)
+    {
+        my_session->client_multistatement = *((unsigned char*) buffer->start + 5);
+        MXS_INFO("tee: client %s multistatements",
+                 my_session->client_multistatement ? "enabled" : "disabled");
+    }
+
+    reset_branch_state(my_session, PARENT, command);
+
+    /** In async mode the branch state is reset when a duplicate is sent */
+    if (!my_session->instance->async)
+    {
+        reset_branch_state(my_session, CHILD, command);
+    }
+
+    my_session->command = command;
+
+    return 1;
+}
+
+/**
+ * Reset the reply tracking of one branch.
+ * @param my_session Tee session
+ * @param branch PARENT or CHILD
+ * @param command The command sent to the branch
+ */
+void reset_branch_state(TEE_SESSION* my_session, int branch, unsigned char command)
+{
     switch (command)
     {
         case 0x1b:
-            my_session->client_multistatement = *((unsigned char*) buffer->start + 5);
-            MXS_INFO("tee: client %s multistatements",
-                     my_session->client_multistatement ? "enabled" : "disabled");
         case 0x03:
         case 0x16:
         case 0x17:
         case 0x04:
         case 0x0a:
-            memset(my_session->multipacket, (char) true, 2 * sizeof(bool));
+            my_session->multipacket[branch] = true;
             break;
         default:
-            memset(my_session->multipacket, (char) false, 2 * sizeof(bool));
+            my_session->multipacket[branch] = false;
             break;
     }
 
-    memset(my_session->replies, 0, 2 * sizeof(int));
-    memset(my_session->reply_packets, 0, 2 * sizeof(int));
-    memset(my_session->eof, 0, 2 * sizeof(int));
-    memset(my_session->waiting, 1, 2 * sizeof(bool));
-    my_session->command = command;
+    my_session->replies[branch] = 0;
+    my_session->reply_packets[branch] = 0;
+    my_session->eof[branch] = 0;
+    my_session->waiting[branch] = true;
+}
 
-    return 1;
+/**
+ * Queue a duplicate for the branch in async mode. Must be called with the
+ * session lock held.
+ *
+ * If the queue is full, the duplicate is dropped. Dropping a command that
+ * changes the session state would make the branch diverge from the client
+ * session, so the duplication stops for the rest of the session instead.
+ *
+ * @param my_session Tee session
+ * @param clone The duplicate
+ * @return The duplicate to route to the branch if the branch is idle or NULL
+ */
+static GWBUF* branch_enqueue(TEE_SESSION* my_session, GWBUF* clone)
+{
+    if (my_session->branch_stopped)
+    {
+        gwbuf_free(clone);
+        return NULL;
+    }
+
+    if (my_session->n_branch_queued >= my_session->instance->queue_size)
+    {
+        my_session->n_dropped++;
+        atomic_add(&my_session->instance->n_dropped, 1);
+
+        if (packet_is_required(clone))
+        {
+            MXS_WARNING("tee: Queue of the branch session is full and a session "
+                        "command was dropped. No more statements of this session "
+                        "are duplicated.");
+            gwbuf_free(my_session->branch_queue);
+            my_session->branch_queue = NULL;
+            my_session->n_branch_queued = 0;
+            my_session->branch_stopped = true;
+        }
+
+        gwbuf_free(clone);
+        return NULL;
+    }
+
+    my_session->branch_queue = gwbuf_append(my_session->branch_queue, clone);
+    my_session->n_branch_queued++;
+
+    return my_session->waiting[CHILD] ? NULL : branch_next(my_session);
+}
+
+/**
+ * Take the next queued duplicate for the branch in async mode. Must be called
+ * with the session lock held.
+ *
+ * @param my_session Tee session
+ * @return The next duplicate or NULL if the queue is empty
+ */
+static GWBUF* branch_next(TEE_SESSION* my_session)
+{
+    GWBUF* buffer = modutil_get_next_MySQL_packet(&my_session->branch_queue);
+
+    if (buffer)
+    {
+        unsigned char command = gwbuf_length(buffer) >= 5 ?
+                                *((unsigned char*) buffer->start + 4) : 1;
+        my_session->n_branch_queued--;
+        my_session->branch_command = command;
+        reset_branch_state(my_session, CHILD, command);
+        my_session->n_duped++;
+    }
+
+    return buffer;
+}
+
+/**
+ * Route a duplicate to the branch. Called without the session lock so that
+ * a reply generated during routing can be processed.
+ *
+ * @param my_session Tee session
+ * @param buffer Duplicate to route, may be NULL
+ */
+static void branch_route(TEE_SESSION* my_session, GWBUF* buffer)
+{
+    if (buffer)
+    {
+        if (my_session->branch_session &&
+            my_session->branch_session->state == SESSION_STATE_ROUTER_READY)
+        {
+            SESSION_ROUTE_QUERY(my_session->branch_session, buffer);
+        }
+        else
+        {
+            gwbuf_free(buffer);
+        }
+    }
 }
 
 void create_orphan(SESSION* ses)
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file filterbench.c - Benchmark of the routing throughput of a filter
+ *
+ * Each thread creates its own session of the filter and routes queries through
+ * it as fast as it can. The router at the end of the chain frees the queries.
+ * The number of queries routed per second is printed when all threads are done.
+ *
+ * Usage: filterbench [-d <module directory>] [-t <threads>] [-n <queries per thread>]
+ *                    [-o <option>] <module> [<parameter>=<value> ...]
+ *
+ * Use the module name "none" to measure the cost of creating and freeing
+ * the queries without a filter.
+ *
+ * Example:
+ *
+ *      filterbench -t 8 -n 1000000 regexfilter match=fetch replace=select
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <filter.h>
+#include <modutil.h>
+#include <session.h>
+#include <dcb.h>
+#include <gwdirs.h>
+#include <log_manager.h>
+
+static const char *queries[] =
+{
+    "SELECT id, name, email FROM users WHERE id = 42",
+    "INSERT INTO orders (user_id, total) VALUES (42, 99.95)",
+    "fetch * from t1 where a = 1",
+    "UPDATE users SET last_login = NOW() WHERE id = 42",
+    "SELECT COUNT(*) FROM orders o JOIN users u ON o.user_id = u.id WHERE u.name LIKE 'a%'",
+    "DELETE FROM sessions WHERE expires < NOW()",
+    "SELECT * FROM products WHERE category IN (1, 2, 3) ORDER BY price DESC LIMIT 10",
+    "BEGIN"
+};
+
+#define N_QUERIES (sizeof(queries) / sizeof(queries[0]))
+
+static FILTER_DEF *filter = NULL;
+static long n_per_thread = 100000;
+
+/** The router at the end of the chain */
+static int bench_route(void *instance, void *session, GWBUF *queue)
+{
+    gwbuf_free(queue);
+    return 1;
+}
+
+static void* bench_main(void *data)
+{
+    SESSION *session = (SESSION*)data;
+    DOWNSTREAM end = {NULL, NULL, bench_route};
+    DOWNSTREAM *head = &end;
+
+    if (filter && (head = filterApply(filter, session, &end)) == NULL)
+    {
+        fprintf(stderr, "Failed to create a filter session.\n");
+        return NULL;
+    }
+
+    for (long i = 0; i < n_per_thread; i++)
+    {
+        GWBUF *buffer = modutil_create_query((char*)queries[i % N_QUERIES]);
+        head->routeQuery(head->instance, head->session, buffer);
+    }
+
+    if (filter)
+    {
+        filter->obj->closeSession(head->instance, head->session);
+        filter->obj->freeSession(head->instance, head->session);
+        free(head);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int n_threads = 1;
+    char *options[16];
+    int n_options = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:t:n:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            set_libdir(strdup(optarg));
+            break;
+
+        case 't':
+            n_threads = atoi(optarg);
+            break;
+
+        case 'n':
+            n_per_thread = atol(optarg);
+            break;
+
+        case 'o':
+            if (n_options < (int)(sizeof(options) / sizeof(options[0])))
+            {
+                options[n_options++] = optarg;
+            }
+            break;
+
+        default:
+            return 1;
+        }
+    }
+
+    if (optind >= argc || n_threads < 1 || n_per_thread < 1)
+    {
+        fprintf(stderr, "Usage: %s [-d <module directory>] [-t <threads>] [-n <queries per thread>] "
+                "[-o <option>] <module> [<parameter>=<value> ...]\n", argv[0]);
+        return 1;
+    }
+
+    char cwd[PATH_MAX];
+    mxs_log_init(NULL, getcwd(cwd, sizeof(cwd)), MXS_LOG_TARGET_FS);
+
+    const char *module = argv[optind++];
+
+    if (strcmp(module, "none") != 0)
+    {
+        filter = filter_alloc("bench", (char*)module);
+
+        for (int i = 0; i < n_options; i++)
+        {
+            filterAddOption(filter, options[i]);
+        }
+
+        for (; optind < argc; optind++)
+        {
+            char *param = strdup(argv[optind]);
+            char *value = strchr(param, '=');
+
+            if (value)
+            {
+                *value++ = '\0';
+                filterAddParameter(filter, param, value);
+            }
+
+            free(param);
+        }
+
+        if (!filter_load(filter))
+        {
+            fprintf(stderr, "Failed to load the filter '%s'.\n", module);
+            mxs_log_finish();
+            return 1;
+        }
+    }
+
+    /** Each thread has its own session with a client DCB for the user and source checks */
+    SESSION *sessions = calloc(n_threads, sizeof(SESSION));
+    DCB *dcbs = calloc(n_threads, sizeof(DCB));
+    pthread_t *threads = calloc(n_threads, sizeof(pthread_t));
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        dcbs[i].remote = "127.0.0.1";
+        dcbs[i].user = "bench";
+        sessions[i].client_dcb = &dcbs[i];
+        pthread_create(&threads[i], NULL, bench_main, &sessions[i]);
+    }
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    long total = n_per_thread * n_threads;
+
+    printf("%s: %ld queries in %.3f seconds with %d threads, %.0f queries/s\n",
+           module, total, seconds, n_threads, total / seconds);
+
+    free(threads);
+    free(dcbs);
+    free(sessions);
+    mxs_log_finish();
+    return 0;
+}
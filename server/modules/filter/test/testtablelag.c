@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * Tests for the routing hints of the table lag filter. The queries are
+ * classified with the query classifier library in the directory given as
+ * the first argument.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <filter.h>
+#include <session.h>
+#include <service.h>
+#include <server.h>
+#include <hint.h>
+#include <modutil.h>
+#include <gwdirs.h>
+#include <log_manager.h>
+#include <hk_heartbeat.h>
+#include <query_classifier.h>
+
+extern FILTER_OBJECT *GetModuleObject();
+
+/** Expected hint of a routed query */
+enum expected_hint
+{
+    NO_HINT,
+    MASTER_HINT,
+    LAG_HINT
+};
+
+/** The hint of the latest query that reached the router */
+static int routed_type = -1;
+static char routed_value[32];
+
+static int route_query(void *instance, void *session, GWBUF *queue)
+{
+    routed_type = queue->hint ? (int)queue->hint->type : -1;
+    routed_value[0] = '\0';
+
+    if (queue->hint && queue->hint->value)
+    {
+        snprintf(routed_value, sizeof(routed_value), "%s", (char*)queue->hint->value);
+    }
+
+    gwbuf_free(queue);
+    return 1;
+}
+
+static int check(FILTER_OBJECT *obj, FILTER *instance, void *session, const char *sql,
+                 enum expected_hint expected, const char *lag)
+{
+    obj->routeQuery(instance, session, modutil_create_query((char*)sql));
+
+    bool ok;
+
+    switch (expected)
+    {
+    case MASTER_HINT:
+        ok = routed_type == HINT_ROUTE_TO_MASTER;
+        break;
+
+    case LAG_HINT:
+        ok = routed_type == HINT_PARAMETER && strcmp(routed_value, lag) == 0;
+        break;
+
+    default:
+        ok = routed_type == -1;
+        break;
+    }
+
+    if (!ok)
+    {
+        fprintf(stderr, "At %ld, '%s' got hint %d '%s', expected %d '%s'.\n", hkheartbeat,
+                sql, routed_type, routed_value, expected, lag ? lag : "");
+    }
+
+    return ok ? 0 : 1;
+}
+
+static void* new_session(FILTER_OBJECT *obj, FILTER *instance, SERVICE *service)
+{
+    static SESSION session;
+    session.service = service;
+
+    void *fsession = obj->newSession(instance, &session);
+    DOWNSTREAM down = {NULL, NULL, route_query};
+    obj->setDownstream(instance, fsession, &down);
+    return fsession;
+}
+
+/**
+ * Reads of a written table go to the master for max_lag plus one seconds
+ * when the servers are not monitored, then to slaves within the lag bound
+ * until the window ends. Other tables are not affected.
+ */
+static int test_window(FILTER_OBJECT *obj, SERVICE *service)
+{
+    FILTER_PARAMETER window = {"window", "60"};
+    FILTER_PARAMETER max_lag = {"max_lag", "5"};
+    FILTER_PARAMETER *params[] = {&window, &max_lag, NULL};
+    FILTER *instance = obj->createInstance(NULL, params);
+    void *session = new_session(obj, instance, service);
+    int rval = 0;
+
+    hkheartbeat = 1000;
+    rval += check(obj, instance, session, "SELECT a FROM t1", NO_HINT, NULL);
+    rval += check(obj, instance, session, "INSERT INTO t1 VALUES (1)", NO_HINT, NULL);
+    rval += check(obj, instance, session, "SELECT a FROM t1", MASTER_HINT, NULL);
+    rval += check(obj, instance, session, "SELECT a FROM T1", MASTER_HINT, NULL);
+    rval += check(obj, instance, session, "SELECT a FROM t2", NO_HINT, NULL);
+    rval += check(obj, instance, session, "SELECT a FROM t1 JOIN t2 ON (t1.a = t2.a)",
+                  MASTER_HINT, NULL);
+
+    hkheartbeat = 1059;
+    rval += check(obj, instance, session, "SELECT a FROM t1", MASTER_HINT, NULL);
+
+    hkheartbeat = 1060;
+    rval += check(obj, instance, session, "SELECT a FROM t1", LAG_HINT, "5");
+    rval += check(obj, instance, session, "SELECT a FROM t2", NO_HINT, NULL);
+
+    hkheartbeat = 1599;
+    rval += check(obj, instance, session, "SELECT a FROM t1", LAG_HINT, "5");
+
+    hkheartbeat = 1600;
+    rval += check(obj, instance, session, "SELECT a FROM t1", NO_HINT, NULL);
+
+    hkheartbeat = 1700;
+    rval += check(obj, instance, session, "UPDATE t2 SET a = 2", NO_HINT, NULL);
+    rval += check(obj, instance, session, "SELECT a FROM t2", MASTER_HINT, NULL);
+    rval += check(obj, instance, session, "SELECT a FROM t1", NO_HINT, NULL);
+
+    obj->freeSession(instance, session);
+    return rval;
+}
+
+/**
+ * Without measured replication lag, reads of a written table go to the
+ * master for the whole window
+ */
+static int test_no_lag_detection(FILTER_OBJECT *obj, SERVICE *service)
+{
+    FILTER_PARAMETER window = {"window", "60"};
+    FILTER_PARAMETER max_lag = {"max_lag", "5"};
+    FILTER_PARAMETER *params[] = {&window, &max_lag, NULL};
+    FILTER *instance = obj->createInstance(NULL, params);
+    void *session = new_session(obj, instance, service);
+    int rval = 0;
+
+    hkheartbeat = 1000;
+    rval += check(obj, instance, session, "INSERT INTO t1 VALUES (1)", NO_HINT, NULL);
+    rval += check(obj, instance, session, "SELECT a FROM t1", MASTER_HINT, NULL);
+
+    hkheartbeat = 1300;
+    rval += check(obj, instance, session, "SELECT a FROM t1", MASTER_HINT, NULL);
+    rval += check(obj, instance, session, "SELECT a FROM t2", NO_HINT, NULL);
+
+    hkheartbeat = 1600;
+    rval += check(obj, instance, session, "SELECT a FROM t1", NO_HINT, NULL);
+
+    obj->freeSession(instance, session);
+    return rval;
+}
+
+/**
+ * A window shorter than the lag bound does not let reads go to lagging slaves
+ */
+static int test_short_window(FILTER_OBJECT *obj, SERVICE *service)
+{
+    FILTER_PARAMETER window = {"window", "2"};
+    FILTER_PARAMETER max_lag = {"max_lag", "5"};
+    FILTER_PARAMETER *params[] = {&window, &max_lag, NULL};
+    FILTER *instance = obj->createInstance(NULL, params);
+    void *session = new_session(obj, instance, service);
+    int rval = 0;
+
+    hkheartbeat = 1000;
+    rval += check(obj, instance, session, "INSERT INTO t1 VALUES (1)", NO_HINT, NULL);
+
+    hkheartbeat = 1030;
+    rval += check(obj, instance, session, "SELECT a FROM t1", MASTER_HINT, NULL);
+
+    hkheartbeat = 1060;
+    rval += check(obj, instance, session, "SELECT a FROM t1", NO_HINT, NULL);
+
+    obj->freeSession(instance, session);
+    return rval;
+}
+
+/**
+ * Writes older than the window are removed when a later write is recorded
+ * and the removed tables behave like tables that were never written to
+ */
+static int test_expired_writes(FILTER_OBJECT *obj, SERVICE *service)
+{
+    FILTER_PARAMETER window = {"window", "60"};
+    FILTER_PARAMETER max_lag = {"max_lag", "5"};
+    FILTER_PARAMETER *params[] = {&window, &max_lag, NULL};
+    hkheartbeat = 1000;
+    FILTER *instance = obj->createInstance(NULL, params);
+    void *session = new_session(obj, instance, service);
+    int rval = 0;
+
+    rval += check(obj, instance, session, "INSERT INTO t1 VALUES (1)", NO_HINT, NULL);
+    rval += check(obj, instance, session, "INSERT INTO t2 VALUES (1)", NO_HINT, NULL);
+
+    hkheartbeat = 1300;
+    rval += check(obj, instance, session, "INSERT INTO t2 VALUES (2)", NO_HINT, NULL);
+
+    hkheartbeat = 1600;
+    rval += check(obj, instance, session, "INSERT INTO t3 VALUES (1)", NO_HINT, NULL);
+    rval += check(obj, instance, session, "SELECT a FROM t1", NO_HINT, NULL);
+    rval += check(obj, instance, session, "SELECT a FROM t2", LAG_HINT, "5");
+    rval += check(obj, instance, session, "SELECT a FROM t3", MASTER_HINT, NULL);
+
+    hkheartbeat = 1700;
+    rval += check(obj, instance, session, "INSERT INTO t1 VALUES (2)", NO_HINT, NULL);
+    rval += check(obj, instance, session, "SELECT a FROM t1", MASTER_HINT, NULL);
+
+    hkheartbeat = 2300;
+    rval += check(obj, instance, session, "INSERT INTO t4 VALUES (1)", NO_HINT, NULL);
+    rval += check(obj, instance, session, "SELECT a FROM t1", NO_HINT, NULL);
+    rval += check(obj, instance, session, "SELECT a FROM t2", NO_HINT, NULL);
+    rval += check(obj, instance, session, "SELECT a FROM t4", MASTER_HINT, NULL);
+
+    obj->freeSession(instance, session);
+    return rval;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <query classifier directory>\n", argv[0]);
+        return 1;
+    }
+
+    mxs_log_init(NULL, NULL, MXS_LOG_TARGET_DEFAULT);
+    set_libdir(strdup(argv[1]));
+
+    if (!qc_init("qc_sqlite", NULL))
+    {
+        fprintf(stderr, "Could not initialize the query classifier.\n");
+        return 1;
+    }
+
+    FILTER_OBJECT *obj = GetModuleObject();
+    SERVER *server = server_alloc("127.0.0.1", "MySQLBackend", 3306);
+    SERVER_REF ref = {NULL, server};
+    SERVICE service = {0};
+    service.name = "test_service";
+    service.dbref = &ref;
+    int rval = 0;
+
+    /** The server is not monitored, so only the max_lag and the rounding of
+     * the lag to whole seconds keep the reads on the master */
+    server->rlag = 0;
+    rval += test_window(obj, &service);
+    rval += test_short_window(obj, &service);
+
+    rval += test_expired_writes(obj, &service);
+
+    /** The lag of the server is not measured at all */
+    server->rlag = -2;
+    rval += test_no_lag_detection(obj, &service);
+    rval += test_no_lag_detection(obj, NULL);
+
+    /** The lag could not be measured in the latest monitoring round */
+    server->rlag = -1;
+    rval += test_no_lag_detection(obj, &service);
+
+    qc_end();
+    mxs_log_finish();
+    return rval;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * Tests for the async mode of the tee filter. The filter session is built
+ * without a branch service, the routing of the main and the branch session
+ * is done by the test.
+ */
+
+#include "../tee.c"
+#include <unistd.h>
+
+/** Queries that reached the main and the branch session */
+static int n_main;
+static int n_branch;
+
+/** Replies that reached the client */
+static int n_client;
+
+static int route_main(void *instance, void *session, GWBUF *queue)
+{
+    n_main++;
+    gwbuf_free(queue);
+    return 1;
+}
+
+static int route_branch(void *instance, void *session, GWBUF *queue)
+{
+    n_branch++;
+    gwbuf_free(queue);
+    return 1;
+}
+
+static int reply_client(void *instance, void *session, GWBUF *reply)
+{
+    n_client++;
+    gwbuf_free(reply);
+    return 1;
+}
+
+static GWBUF* create_ok()
+{
+    uint8_t ok[] = {0x07, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00};
+    return gwbuf_alloc_and_load(sizeof(ok), ok);
+}
+
+static int check(const char *step, int main_expected, int branch_expected, int client_expected)
+{
+    if (n_main != main_expected || n_branch != branch_expected || n_client != client_expected)
+    {
+        fprintf(stderr, "%s: main %d, branch %d, client %d, expected %d, %d, %d.\n", step,
+                n_main, n_branch, n_client, main_expected, branch_expected, client_expected);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Queries are routed to the main session without waiting for the branch and
+ * the duplicates are sent to the branch one at a time
+ */
+static int test_async(TEE_INSTANCE *instance)
+{
+    SESSION branch = {0};
+    branch.state = SESSION_STATE_ROUTER_READY;
+    branch.head.routeQuery = route_branch;
+
+    TEE_SESSION *session = calloc(1, sizeof(TEE_SESSION));
+    session->active = 1;
+    session->instance = instance;
+    session->branch_session = &branch;
+    session->down.routeQuery = route_main;
+    session->up.clientReply = reply_client;
+    spinlock_init(&session->tee_lock);
+
+    FILTER *filter = (FILTER*)instance;
+    int rval = 0;
+
+    routeQuery(filter, session, modutil_create_query("SELECT 1"));
+    rval += check("First query", 1, 1, 0);
+
+    routeQuery(filter, session, modutil_create_query("SELECT 2"));
+    rval += check("Second query", 2, 1, 0);
+
+    clientReply(filter, session, create_ok());
+    rval += check("First main reply", 2, 1, 1);
+
+    clientReply(NULL, session, create_ok());
+    rval += check("First branch reply", 2, 2, 1);
+
+    clientReply(filter, session, create_ok());
+    clientReply(NULL, session, create_ok());
+    rval += check("Second replies", 2, 2, 2);
+
+    if (session->n_duped != 2 || session->n_branch_queued != 0)
+    {
+        fprintf(stderr, "Duplicated %d and queued %d, expected 2 and 0.\n",
+                session->n_duped, session->n_branch_queued);
+        rval++;
+    }
+
+    gwbuf_free(session->queue);
+    free(session);
+    return rval;
+}
+
+/**
+ * Duplicates beyond the queue size are dropped while the branch is busy
+ */
+static int test_async_queue_full(TEE_INSTANCE *instance)
+{
+    SESSION branch = {0};
+    branch.state = SESSION_STATE_ROUTER_READY;
+    branch.head.routeQuery = route_branch;
+
+    TEE_SESSION *session = calloc(1, sizeof(TEE_SESSION));
+    session->active = 1;
+    session->instance = instance;
+    session->branch_session = &branch;
+    session->down.routeQuery = route_main;
+    session->up.clientReply = reply_client;
+    spinlock_init(&session->tee_lock);
+
+    FILTER *filter = (FILTER*)instance;
+    int rval = 0;
+    n_main = n_branch = n_client = 0;
+
+    for (int i = 0; i < instance->queue_size + 3; i++)
+    {
+        routeQuery(filter, session, modutil_create_query("SELECT 1"));
+    }
+
+    rval += check("Full queue", instance->queue_size + 3, 1, 0);
+
+    if (session->n_dropped != 2 || session->n_branch_queued != instance->queue_size)
+    {
+        fprintf(stderr, "Dropped %d and queued %d, expected 2 and %d.\n",
+                session->n_dropped, session->n_branch_queued, instance->queue_size);
+        rval++;
+    }
+
+    gwbuf_free(session->branch_queue);
+    gwbuf_free(session->queue);
+    free(session);
+    return rval;
+}
+
+int main(int argc, char **argv)
+{
+    mxs_log_init(NULL, NULL, MXS_LOG_TARGET_DEFAULT);
+
+    /** A deadlock fails the test instead of hanging it */
+    alarm(30);
+
+    TEE_INSTANCE instance = {0};
+    instance.async = true;
+    instance.queue_size = 4;
+    instance.match_id = -1;
+    instance.nomatch_id = -1;
+
+    int rval = 0;
+    rval += test_async(&instance);
+    rval += test_async_queue_full(&instance);
+
+    mxs_log_finish();
+    return rval;
+}
@@ -26,6 +26,11 @@
  * file to which the queries are logged. A serial number is appended to this
  * name in order that each session logs to a different file.
  *
+ * With digest_stats=true the filter also aggregates statistics of all
+ * sessions by the canonical form of the queries. Each routing thread updates
+ * its own shard of the statistics and the shards are merged when the
+ * statistics are shown or exported.
+ *
  * Date         Who             Description
  * 18/06/2014   Mark Riddoch    Addition of source and user filters
  *
@@ -42,8 +47,17 @@
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
-#include <regex.h>
+#include <maxscale_pcre2.h>
 #include <atomic.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <spinlock.h>
+#include <platform.h>
+#include <maxconfig.h>
+#include <housekeeper.h>
+#include <query_classifier.h>
+#include <mysql_client_server_protocol.h>
 
 MODULE_INFO info =
 {
@@ -55,6 +69,15 @@ MODULE_INFO info =
 
 static char *version_str = "V1.0.1";
 
+/** Number of buckets in the latency histogram of a digest */
+#define TOPN_HISTOGRAM_BUCKETS 8
+
+/** Default maximum number of digests in a shard */
+#define TOPN_DEFAULT_MAX_DIGESTS 1000
+
+/** Default interval of the digest export in seconds */
+#define TOPN_DEFAULT_EXPORT_INTERVAL 60
+
 /*
  * The filter entry points
  */
@@ -82,6 +105,36 @@ static FILTER_OBJECT MyObject =
     diagnostic,
 };
 
+/**
+ * Statistics of the queries with the same canonical form
+ */
+typedef struct topn_digest
+{
+    uint64_t hash; /*< Hash of the canonical form */
+    char *text; /*< The canonical form */
+    uint64_t count; /*< Number of executions */
+    uint64_t errors; /*< Number of failed executions */
+    uint64_t rows; /*< Number of rows returned */
+    uint64_t total_us; /*< Total time to the first reply */
+    uint64_t min_us; /*< Shortest time to the first reply */
+    uint64_t max_us; /*< Longest time to the first reply */
+    uint64_t histogram[TOPN_HISTOGRAM_BUCKETS]; /*< Executions by time to the first reply */
+    uint64_t created; /*< Creation order in the shard, lower is older */
+    struct topn_digest *next; /*< Next digest in the hash bucket */
+} TOPN_DIGEST;
+
+/**
+ * The digests updated by one routing thread
+ */
+typedef struct
+{
+    SPINLOCK lock; /*< Only contended while the statistics are reported */
+    TOPN_DIGEST **buckets;
+    int n_buckets;
+    int n_digests;
+    uint64_t n_created; /*< Number of digests created in the shard */
+} TOPN_SHARD;
+
 /**
  * A instance structure, the assumption is that the option passed
  * to the filter is simply a base for the filename to which the queries
@@ -98,9 +151,17 @@ typedef struct
     char *source; /* The source of the client connection */
     char *user; /* A user name to filter on */
     char *match; /* Optional text to match against */
-    regex_t re; /* Compiled regex text */
     char *exclude; /* Optional text to match against for exclusion */
-    regex_t exre; /* Compiled regex nomatch text */
+    MXS_PCRE2_SET *patterns; /* The match and exclude patterns */
+    int match_id; /* ID of the match pattern or -1 */
+    int exclude_id; /* ID of the exclude pattern or -1 */
+    bool digest_stats; /* Whether to collect statistics by digest */
+    int max_digests; /* Maximum number of digests in a shard */
+    char *digest_file; /* File the digests are exported into */
+    int export_interval; /* Interval of the digest export in seconds */
+    TOPN_SHARD *shards; /* The digest shards, one for each routing thread */
+    int n_shards; /* Number of digest shards */
+    int evictions; /* Number of evicted digests */
 } TOPN_INSTANCE;
 
 /**
@@ -112,6 +173,15 @@ typedef struct topnq
     char *sql;
 } TOPNQ;
 
+/** Progress of the reply to a query */
+enum topn_reply_state
+{
+    TOPN_REPLY_START, /*< Waiting for the first packet */
+    TOPN_REPLY_COLUMNS, /*< Reading the column definitions */
+    TOPN_REPLY_ROWS, /*< Reading the rows */
+    TOPN_REPLY_DONE /*< The reply is complete */
+};
+
 /**
  * The session structure for this TOPN filter.
  * This stores the downstream filter information, such that the
@@ -136,6 +206,17 @@ typedef struct
     struct timeval total;
     struct timeval connect;
     struct timeval disconnect;
+    MXS_PCRE2_SET_STATE *match_state;
+    bool waiting; /* Waiting for the first reply to a matched query */
+    char *digest_text; /* Canonical form of the query being executed */
+    struct timeval duration; /* Time to the first reply of the current query */
+    enum topn_reply_state reply_state;
+    uint64_t reply_rows; /* Rows in the reply */
+    bool reply_error; /* Whether the reply was an error */
+    uint8_t reply_header[MYSQL_HEADER_LEN + 1]; /* Header and first byte of a packet */
+    int reply_header_len; /* Bytes in reply_header */
+    size_t reply_skip; /* Bytes to skip to the next packet */
+    bool reply_continued; /* Whether the next packet continues a large payload */
 } TOPN_SESSION;
 
 /**
@@ -174,6 +255,599 @@ GetModuleObject()
 {
     return &MyObject;
 }
+
+/** Index of the digest shard used by the current routing thread */
+static thread_local int topn_shard_index = -1;
+
+/** Number of threads that have been assigned a shard index */
+static int topn_thread_count = 0;
+
+/** Upper bounds of the latency histogram buckets in microseconds */
+static const uint64_t topn_histogram_bounds[TOPN_HISTOGRAM_BUCKETS - 1] =
+{
+    10, 100, 1000, 10000, 100000, 1000000, 10000000
+};
+
+/** Column names of the histogram buckets in the exported file */
+static const char *topn_histogram_names[TOPN_HISTOGRAM_BUCKETS] =
+{
+    "COUNT_LT_10US", "COUNT_LT_100US", "COUNT_LT_1MS", "COUNT_LT_10MS",
+    "COUNT_LT_100MS", "COUNT_LT_1S", "COUNT_LT_10S", "COUNT_GE_10S"
+};
+
+/**
+ * Calculate the 64-bit FNV-1a hash of a digest text
+ *
+ * @param text The canonical form of a query
+ * @return The hash
+ */
+static uint64_t topn_digest_hash(const char *text)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    while (*text)
+    {
+        hash ^= (uint8_t)*text++;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static int topn_histogram_bucket(uint64_t us)
+{
+    int i = 0;
+
+    while (i < TOPN_HISTOGRAM_BUCKETS - 1 && us >= topn_histogram_bounds[i])
+    {
+        i++;
+    }
+
+    return i;
+}
+
+/** The eviction order of a digest */
+typedef struct
+{
+    uint64_t count;
+    uint64_t created;
+} TOPN_RANK;
+
+static int cmp_rank(const void *a, const void *b)
+{
+    const TOPN_RANK *x = (const TOPN_RANK*)a;
+    const TOPN_RANK *y = (const TOPN_RANK*)b;
+
+    if (x->count != y->count)
+    {
+        return x->count < y->count ? -1 : 1;
+    }
+
+    return x->created < y->created ? -1 : x->created > y->created;
+}
+
+/**
+ * Evict the least frequent digests of a full shard
+ *
+ * A tenth of the digests, at least one, is evicted. The digests are ranked
+ * by execution count and digests with equal counts by age, the oldest
+ * first. Evicting a batch at a time keeps the cost of finding the least
+ * frequent digests low when new digests keep arriving.
+ *
+ * @param shard Shard to evict from, must be locked
+ * @return Number of evicted digests
+ */
+static int topn_shard_evict(TOPN_SHARD *shard)
+{
+    TOPN_RANK *ranks = malloc(shard->n_digests * sizeof(TOPN_RANK));
+    int n = 0;
+
+    if (ranks == NULL)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < shard->n_buckets; i++)
+    {
+        for (TOPN_DIGEST *d = shard->buckets[i]; d; d = d->next)
+        {
+            ranks[n].count = d->count;
+            ranks[n].created = d->created;
+            n++;
+        }
+    }
+
+    int n_evict = n / 10 > 0 ? n / 10 : 1;
+    int evicted = 0;
+
+    if (n > 0)
+    {
+        qsort(ranks, n, sizeof(TOPN_RANK), cmp_rank);
+
+        /** The creation order is unique so exactly n_evict digests rank
+         * at or below the last one to evict */
+        TOPN_RANK last = ranks[n_evict - 1];
+
+        for (int i = 0; i < shard->n_buckets; i++)
+        {
+            TOPN_DIGEST **prev = &shard->buckets[i];
+
+            while (*prev)
+            {
+                TOPN_DIGEST *d = *prev;
+                TOPN_RANK rank = {d->count, d->created};
+
+                if (cmp_rank(&rank, &last) <= 0)
+                {
+                    *prev = d->next;
+                    free(d->text);
+                    free(d);
+                    evicted++;
+                }
+                else
+                {
+                    prev = &d->next;
+                }
+            }
+        }
+    }
+
+    free(ranks);
+    shard->n_digests -= evicted;
+    return evicted;
+}
+
+/**
+ * Add an executed query to the digest statistics
+ *
+ * The statistics are kept in a shard of the routing thread so the lock is
+ * only contended while the statistics are being reported.
+ *
+ * @param my_instance The filter instance
+ * @param text Canonical form of the query, freed by this function
+ * @param us Time to the first reply in microseconds
+ * @param rows Number of rows returned
+ * @param error Whether the query failed
+ */
+static void topn_digest_update(TOPN_INSTANCE *my_instance, char *text, uint64_t us,
+                               uint64_t rows, bool error)
+{
+    if (topn_shard_index == -1)
+    {
+        topn_shard_index = atomic_add(&topn_thread_count, 1);
+    }
+
+    TOPN_SHARD *shard = &my_instance->shards[topn_shard_index % my_instance->n_shards];
+    uint64_t hash = topn_digest_hash(text);
+    int bucket = hash & (shard->n_buckets - 1);
+
+    spinlock_acquire(&shard->lock);
+
+    TOPN_DIGEST *d = shard->buckets[bucket];
+
+    while (d && (d->hash != hash || strcmp(d->text, text) != 0))
+    {
+        d = d->next;
+    }
+
+    if (d == NULL)
+    {
+        if (shard->n_digests >= my_instance->max_digests)
+        {
+            atomic_add(&my_instance->evictions, topn_shard_evict(shard));
+        }
+
+        if ((d = calloc(1, sizeof(TOPN_DIGEST))) == NULL)
+        {
+            spinlock_release(&shard->lock);
+            free(text);
+            return;
+        }
+
+        d->hash = hash;
+        d->text = text;
+        d->min_us = us;
+        d->created = shard->n_created++;
+        d->next = shard->buckets[bucket];
+        shard->buckets[bucket] = d;
+        shard->n_digests++;
+        text = NULL;
+    }
+
+    d->count++;
+    d->total_us += us;
+    d->min_us = us < d->min_us ? us : d->min_us;
+    d->max_us = us > d->max_us ? us : d->max_us;
+    d->rows += rows;
+    d->errors += error;
+    d->histogram[topn_histogram_bucket(us)]++;
+
+    spinlock_release(&shard->lock);
+    free(text);
+}
+
+static int cmp_digest_key(const void *va, const void *vb)
+{
+    const TOPN_DIGEST *a = (const TOPN_DIGEST*)va;
+    const TOPN_DIGEST *b = (const TOPN_DIGEST*)vb;
+
+    if (a->hash != b->hash)
+    {
+        return a->hash < b->hash ? -1 : 1;
+    }
+
+    return strcmp(a->text, b->text);
+}
+
+static int cmp_digest_total(const void *va, const void *vb)
+{
+    const TOPN_DIGEST *a = (const TOPN_DIGEST*)va;
+    const TOPN_DIGEST *b = (const TOPN_DIGEST*)vb;
+    return a->total_us < b->total_us ? 1 : a->total_us > b->total_us ? -1 : 0;
+}
+
+/**
+ * Merge the digest statistics of all shards
+ *
+ * @param my_instance The filter instance
+ * @param n_digests Set to the number of digests
+ * @return The digests sorted by total execution time, free with
+ * topn_digest_snapshot_free(). NULL if there are no digests or if memory
+ * allocation failed.
+ */
+static TOPN_DIGEST* topn_digest_snapshot(TOPN_INSTANCE *my_instance, int *n_digests)
+{
+    TOPN_DIGEST *digests = NULL;
+    int n = 0;
+
+    *n_digests = 0;
+
+    for (int s = 0; s < my_instance->n_shards; s++)
+    {
+        TOPN_SHARD *shard = &my_instance->shards[s];
+        spinlock_acquire(&shard->lock);
+
+        TOPN_DIGEST *tmp = realloc(digests, (n + shard->n_digests + 1) * sizeof(TOPN_DIGEST));
+
+        if (tmp == NULL)
+        {
+            spinlock_release(&shard->lock);
+            break;
+        }
+
+        digests = tmp;
+
+        for (int i = 0; i < shard->n_buckets; i++)
+        {
+            for (TOPN_DIGEST *d = shard->buckets[i]; d; d = d->next)
+            {
+                digests[n] = *d;
+
+                if ((digests[n].text = strdup(d->text)))
+                {
+                    n++;
+                }
+            }
+        }
+
+        spinlock_release(&shard->lock);
+    }
+
+    /** The same digest can be in more than one shard */
+    qsort(digests, n, sizeof(TOPN_DIGEST), cmp_digest_key);
+    int merged = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (merged > 0 && cmp_digest_key(&digests[merged - 1], &digests[i]) == 0)
+        {
+            TOPN_DIGEST *d = &digests[merged - 1];
+            d->count += digests[i].count;
+            d->total_us += digests[i].total_us;
+            d->min_us = digests[i].min_us < d->min_us ? digests[i].min_us : d->min_us;
+            d->max_us = digests[i].max_us > d->max_us ? digests[i].max_us : d->max_us;
+            d->rows += digests[i].rows;
+            d->errors += digests[i].errors;
+
+            for (int j = 0; j < TOPN_HISTOGRAM_BUCKETS; j++)
+            {
+                d->histogram[j] += digests[i].histogram[j];
+            }
+
+            free(digests[i].text);
+        }
+        else
+        {
+            digests[merged++] = digests[i];
+        }
+    }
+
+    qsort(digests, merged, sizeof(TOPN_DIGEST), cmp_digest_total);
+    *n_digests = merged;
+    return digests;
+}
+
+static void topn_digest_snapshot_free(TOPN_DIGEST *digests, int n_digests)
+{
+    for (int i = 0; i < n_digests; i++)
+    {
+        free(digests[i].text);
+    }
+
+    free(digests);
+}
+
+/**
+ * Write a digest text into a tab-separated file
+ *
+ * Tabs, newlines and carriage returns are written as \t, \n and \r, and
+ * backslashes as \\, so that a text is always one field of one row.
+ *
+ * @param fp File to write to
+ * @param text The digest text
+ */
+static void topn_write_tsv_field(FILE *fp, const char *text)
+{
+    for (const char *c = text; *c; c++)
+    {
+        switch (*c)
+        {
+        case '\t':
+            fputs("\\t", fp);
+            break;
+
+        case '\n':
+            fputs("\\n", fp);
+            break;
+
+        case '\r':
+            fputs("\\r", fp);
+            break;
+
+        case '\\':
+            fputs("\\\\", fp);
+            break;
+
+        default:
+            fputc(*c, fp);
+            break;
+        }
+    }
+}
+
+/**
+ * Export the digest statistics into a file
+ *
+ * The columns follow the performance_schema table
+ * events_statements_summary_by_digest. The times are in picoseconds like
+ * in the performance_schema. The file is written under a temporary name
+ * and renamed so that readers never see a partial file.
+ *
+ * @param data The filter instance
+ */
+static void topn_digest_export(void *data)
+{
+    TOPN_INSTANCE *my_instance = (TOPN_INSTANCE*)data;
+    char tmpname[strlen(my_instance->digest_file) + sizeof(".tmp")];
+    sprintf(tmpname, "%s.tmp", my_instance->digest_file);
+    FILE *fp = fopen(tmpname, "w");
+
+    if (fp == NULL)
+    {
+        char errbuf[STRERROR_BUFLEN];
+        MXS_ERROR("topfilter: Failed to open '%s': %d, %s", tmpname,
+                  errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+        return;
+    }
+
+    int n_digests;
+    TOPN_DIGEST *digests = topn_digest_snapshot(my_instance, &n_digests);
+
+    fprintf(fp, "DIGEST\tDIGEST_TEXT\tCOUNT_STAR\tSUM_TIMER_WAIT\tMIN_TIMER_WAIT\t"
+            "AVG_TIMER_WAIT\tMAX_TIMER_WAIT\tSUM_ERRORS\tSUM_ROWS_SENT");
+
+    for (int j = 0; j < TOPN_HISTOGRAM_BUCKETS; j++)
+    {
+        fprintf(fp, "\t%s", topn_histogram_names[j]);
+    }
+
+    fprintf(fp, "\n");
+
+    for (int i = 0; i < n_digests; i++)
+    {
+        TOPN_DIGEST *d = &digests[i];
+        fprintf(fp, "%016" PRIx64 "\t", d->hash);
+        topn_write_tsv_field(fp, d->text);
+        fprintf(fp, "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%"
+                PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64,
+                d->count, d->total_us * 1000000, d->min_us * 1000000,
+                d->total_us * 1000000 / d->count, d->max_us * 1000000, d->errors, d->rows);
+
+        for (int j = 0; j < TOPN_HISTOGRAM_BUCKETS; j++)
+        {
+            fprintf(fp, "\t%" PRIu64, d->histogram[j]);
+        }
+
+        fprintf(fp, "\n");
+    }
+
+    topn_digest_snapshot_free(digests, n_digests);
+
+    if (fclose(fp) != 0 || rename(tmpname, my_instance->digest_file) != 0)
+    {
+        char errbuf[STRERROR_BUFLEN];
+        MXS_ERROR("topfilter: Failed to write '%s': %d, %s", my_instance->digest_file,
+                  errno, strerror_r(errno, errbuf, sizeof(errbuf)));
+        unlink(tmpname);
+    }
+}
+
+/**
+ * Process the first byte of a reply packet
+ *
+ * @param my_session The session
+ * @param command First byte of the payload
+ * @param len Payload length
+ */
+static void topn_reply_packet(TOPN_SESSION *my_session, uint8_t command, size_t len)
+{
+    /** An EOF packet, a row can start with 0xfe only if it is longer */
+    bool eof = command == 0xfe && len < 9;
+
+    switch (my_session->reply_state)
+    {
+    case TOPN_REPLY_START:
+        if (command == 0xff)
+        {
+            my_session->reply_error = true;
+            my_session->reply_state = TOPN_REPLY_DONE;
+        }
+        else if (command == 0x00 || command == 0xfb)
+        {
+            /** OK packet or a LOAD DATA LOCAL INFILE request */
+            my_session->reply_state = TOPN_REPLY_DONE;
+        }
+        else
+        {
+            my_session->reply_state = TOPN_REPLY_COLUMNS;
+        }
+        break;
+
+    case TOPN_REPLY_COLUMNS:
+        if (eof)
+        {
+            my_session->reply_state = TOPN_REPLY_ROWS;
+        }
+        break;
+
+    case TOPN_REPLY_ROWS:
+        if (eof || command == 0xff)
+        {
+            my_session->reply_error = command == 0xff;
+            my_session->reply_state = TOPN_REPLY_DONE;
+        }
+        else
+        {
+            my_session->reply_rows++;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * Follow the packets of a reply
+ *
+ * The packets may be split between buffers so the header and the first
+ * byte of the payload are collected before a packet is processed.
+ *
+ * @param my_session The session
+ * @param reply Part of the reply
+ * @return True if the reply is complete
+ */
+static bool topn_reply_parse(TOPN_SESSION *my_session, GWBUF *reply)
+{
+    for (GWBUF *buf = reply; buf && my_session->reply_state != TOPN_REPLY_DONE; buf = buf->next)
+    {
+        uint8_t *ptr = GWBUF_DATA(buf);
+        uint8_t *end = ptr + GWBUF_LENGTH(buf);
+
+        while (ptr < end && my_session->reply_state != TOPN_REPLY_DONE)
+        {
+            if (my_session->reply_skip > 0)
+            {
+                size_t n = end - ptr < my_session->reply_skip ? end - ptr : my_session->reply_skip;
+                ptr += n;
+                my_session->reply_skip -= n;
+                continue;
+            }
+
+            my_session->reply_header[my_session->reply_header_len++] = *ptr++;
+
+            size_t len = gw_mysql_get_byte3(my_session->reply_header);
+
+            if (my_session->reply_header_len == MYSQL_HEADER_LEN && len == 0)
+            {
+                /** The empty packet that ends a payload of exactly 16MB */
+                my_session->reply_header_len = 0;
+                my_session->reply_continued = false;
+            }
+            else if (my_session->reply_header_len == MYSQL_HEADER_LEN + 1)
+            {
+                /** The rest of a payload of 16MB or more is in the next
+                 * packets and is not interpreted */
+                if (!my_session->reply_continued)
+                {
+                    topn_reply_packet(my_session, my_session->reply_header[MYSQL_HEADER_LEN], len);
+                }
+
+                my_session->reply_continued = len == 0xffffff;
+                my_session->reply_skip = len - 1;
+                my_session->reply_header_len = 0;
+            }
+        }
+    }
+
+    return my_session->reply_state == TOPN_REPLY_DONE;
+}
+
+/**
+ * Add the query of the session to the digest statistics
+ *
+ * @param my_instance The filter instance
+ * @param my_session The session
+ */
+static void topn_digest_finish(TOPN_INSTANCE *my_instance, TOPN_SESSION *my_session)
+{
+    if (my_session->digest_text)
+    {
+        uint64_t us = my_session->duration.tv_sec * 1000000 +
+            my_session->duration.tv_usec;
+        topn_digest_update(my_instance, my_session->digest_text, us,
+                           my_session->reply_rows, my_session->reply_error);
+        my_session->digest_text = NULL;
+    }
+}
+
+/**
+ * Allocate the digest shards
+ *
+ * @param my_instance The filter instance
+ * @return True on success
+ */
+static bool topn_digest_init(TOPN_INSTANCE *my_instance)
+{
+    my_instance->n_shards = config_threadcount();
+
+    if ((my_instance->shards = calloc(my_instance->n_shards, sizeof(TOPN_SHARD))) == NULL)
+    {
+        return false;
+    }
+
+    int n_buckets = 16;
+
+    while (n_buckets < my_instance->max_digests)
+    {
+        n_buckets <<= 1;
+    }
+
+    for (int i = 0; i < my_instance->n_shards; i++)
+    {
+        TOPN_SHARD *shard = &my_instance->shards[i];
+        spinlock_init(&shard->lock);
+        shard->n_buckets = n_buckets;
+
+        if ((shard->buckets = calloc(n_buckets, sizeof(TOPN_DIGEST*))) == NULL)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 /**
  * Create an instance of the filter for a particular service
  * within MaxScale.
@@ -194,9 +868,19 @@ createInstance(char **options, FILTER_PARAMETER **params)
         my_instance->topN = 10;
         my_instance->match = NULL;
         my_instance->exclude = NULL;
+        my_instance->patterns = NULL;
+        my_instance->match_id = -1;
+        my_instance->exclude_id = -1;
         my_instance->source = NULL;
         my_instance->user = NULL;
         my_instance->filebase = NULL;
+        my_instance->digest_stats = false;
+        my_instance->max_digests = TOPN_DEFAULT_MAX_DIGESTS;
+        my_instance->digest_file = NULL;
+        my_instance->export_interval = TOPN_DEFAULT_EXPORT_INTERVAL;
+        my_instance->shards = NULL;
+        my_instance->n_shards = 0;
+        my_instance->evictions = 0;
         bool error = false;
 
         for (i = 0; params && params[i]; i++)
@@ -225,6 +909,36 @@ createInstance(char **options, FILTER_PARAMETER **params)
             {
                 my_instance->user = strdup(params[i]->value);
             }
+            else if (!strcmp(params[i]->name, "digest_stats"))
+            {
+                my_instance->digest_stats = config_truth_value(params[i]->value);
+            }
+            else if (!strcmp(params[i]->name, "max_digests"))
+            {
+                my_instance->max_digests = atoi(params[i]->value);
+
+                if (my_instance->max_digests <= 0)
+                {
+                    MXS_ERROR("topfilter: Invalid value for 'max_digests': %s",
+                              params[i]->value);
+                    error = true;
+                }
+            }
+            else if (!strcmp(params[i]->name, "digest_file"))
+            {
+                my_instance->digest_file = strdup(params[i]->value);
+            }
+            else if (!strcmp(params[i]->name, "digest_export_interval"))
+            {
+                my_instance->export_interval = atoi(params[i]->value);
+
+                if (my_instance->export_interval <= 0)
+                {
+                    MXS_ERROR("topfilter: Invalid value for 'digest_export_interval': %s",
+                              params[i]->value);
+                    error = true;
+                }
+            }
             else if (!filter_standard_parameter(params[i]->name))
             {
                 MXS_ERROR("topfilter: Unexpected parameter '%s'.",
@@ -233,7 +947,7 @@ createInstance(char **options, FILTER_PARAMETER **params)
             }
         }
 
-        int cflags = REG_ICASE;
+        int cflags = PCRE2_CASELESS;
 
         if (options)
         {
@@ -241,15 +955,15 @@ createInstance(char **options, FILTER_PARAMETER **params)
             {
                 if (!strcasecmp(options[i], "ignorecase"))
                 {
-                    cflags |= REG_ICASE;
+                    cflags |= PCRE2_CASELESS;
                 }
                 else if (!strcasecmp(options[i], "case"))
                 {
-                    cflags &= ~REG_ICASE;
+                    cflags &= ~PCRE2_CASELESS;
                 }
                 else if (!strcasecmp(options[i], "extended"))
                 {
-                    cflags |= REG_EXTENDED;
+                    /** PCRE2 patterns always use the extended syntax */
                 }
                 else
                 {
@@ -260,54 +974,86 @@ createInstance(char **options, FILTER_PARAMETER **params)
             }
         }
 
-        if (my_instance->filebase == NULL)
+        /** The session reports are optional when the digests are collected */
+        if (my_instance->filebase == NULL && !my_instance->digest_stats)
         {
             MXS_ERROR("topfilter: No 'filebase' parameter defined.");
             error = true;
         }
 
+        if (my_instance->digest_file && !my_instance->digest_stats)
+        {
+            MXS_ERROR("topfilter: The 'digest_file' parameter requires 'digest_stats=true'.");
+            error = true;
+        }
+
+        if (!error && my_instance->digest_stats && !topn_digest_init(my_instance))
+        {
+            MXS_ERROR("topfilter: Memory allocation failed.");
+            error = true;
+        }
+
         my_instance->sessions = 0;
-        if (my_instance->match &&
-            regcomp(&my_instance->re, my_instance->match, cflags))
+
+        int errnumber;
+        size_t erroffset;
+        char errbuffer[1024];
+
+        /** Both patterns are matched with one scan of the query */
+        if ((my_instance->match || my_instance->exclude) &&
+            (my_instance->patterns = mxs_pcre2_set_alloc(cflags)) == NULL)
         {
+            MXS_ERROR("topfilter: Memory allocation failed.");
+            error = true;
+        }
+        else if (my_instance->match &&
+                 (my_instance->match_id = mxs_pcre2_set_add(my_instance->patterns, my_instance->match,
+                                                            &errnumber, &erroffset)) == -1)
+        {
+            pcre2_get_error_message(errnumber, (PCRE2_UCHAR*) errbuffer, sizeof(errbuffer));
             MXS_ERROR("topfilter: Invalid regular expression '%s'"
-                      " for the 'match' parameter.",
-                      my_instance->match);
-            regfree(&my_instance->re);
-            free(my_instance->match);
-            my_instance->match = NULL;
+                      " for the 'match' parameter at %lu: %s",
+                      my_instance->match, erroffset, errbuffer);
             error = true;
         }
-        if (my_instance->exclude &&
-            regcomp(&my_instance->exre, my_instance->exclude, cflags))
+        else if (my_instance->exclude &&
+                 (my_instance->exclude_id = mxs_pcre2_set_add(my_instance->patterns, my_instance->exclude,
+                                                              &errnumber, &erroffset)) == -1)
         {
+            pcre2_get_error_message(errnumber, (PCRE2_UCHAR*) errbuffer, sizeof(errbuffer));
             MXS_ERROR("topfilter: Invalid regular expression '%s'"
-                      " for the 'nomatch' parameter.\n",
-                      my_instance->exclude);
-            regfree(&my_instance->exre);
-            free(my_instance->exclude);
-            my_instance->exclude = NULL;
+                      " for the 'exclude' parameter at %lu: %s",
+                      my_instance->exclude, erroffset, errbuffer);
             error = true;
         }
+        else if (my_instance->patterns)
+        {
+            mxs_pcre2_set_compile(my_instance->patterns);
+        }
 
         if (error)
         {
-            if (my_instance->exclude)
-            {
-                regfree(&my_instance->exre);
-                free(my_instance->exclude);
-            }
-            if (my_instance->match)
+            mxs_pcre2_set_free(my_instance->patterns);
+            free(my_instance->exclude);
+            free(my_instance->match);
+            for (i = 0; i < my_instance->n_shards; i++)
             {
-                regfree(&my_instance->re);
-                free(my_instance->match);
+                free(my_instance->shards[i].buckets);
             }
+            free(my_instance->shards);
+            free(my_instance->digest_file);
             free(my_instance->filebase);
             free(my_instance->source);
             free(my_instance->user);
             free(my_instance);
             my_instance = NULL;
         }
+        else if (my_instance->digest_file)
+        {
+            char name[strlen(my_instance->digest_file) + sizeof("topfilter: ")];
+            sprintf(name, "topfilter: %s", my_instance->digest_file);
+            hktask_add(name, topn_digest_export, my_instance, my_instance->export_interval);
+        }
     }
     return (FILTER *) my_instance;
 }
@@ -331,15 +1077,26 @@ newSession(FILTER *instance, SESSION *session)
 
     if ((my_session = calloc(1, sizeof(TOPN_SESSION))) != NULL)
     {
-        if ((my_session->filename =
+        if (my_instance->filebase &&
+            (my_session->filename =
                  (char *) malloc(strlen(my_instance->filebase) + 20))
             == NULL)
         {
             free(my_session);
             return NULL;
         }
-        sprintf(my_session->filename, "%s.%d", my_instance->filebase,
-                my_instance->sessions);
+        if (my_instance->patterns &&
+            (my_session->match_state = mxs_pcre2_set_state_alloc()) == NULL)
+        {
+            free(my_session->filename);
+            free(my_session);
+            return NULL;
+        }
+        if (my_session->filename)
+        {
+            sprintf(my_session->filename, "%s.%d", my_instance->filebase,
+                    my_instance->sessions);
+        }
         atomic_add(&my_instance->sessions, 1);
         my_session->top = (TOPNQ **) calloc(my_instance->topN + 1,
                                             sizeof(TOPNQ *));
@@ -380,8 +1137,11 @@ newSession(FILTER *instance, SESSION *session)
             my_session->active = 0;
         }
 
-        sprintf(my_session->filename, "%s.%d", my_instance->filebase,
-                my_instance->sessions);
+        if (my_session->filename)
+        {
+            sprintf(my_session->filename, "%s.%d", my_instance->filebase,
+                    my_instance->sessions);
+        }
         gettimeofday(&my_session->connect, NULL);
     }
 
@@ -406,9 +1166,17 @@ closeSession(FILTER *instance, void *session)
     FILE *fp;
     int statements;
 
+    /** A query without a complete reply is counted if it got a reply */
+    if (my_session->digest_text && !my_session->waiting)
+    {
+        topn_digest_finish(my_instance, my_session);
+    }
+    free(my_session->digest_text);
+    my_session->digest_text = NULL;
+
     gettimeofday(&my_session->disconnect, NULL);
     timersub((&my_session->disconnect), &(my_session->connect), &diff);
-    if ((fp = fopen(my_session->filename, "w")) != NULL)
+    if (my_session->filename && (fp = fopen(my_session->filename, "w")) != NULL)
     {
         statements = my_session->n_statements != 0 ? my_session->n_statements : 1;
 
@@ -470,6 +1238,7 @@ freeSession(FILTER *instance, void *session)
     TOPN_SESSION *my_session = (TOPN_SESSION *) session;
 
     free(my_session->filename);
+    mxs_pcre2_set_state_free(my_session->match_state);
     free(session);
     return;
 }
@@ -523,6 +1292,11 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
     TOPN_SESSION *my_session = (TOPN_SESSION *) session;
     char *ptr;
 
+    if (my_session->digest_text && !my_session->waiting)
+    {
+        topn_digest_finish(my_instance, my_session);
+    }
+
     if (my_session->active)
     {
         if (queue->next != NULL)
@@ -531,10 +1305,13 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
         }
         if ((ptr = modutil_get_SQL(queue)) != NULL)
         {
-            if ((my_instance->match == NULL ||
-                 regexec(&my_instance->re, ptr, 0, NULL, 0) == 0) &&
-                (my_instance->exclude == NULL ||
-                 regexec(&my_instance->exre, ptr, 0, NULL, 0) != 0))
+            if (my_instance->patterns == NULL ||
+                (mxs_pcre2_set_match(my_instance->patterns, my_session->match_state,
+                                     ptr, strlen(ptr)) >= 0 &&
+                 (my_instance->match_id == -1 ||
+                  mxs_pcre2_set_matched(my_session->match_state, my_instance->match_id)) &&
+                 (my_instance->exclude_id == -1 ||
+                  !mxs_pcre2_set_matched(my_session->match_state, my_instance->exclude_id))))
             {
                 my_session->n_statements++;
                 if (my_session->current)
@@ -543,6 +1320,22 @@ routeQuery(FILTER *instance, void *session, GWBUF *queue)
                 }
                 gettimeofday(&my_session->start, NULL);
                 my_session->current = ptr;
+                my_session->waiting = true;
+
+                if (my_instance->digest_stats)
+                {
+                    char *canonical = qc_get_canonical(queue);
+
+                    /** Prepared statements have no literals to replace */
+                    free(my_session->digest_text);
+                    my_session->digest_text = canonical ? canonical : strdup(ptr);
+                    my_session->reply_state = TOPN_REPLY_START;
+                    my_session->reply_rows = 0;
+                    my_session->reply_error = false;
+                    my_session->reply_header_len = 0;
+                    my_session->reply_skip = 0;
+                    my_session->reply_continued = false;
+                }
             }
             else
             {
@@ -576,11 +1369,22 @@ clientReply(FILTER *instance, void *session, GWBUF *reply)
     struct timeval tv, diff;
     int i, inserted;
 
-    if (my_session->current)
+    if (my_session->waiting)
     {
         gettimeofday(&tv, NULL);
         timersub(&tv, &(my_session->start), &diff);
+        my_session->duration = diff;
+        my_session->waiting = false;
+    }
 
+    if (my_session->digest_text && topn_reply_parse(my_session, reply))
+    {
+        topn_digest_finish(my_instance, my_session);
+    }
+
+    if (my_session->current)
+    {
+        diff = my_session->duration;
         timeradd(&(my_session->total), &diff, &(my_session->total));
 
         inserted = 0;
@@ -662,10 +1466,36 @@ diagnostic(FILTER *instance, void *fsession, DCB *dcb)
         dcb_printf(dcb, "\t\tExclude queries that match     %s\n",
                    my_instance->exclude);
     }
-    if (my_session)
+    if (my_instance->digest_stats)
+    {
+        int n_digests;
+        TOPN_DIGEST *digests = topn_digest_snapshot(my_instance, &n_digests);
+
+        dcb_printf(dcb, "\t\tDigests                %d\n", n_digests);
+        dcb_printf(dcb, "\t\tEvicted digests        %d\n", my_instance->evictions);
+        dcb_printf(dcb, "\t\tTop %d digests by total time:\n", my_instance->topN);
+
+        for (i = 0; i < n_digests && i < my_instance->topN; i++)
+        {
+            TOPN_DIGEST *d = &digests[i];
+            dcb_printf(dcb, "\t\t%d place: %016" PRIx64 "\n", i + 1, d->hash);
+            dcb_printf(dcb, "\t\t\tExecutions: %" PRIu64 " Errors: %" PRIu64
+                       " Rows: %" PRIu64 "\n", d->count, d->errors, d->rows);
+            dcb_printf(dcb, "\t\t\tTotal: %.3f Min: %.3f Avg: %.3f Max: %.3f seconds\n",
+                       d->total_us / 1000000.0, d->min_us / 1000000.0,
+                       d->total_us / 1000000.0 / d->count, d->max_us / 1000000.0);
+            dcb_printf(dcb, "\t\t\tSQL: %s\n", d->text);
+        }
+
+        topn_digest_snapshot_free(digests, n_digests);
+    }
+    if (my_session && my_session->filename)
     {
         dcb_printf(dcb, "\t\tLogging to file %s.\n",
                    my_session->filename);
+    }
+    if (my_session)
+    {
         dcb_printf(dcb, "\t\tCurrent Top %d:\n", my_instance->topN);
         for (i = 0; i < my_instance->topN; i++)
         {
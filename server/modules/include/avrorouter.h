@@ -11,6 +11,7 @@
 #include <dcb.h>
 #include <service.h>
 #include <spinlock.h>
+#include <thread.h>
 #include <mysql_binlog.h>
 #include <users.h>
 #include <dbusers.h>
@@ -39,6 +40,9 @@
 #define AVRO_DEFAULT_BLOCK_TRX_COUNT 1
 #define AVRO_DEFAULT_BLOCK_ROW_COUNT 1000
 
+/** The default codec of new Avro files */
+#define AVRO_DEFAULT_CODEC "null"
+
 #define MAX_MAPPED_TABLES 1024
 
 #define GTID_TABLE_NAME        "gtid"
@@ -47,9 +51,25 @@
 #define MEMORY_TABLE_NAME      MEMORY_DATABASE_NAME".mem_used_tables"
 #define INDEX_TABLE_NAME       "indexing_progress"
 
+/** The default synchronous level of the GTID index database */
+#define AVRO_DEFAULT_INDEX_SYNCHRONOUS "NORMAL"
+
+/** Export batching defaults */
+#define AVRO_DEFAULT_EXPORT_BATCH_SIZE (512 * 1024)
+#define AVRO_DEFAULT_EXPORT_LINGER     100
+
+/** The default number of acknowledgements the Kafka broker waits for */
+#define AVRO_DEFAULT_EXPORT_ACKS 1
+
 /** Name of the file where the binlog to Avro conversion progress is stored */
 #define AVRO_PROGRESS_FILE "avro-conversion.ini"
 
+/** Name of the file where the export progress is stored */
+#define AVRO_EXPORT_PROGRESS_FILE "avro-export.ini"
+
+/** How often a batch the export sink did not accept is retried, in milliseconds */
+#define AVRO_EXPORT_RETRY_INTERVAL 1000
+
 /** Buffer limits */
 #define AVRO_SQL_BUFFER_SIZE 2048
 
@@ -93,6 +113,9 @@ typedef enum avro_binlog_end
 /** How many bytes each thread tries to send */
 #define AVRO_DATA_BURST_SIZE MAX_BUFFER_SIZE
 
+/** How many bytes of JSON rows are collected before they are sent */
+#define AVRO_JSON_FLUSH_SIZE (64 * 1024)
+
 /** A CREATE TABLE abstraction */
 typedef struct table_create
 {
@@ -163,6 +186,8 @@ typedef struct avro_table_t
     avro_file_writer_t avro_file; /*< Current Avro data file */
     avro_value_iface_t *avro_writer_iface; /*< Avro C API writer interface */
     avro_schema_t avro_schema; /*< Native Avro schema of the table */
+    MAXAVRO_FILE *tail; /*< Reads the flushed blocks into the block cache */
+    long cache_start; /*< Blocks before this offset are not cached */
 } AVRO_TABLE;
 
 /** Data format used when streaming data to the clients */
@@ -185,6 +210,129 @@ typedef struct gtid_pos
                          * rebuild GTID events in the correct order. */
 } gtid_pos_t;
 
+/**
+ * A row event waiting to be converted into Avro records by a conversion thread.
+ * The row data and the column bitfield are stored after the structure.
+ */
+typedef struct avro_row_job
+{
+    REP_HEADER  hdr; /*< Replication header of the row event */
+    gtid_pos_t  gtid; /*< GTID of the event before the first record was added */
+    TABLE_MAP   *map; /*< Table map of the row event */
+    AVRO_TABLE  *table; /*< Avro file where the records are written */
+    uint8_t     *col_present; /*< Columns present in the row event */
+    uint8_t     *rows; /*< Start of the row data */
+    uint8_t     *end; /*< End of the row data */
+    struct avro_row_job *next;
+} AVRO_ROW_JOB;
+
+/**
+ * A conversion thread and its queue of row events. All row events of a table
+ * are converted by the same thread which keeps the records in binlog order.
+ */
+typedef struct avro_converter
+{
+    THREAD          thread; /*< The conversion thread */
+    pthread_mutex_t lock; /*< Protects the queue */
+    pthread_cond_t  cond; /*< Signaled when a job is added or completed */
+    AVRO_ROW_JOB    *head; /*< First queued job */
+    AVRO_ROW_JOB    *tail; /*< Last queued job */
+    int             pending; /*< Jobs queued or being converted */
+} AVRO_CONVERTER;
+
+/** Maximum number of row events queued for one conversion thread */
+#define AVRO_CONVERTER_QUEUE_MAX 1024
+
+/** A message in an export batch, the offsets are relative to the batch data */
+typedef struct avro_export_msg
+{
+    size_t key; /*< Offset of the key */
+    size_t key_len; /*< Length of the key */
+    size_t value; /*< Offset of the value */
+    size_t value_len; /*< Length of the value */
+} AVRO_EXPORT_MSG;
+
+/** Messages that are written to an export sink at the same time */
+typedef struct avro_export_batch
+{
+    char            *data; /*< Keys and values of the messages */
+    size_t          length; /*< Length of the data */
+    size_t          size; /*< Allocated size of the data */
+    AVRO_EXPORT_MSG *msgs; /*< The messages */
+    size_t          n_msgs; /*< Number of messages */
+    size_t          msgs_size; /*< Allocated number of messages */
+    uint64_t        started; /*< When the first message was added, in milliseconds */
+} AVRO_EXPORT_BATCH;
+
+/** Destination of the exported messages */
+typedef struct avro_sink
+{
+    /** Write a batch, returns false if the batch must be written again later */
+    bool (*write)(struct avro_sink *sink, const AVRO_EXPORT_BATCH *batch);
+    /** Close and free the sink */
+    void (*free)(struct avro_sink *sink);
+} AVRO_SINK;
+
+/** An Avro file whose new records are exported */
+typedef struct avro_export_file
+{
+    char            *filename; /*< Absolute filename */
+    char            *table; /*< Table identifier in database.table format */
+    char            *prefix; /*< Start of the exported JSON records */
+    long            start; /*< Offset of the first exported block */
+    long            acked; /*< Offset of the first block with records the sink
+                            * has not accepted */
+    MAXAVRO_FILE    *file; /*< Reader of the file, NULL until the file has new blocks */
+    bool            open; /*< The table is still being written to */
+    bool            done; /*< The table was closed and the file was read to the end */
+    bool            error; /*< The file could not be read and is skipped */
+    struct avro_export_file *next;
+} AVRO_EXPORT_FILE;
+
+/** Router options of the exporter */
+typedef struct avro_export_options
+{
+    char    *sink; /*< Type of the sink, file or kafka */
+    char    *path; /*< Path of the file sink */
+    char    *broker; /*< Address of the Kafka broker in host:port format */
+    char    *topic; /*< Kafka topic */
+    enum avro_data_format format; /*< Format of the exported records */
+    size_t  batch_size; /*< Size of a batch in bytes */
+    int     linger; /*< Maximum age of a batch in milliseconds */
+    int     acks; /*< Acknowledgements the Kafka broker waits for */
+} AVRO_EXPORT_OPTIONS;
+
+/**
+ * Exports the records of the Avro files to a sink. The flushed records are
+ * collected into batches that are written when they are full or old enough.
+ * The files are read and the batches written by a separate export thread.
+ */
+typedef struct avro_exporter
+{
+    const char          *name; /*< Name of the service */
+    char                *checkpoint; /*< File where the export progress is stored */
+    AVRO_SINK           *sink; /*< Where the batches are written */
+    enum avro_data_format format; /*< Format of the exported records */
+    size_t              batch_size; /*< Size of a batch in bytes */
+    int                 linger; /*< Maximum age of a batch in milliseconds */
+    AVRO_EXPORT_BATCH   batch; /*< The batch being collected */
+    AVRO_EXPORT_FILE    *files; /*< Files being exported, oldest first */
+    MAXAVRO_BLOCK_CACHE *block_cache; /*< Block cache of the router, if used */
+    bool                blocked; /*< The sink did not accept the current batch */
+    bool                unread; /*< The files may have records that were not read */
+    THREAD              thread; /*< The export thread */
+    bool                started; /*< Whether the export thread was started */
+    pthread_mutex_t     lock; /*< Protects the list of files, their open, done
+                                   * and acked fields and the fields below */
+    pthread_cond_t      cond; /*< Signaled when the fields below change */
+    bool                flushed; /*< New records were flushed */
+    bool                shutdown; /*< The export thread should stop */
+    uint64_t            messages; /*< Number of exported messages */
+    uint64_t            bytes; /*< Number of exported bytes */
+    uint64_t            batches; /*< Number of written batches */
+    uint64_t            failures; /*< Number of failed batch writes */
+} AVRO_EXPORTER;
+
 /**
  * The client structure used within this router.
  * This represents the clients that are requesting AVRO files from MaxScale.
@@ -211,6 +359,7 @@ typedef struct avro_client
     bool            requested_gtid; /*< If the client requested */
     gtid_pos_t      gtid; /*< Current/requested GTID */
     gtid_pos_t      gtid_start; /*< First sent GTID */
+    MAXAVRO_FILTER  *filter;        /*< Requested fields and row conditions */
     unsigned int    cstate;         /*< Catch up state */
     sqlite3       *sqlite_handle;
 #if defined(SS_DEBUG)
@@ -261,6 +410,22 @@ typedef struct avro_instance
     uint64_t        row_count; /*< Row events processed */
     uint64_t        row_target; /*< Minimum about of row events that will trigger
                                  * a flush of all tables */
+    char            *codec; /*< Codec used for new Avro files */
+    HASHTABLE       *table_codecs; /*< Per table codecs, keyed by database.table */
+    size_t          block_size; /*< Size of an Avro data block, 0 for the default */
+    int             conversion_threads; /*< Number of row event conversion threads,
+                                         * 0 converts the rows in the binlog reader */
+    AVRO_CONVERTER  *converters; /*< The conversion threads */
+    size_t          block_cache_size; /*< Maximum size of the block cache, 0 disables it */
+    MAXAVRO_BLOCK_CACHE *block_cache; /*< Recently written blocks shared by the clients */
+    char            *index_synchronous; /*< Synchronous level of the GTID index */
+    sqlite3_stmt    *gtid_insert_stmt; /*< Adds a GTID to the index */
+    sqlite3_stmt    *used_table_stmt; /*< Adds a table to the in-memory used tables */
+    sqlite3_stmt    *progress_select_stmt; /*< Reads the indexed position of a file */
+    sqlite3_stmt    *progress_update_stmt; /*< Updates the indexed position of a file */
+    sqlite3_stmt    *progress_insert_stmt; /*< Adds the first indexed position of a file */
+    AVRO_EXPORT_OPTIONS export_options; /*< Router options of the exporter */
+    AVRO_EXPORTER   *exporter; /*< Exports the converted records, NULL if not used */
     struct avro_instance  *next;
 } AVRO_INSTANCE;
 
@@ -278,14 +443,32 @@ extern void avro_client_rotate(AVRO_INSTANCE *router, AVRO_CLIENT *client, uint8
 extern bool avro_open_binlog(const char *binlogdir, const char *file, int *fd);
 extern void avro_close_binlog(int fd);
 extern avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router);
-extern AVRO_TABLE* avro_table_alloc(const char* filepath, const char* json_schema);
+extern AVRO_TABLE* avro_table_alloc(const char* filepath, const char* json_schema,
+                                    const char *codec, size_t block_size);
 extern void* avro_table_free(AVRO_TABLE *table);
 extern void avro_flush_all_tables(AVRO_INSTANCE *router);
 extern char* json_new_schema_from_table(TABLE_MAP *map);
 extern void save_avro_schema(const char *path, const char* schema, TABLE_MAP *map);
 extern bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr);
 extern bool handle_row_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr);
+extern void avro_convert_rows(gtid_pos_t *gtid, REP_HEADER *hdr, TABLE_MAP *map, AVRO_TABLE *table,
+                              uint8_t *ptr, uint8_t *end, uint8_t *col_present);
+extern int avro_count_records(REP_HEADER *hdr, TABLE_MAP *map, uint8_t *ptr,
+                              uint8_t *end, uint8_t *col_present);
+extern int avro_start_conversion_threads(AVRO_INSTANCE *router);
+extern void avro_queue_row_event(AVRO_INSTANCE *router, const char *table_ident, AVRO_ROW_JOB *job);
+extern void avro_wait_conversion_threads(AVRO_INSTANCE *router);
 extern void table_map_remap(uint8_t *ptr, uint8_t hdr_len, TABLE_MAP *map);
+extern AVRO_EXPORTER* avro_exporter_alloc(const char *name, const AVRO_EXPORT_OPTIONS *options,
+                                          const char *avrodir);
+extern bool avro_exporter_start(AVRO_EXPORTER *exporter);
+extern void avro_exporter_free(AVRO_EXPORTER *exporter);
+extern void avro_export_tables(AVRO_INSTANCE *router);
+extern bool avro_export_batch_add(AVRO_EXPORT_BATCH *batch, const char *key, size_t key_len,
+                                  const char *value, size_t value_len);
+extern void avro_export_batch_free(AVRO_EXPORT_BATCH *batch);
+extern AVRO_SINK* avro_file_sink_alloc(const char *path, enum avro_data_format format);
+extern AVRO_SINK* avro_kafka_sink_alloc(const char *broker, const char *topic, int acks);
 
 #define AVRO_CLIENT_UNREGISTERED 0x0000
 #define AVRO_CLIENT_REGISTERED   0x0001
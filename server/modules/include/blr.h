@@ -39,7 +39,7 @@
 #include <pthread.h>
 #include <stdint.h>
 #include <memlog.h>
-#include <zlib.h>
+#include <maxscale_crc32.h>
 #include <mysql_client_server_protocol.h>
 
 #define BINLOG_FNAMELEN         255
@@ -139,6 +139,43 @@
 #define DEF_LONG_BURST          500
 #define DEF_BURST_SIZE          1024000 /* 1 Mb */
 
+/**
+ * Default binlog write buffer size. With 0 every event is written to the
+ * binlog file as soon as it is received.
+ */
+#define DEF_WRITE_BUFFER_SIZE   0
+
+/**
+ * Default maximum time in milliseconds that events stay in the binlog
+ * write buffer before they are written to the binlog file.
+ */
+#define DEF_WRITE_BUFFER_INTERVAL 100
+
+/**
+ * Whether the events of an open transaction are held back from the slaves
+ * until the transaction is complete or the write buffer is written out.
+ */
+#define BLR_HOLDS_TRANSACTIONS(router) ((router)->trx_safe || (router)->write_buffer_size)
+
+/**
+ * Binlog index files. An index file stores the position, timestamp and GTID
+ * of an event group every DEF_INDEX_INTERVAL events.
+ */
+#define DEF_INDEX_INTERVAL      1000
+#define BLR_INDEX_SUFFIX        ".idx"
+#define BLR_INDEX_MAGIC         "MXSBLIDX"
+#define BLR_INDEX_MAGIC_LEN     8
+#define BLR_INDEX_VERSION       1
+#define BLR_INDEX_HDR_LEN       (BLR_INDEX_MAGIC_LEN + 4)
+#define BLR_INDEX_ENTRY_LEN     28
+
+/**
+ * Maximum number of binlog events read when finding the position of a GTID.
+ * This limits the time a slave registration spends reading binlog files
+ * that do not have an index.
+ */
+#define BLR_INDEX_SCAN_LIMIT    (100 * DEF_INDEX_INTERVAL)
+
 /**
  * master reconnect backoff constants
  * BLR_MASTER_BACKOFF_TIME      The increments of the back off time (seconds)
@@ -199,6 +236,38 @@
 #define MYSQL_ERROR_MSG(buf)    ((uint8_t *)GWBUF_DATA(buf) + 7)
 #define MYSQL_COMMAND(buf)      (*((uint8_t *)GWBUF_DATA(buf) + 4))
 
+/** An entry in a binlog index file */
+typedef struct blr_index_entry
+{
+    uint64_t    pos;        /*< Position of the first event of the group */
+    uint64_t    seq;        /*< GTID sequence number, 0 if no GTID */
+    uint32_t    domain;     /*< GTID domain */
+    uint32_t    server_id;  /*< Server ID of the event */
+    uint32_t    timestamp;  /*< Timestamp of the event */
+} BLR_INDEX_ENTRY;
+
+/** A binlog index file being written */
+typedef struct blr_index
+{
+    char        *path;          /*< Path to the index file */
+    char        *tmp_path;      /*< Path of the file while it is written, NULL
+                                 *  if entries are appended to the index file */
+    FILE        *file;          /*< The index file */
+    unsigned int interval;      /*< Minimum number of events between entries */
+    unsigned int n_events;      /*< Events since the last entry */
+    unsigned long n_entries;    /*< Number of entries written */
+    bool        error;          /*< Whether writing has failed */
+} BLR_INDEX;
+
+/** How the binlog file being written is synchronised to disk */
+typedef enum blr_sync_method
+{
+    BLR_SYNC_FSYNC,         /*< fsync(), the default */
+    BLR_SYNC_FDATASYNC,     /*< fdatasync(), no metadata update unless needed */
+    BLR_SYNC_FILE_RANGE,    /*< sync_file_range(), only start the writeback */
+    BLR_SYNC_NONE           /*< Leave the writeback to the operating system */
+} blr_sync_method_t;
+
 /** Possible states of an event sent by the master */
 enum blr_event_state
 {
@@ -351,7 +420,12 @@ typedef struct router_slave
     SPINLOCK        catch_lock;     /*< Event catchup lock */
     unsigned int    cstate;         /*< Catch up state */
     bool            mariadb10_compat;/*< MariaDB 10.0 compatibility */
+    bool            use_gtid;       /*< Slave set @slave_connect_state */
+    uint32_t        gtid_domain;    /*< GTID domain of @slave_connect_state */
+    uint32_t        gtid_server_id; /*< GTID server ID of @slave_connect_state */
+    uint64_t        gtid_seq;       /*< GTID sequence of @slave_connect_state, 0 if empty */
     SPINLOCK        rses_lock;      /*< Protects rses_deleted */
+    int             refcount;       /*< References from the slave list and snapshots */
     pthread_t       pthread;
     struct router_instance
         *router;        /*< Pointer to the owning router */
@@ -373,6 +447,19 @@ typedef struct router_slave
 } ROUTER_SLAVE;
 
 
+/**
+ * A copy-on-write snapshot of the slaves that are receiving binlog events.
+ * The snapshot is replaced whenever a slave starts dumping or is removed
+ * so that the master thread can distribute events without holding the
+ * router lock. Each snapshot holds a reference to the slaves in it.
+ */
+typedef struct blr_slave_array
+{
+    int             refcount;       /*< Number of users of this snapshot */
+    int             n_slaves;       /*< Number of slaves in the snapshot */
+    ROUTER_SLAVE    *slaves[];      /*< The slaves */
+} BLR_SLAVE_ARRAY;
+
 /**
  * The statistics for this router instance
  */
@@ -395,6 +482,10 @@ typedef struct
     uint64_t        n_fakeevents;   /*< Fake events not written to disk */
     uint64_t        n_artificial;   /*< Artificial events not written to disk */
     int             n_badcrc;       /*< No. of bad CRC's from master */
+    uint64_t        n_binlog_writes; /*< Number of write calls to the binlog file */
+    uint64_t        n_binlog_syncs; /*< Number of syncs of the binlog file */
+    uint64_t        sync_time_total; /*< Time spent in syncs, in microseconds */
+    uint64_t        sync_time_max;  /*< Longest sync, in microseconds */
     uint64_t        events[MAX_EVENT_TYPE_END + 1]; /*< Per event counters */
     uint64_t        lastsample;
     int             minno;
@@ -432,6 +523,7 @@ typedef struct router_instance
 {
     SERVICE                 *service;       /*< Pointer to the service using this router */
     ROUTER_SLAVE            *slaves;        /*< Link list of all the slave connections  */
+    BLR_SLAVE_ARRAY         *slave_array;   /*< Snapshot of the dumping slaves */
     SPINLOCK                lock;           /*< Spinlock for the instance data */
     char                    *uuid;          /*< UUID for the router to use w/master */
     int                     masterid;       /*< Set ID of the master, sent to slaves */
@@ -473,6 +565,16 @@ typedef struct router_instance
                                              *  file being written
                                              */
     uint64_t          last_written; /*< Position of the last write operation */
+    uint8_t           *write_buffer; /*< Events not yet written to the binlog file */
+    unsigned long     write_buffer_size; /*< Size of write_buffer, 0 disables it */
+    unsigned long     write_buffer_len; /*< Bytes stored in write_buffer */
+    unsigned long     write_buffer_interval; /*< Maximum age of buffered events in milliseconds */
+    uint64_t          write_buffer_start; /*< Time the oldest buffered event was stored */
+    blr_sync_method_t sync_method;  /*< How the binlog file is synced */
+    unsigned long     sync_interval; /*< Minimum time between syncs in milliseconds */
+    uint64_t          last_sync;    /*< Time of the last sync in milliseconds */
+    BLR_INDEX         *index;       /*< Index of the binlog file being written */
+    unsigned int      index_interval; /*< Events between index entries, 0 disables the index */
     uint64_t          last_event_pos;       /*< Position of last event written */
     uint64_t          current_safe_event;
     /*< Position of the latest safe event being sent to slaves */
@@ -608,11 +710,18 @@ extern int blr_slave_request(ROUTER_INSTANCE *, ROUTER_SLAVE *, GWBUF *);
 extern void blr_slave_rotate(ROUTER_INSTANCE *, ROUTER_SLAVE *, uint8_t *);
 extern int blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large);
 extern void blr_init_cache(ROUTER_INSTANCE *);
+extern void blr_slave_start_dumping(ROUTER_INSTANCE *, ROUTER_SLAVE *);
+extern void blr_slave_remove(ROUTER_INSTANCE *, ROUTER_SLAVE *);
+extern void blr_slave_release(ROUTER_SLAVE *);
+extern BLR_SLAVE_ARRAY *blr_slave_array_acquire(ROUTER_INSTANCE *);
+extern void blr_slave_array_release(BLR_SLAVE_ARRAY *);
 
 extern int  blr_file_init(ROUTER_INSTANCE *);
 extern int  blr_write_binlog_record(ROUTER_INSTANCE *, REP_HEADER *, uint32_t pos, uint8_t *);
 extern int  blr_file_rotate(ROUTER_INSTANCE *, char *, uint64_t);
 extern void blr_file_flush(ROUTER_INSTANCE *);
+extern int  blr_file_flush_buffer(ROUTER_INSTANCE *);
+extern bool blr_file_buffer_expired(ROUTER_INSTANCE *);
 extern BLFILE *blr_open_binlog(ROUTER_INSTANCE *, char *);
 extern GWBUF *blr_read_binlog(ROUTER_INSTANCE *, BLFILE *, unsigned long, REP_HEADER *, char *);
 extern void blr_close_binlog(ROUTER_INSTANCE *, BLFILE *);
@@ -624,12 +733,23 @@ extern int blr_file_next_exists(ROUTER_INSTANCE *, ROUTER_SLAVE *);
 uint32_t extract_field(uint8_t *src, int bits);
 void blr_cache_read_master_data(ROUTER_INSTANCE *router);
 int blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug);
+int blr_read_events_index(ROUTER_INSTANCE *router, int fix, int debug, BLR_INDEX *index);
 int blr_save_dbusers(const ROUTER_INSTANCE *router);
 char    *blr_get_event_description(ROUTER_INSTANCE *router, uint8_t event);
 void blr_file_append(ROUTER_INSTANCE *router, char *file);
 void blr_cache_response(ROUTER_INSTANCE *router, char *response, GWBUF *buf);
 char * blr_last_event_description(ROUTER_INSTANCE *router);
 
+extern BLR_INDEX *blr_index_create(const char *binlog_path, unsigned int interval);
+extern BLR_INDEX *blr_index_open(const char *binlog_path, uint64_t binlog_size, unsigned int interval);
+extern void blr_index_add(BLR_INDEX *index, const BLR_INDEX_ENTRY *entry);
+extern void blr_index_event(BLR_INDEX *index, bool mariadb10, uint64_t pos, bool safe,
+                            REP_HEADER *hdr, uint8_t *body);
+extern bool blr_index_close(BLR_INDEX *index);
+extern bool blr_index_find_gtid(ROUTER_INSTANCE *router, uint32_t domain, uint64_t seq,
+                                char *file, uint64_t *pos);
+extern int blr_file_first_binlog(ROUTER_INSTANCE *router);
+
 extern bool blr_send_event(blr_thread_role_t role,
                            const char* binlog_name,
                            uint32_t binlog_pos,
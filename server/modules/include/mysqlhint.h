@@ -20,6 +20,7 @@
  * 17-07-2014   Mark Riddoch    Initial implementation
  */
 #include <hint.h>
+#include <hashtable.h>
 
 /* Parser tokens for the hint parser */
 typedef enum
@@ -45,20 +46,6 @@ typedef struct
     char        *value;     // The string version of the token
 } HINT_TOKEN;
 
-/**
- * A named hint set.
- *
- * The hint "MaxScale name PREPARE ..." can be used to defined a named set
- * of hints that can be later applied.
- */
-typedef struct namedhints
-{
-    char        *name;  /*< Hintsets name */
-    HINT        *hints;
-    struct namedhints
-        *next;  /*< Next named hint */
-} NAMEDHINTS;
-
 /**
  * A session meaintains a stack of hints, the hints BEGIN and STOP are used
  * push hints on and off the stack. The current top of the stack is added to
@@ -89,9 +76,17 @@ typedef struct
     GWBUF       *request;
     int     query_len;
     HINTSTACK   *stack;
-    NAMEDHINTS  *named_hints;   /* The named hints defined in this session */
+    HASHTABLE   *named_hints;   /* The named hints defined in this session.
+                                 * The hint "MaxScale name PREPARE ..." can be
+                                 * used to define a named set of hints that can
+                                 * be later applied. */
+    HASHTABLE   *hint_cache;    /* Parsed one-off hints keyed by comment text */
+    int         n_cached;       /* Number of entries in hint_cache */
 } HINT_SESSION;
 
+/* Maximum number of parsed hints cached per session */
+#define HINT_CACHE_SIZE 64
+
 /* Some useful macros */
 #define CURRENT_HINT(session)   ((session)->stack ? \
                     (session)->stack->hints : NULL)
@@ -107,7 +102,7 @@ typedef struct
 
 
 extern HINT *hint_parser(HINT_SESSION *session, GWBUF *request);
-NAMEDHINTS* free_named_hint(NAMEDHINTS* named_hint);
+void*       free_hint_list(void* hint);
 HINTSTACK*  free_hint_stack(HINTSTACK* hint_stack);
 
 
@@ -505,12 +505,11 @@ monitorMain(void *arg)
         thread_millisleep(MON_BASE_INTERVAL_MS);
 
         /**
-         * Calculate how far away the monitor interval is from its full
-         * cycle and if monitor interval time further than the base
-         * interval, then skip monitoring checks. Excluding the first
-         * round.
+         * Skip the monitoring checks until the monitor interval is full,
+         * a liveness check fails or a router requests a new round.
+         * The first round is always done.
          */
-        if (nrounds != 0 && ((nrounds * MON_BASE_INTERVAL_MS) % mon->interval) >= MON_BASE_INTERVAL_MS)
+        if (!monitor_round_due(mon, nrounds))
         {
             nrounds += 1;
             continue;
@@ -526,9 +525,15 @@ monitorMain(void *arg)
         while (ptr)
         {
             ptr->mon_prev_status = ptr->server->status;
+            ptr = ptr->next;
+        }
+
+        monitor_probe_all(mon, monitorDatabase);
 
-            monitorDatabase(mon, ptr);
+        ptr = mon->databases;
 
+        while (ptr)
+        {
             /* Log server status change */
             if (mon_status_changed(ptr))
             {
@@ -574,14 +574,11 @@ monitorMain(void *arg)
         /** Wait base interval */
         thread_millisleep(MON_BASE_INTERVAL_MS);
         /**
-         * Calculate how far away the monitor interval is from its full
-         * cycle and if monitor interval time further than the base
-         * interval, then skip monitoring checks. Excluding the first
-         * round.
+         * Skip the monitoring checks until the monitor interval is full,
+         * a liveness check fails or a router requests a new round.
+         * The first round is always done.
          */
-        if (nrounds != 0 &&
-            ((nrounds * MON_BASE_INTERVAL_MS) % mon->interval) >=
-            MON_BASE_INTERVAL_MS)
+        if (!monitor_round_due(mon, nrounds))
         {
             nrounds += 1;
             continue;
@@ -595,10 +592,16 @@ monitorMain(void *arg)
         {
             /* copy server status into monitor pending_status */
             ptr->pending_status = ptr->server->status;
+            ptr = ptr->next;
+        }
+
+        /* monitor all nodes concurrently */
+        monitor_probe_all(mon, monitorDatabase);
 
-            /* monitor current node */
-            monitorDatabase(mon, ptr);
+        ptr = mon->databases;
 
+        while (ptr)
+        {
             if (mon_status_changed(ptr))
             {
                 if (!(SERVER_IS_RUNNING(ptr->server)) ||
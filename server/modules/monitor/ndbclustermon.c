@@ -253,7 +253,7 @@ diagnostics(DCB *dcb, void *arg)
  * @param database  The database to probe
  */
 static void
-monitorDatabase(MONITOR_SERVERS *database, char *defaultUser, char *defaultPasswd, MONITOR *mon)
+monitorDatabase(MONITOR *mon, MONITOR_SERVERS *database)
 {
     MYSQL_ROW row;
     MYSQL_RES *result;
@@ -395,14 +395,11 @@ monitorMain(void *arg)
         /** Wait base interval */
         thread_millisleep(MON_BASE_INTERVAL_MS);
         /**
-         * Calculate how far away the monitor interval is from its full
-         * cycle and if monitor interval time further than the base
-         * interval, then skip monitoring checks. Excluding the first
-         * round.
+         * Skip the monitoring checks until the monitor interval is full,
+         * a liveness check fails or a router requests a new round.
+         * The first round is always done.
          */
-        if (nrounds != 0 &&
-            ((nrounds * MON_BASE_INTERVAL_MS) % mon->interval) >=
-            MON_BASE_INTERVAL_MS)
+        if (!monitor_round_due(mon, nrounds))
         {
             nrounds += 1;
             continue;
@@ -413,8 +410,15 @@ monitorMain(void *arg)
         while (ptr)
         {
             ptr->mon_prev_status = ptr->server->status;
-            monitorDatabase(ptr, mon->user, mon->password, mon);
+            ptr = ptr->next;
+        }
 
+        monitor_probe_all(mon, monitorDatabase);
+
+        ptr = mon->databases;
+
+        while (ptr)
+        {
             if (ptr->server->status != ptr->mon_prev_status ||
                 SERVER_IS_DOWN(ptr->server))
             {
@@ -94,6 +94,8 @@ bool avro_save_conversion_state(AVRO_INSTANCE *router);
 static void stats_func(void *);
 void avro_index_file(AVRO_INSTANCE *router, const char* path);
 void avro_update_index(AVRO_INSTANCE* router);
+bool avro_index_init(AVRO_INSTANCE *router);
+void avro_index_free(AVRO_INSTANCE *router);
 
 /** The module object definition */
 static ROUTER_OBJECT MyObject =
@@ -211,6 +213,23 @@ bool create_tables(sqlite3* handle)
         return false;
     }
 
+    /** Covering indexes for the lookups done when clients are positioned */
+    rc = sqlite3_exec(handle, "CREATE INDEX IF NOT EXISTS "GTID_TABLE_NAME"_file_index ON "
+                      GTID_TABLE_NAME"(avrofile, domain, server_id, sequence, position);"
+                      "CREATE INDEX IF NOT EXISTS "USED_TABLES_TABLE_NAME"_gtid_index ON "
+                      USED_TABLES_TABLE_NAME"(domain, server_id, sequence, "
+                      "binlog_timestamp, table_name);"
+                      "CREATE INDEX IF NOT EXISTS "INDEX_TABLE_NAME"_file_index ON "
+                      INDEX_TABLE_NAME"(filename, position);",
+                      NULL, NULL, &errmsg);
+    if (rc != SQLITE_OK)
+    {
+        MXS_ERROR("Failed to create indexes for the GTID index tables: %s",
+                  sqlite3_errmsg(handle));
+        sqlite3_free(errmsg);
+        return false;
+    }
+
     rc = sqlite3_exec(handle, "ATTACH DATABASE ':memory:' AS "MEMORY_DATABASE_NAME,
                       NULL, NULL, &errmsg);
     if (rc != SQLITE_OK)
@@ -332,9 +351,31 @@ createInstance(SERVICE *service, char **options)
     inst->trx_count = 0;
     inst->row_target = AVRO_DEFAULT_BLOCK_ROW_COUNT;
     inst->trx_target = AVRO_DEFAULT_BLOCK_TRX_COUNT;
+    inst->codec = strdup(AVRO_DEFAULT_CODEC);
+    inst->block_size = 0;
+    inst->conversion_threads = 0;
+    inst->converters = NULL;
+    inst->block_cache_size = 0;
+    inst->block_cache = NULL;
+    inst->index_synchronous = strdup(AVRO_DEFAULT_INDEX_SYNCHRONOUS);
+    inst->export_options.format = AVRO_FORMAT_JSON;
+    inst->export_options.batch_size = AVRO_DEFAULT_EXPORT_BATCH_SIZE;
+    inst->export_options.linger = AVRO_DEFAULT_EXPORT_LINGER;
+    inst->export_options.acks = AVRO_DEFAULT_EXPORT_ACKS;
+    inst->exporter = NULL;
     int first_file = 1;
     bool err = false;
 
+    if ((inst->table_codecs = hashtable_alloc(100, simple_str_hash, strcmp)))
+    {
+        hashtable_memory_fns(inst->table_codecs, (HASHMEMORYFN)strdup, (HASHMEMORYFN)strdup,
+                             safe_key_free, safe_key_free);
+    }
+    else
+    {
+        err = true;
+    }
+
     CONFIG_PARAMETER *param = config_get_param(service->svc_config_param, "source");
     if (param)
     {
@@ -402,6 +443,144 @@ createInstance(SERVICE *service, char **options)
                 {
                     first_file = MAX(1, atoi(value));
                 }
+                else if (strcmp(options[i], "codec") == 0)
+                {
+                    if (maxavro_codec_from_string(value) == MAXAVRO_CODEC_UNKNOWN)
+                    {
+                        MXS_ERROR("[%s] Unsupported Avro codec: '%s'", service->name, value);
+                        err = true;
+                    }
+                    else
+                    {
+                        free(inst->codec);
+                        inst->codec = strdup(value);
+                    }
+                }
+                else if (strcmp(options[i], "table_codec") == 0)
+                {
+                    /** The value is in database.table:codec format */
+                    char *codec = strrchr(value, ':');
+
+                    if (codec == NULL || codec == value || strchr(value, '.') == NULL)
+                    {
+                        MXS_ERROR("[%s] Invalid value for 'table_codec', expected "
+                                  "<database>.<table>:<codec>: '%s'", service->name, value);
+                        err = true;
+                    }
+                    else
+                    {
+                        *codec++ = '\0';
+
+                        if (maxavro_codec_from_string(codec) == MAXAVRO_CODEC_UNKNOWN)
+                        {
+                            MXS_ERROR("[%s] Unsupported Avro codec for table '%s': '%s'",
+                                      service->name, value, codec);
+                            err = true;
+                        }
+                        else if (inst->table_codecs)
+                        {
+                            hashtable_delete(inst->table_codecs, value);
+                            hashtable_add(inst->table_codecs, value, codec);
+                        }
+                    }
+                }
+                else if (strcmp(options[i], "block_size") == 0)
+                {
+                    inst->block_size = atol(value);
+                }
+                else if (strcmp(options[i], "block_cache_size") == 0)
+                {
+                    inst->block_cache_size = atol(value);
+                }
+                else if (strcmp(options[i], "conversion_threads") == 0)
+                {
+                    inst->conversion_threads = MAX(0, atoi(value));
+                }
+                else if (strcmp(options[i], "index_synchronous") == 0)
+                {
+                    if (strcasecmp(value, "OFF") == 0 ||
+                        strcasecmp(value, "NORMAL") == 0 ||
+                        strcasecmp(value, "FULL") == 0)
+                    {
+                        free(inst->index_synchronous);
+                        inst->index_synchronous = strdup(value);
+                    }
+                    else
+                    {
+                        MXS_ERROR("[%s] Invalid value for 'index_synchronous', expected "
+                                  "OFF, NORMAL or FULL: '%s'", service->name, value);
+                        err = true;
+                    }
+                }
+                else if (strcmp(options[i], "export") == 0)
+                {
+                    if (strcmp(value, "file") == 0 || strcmp(value, "kafka") == 0)
+                    {
+                        free(inst->export_options.sink);
+                        inst->export_options.sink = strdup(value);
+                    }
+                    else
+                    {
+                        MXS_ERROR("[%s] Invalid value for 'export', expected "
+                                  "file or kafka: '%s'", service->name, value);
+                        err = true;
+                    }
+                }
+                else if (strcmp(options[i], "export_path") == 0)
+                {
+                    free(inst->export_options.path);
+                    inst->export_options.path = strdup(value);
+                }
+                else if (strcmp(options[i], "export_broker") == 0)
+                {
+                    free(inst->export_options.broker);
+                    inst->export_options.broker = strdup(value);
+                }
+                else if (strcmp(options[i], "export_topic") == 0)
+                {
+                    free(inst->export_options.topic);
+                    inst->export_options.topic = strdup(value);
+                }
+                else if (strcmp(options[i], "export_format") == 0)
+                {
+                    if (strcasecmp(value, "JSON") == 0)
+                    {
+                        inst->export_options.format = AVRO_FORMAT_JSON;
+                    }
+                    else if (strcasecmp(value, "AVRO") == 0)
+                    {
+                        inst->export_options.format = AVRO_FORMAT_AVRO;
+                    }
+                    else
+                    {
+                        MXS_ERROR("[%s] Invalid value for 'export_format', expected "
+                                  "JSON or AVRO: '%s'", service->name, value);
+                        err = true;
+                    }
+                }
+                else if (strcmp(options[i], "export_batch_size") == 0)
+                {
+                    inst->export_options.batch_size = MAX(1, atol(value));
+                }
+                else if (strcmp(options[i], "export_linger") == 0)
+                {
+                    inst->export_options.linger = MAX(0, atoi(value));
+                }
+                else if (strcmp(options[i], "export_acks") == 0)
+                {
+                    int acks = atoi(value);
+
+                    if (acks >= -1 && acks <= 1)
+                    {
+                        inst->export_options.acks = acks;
+                    }
+                    else
+                    {
+                        MXS_ERROR("[%s] Invalid value for 'export_acks', expected "
+                                  "-1, 0 or 1: '%s'", service->name, value);
+                        err = true;
+                    }
+                }
                 else
                 {
                     MXS_WARNING("[avrorouter] Unknown router option: '%s'", options[i]);
@@ -452,6 +631,26 @@ createInstance(SERVICE *service, char **options)
         }
     }
 
+    AVRO_EXPORT_OPTIONS *export = &inst->export_options;
+
+    if (export->sink && strcmp(export->sink, "file") == 0 && export->path == NULL)
+    {
+        MXS_ERROR("[%s] The file export needs the 'export_path' option.", service->name);
+        err = true;
+    }
+    else if (export->sink && strcmp(export->sink, "kafka") == 0 &&
+             (export->broker == NULL || export->topic == NULL))
+    {
+        MXS_ERROR("[%s] The Kafka export needs the 'export_broker' and 'export_topic' "
+                  "options.", service->name);
+        err = true;
+    }
+    else if (export->sink && !err &&
+             (inst->exporter = avro_exporter_alloc(service->name, export, inst->avrodir)) == NULL)
+    {
+        err = true;
+    }
+
     snprintf(inst->binlog_name, sizeof(inst->binlog_name), BINLOG_NAMEFMT, inst->fileroot, first_file);
     inst->prevbinlog[0] = '\0';
 
@@ -507,17 +706,26 @@ createInstance(SERVICE *service, char **options)
                   sqlite3_errmsg(inst->sqlite_handle));
         err = true;
     }
-    else if (!create_tables(inst->sqlite_handle))
+    else if (!create_tables(inst->sqlite_handle) || !avro_index_init(inst))
     {
         err = true;
     }
 
     if (err)
     {
+        avro_index_free(inst);
         sqlite3_close_v2(inst->sqlite_handle);
         hashtable_free(inst->table_maps);
         hashtable_free(inst->open_tables);
         hashtable_free(inst->created_tables);
+        hashtable_free(inst->table_codecs);
+        free(inst->codec);
+        free(inst->index_synchronous);
+        avro_exporter_free(inst->exporter);
+        free(export->sink);
+        free(export->path);
+        free(export->broker);
+        free(export->topic);
         free(inst->avrodir);
         free(inst->binlogdir);
         free(inst->fileroot);
@@ -534,10 +742,39 @@ createInstance(SERVICE *service, char **options)
     instances = inst;
     spinlock_release(&instlock);
 
+    if (inst->block_cache_size > 0)
+    {
+        inst->block_cache = maxavro_block_cache_alloc(inst->block_cache_size);
+    }
+
+    if (inst->exporter)
+    {
+        inst->exporter->block_cache = inst->block_cache;
+
+        if (!avro_exporter_start(inst->exporter))
+        {
+            avro_exporter_free(inst->exporter);
+            inst->exporter = NULL;
+        }
+    }
+
+    if (inst->exporter)
+    {
+        MXS_NOTICE("[%s] Exporting the converted records in %s format to %s '%s'.",
+                   service->name, avro_client_ouput[export->format], export->sink,
+                   export->path ? export->path : export->broker);
+    }
+
     /* AVRO converter init */
     avro_load_conversion_state(inst);
     avro_load_metadata_from_schemas(inst);
 
+    if (inst->conversion_threads > 0)
+    {
+        MXS_NOTICE("[%s] Using %d threads to convert row events.", service->name,
+                   avro_start_conversion_threads(inst));
+    }
+
     /*
      * Add tasks for statistic computation
      */
@@ -652,6 +889,7 @@ static void freeSession(ROUTER* router_instance, void* router_client_ses)
 
     free(client->uuid);
     maxavro_file_close(client->file_handle);
+    maxavro_filter_free(client->filter);
     sqlite3_close_v2(client->sqlite_handle);
 
     /*
@@ -798,6 +1036,29 @@ diagnostics(ROUTER *router, DCB *dcb)
                router_inst->avrodir, AVRO_PROGRESS_FILE);
     dcb_printf(dcb, "\tAVRO files directory:                %s\n",
                router_inst->avrodir);
+    dcb_printf(dcb, "\tAVRO file codec:                     %s\n",
+               router_inst->codec);
+    dcb_printf(dcb, "\tRow event conversion threads:        %d\n",
+               router_inst->conversion_threads);
+
+    if (router_inst->block_cache)
+    {
+        dcb_printf(dcb, "\tBlock cache size:                    %lu/%lu bytes\n",
+                   router_inst->block_cache->size, router_inst->block_cache->max_size);
+        dcb_printf(dcb, "\tBlock cache hits/misses:             %lu/%lu\n",
+                   router_inst->block_cache->hits, router_inst->block_cache->misses);
+    }
+
+    if (router_inst->exporter)
+    {
+        AVRO_EXPORTER *exporter = router_inst->exporter;
+        dcb_printf(dcb, "\tExport sink:                         %s%s\n",
+                   router_inst->export_options.sink, exporter->blocked ? " (blocked)" : "");
+        dcb_printf(dcb, "\tExported messages/bytes/batches:     %lu/%lu/%lu\n",
+                   exporter->messages, exporter->bytes, exporter->batches);
+        dcb_printf(dcb, "\tFailed export batch writes:          %lu\n",
+                   exporter->failures);
+    }
 
     localtime_r(&router_inst->stats.lastReply, &tm);
     asctime_r(&tm, buf);
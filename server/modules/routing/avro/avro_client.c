@@ -54,6 +54,64 @@ static bool avro_client_stream_data(AVRO_CLIENT *client);
 void avro_notify_client(AVRO_CLIENT *client);
 void poll_fake_write_event(DCB *dcb);
 GWBUF* read_avro_json_schema(const char *avrofile, const char* dir);
+/**
+ * @brief Remove the fields the client did not request from a JSON schema
+ *
+ * @param schema JSON schema, freed by this function
+ * @param filter The fields the client requested
+ * @return The projected schema or NULL on error
+ */
+static GWBUF* project_json_schema(GWBUF *schema, const MAXAVRO_FILTER *filter)
+{
+    GWBUF *rval = NULL;
+    json_error_t err;
+    json_t *json;
+
+    if ((schema = gwbuf_make_contiguous(schema)) &&
+        (json = json_loadb((char*)GWBUF_DATA(schema), GWBUF_LENGTH(schema), 0, &err)))
+    {
+        json_t *fields = json_object_get(json, "fields");
+        size_t i = 0;
+
+        while (i < json_array_size(fields))
+        {
+            const char *name = json_string_value(json_object_get(json_array_get(fields, i), "name"));
+            bool found = false;
+
+            for (size_t j = 0; name && j < filter->num_fields && !found; j++)
+            {
+                found = strcmp(name, filter->fields[j]) == 0;
+            }
+
+            if (found)
+            {
+                i++;
+            }
+            else
+            {
+                json_array_remove(fields, i);
+            }
+        }
+
+        char *str = json_dumps(json, JSON_PRESERVE_ORDER);
+
+        if (str)
+        {
+            rval = gwbuf_alloc_and_load(strlen(str), str);
+            free(str);
+        }
+
+        json_decref(json);
+    }
+    else if (schema)
+    {
+        MXS_ERROR("Failed to parse JSON schema: %s", err.text);
+    }
+
+    gwbuf_free(schema);
+    return rval;
+}
+
 GWBUF* read_avro_binary_schema(const char *avrofile, const char* dir);
 const char* get_avrofile_name(const char *file_ptr, int data_len, char *dest);
 
@@ -240,6 +298,249 @@ void extract_gtid_request(gtid_pos_t *gtid, const char *start, int len)
     }
 }
 
+/**
+ * @brief Find a keyword that is surrounded by whitespace
+ *
+ * @param str String to search
+ * @param keyword Keyword to find
+ * @return Pointer to the keyword or NULL if it was not found
+ */
+static char* find_keyword(char *str, const char *keyword)
+{
+    size_t len = strlen(keyword);
+    char *ptr = str;
+
+    while ((ptr = strstr(ptr, keyword)))
+    {
+        if ((ptr == str || isspace(ptr[-1])) && (ptr[len] == '\0' || isspace(ptr[len])))
+        {
+            return ptr;
+        }
+        ptr += len;
+    }
+
+    return NULL;
+}
+
+static char* skip_space(char *ptr)
+{
+    while (isspace(*ptr))
+    {
+        ptr++;
+    }
+    return ptr;
+}
+
+/**
+ * @brief Parse the field list of a FIELDS clause
+ *
+ * @param str Comma separated list of field names
+ * @param filter Filter where the fields are stored
+ * @return True if at least one field was parsed
+ */
+static bool parse_fields(char *str, MAXAVRO_FILTER *filter)
+{
+    char *saveptr;
+    char *tok = strtok_r(str, ", \t\r\n", &saveptr);
+
+    while (tok)
+    {
+        char **fields = realloc(filter->fields, (filter->num_fields + 1) * sizeof(char*));
+
+        if (fields == NULL || (fields[filter->num_fields] = strdup(tok)) == NULL)
+        {
+            if (fields)
+            {
+                filter->fields = fields;
+            }
+            return false;
+        }
+
+        filter->fields = fields;
+        filter->num_fields++;
+        tok = strtok_r(NULL, ", \t\r\n", &saveptr);
+    }
+
+    return filter->num_fields > 0;
+}
+
+/**
+ * @brief Parse the conditions of a WHERE clause
+ *
+ * The conditions are of the form `field op value` and they are separated by
+ * the AND keyword. The operator is one of =, !=, <>, <, <=, > and >=. A value
+ * that contains whitespace must be quoted with single or double quotes.
+ *
+ * @param str The conditions
+ * @param filter Filter where the conditions are stored
+ * @return True if the conditions were parsed
+ */
+static bool parse_conditions(char *str, MAXAVRO_FILTER *filter)
+{
+    static const struct
+    {
+        const char *str;
+        enum maxavro_compare op;
+    } operators[] =
+    {
+        {"!=", MAXAVRO_CMP_NE},
+        {"<>", MAXAVRO_CMP_NE},
+        {"<=", MAXAVRO_CMP_LE},
+        {">=", MAXAVRO_CMP_GE},
+        {"=", MAXAVRO_CMP_EQ},
+        {"<", MAXAVRO_CMP_LT},
+        {">", MAXAVRO_CMP_GT}
+    };
+    char *ptr = skip_space(str);
+
+    do
+    {
+        MAXAVRO_CONDITION cond;
+        char *name = ptr;
+
+        while (isalnum(*ptr) || *ptr == '_')
+        {
+            ptr++;
+        }
+
+        size_t name_len = ptr - name;
+        ptr = skip_space(ptr);
+        int i = 0;
+        int n_ops = sizeof(operators) / sizeof(operators[0]);
+
+        while (i < n_ops && strncmp(ptr, operators[i].str, strlen(operators[i].str)) != 0)
+        {
+            i++;
+        }
+
+        if (name_len == 0 || i == n_ops)
+        {
+            return false;
+        }
+
+        cond.op = operators[i].op;
+        ptr = skip_space(ptr + strlen(operators[i].str));
+        char *value = ptr;
+        size_t value_len;
+
+        if (*ptr == '\'' || *ptr == '"')
+        {
+            char *end = strchr(ptr + 1, *ptr);
+
+            if (end == NULL)
+            {
+                return false;
+            }
+
+            value++;
+            value_len = end - value;
+            ptr = end + 1;
+        }
+        else
+        {
+            while (*ptr && !isspace(*ptr))
+            {
+                ptr++;
+            }
+            value_len = ptr - value;
+
+            if (value_len == 0)
+            {
+                return false;
+            }
+        }
+
+        MAXAVRO_CONDITION *conditions = realloc(filter->conditions, (filter->num_conditions + 1) *
+                                                sizeof(MAXAVRO_CONDITION));
+
+        if (conditions == NULL)
+        {
+            return false;
+        }
+
+        filter->conditions = conditions;
+        cond.field = strndup(name, name_len);
+        cond.value = strndup(value, value_len);
+        conditions[filter->num_conditions++] = cond;
+
+        if (cond.field == NULL || cond.value == NULL)
+        {
+            return false;
+        }
+
+        ptr = skip_space(ptr);
+
+        if (*ptr)
+        {
+            if (strncmp(ptr, "AND", 3) != 0 || !isspace(ptr[3]))
+            {
+                return false;
+            }
+            ptr = skip_space(ptr + 3);
+        }
+    }
+    while (*ptr);
+
+    return true;
+}
+
+/**
+ * @brief Parse the optional part of a REQUEST-DATA command
+ *
+ * The optional part is `[GTID] [FIELDS field[,field...]] [WHERE conditions]`.
+ *
+ * @param client Client that sent the command
+ * @param start Start of the optional part
+ * @param len Length of the optional part
+ * @return True if the command was parsed
+ */
+static bool parse_data_request(AVRO_CLIENT *client, const char *start, int len)
+{
+    char str[len + 1];
+    memcpy(str, start, len);
+    str[len] = '\0';
+
+    char *where = find_keyword(str, "WHERE");
+
+    if (where)
+    {
+        *where = '\0';
+        where += strlen("WHERE");
+    }
+
+    char *fields = find_keyword(str, "FIELDS");
+
+    if (fields)
+    {
+        *fields = '\0';
+        fields += strlen("FIELDS");
+    }
+
+    if (*skip_space(str))
+    {
+        client->requested_gtid = true;
+        extract_gtid_request(&client->gtid, str, strlen(str));
+        memcpy(&client->gtid_start, &client->gtid, sizeof(client->gtid_start));
+    }
+
+    maxavro_filter_free(client->filter);
+    client->filter = NULL;
+
+    if (fields || where)
+    {
+        if ((client->filter = calloc(1, sizeof(MAXAVRO_FILTER))) == NULL ||
+            (fields && !parse_fields(fields, client->filter)) ||
+            (where && !parse_conditions(where, client->filter)))
+        {
+            maxavro_filter_free(client->filter);
+            client->filter = NULL;
+            return false;
+        }
+    }
+
+    return true;
+}
+
 /**
  * Callback for GTID retrieval
  * @param data User data
@@ -460,14 +761,15 @@ avro_client_process_command(AVRO_INSTANCE *router, AVRO_CLIENT *client, GWBUF *q
         {
             const char *gtid_ptr = get_avrofile_name(file_ptr, data_len, client->avro_binfile);
 
-            if (gtid_ptr)
+            if (gtid_ptr && !parse_data_request(client, gtid_ptr, data_len - (gtid_ptr - file_ptr)))
             {
-                client->requested_gtid = true;
-                extract_gtid_request(&client->gtid, gtid_ptr, data_len - (gtid_ptr - file_ptr));
-                memcpy(&client->gtid_start, &client->gtid, sizeof(client->gtid_start));
+                dcb_printf(client->dcb, "ERR REQUEST-DATA Invalid FIELDS or WHERE clause");
             }
-
-            if (file_in_dir(router->avrodir, client->avro_binfile))
+            else if (client->filter && client->format != AVRO_FORMAT_JSON)
+            {
+                dcb_printf(client->dcb, "ERR REQUEST-DATA FIELDS and WHERE require the JSON format");
+            }
+            else if (file_in_dir(router->avrodir, client->avro_binfile))
             {
                 /* set callback routine for data sending */
                 dcb_add_callback(client->dcb, DCB_REASON_DRAINED, avro_client_callback, client);
@@ -552,43 +854,95 @@ const char* get_avrofile_name(const char *file_ptr, int data_len, char *dest)
     return rval;
 }
 
-static int send_row(DCB *dcb, json_t* row)
+/**
+ * @brief Send the JSON rows collected in an encoder
+ *
+ * @param dcb DCB to send to
+ * @param encoder Encoder with the rows
+ * @return Return value of the DCB write or 1 if there was nothing to send
+ */
+static int send_rows(DCB *dcb, MAXAVRO_JSON_ENCODER *encoder)
 {
-    char *json = json_dumps(row, JSON_PRESERVE_ORDER);
-    GWBUF *buf;
-    int rc = 0;
+    int rc = 1;
 
-    if (json && (buf = gwbuf_alloc_and_load(strlen(json), (void*)json)))
+    if (encoder->length > 0)
     {
-        rc = dcb->func.write(dcb, buf);
+        GWBUF *buf = maxavro_json_encoder_flush(encoder);
+
+        if (buf)
+        {
+            rc = dcb->func.write(dcb, buf);
+        }
+        else
+        {
+            MXS_ERROR("Failed to dump JSON value.");
+            rc = 0;
+        }
     }
-    else
+
+    return rc;
+}
+
+/** Indexes of the GTID fields in the records */
+typedef struct
+{
+    int domain;
+    int server_id;
+    int seq;
+} gtid_fields_t;
+
+static gtid_fields_t get_gtid_fields(MAXAVRO_JSON_ENCODER *encoder)
+{
+    gtid_fields_t fields;
+    fields.domain = maxavro_json_encoder_field(encoder, avro_domain);
+    fields.server_id = maxavro_json_encoder_field(encoder, avro_server_id);
+    fields.seq = maxavro_json_encoder_field(encoder, avro_sequence);
+    ss_dassert(fields.domain >= 0 && fields.server_id >= 0 && fields.seq >= 0);
+    return fields;
+}
+
+static void set_current_gtid(AVRO_CLIENT *client, MAXAVRO_JSON_ENCODER *encoder,
+                             gtid_fields_t *fields)
+{
+    if (fields->domain >= 0 && fields->server_id >= 0 && fields->seq >= 0)
     {
-        MXS_ERROR("Failed to dump JSON value.");
-        rc = 0;
+        client->gtid.seq = encoder->integers[fields->seq];
+        client->gtid.server_id = encoder->integers[fields->server_id];
+        client->gtid.domain = encoder->integers[fields->domain];
     }
-    free(json);
-    return rc;
 }
 
-static void set_current_gtid(AVRO_CLIENT *client, json_t *row)
+/**
+ * @brief Get the JSON encoder of a file
+ *
+ * The fields and conditions the client requested are compiled into the encoder
+ * the first time it is used for the client.
+ *
+ * @param client Client that streams the file
+ * @param file File to stream
+ * @return The encoder or NULL on error
+ */
+static MAXAVRO_JSON_ENCODER* get_json_encoder(AVRO_CLIENT *client, MAXAVRO_FILE *file)
 {
-    json_t *obj = json_object_get(row, avro_sequence);
-    ss_dassert(json_is_integer(obj));
-    client->gtid.seq = json_integer_value(obj);
+    MAXAVRO_JSON_ENCODER *encoder = maxavro_file_json_encoder(file);
 
-    obj = json_object_get(row, avro_server_id);
-    ss_dassert(json_is_integer(obj));
-    client->gtid.server_id = json_integer_value(obj);
+    if (encoder && client->filter && encoder->filter != client->filter &&
+        !maxavro_json_encoder_set_filter(encoder, client->filter))
+    {
+        dcb_printf(client->dcb, "ERR REQUEST-DATA Invalid WHERE clause for '%s'",
+                   client->avro_binfile);
+        encoder = NULL;
+    }
 
-    obj = json_object_get(row, avro_domain);
-    ss_dassert(json_is_integer(obj));
-    client->gtid.domain = json_integer_value(obj);
+    return encoder;
 }
 
 /**
  * @brief Stream Avro data in JSON format
  *
+ * The rows are encoded directly into JSON text and sent in batches of
+ * AVRO_JSON_FLUSH_SIZE bytes.
+ *
  * @param file File to stream from
  * @param dcb DCB to stream to
  * @return True if more data is readable, false if all data was sent
@@ -597,18 +951,29 @@ static bool stream_json(AVRO_CLIENT *client)
 {
     int bytes = 0;
     MAXAVRO_FILE *file = client->file_handle;
+    MAXAVRO_JSON_ENCODER *encoder = get_json_encoder(client, file);
     DCB *dcb = client->dcb;
 
+    if (encoder == NULL)
+    {
+        return false;
+    }
+
+    gtid_fields_t fields = get_gtid_fields(encoder);
+
     do
     {
-        json_t *row;
         int rc = 1;
-        while (rc > 0 && (row = maxavro_record_read_json(file)))
+        while (rc > 0 && maxavro_record_encode_json(file, encoder))
         {
-            rc = send_row(dcb, row);
-            set_current_gtid(client, row);
-            json_decref(row);
+            set_current_gtid(client, encoder, &fields);
+
+            if (encoder->length >= AVRO_JSON_FLUSH_SIZE)
+            {
+                rc = send_rows(dcb, encoder);
+            }
         }
+        send_rows(dcb, encoder);
         bytes += file->block_size;
     }
     while (maxavro_next_block(file) && bytes < AVRO_DATA_BURST_SIZE);
@@ -647,21 +1012,14 @@ static bool stream_binary(AVRO_CLIENT *client)
     return bytes >= AVRO_DATA_BURST_SIZE;
 }
 
-static int sqlite_cb(void* data, int rows, char** values, char** names)
-{
-    for (int i = 0; i < rows; i++)
-    {
-        if (values[i])
-        {
-            *((long*)data) = strtol(values[i], NULL, 10);
-            return 0;
-        }
-    }
-    return 0;
-}
-
-static const char select_template[] = "SELECT max(position) FROM gtid WHERE domain=%lu "
-                                      "AND server_id=%lu AND sequence <= %lu AND avrofile=\"%s\";";
+/**
+ * The GTID index has a covering index on (avrofile, domain, server_id, sequence,
+ * position) so this is a single index lookup. The positions in a file grow with
+ * the sequence numbers so the last matching row has the largest position.
+ */
+static const char select_sql[] = "SELECT position FROM "GTID_TABLE_NAME
+                                 " WHERE avrofile = ? AND domain = ? AND server_id = ?"
+                                 " AND sequence <= ? ORDER BY sequence DESC LIMIT 1;";
 
 static bool seek_to_index_pos(AVRO_CLIENT *client, MAXAVRO_FILE* file)
 {
@@ -669,17 +1027,27 @@ static bool seek_to_index_pos(AVRO_CLIENT *client, MAXAVRO_FILE* file)
     ss_dassert(name);
     name++;
 
-    char sql[sizeof(select_template) + NAME_MAX + 80];
-    snprintf(sql, sizeof(sql), select_template, client->gtid.domain,
-             client->gtid.server_id, client->gtid.seq, name);
-
-    long offset = -1;
-    char *errmsg = NULL;
+    sqlite3_stmt *stmt;
     bool rval = false;
 
-    if (sqlite3_exec(client->sqlite_handle, sql, sqlite_cb, &offset, &errmsg) == SQLITE_OK)
+    if (sqlite3_prepare_v2(client->sqlite_handle, select_sql, -1, &stmt, NULL) != SQLITE_OK)
     {
+        MXS_ERROR("Failed to prepare index query: %s", sqlite3_errmsg(client->sqlite_handle));
+        return false;
+    }
+
+    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, client->gtid.domain);
+    sqlite3_bind_int64(stmt, 3, client->gtid.server_id);
+    sqlite3_bind_int64(stmt, 4, client->gtid.seq);
+
+    int rc = sqlite3_step(stmt);
+
+    if (rc == SQLITE_ROW || rc == SQLITE_DONE)
+    {
+        long offset = rc == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : -1;
         rval = true;
+
         if (offset > 0 && !maxavro_record_set_pos(file, offset))
         {
             rval = false;
@@ -688,9 +1056,11 @@ static bool seek_to_index_pos(AVRO_CLIENT *client, MAXAVRO_FILE* file)
     else
     {
         MXS_ERROR("Failed to query index position for GTID %lu-%lu-%lu: %s",
-                  client->gtid.domain, client->gtid.server_id, client->gtid.seq, errmsg);
+                  client->gtid.domain, client->gtid.server_id, client->gtid.seq,
+                  sqlite3_errmsg(client->sqlite_handle));
     }
-    sqlite3_free(errmsg);
+
+    sqlite3_finalize(stmt);
     return rval;
 }
 
@@ -702,51 +1072,42 @@ static bool seek_to_index_pos(AVRO_CLIENT *client, MAXAVRO_FILE* file)
 static bool seek_to_gtid(AVRO_CLIENT *client, MAXAVRO_FILE* file)
 {
     bool seeking = true;
+    MAXAVRO_JSON_ENCODER *encoder = get_json_encoder(client, file);
+
+    if (encoder == NULL)
+    {
+        return false;
+    }
+
+    gtid_fields_t fields = get_gtid_fields(encoder);
 
     do
     {
-        json_t *row;
-        while ((row = maxavro_record_read_json(file)))
+        while (seeking && maxavro_record_encode_json(file, encoder))
         {
-            json_t *obj = json_object_get(row, avro_sequence);
-            ss_dassert(json_is_integer(obj));
-            uint64_t value = json_integer_value(obj);
-
             /** If a larger GTID is found, use that */
-            if (value >= client->gtid.seq)
+            if (encoder->integers[fields.seq] >= client->gtid.seq &&
+                encoder->integers[fields.server_id] == client->gtid.server_id &&
+                encoder->integers[fields.domain] == client->gtid.domain)
             {
-                obj = json_object_get(row, avro_server_id);
-                ss_dassert(json_is_integer(obj));
-                value = json_integer_value(obj);
-
-                if (value == client->gtid.server_id)
-                {
-                    obj = json_object_get(row, avro_domain);
-                    ss_dassert(json_is_integer(obj));
-                    value = json_integer_value(obj);
-
-                    if (value == client->gtid.domain)
-                    {
-                        MXS_INFO("Found GTID %lu-%lu-%lu for %s@%s",
-                                 client->gtid.domain, client->gtid.server_id,
-                                 client->gtid.seq, client->dcb->user, client->dcb->remote);
-                        seeking = false;
-                    }
-                }
+                MXS_INFO("Found GTID %lu-%lu-%lu for %s@%s",
+                         client->gtid.domain, client->gtid.server_id,
+                         client->gtid.seq, client->dcb->user, client->dcb->remote);
+                seeking = false;
             }
-
-            /** We'll send the first found row immediately since we have already
-             * read the row into memory */
-            if (!seeking)
+            else
             {
-                send_row(client->dcb, row);
+                /** Discard the rows before the GTID */
+                encoder->length = 0;
             }
-
-            json_decref(row);
         }
     }
     while (seeking && maxavro_next_block(file));
 
+    /** We'll send the first found row immediately since we have already
+     * read the row into memory */
+    send_rows(client->dcb, encoder);
+
     return !seeking;
 }
 
@@ -769,9 +1130,10 @@ static bool avro_client_stream_data(AVRO_CLIENT *client)
         snprintf(filename, PATH_MAX, "%s/%s", router->avrodir, client->avro_binfile);
 
         spinlock_acquire(&client->file_lock);
-        if (client->file_handle == NULL)
+        if (client->file_handle == NULL &&
+            (client->file_handle = maxavro_file_open(filename)))
         {
-            client->file_handle = maxavro_file_open(filename);
+            client->file_handle->block_cache = router->block_cache;
         }
         spinlock_release(&client->file_lock);
 
@@ -902,6 +1264,7 @@ static void rotate_avro_file(AVRO_CLIENT *client, char *fullname)
     }
     else
     {
+        client->file_handle->block_cache = client->router->block_cache;
         MXS_INFO("Rotated '%s'@'%s' to file: %s", client->dcb->user,
                  client->dcb->remote, fullname);
     }
@@ -970,6 +1333,11 @@ int avro_client_callback(DCB *dcb, DCB_REASON reason, void *userdata)
             {
                 case AVRO_FORMAT_JSON:
                     schema = read_avro_json_schema(client->avro_binfile, client->router->avrodir);
+
+                    if (schema && client->filter && client->filter->fields)
+                    {
+                        schema = project_json_schema(schema, client->filter);
+                    }
                     break;
 
                 case AVRO_FORMAT_AVRO:
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file avro_converter.c - Row event conversion threads
+ *
+ * The binlog reader parses the events and queues the row events for a pool of
+ * conversion threads. The threads decode the row images and write the Avro
+ * records. Each table is always handled by the same thread, so the records of
+ * a table are written in binlog order.
+ *
+ * The reader waits for the queues to empty before it flushes the Avro files and
+ * stores the conversion state, and before it modifies the table maps or table
+ * definitions that the conversion threads use.
+ */
+
+#include <avrorouter.h>
+#include <skygw_utils.h>
+#include <log_manager.h>
+
+/**
+ * @brief Main loop of a conversion thread
+ *
+ * @param data The AVRO_CONVERTER of this thread
+ */
+static void converter_main(void *data)
+{
+    AVRO_CONVERTER *conv = (AVRO_CONVERTER*)data;
+
+    pthread_mutex_lock(&conv->lock);
+
+    while (true)
+    {
+        while (conv->head == NULL)
+        {
+            pthread_cond_wait(&conv->cond, &conv->lock);
+        }
+
+        AVRO_ROW_JOB *job = conv->head;
+        conv->head = job->next;
+
+        if (conv->head == NULL)
+        {
+            conv->tail = NULL;
+        }
+
+        pthread_mutex_unlock(&conv->lock);
+
+        avro_convert_rows(&job->gtid, &job->hdr, job->map, job->table,
+                          job->rows, job->end, job->col_present);
+        free(job);
+
+        pthread_mutex_lock(&conv->lock);
+        conv->pending--;
+        pthread_cond_broadcast(&conv->cond);
+    }
+
+    pthread_mutex_unlock(&conv->lock);
+}
+
+/**
+ * @brief Start the conversion threads
+ *
+ * If not all threads could be started, the rows are converted by the threads
+ * that were started. If none were started, the rows are converted by the
+ * binlog reader.
+ *
+ * @param router Avro router instance
+ * @return Number of started threads
+ */
+int avro_start_conversion_threads(AVRO_INSTANCE *router)
+{
+    int n = router->conversion_threads;
+
+    if (n > 0 && (router->converters = calloc(n, sizeof(AVRO_CONVERTER))) == NULL)
+    {
+        n = 0;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        AVRO_CONVERTER *conv = &router->converters[i];
+        pthread_mutex_init(&conv->lock, NULL);
+        pthread_cond_init(&conv->cond, NULL);
+
+        if (thread_start(&conv->thread, converter_main, conv) == NULL)
+        {
+            MXS_ERROR("[%s] Failed to start conversion thread %d, using %d "
+                      "conversion threads.", router->service->name, i + 1, i);
+            pthread_mutex_destroy(&conv->lock);
+            pthread_cond_destroy(&conv->cond);
+            n = i;
+        }
+    }
+
+    if (n == 0)
+    {
+        free(router->converters);
+        router->converters = NULL;
+    }
+
+    router->conversion_threads = n;
+    return n;
+}
+
+/**
+ * @brief Queue a row event for conversion
+ *
+ * The event is queued for the thread that handles the table. If the queue is
+ * full, this waits until the thread has converted some of the queued events.
+ *
+ * @param router Avro router instance
+ * @param table_ident Table identifier in database.table format
+ * @param job The row event, freed by the conversion thread
+ */
+void avro_queue_row_event(AVRO_INSTANCE *router, const char *table_ident, AVRO_ROW_JOB *job)
+{
+    unsigned int hash = simple_str_hash((char*)table_ident);
+    AVRO_CONVERTER *conv = &router->converters[hash % router->conversion_threads];
+    job->next = NULL;
+
+    pthread_mutex_lock(&conv->lock);
+
+    while (conv->pending >= AVRO_CONVERTER_QUEUE_MAX)
+    {
+        pthread_cond_wait(&conv->cond, &conv->lock);
+    }
+
+    if (conv->tail)
+    {
+        conv->tail->next = job;
+    }
+    else
+    {
+        conv->head = job;
+    }
+
+    conv->tail = job;
+    conv->pending++;
+    pthread_cond_broadcast(&conv->cond);
+    pthread_mutex_unlock(&conv->lock);
+}
+
+/**
+ * @brief Wait until all queued row events are converted
+ *
+ * @param router Avro router instance
+ */
+void avro_wait_conversion_threads(AVRO_INSTANCE *router)
+{
+    for (int i = 0; i < router->conversion_threads; i++)
+    {
+        AVRO_CONVERTER *conv = &router->converters[i];
+        pthread_mutex_lock(&conv->lock);
+
+        while (conv->pending > 0)
+        {
+            pthread_cond_wait(&conv->cond, &conv->lock);
+        }
+
+        pthread_mutex_unlock(&conv->lock);
+    }
+}
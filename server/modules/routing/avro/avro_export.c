@@ -0,0 +1,1131 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file avro_export.c - Export of the converted records to a sink
+ *
+ * After the Avro files are flushed, the export thread reads the new records of
+ * each file and collects them into a batch of messages. The batch is written to
+ * the sink when it is full or when it is older than the linger time.
+ *
+ * In JSON format, each record is one message whose key is the table identifier.
+ * The record has the extra field "table" before the other fields. In Avro
+ * format, the first message of each file is the file header and the rest are
+ * data blocks. The key of the message is the name of the file.
+ *
+ * If the sink does not accept a batch, the exporter keeps the batch, stops
+ * reading the files and retries the batch every AVRO_EXPORT_RETRY_INTERVAL
+ * milliseconds. The conversion of the binlogs continues and the records wait
+ * in the Avro files.
+ *
+ * Once the sink has accepted a batch, the offset of the first block of each
+ * file that has records that were not accepted is stored in the Avro
+ * directory. After a restart the files are exported again from the stored
+ * offsets, so each record is exported at least once.
+ */
+
+#include <avrorouter.h>
+#include <skygw_utils.h>
+#include <log_manager.h>
+#include <ini.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+/** Current time in milliseconds */
+static uint64_t time_in_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool batch_reserve(AVRO_EXPORT_BATCH *batch, size_t len)
+{
+    if (batch->length + len > batch->size)
+    {
+        size_t size = batch->size ? batch->size : 4096;
+
+        while (batch->length + len > size)
+        {
+            size *= 2;
+        }
+
+        char *data = realloc(batch->data, size);
+
+        if (data == NULL)
+        {
+            return false;
+        }
+
+        batch->data = data;
+        batch->size = size;
+    }
+
+    if (batch->n_msgs == batch->msgs_size)
+    {
+        size_t size = batch->msgs_size ? batch->msgs_size * 2 : 256;
+        AVRO_EXPORT_MSG *msgs = realloc(batch->msgs, size * sizeof(AVRO_EXPORT_MSG));
+
+        if (msgs == NULL)
+        {
+            return false;
+        }
+
+        batch->msgs = msgs;
+        batch->msgs_size = size;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Add a message to a batch
+ *
+ * The value of the message is @c prefix followed by @c value.
+ *
+ * @return True if the message was added, false if memory allocation failed
+ */
+static bool add_message(AVRO_EXPORT_BATCH *batch, const char *key, size_t key_len,
+                        const char *prefix, size_t prefix_len,
+                        const char *value, size_t value_len)
+{
+    if (!batch_reserve(batch, key_len + prefix_len + value_len))
+    {
+        MXS_ERROR("Memory allocation failed.");
+        return false;
+    }
+
+    if (batch->n_msgs == 0)
+    {
+        batch->started = time_in_ms();
+    }
+
+    AVRO_EXPORT_MSG *msg = &batch->msgs[batch->n_msgs++];
+    msg->key = batch->length;
+    msg->key_len = key_len;
+    memcpy(batch->data + batch->length, key, key_len);
+    batch->length += key_len;
+
+    msg->value = batch->length;
+    msg->value_len = prefix_len + value_len;
+    if (prefix_len > 0)
+    {
+        memcpy(batch->data + batch->length, prefix, prefix_len);
+        batch->length += prefix_len;
+    }
+
+    memcpy(batch->data + batch->length, value, value_len);
+    batch->length += value_len;
+
+    return true;
+}
+
+/**
+ * @brief Add a message to a batch
+ *
+ * @param batch Batch to add to
+ * @param key Key of the message
+ * @param key_len Length of the key
+ * @param value Value of the message
+ * @param value_len Length of the value
+ * @return True if the message was added, false if memory allocation failed
+ */
+bool avro_export_batch_add(AVRO_EXPORT_BATCH *batch, const char *key, size_t key_len,
+                           const char *value, size_t value_len)
+{
+    return add_message(batch, key, key_len, NULL, 0, value, value_len);
+}
+
+/**
+ * @brief Free the memory of a batch
+ *
+ * @param batch Batch to free, the structure itself is not freed
+ */
+void avro_export_batch_free(AVRO_EXPORT_BATCH *batch)
+{
+    free(batch->data);
+    free(batch->msgs);
+    memset(batch, 0, sizeof(*batch));
+}
+
+/** The file sink */
+typedef struct
+{
+    AVRO_SINK   sink;
+    char        *path; /*< Path of the file or named pipe */
+    enum avro_data_format format; /*< Output format */
+    int         fd; /*< The open file, -1 if not open */
+    char        *buffer; /*< The formatted batch */
+    size_t      size; /*< Size of the buffer */
+    size_t      written; /*< Bytes of the formatted batch that were written */
+} FILE_SINK;
+
+static bool file_sink_open(FILE_SINK *fs)
+{
+    /** A named pipe without a reader fails with ENXIO instead of blocking */
+    fs->fd = open(fs->path, O_WRONLY | O_APPEND | O_CREAT | O_NONBLOCK, 0644);
+
+    if (fs->fd == -1)
+    {
+        if (errno != ENXIO)
+        {
+            char err[STRERROR_BUFLEN];
+            MXS_ERROR("Failed to open export file '%s': %d, %s", fs->path, errno,
+                      strerror_r(errno, err, sizeof(err)));
+        }
+        return false;
+    }
+
+    fcntl(fs->fd, F_SETFL, fcntl(fs->fd, F_GETFL) & ~O_NONBLOCK);
+    return true;
+}
+
+static inline char* write_be32(char *ptr, uint32_t value)
+{
+    value = htonl(value);
+    memcpy(ptr, &value, sizeof(value));
+    return ptr + sizeof(value);
+}
+
+/**
+ * @brief Format a batch for the file sink
+ *
+ * JSON messages are written one per line. Avro messages are written as the
+ * length of the key, the key, the length of the value and the value with the
+ * lengths as 32-bit big-endian integers.
+ *
+ * @return Length of the formatted batch or 0 if memory allocation failed
+ */
+static size_t file_sink_format(FILE_SINK *fs, const AVRO_EXPORT_BATCH *batch)
+{
+    size_t len = 0;
+
+    for (size_t i = 0; i < batch->n_msgs; i++)
+    {
+        len += fs->format == AVRO_FORMAT_JSON ? batch->msgs[i].value_len + 1 :
+               batch->msgs[i].key_len + batch->msgs[i].value_len + 8;
+    }
+
+    if (len > fs->size)
+    {
+        char *buffer = realloc(fs->buffer, len);
+
+        if (buffer == NULL)
+        {
+            MXS_ERROR("Memory allocation failed.");
+            return 0;
+        }
+
+        fs->buffer = buffer;
+        fs->size = len;
+    }
+
+    char *ptr = fs->buffer;
+
+    for (size_t i = 0; i < batch->n_msgs; i++)
+    {
+        const AVRO_EXPORT_MSG *msg = &batch->msgs[i];
+
+        if (fs->format == AVRO_FORMAT_JSON)
+        {
+            memcpy(ptr, batch->data + msg->value, msg->value_len);
+            ptr += msg->value_len;
+            *ptr++ = '\n';
+        }
+        else
+        {
+            ptr = write_be32(ptr, msg->key_len);
+            memcpy(ptr, batch->data + msg->key, msg->key_len);
+            ptr += msg->key_len;
+            ptr = write_be32(ptr, msg->value_len);
+            memcpy(ptr, batch->data + msg->value, msg->value_len);
+            ptr += msg->value_len;
+        }
+    }
+
+    return len;
+}
+
+/**
+ * The part of the batch that was written before an error is not written again
+ * when the same batch is retried.
+ */
+static bool file_sink_write(AVRO_SINK *sink, const AVRO_EXPORT_BATCH *batch)
+{
+    FILE_SINK *fs = (FILE_SINK*)sink;
+    size_t len = file_sink_format(fs, batch);
+
+    if (len == 0 || (fs->fd == -1 && !file_sink_open(fs)))
+    {
+        return false;
+    }
+
+    while (fs->written < len)
+    {
+        ssize_t rc = write(fs->fd, fs->buffer + fs->written, len - fs->written);
+
+        if (rc == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            char err[STRERROR_BUFLEN];
+            MXS_ERROR("Failed to write to export file '%s': %d, %s", fs->path, errno,
+                      strerror_r(errno, err, sizeof(err)));
+            close(fs->fd);
+            fs->fd = -1;
+            return false;
+        }
+
+        fs->written += rc;
+    }
+
+    fs->written = 0;
+    return true;
+}
+
+static void file_sink_free(AVRO_SINK *sink)
+{
+    FILE_SINK *fs = (FILE_SINK*)sink;
+
+    if (fs->fd != -1)
+    {
+        close(fs->fd);
+    }
+
+    free(fs->buffer);
+    free(fs->path);
+    free(fs);
+}
+
+/**
+ * @brief Allocate a sink that writes to a file or a named pipe
+ *
+ * The file is opened when the first batch is written. A named pipe without a
+ * reader does not accept batches until a reader opens it.
+ *
+ * @param path Path of the file
+ * @param format Format of the messages
+ * @return New sink or NULL if memory allocation failed
+ */
+AVRO_SINK* avro_file_sink_alloc(const char *path, enum avro_data_format format)
+{
+    FILE_SINK *fs = calloc(1, sizeof(FILE_SINK));
+
+    if (fs == NULL || (fs->path = strdup(path)) == NULL)
+    {
+        MXS_ERROR("Memory allocation failed.");
+        free(fs);
+        return NULL;
+    }
+
+    fs->sink.write = file_sink_write;
+    fs->sink.free = file_sink_free;
+    fs->format = format;
+    fs->fd = -1;
+
+    return &fs->sink;
+}
+
+
+/**
+ * @brief Create the JSON prefix of the records of a table
+ *
+ * @param table Table identifier
+ * @return The start of a JSON object with the "table" field
+ */
+static char* json_prefix(const char *table)
+{
+    static const char start[] = "{\"table\": \"";
+    static const char end[] = "\", ";
+    char *prefix = malloc(sizeof(start) + strlen(table) * 2 + sizeof(end));
+
+    if (prefix)
+    {
+        char *ptr = prefix;
+        strcpy(ptr, start);
+        ptr += sizeof(start) - 1;
+
+        for (const char *c = table; *c; c++)
+        {
+            if (*c == '"' || *c == '\\')
+            {
+                *ptr++ = '\\';
+            }
+            *ptr++ = *c;
+        }
+
+        strcpy(ptr, end);
+    }
+
+    return prefix;
+}
+
+/**
+ * @brief Start exporting a file
+ *
+ * @param filename Absolute filename
+ * @param start Offset of the first exported block
+ * @return New export file or NULL if memory allocation failed
+ */
+static AVRO_EXPORT_FILE* export_file_alloc(const char *filename, long start)
+{
+    AVRO_EXPORT_FILE *file = calloc(1, sizeof(AVRO_EXPORT_FILE));
+
+    if (file && (file->filename = strdup(filename)))
+    {
+        /** The files are named database.table.000001.avro */
+        const char *name = strrchr(filename, '/');
+        name = name ? name + 1 : filename;
+        const char *end = name + strlen(name);
+
+        for (int dots = 0; end > name && dots < 2;)
+        {
+            if (*--end == '.')
+            {
+                dots++;
+            }
+        }
+
+        if ((file->table = strndup(name, end > name ? end - name : strlen(name))) &&
+            (file->prefix = json_prefix(file->table)))
+        {
+            file->start = start;
+            file->acked = start;
+            return file;
+        }
+    }
+
+    MXS_ERROR("Memory allocation failed.");
+
+    if (file)
+    {
+        free(file->filename);
+        free(file->table);
+        free(file);
+    }
+
+    return NULL;
+}
+
+static void export_file_free(AVRO_EXPORT_FILE *file)
+{
+    maxavro_file_close(file->file);
+    free(file->filename);
+    free(file->table);
+    free(file->prefix);
+    free(file);
+}
+
+/**
+ * @brief Store the export progress
+ *
+ * The offset of the first block of each file that has records the sink has
+ * not accepted is stored. The file is written to a temporary file which then
+ * replaces the old one. The caller must hold the lock of the exporter.
+ *
+ * @param exporter Exporter whose progress is stored
+ * @return True if the progress was stored
+ */
+static bool save_checkpoint(AVRO_EXPORTER *exporter)
+{
+    char filename[PATH_MAX + 1];
+    char err_msg[STRERROR_BUFLEN];
+
+    snprintf(filename, sizeof(filename), "%s.tmp", exporter->checkpoint);
+
+    FILE *file = fopen(filename, "wb");
+
+    if (file == NULL)
+    {
+        MXS_ERROR("Failed to open file '%s': %d, %s", filename,
+                  errno, strerror_r(errno, err_msg, sizeof(err_msg)));
+        return false;
+    }
+
+    for (AVRO_EXPORT_FILE *ef = exporter->files; ef; ef = ef->next)
+    {
+        fprintf(file, "[%s]\nposition=%ld\n", ef->filename, ef->acked);
+    }
+
+    if (fclose(file) != 0 || rename(filename, exporter->checkpoint) == -1)
+    {
+        MXS_ERROR("Failed to store the export progress in '%s': %d, %s",
+                  exporter->checkpoint, errno, strerror_r(errno, err_msg, sizeof(err_msg)));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Callback for the @c ini_parse of the stored export progress
+ *
+ * Each section is the name of a file that is exported from the position
+ * stored in the section.
+ */
+static int checkpoint_handler(void* data, const char* section, const char* key, const char* value)
+{
+    AVRO_EXPORTER *exporter = (AVRO_EXPORTER*)data;
+
+    if (strcmp(key, "position") != 0)
+    {
+        return 0;
+    }
+
+    AVRO_EXPORT_FILE **ptr = &exporter->files;
+
+    while (*ptr)
+    {
+        ptr = &(*ptr)->next;
+    }
+
+    *ptr = export_file_alloc(section, strtol(value, NULL, 10));
+
+    return *ptr != NULL;
+}
+
+/**
+ * @brief Load the stored export progress
+ *
+ * The records of the stored files that the sink did not accept before
+ * MaxScale was stopped are exported again.
+ *
+ * @param exporter Exporter whose progress is loaded
+ * @return True if there was no stored progress or it was loaded
+ */
+static bool load_checkpoint(AVRO_EXPORTER *exporter)
+{
+    if (access(exporter->checkpoint, F_OK) == -1)
+    {
+        return true;
+    }
+
+    int rc = ini_parse(exporter->checkpoint, checkpoint_handler, exporter);
+
+    if (rc != 0)
+    {
+        MXS_ERROR("[%s] Failed to load the export progress from '%s', error %d.",
+                  exporter->name, exporter->checkpoint, rc);
+        return false;
+    }
+
+    int n = 0;
+
+    for (AVRO_EXPORT_FILE *file = exporter->files; file; file = file->next)
+    {
+        n++;
+    }
+
+    MXS_NOTICE("[%s] Loaded the export progress of %d files from '%s'.",
+               exporter->name, n, exporter->checkpoint);
+    exporter->unread = n > 0;
+    return true;
+}
+
+/**
+ * @brief Allocate an exporter
+ *
+ * The stored export progress is loaded from the Avro directory. The export
+ * thread is started with avro_exporter_start().
+ *
+ * @param name Name of the service
+ * @param options Router options of the exporter
+ * @param avrodir Directory of the Avro files
+ * @return New exporter or NULL on error
+ */
+AVRO_EXPORTER* avro_exporter_alloc(const char *name, const AVRO_EXPORT_OPTIONS *options,
+                                   const char *avrodir)
+{
+    AVRO_EXPORTER *exporter = calloc(1, sizeof(AVRO_EXPORTER));
+    char *checkpoint = malloc(strlen(avrodir) + sizeof("/" AVRO_EXPORT_PROGRESS_FILE));
+
+    if (exporter == NULL || checkpoint == NULL)
+    {
+        MXS_ERROR("Memory allocation failed.");
+        free(exporter);
+        free(checkpoint);
+        return NULL;
+    }
+
+    sprintf(checkpoint, "%s/" AVRO_EXPORT_PROGRESS_FILE, avrodir);
+    exporter->checkpoint = checkpoint;
+    exporter->name = name;
+    exporter->format = options->format;
+    exporter->batch_size = options->batch_size;
+    exporter->linger = options->linger;
+    pthread_mutex_init(&exporter->lock, NULL);
+    pthread_cond_init(&exporter->cond, NULL);
+
+    if (strcmp(options->sink, "file") == 0)
+    {
+        exporter->sink = avro_file_sink_alloc(options->path, options->format);
+    }
+    else
+    {
+        ss_dassert(strcmp(options->sink, "kafka") == 0);
+        exporter->sink = avro_kafka_sink_alloc(options->broker, options->topic, options->acks);
+    }
+
+    if (exporter->sink == NULL || !load_checkpoint(exporter))
+    {
+        avro_exporter_free(exporter);
+        return NULL;
+    }
+
+    return exporter;
+}
+
+/**
+ * @brief Free an exporter
+ *
+ * The export thread is stopped after it has tried to write the current batch
+ * once more. A batch that was not written is exported again after a restart.
+ *
+ * @param exporter Exporter to free
+ */
+void avro_exporter_free(AVRO_EXPORTER *exporter)
+{
+    if (exporter)
+    {
+        if (exporter->started)
+        {
+            pthread_mutex_lock(&exporter->lock);
+            exporter->shutdown = true;
+            pthread_cond_signal(&exporter->cond);
+            pthread_mutex_unlock(&exporter->lock);
+            thread_wait(exporter->thread);
+        }
+
+        while (exporter->files)
+        {
+            AVRO_EXPORT_FILE *file = exporter->files;
+            exporter->files = file->next;
+            export_file_free(file);
+        }
+
+        if (exporter->sink)
+        {
+            exporter->sink->free(exporter->sink);
+        }
+
+        avro_export_batch_free(&exporter->batch);
+        pthread_mutex_destroy(&exporter->lock);
+        pthread_cond_destroy(&exporter->cond);
+        free(exporter->checkpoint);
+        free(exporter);
+    }
+}
+
+/**
+ * @brief Mark the records read so far as accepted by the sink
+ *
+ * This is called when the batch is empty. The files whose reader is in the
+ * middle of a block are exported again from the start of the block after a
+ * restart.
+ *
+ * @param exporter Exporter whose progress is stored
+ */
+static void export_ack(AVRO_EXPORTER *exporter)
+{
+    bool changed = false;
+
+    pthread_mutex_lock(&exporter->lock);
+
+    for (AVRO_EXPORT_FILE *file = exporter->files; file; file = file->next)
+    {
+        long acked = file->file ? file->file->block_start_pos : file->start;
+
+        if (acked > file->acked)
+        {
+            file->acked = acked;
+            changed = true;
+        }
+    }
+
+    if (changed)
+    {
+        save_checkpoint(exporter);
+    }
+
+    pthread_mutex_unlock(&exporter->lock);
+}
+
+/**
+ * @brief Write the current batch to the sink
+ *
+ * The export progress is stored after the sink accepts the batch.
+ *
+ * @param exporter Exporter whose batch is written
+ * @return True if the batch was written or it was empty, false if the sink
+ * did not accept it
+ */
+static bool export_flush(AVRO_EXPORTER *exporter)
+{
+    AVRO_EXPORT_BATCH *batch = &exporter->batch;
+
+    if (batch->n_msgs == 0)
+    {
+        return true;
+    }
+
+    if (!exporter->sink->write(exporter->sink, batch))
+    {
+        if (!exporter->blocked)
+        {
+            MXS_WARNING("[%s] The export sink did not accept %lu messages, retrying "
+                        "every %d milliseconds.", exporter->name, batch->n_msgs,
+                        AVRO_EXPORT_RETRY_INTERVAL);
+            exporter->blocked = true;
+        }
+        exporter->failures++;
+        return false;
+    }
+
+    if (exporter->blocked)
+    {
+        MXS_NOTICE("[%s] The export sink accepted the retried messages.", exporter->name);
+        exporter->blocked = false;
+    }
+
+    exporter->messages += batch->n_msgs;
+    exporter->bytes += batch->length;
+    exporter->batches++;
+    batch->n_msgs = 0;
+    batch->length = 0;
+    export_ack(exporter);
+
+    return true;
+}
+
+/** Write the batch if it is full */
+static inline bool flush_if_full(AVRO_EXPORTER *exporter)
+{
+    return exporter->batch.length < exporter->batch_size || export_flush(exporter);
+}
+
+/**
+ * @brief Open the reader of an export file
+ *
+ * The reader is opened once the file has new blocks. In Avro format, the file
+ * header is added to the batch before the first data block.
+ *
+ * @return True if the reader was opened
+ */
+static bool export_file_open(AVRO_EXPORTER *exporter, AVRO_EXPORT_FILE *file)
+{
+    struct stat st;
+
+    /** A file with no data blocks cannot be opened */
+    if (stat(file->filename, &st) != 0 || st.st_size <= file->start ||
+        (file->file = maxavro_file_open(file->filename)) == NULL)
+    {
+        return false;
+    }
+
+    const char *name = strrchr(file->filename, '/');
+    name = name ? name + 1 : file->filename;
+
+    if (exporter->format == AVRO_FORMAT_AVRO)
+    {
+        GWBUF *header = maxavro_file_binary_header(file->file);
+
+        if (header == NULL || !avro_export_batch_add(&exporter->batch, name, strlen(name),
+                                                     (char*)GWBUF_DATA(header),
+                                                     GWBUF_LENGTH(header)))
+        {
+            gwbuf_free(header);
+            maxavro_file_close(file->file);
+            file->file = NULL;
+            return false;
+        }
+
+        gwbuf_free(header);
+    }
+
+    file->file->block_cache = exporter->block_cache;
+
+    if (!maxavro_record_set_pos(file->file, MAX(file->start, file->file->header_end_pos)))
+    {
+        MXS_ERROR("[%s] Failed to read the data block at offset %ld of '%s', the "
+                  "file is not exported.", exporter->name,
+                  MAX(file->start, file->file->header_end_pos), file->filename);
+        maxavro_file_close(file->file);
+        file->file = NULL;
+        file->error = true;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Add the new records of a file to the batch
+ *
+ * @return False if the sink did not accept a full batch and the file was not
+ * read to the end
+ */
+static bool export_records(AVRO_EXPORTER *exporter, AVRO_EXPORT_FILE *file)
+{
+    MAXAVRO_JSON_ENCODER *encoder = maxavro_file_json_encoder(file->file);
+
+    if (encoder == NULL)
+    {
+        return true;
+    }
+
+    size_t key_len = strlen(file->table);
+    size_t prefix_len = strlen(file->prefix);
+
+    do
+    {
+        while (maxavro_record_encode_json(file->file, encoder))
+        {
+            /** The prefix replaces the opening brace of the record */
+            ss_dassert(encoder->length > 2);
+            add_message(&exporter->batch, file->table, key_len, file->prefix, prefix_len,
+                        encoder->buffer + 1, encoder->length - 1);
+            encoder->length = 0;
+
+            if (!flush_if_full(exporter))
+            {
+                return false;
+            }
+        }
+    }
+    while (maxavro_next_block(file->file));
+
+    return true;
+}
+
+/**
+ * @brief Add the new data blocks of a file to the batch
+ *
+ * @return False if the sink did not accept a full batch and the file was not
+ * read to the end
+ */
+static bool export_blocks(AVRO_EXPORTER *exporter, AVRO_EXPORT_FILE *file)
+{
+    const char *name = strrchr(file->filename, '/');
+    name = name ? name + 1 : file->filename;
+    size_t name_len = strlen(name);
+    GWBUF *block;
+
+    while ((block = maxavro_record_read_binary(file->file)))
+    {
+        avro_export_batch_add(&exporter->batch, name, name_len,
+                              (char*)GWBUF_DATA(block), GWBUF_LENGTH(block));
+        gwbuf_free(block);
+
+        if (!flush_if_full(exporter))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Export the new records of a file
+ *
+ * @return False if the sink did not accept a full batch
+ */
+static bool export_file(AVRO_EXPORTER *exporter, AVRO_EXPORT_FILE *file)
+{
+    if (file->error || (file->file == NULL && !export_file_open(exporter, file)))
+    {
+        return true;
+    }
+
+    bool rval = exporter->format == AVRO_FORMAT_AVRO ?
+                export_blocks(exporter, file) : export_records(exporter, file);
+
+    if (rval && maxavro_get_error(file->file) != MAXAVRO_ERR_NONE)
+    {
+        MXS_ERROR("[%s] Failed to read '%s': %s. The rest of the file is not exported.",
+                  exporter->name, file->filename, maxavro_get_error_string(file->file));
+        maxavro_file_close(file->file);
+        file->file = NULL;
+        file->error = true;
+    }
+
+    return rval;
+}
+
+
+/**
+ * @brief Update the export files with the tables that are open after a flush
+ *
+ * New files are exported from the first block that did not exist when the
+ * table was opened. A file whose table was closed is exported to the end and
+ * then forgotten. The progress is stored before the conversion state so that
+ * the records of a new file are exported after a restart even if the sink
+ * never accepted them. The caller must hold the lock of the exporter.
+ *
+ * @param exporter The exporter
+ * @param router Avro router instance
+ */
+static void update_files(AVRO_EXPORTER *exporter, AVRO_INSTANCE *router)
+{
+    bool added = false;
+
+    for (AVRO_EXPORT_FILE *file = exporter->files; file; file = file->next)
+    {
+        file->open = false;
+    }
+
+    HASHITERATOR *iter = hashtable_iterator(router->open_tables);
+
+    if (iter)
+    {
+        char *key;
+        while ((key = (char*)hashtable_next(iter)))
+        {
+            AVRO_TABLE *table = hashtable_fetch(router->open_tables, key);
+            AVRO_EXPORT_FILE **ptr = &exporter->files;
+
+            if (table == NULL)
+            {
+                continue;
+            }
+
+            while (*ptr && strcmp((*ptr)->filename, table->filename) != 0)
+            {
+                ptr = &(*ptr)->next;
+            }
+
+            if (*ptr == NULL && (*ptr = export_file_alloc(table->filename, table->cache_start)))
+            {
+                added = true;
+            }
+
+            if (*ptr)
+            {
+                (*ptr)->open = true;
+                (*ptr)->done = false;
+            }
+        }
+        hashtable_iterator_free(iter);
+    }
+
+    if (added)
+    {
+        save_checkpoint(exporter);
+    }
+}
+
+/**
+ * @brief Read the new records of all files into batches
+ *
+ * The files are exported in the order they were opened in. The conversion
+ * only appends files to the list and only the export thread removes them, so
+ * the lock is only needed to move to the next file.
+ *
+ * @return False if the sink did not accept a full batch
+ */
+static bool export_files(AVRO_EXPORTER *exporter)
+{
+    pthread_mutex_lock(&exporter->lock);
+    AVRO_EXPORT_FILE *file = exporter->files;
+    pthread_mutex_unlock(&exporter->lock);
+
+    while (file)
+    {
+        if (!export_file(exporter, file))
+        {
+            return false;
+        }
+
+        pthread_mutex_lock(&exporter->lock);
+        file->done = !file->open;
+        file = file->next;
+        pthread_mutex_unlock(&exporter->lock);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Forget the files that were exported to the end
+ *
+ * This is called when the batch is empty so that the sink has accepted all
+ * records of the files.
+ */
+static void remove_done_files(AVRO_EXPORTER *exporter)
+{
+    pthread_mutex_lock(&exporter->lock);
+
+    AVRO_EXPORT_FILE **ptr = &exporter->files;
+    bool removed = false;
+
+    while (*ptr)
+    {
+        AVRO_EXPORT_FILE *file = *ptr;
+
+        if (file->done)
+        {
+            *ptr = file->next;
+            export_file_free(file);
+            removed = true;
+        }
+        else
+        {
+            ptr = &file->next;
+        }
+    }
+
+    if (removed)
+    {
+        save_checkpoint(exporter);
+    }
+
+    pthread_mutex_unlock(&exporter->lock);
+}
+
+/** Milliseconds until the export thread has to write the batch or -1 if it
+ * only needs to wait for new records */
+static int export_wait_time(AVRO_EXPORTER *exporter)
+{
+    if (exporter->blocked)
+    {
+        return AVRO_EXPORT_RETRY_INTERVAL;
+    }
+    else if (exporter->batch.n_msgs > 0)
+    {
+        uint64_t age = time_in_ms() - exporter->batch.started;
+        return age < (uint64_t)exporter->linger ? exporter->linger - age : 0;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Main loop of the export thread
+ *
+ * The thread reads the records that are flushed to the Avro files and writes
+ * them to the sink. Writing to the sink blocks only this thread, so a slow or
+ * unavailable sink does not stop the conversion of the binlogs. The records
+ * that were not exported stay in the Avro files and the stored export progress
+ * tells where to continue from after a restart.
+ *
+ * @param data The AVRO_EXPORTER
+ */
+static void export_main(void *data)
+{
+    AVRO_EXPORTER *exporter = (AVRO_EXPORTER*)data;
+    bool shutdown = false;
+
+    while (!shutdown)
+    {
+        int wait = export_wait_time(exporter);
+
+        pthread_mutex_lock(&exporter->lock);
+
+        /** Records left unread because of a blocked sink wait for the retry */
+        if (!exporter->flushed && !exporter->shutdown && wait != 0 &&
+            (exporter->blocked || !exporter->unread))
+        {
+            if (wait < 0)
+            {
+                pthread_cond_wait(&exporter->cond, &exporter->lock);
+            }
+            else
+            {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += wait / 1000;
+                ts.tv_nsec += (wait % 1000) * 1000000;
+
+                if (ts.tv_nsec >= 1000000000)
+                {
+                    ts.tv_sec++;
+                    ts.tv_nsec -= 1000000000;
+                }
+
+                pthread_cond_timedwait(&exporter->cond, &exporter->lock, &ts);
+            }
+        }
+
+        exporter->unread = exporter->unread || exporter->flushed;
+        exporter->flushed = false;
+        shutdown = exporter->shutdown;
+
+        pthread_mutex_unlock(&exporter->lock);
+
+        if (exporter->blocked && !export_flush(exporter))
+        {
+            continue;
+        }
+
+        if (exporter->unread)
+        {
+            exporter->unread = !export_files(exporter);
+        }
+
+        if (exporter->batch.n_msgs > 0 && !exporter->blocked &&
+            (shutdown || export_wait_time(exporter) == 0))
+        {
+            export_flush(exporter);
+        }
+
+        if (exporter->batch.n_msgs == 0)
+        {
+            remove_done_files(exporter);
+        }
+    }
+}
+
+/**
+ * @brief Start the export thread
+ *
+ * @param exporter Exporter to start
+ * @return True if the thread was started
+ */
+bool avro_exporter_start(AVRO_EXPORTER *exporter)
+{
+    if (thread_start(&exporter->thread, export_main, exporter) == NULL)
+    {
+        MXS_ERROR("[%s] Failed to start the export thread.", exporter->name);
+        return false;
+    }
+
+    exporter->started = true;
+    return true;
+}
+
+/**
+ * @brief Export the flushed records of all tables
+ *
+ * This is called after the Avro files are flushed. The files of the open
+ * tables are added to the export and the export thread is woken up to read
+ * the new records.
+ *
+ * @param router Avro router instance
+ */
+void avro_export_tables(AVRO_INSTANCE *router)
+{
+    AVRO_EXPORTER *exporter = router->exporter;
+
+    pthread_mutex_lock(&exporter->lock);
+    update_files(exporter, router);
+    exporter->flushed = true;
+    pthread_cond_signal(&exporter->cond);
+    pthread_mutex_unlock(&exporter->lock);
+}
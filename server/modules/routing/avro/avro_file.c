@@ -36,6 +36,7 @@
 #include <avrorouter.h>
 #include <log_manager.h>
 #include <maxscale_pcre2.h>
+#include <maxscale_crc32.h>
 #include <ini.h>
 #include <stdlib.h>
 #include <glob.h>
@@ -96,11 +97,15 @@ void avro_close_binlog(int fd)
 /**
  * @brief Allocate an Avro table
  *
- * Create an Aro table and prepare it for writing.
+ * Create an Aro table and prepare it for writing. Existing files keep the
+ * codec they were created with.
  * @param filepath Path to the created file
  * @param json_schema The schema of the table in JSON format
+ * @param codec Codec used to compress the data blocks of a new file
+ * @param block_size Size of a data block in bytes, 0 for the library default
  */
-AVRO_TABLE* avro_table_alloc(const char* filepath, const char* json_schema)
+AVRO_TABLE* avro_table_alloc(const char* filepath, const char* json_schema,
+                             const char *codec, size_t block_size)
 {
     AVRO_TABLE *table = calloc(1, sizeof(AVRO_TABLE));
     if (table)
@@ -121,7 +126,8 @@ AVRO_TABLE* avro_table_alloc(const char* filepath, const char* json_schema)
         }
         else
         {
-            rc = avro_file_writer_create(filepath, table->avro_schema, &table->avro_file);
+            rc = avro_file_writer_create_with_codec(filepath, table->avro_schema,
+                                                    &table->avro_file, codec, block_size);
         }
 
         if (rc)
@@ -141,6 +147,8 @@ AVRO_TABLE* avro_table_alloc(const char* filepath, const char* json_schema)
             return NULL;
         }
 
+        struct stat st;
+        table->cache_start = stat(filepath, &st) == 0 ? st.st_size : 0;
         table->json_schema = strdup(json_schema);
         table->filename = strdup(filepath);
     }
@@ -307,6 +315,7 @@ void* avro_table_free(AVRO_TABLE *table)
         avro_file_writer_close(table->avro_file);
         avro_value_iface_decref(table->avro_writer_iface);
         avro_schema_decref(table->avro_schema);
+        maxavro_file_close(table->tail);
         free(table->json_schema);
         free(table->filename);
     }
@@ -603,6 +612,37 @@ avro_binlog_end_t avro_read_all_events(AVRO_INSTANCE *router)
         /* get event content */
         ptr = GWBUF_DATA(result);
 
+        /* Verify the event checksum, the header is not stored in the buffer */
+        if (found_chksum && hdr.event_size >= BINLOG_EVENT_HDR_LEN + MYSQL_CHECKSUM_LEN)
+        {
+            /** The server calculates the checksum of the Format Description
+             * event with the in-use flag cleared, the flag is set while the
+             * file is open and left set by a crash */
+            uint8_t header[BINLOG_EVENT_HDR_LEN];
+            memcpy(header, hdbuf, BINLOG_EVENT_HDR_LEN);
+
+            if (hdr.event_type == FORMAT_DESCRIPTION_EVENT)
+            {
+                header[17] &= ~LOG_EVENT_BINLOG_IN_USE_F;
+            }
+
+            uint32_t size = hdr.event_size - BINLOG_EVENT_HDR_LEN - MYSQL_CHECKSUM_LEN;
+            uint32_t chksum = mxs_crc32(mxs_crc32(0, header, BINLOG_EVENT_HDR_LEN), ptr, size);
+            uint32_t event_chksum = extract_field(ptr + size, 32);
+
+            if (chksum != event_chksum)
+            {
+                MXS_ERROR("Checksum mismatch for event type %d at %llu in %s: "
+                          "calculated 0x%08x, found 0x%08x.",
+                          hdr.event_type, pos, router->binlog_name,
+                          chksum, event_chksum);
+                gwbuf_free(result);
+                router->binlog_position = last_known_commit;
+                router->current_pos = pos;
+                return AVRO_BINLOG_ERROR;
+            }
+        }
+
         MXS_DEBUG("%s(%x) - %llu", binlog_event_name(hdr.event_type), hdr.event_type, pos);
 
         /* check for FORMAT DESCRIPTION EVENT */
@@ -840,12 +880,72 @@ void avro_load_metadata_from_schemas(AVRO_INSTANCE *router)
     globfree(&files);
 }
 
+/**
+ * @brief Add the flushed blocks of a table to the block cache
+ *
+ * The blocks are read once here so that the clients that are waiting for new
+ * data get them from the cache instead of each reading them from the file.
+ * Blocks are only cached while there are clients or an exporter to read them,
+ * the blocks flushed before that are skipped without reading them.
+ *
+ * @param router Avro router instance
+ * @param table Table whose file was flushed
+ */
+static void cache_new_blocks(AVRO_INSTANCE *router, AVRO_TABLE *table)
+{
+    struct stat st;
+
+    if (router->stats.n_clients == 0 && router->exporter == NULL)
+    {
+        if (table->tail)
+        {
+            maxavro_file_close(table->tail);
+            table->tail = NULL;
+        }
+
+        if (stat(table->filename, &st) == 0)
+        {
+            table->cache_start = st.st_size;
+        }
+        return;
+    }
+
+    if (table->tail == NULL)
+    {
+        /** A file with no data blocks cannot be opened */
+        if (stat(table->filename, &st) != 0 || st.st_size <= table->cache_start ||
+            (table->tail = maxavro_file_open(table->filename)) == NULL)
+        {
+            return;
+        }
+
+        if (table->tail->block_start_pos < table->cache_start &&
+            !maxavro_record_set_pos(table->tail, table->cache_start))
+        {
+            maxavro_file_close(table->tail);
+            table->tail = NULL;
+            return;
+        }
+    }
+
+    maxavro_block_cache_fill(router->block_cache, table->tail);
+}
+
 /**
  * @brief Flush all Avro records to disk
+ *
+ * Waits until the conversion threads have converted all queued row events.
+ * The flushed blocks are added to the block cache and the flushed records are
+ * handed to the export thread.
  * @param router Avro router instance
  */
 void avro_flush_all_tables(AVRO_INSTANCE *router)
 {
+    /** All queued rows must be written before the files are flushed. This
+     * guarantees that the stored conversion state never points past rows that
+     * are not yet on disk. */
+    avro_wait_conversion_threads(router);
+
     HASHITERATOR *iter = hashtable_iterator(router->open_tables);
 
     if (iter)
@@ -858,11 +958,21 @@ void avro_flush_all_tables(AVRO_INSTANCE *router)
             if (table)
             {
                 avro_file_writer_flush(table->avro_file);
+
+                if (router->block_cache)
+                {
+                    cache_new_blocks(router, table);
+                }
             }
         }
         hashtable_iterator_free(iter);
     }
 
+    if (router->exporter)
+    {
+        avro_export_tables(router);
+    }
+
     /** Update the GTID index */
     avro_update_index(router);
 }
@@ -993,7 +1103,17 @@ void handle_query_event(AVRO_INSTANCE *router, REP_HEADER *hdr, int *pending_tra
     sql = tmp;
     len = tmpsz;
 
-    if (is_create_table_statement(router, sql, len))
+    bool create = is_create_table_statement(router, sql, len);
+    bool alter = !create && is_alter_table_statement(router, sql, len);
+
+    if (create || alter)
+    {
+        /** The table maps and table definitions used by the conversion
+         * threads are modified or freed */
+        avro_wait_conversion_threads(router);
+    }
+
+    if (create)
     {
         TABLE_CREATE *created = table_create_alloc(sql, db);
 
@@ -1002,7 +1122,7 @@ void handle_query_event(AVRO_INSTANCE *router, REP_HEADER *hdr, int *pending_tra
             MXS_ERROR("Failed to save statement to disk: %.*s", len, sql);
         }
     }
-    else if (is_alter_table_statement(router, sql, len))
+    else if (alter)
     {
         char ident[MYSQL_TABLE_MAXLEN + MYSQL_DATABASE_MAXLEN + 2];
         char full_ident[MYSQL_TABLE_MAXLEN + MYSQL_DATABASE_MAXLEN + 2];
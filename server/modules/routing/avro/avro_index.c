@@ -35,103 +35,271 @@
 #include <avrorouter.h>
 #include <skygw_debug.h>
 #include <glob.h>
+#include <sys/stat.h>
 
 void* safe_key_free(void *data);
 
-static const char insert_template[] = "INSERT INTO gtid(domain, server_id, "
-                                      "sequence, avrofile, position) values (%lu, %lu, %lu, \"%s\", %ld);";
+static const char gtid_insert_sql[] = "INSERT OR IGNORE INTO "GTID_TABLE_NAME
+                                      "(domain, server_id, sequence, avrofile, position)"
+                                      " VALUES (?, ?, ?, ?, ?);";
 
-static void set_gtid(gtid_pos_t *gtid, json_t *row)
+static const char progress_select_sql[] = "SELECT max(position) FROM "INDEX_TABLE_NAME
+                                          " WHERE filename = ?;";
+
+static const char progress_update_sql[] = "UPDATE "INDEX_TABLE_NAME" SET position = ?"
+                                          " WHERE filename = ?;";
+
+static const char progress_insert_sql[] = "INSERT INTO "INDEX_TABLE_NAME
+                                          "(position, filename) VALUES (?, ?);";
+
+/** The SQL for the in-memory used_tables table */
+static const char used_table_sql[] = "INSERT OR IGNORE INTO "MEMORY_TABLE_NAME
+                                     "(domain, server_id, sequence, binlog_timestamp, table_name)"
+                                     " VALUES (?, ?, ?, ?, ?);";
+
+/**
+ * @brief Execute a statement without a result
+ *
+ * @param router Avro router instance
+ * @param sql Statement to execute
+ * @return True if the statement was executed successfully
+ */
+static bool index_exec(AVRO_INSTANCE *router, const char *sql)
 {
-    json_t *obj = json_object_get(row, avro_sequence);
-    ss_dassert(json_is_integer(obj));
-    gtid->seq = json_integer_value(obj);
+    char *errmsg = NULL;
+    bool rval = sqlite3_exec(router->sqlite_handle, sql, NULL, NULL, &errmsg) == SQLITE_OK;
 
-    obj = json_object_get(row, avro_server_id);
-    ss_dassert(json_is_integer(obj));
-    gtid->server_id = json_integer_value(obj);
+    if (!rval)
+    {
+        MXS_ERROR("Failed to execute '%s' on the GTID index: %s", sql, errmsg);
+    }
 
-    obj = json_object_get(row, avro_domain);
-    ss_dassert(json_is_integer(obj));
-    gtid->domain = json_integer_value(obj);
+    sqlite3_free(errmsg);
+    return rval;
 }
 
-int index_query_cb(void *data, int rows, char** values, char** names)
+/**
+ * @brief Execute a prepared statement without a result
+ *
+ * The statement is reset and its bindings are cleared after it is executed.
+ *
+ * @param router Avro router instance
+ * @param stmt Statement to execute
+ * @return True if the statement was executed successfully
+ */
+static bool index_step(AVRO_INSTANCE *router, sqlite3_stmt *stmt)
+{
+    bool rval = sqlite3_step(stmt) == SQLITE_DONE;
+
+    if (!rval)
+    {
+        MXS_ERROR("Failed to execute '%s' on the GTID index: %s",
+                  sqlite3_sql(stmt), sqlite3_errmsg(router->sqlite_handle));
+    }
+
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return rval;
+}
+
+/**
+ * @brief Prepare the GTID index for writing
+ *
+ * This enables the write-ahead log, sets the synchronous level of the database
+ * and prepares the statements used to update the index.
+ *
+ * @param router Avro router instance
+ * @return True if the index was prepared successfully
+ */
+bool avro_index_init(AVRO_INSTANCE *router)
 {
-    for (int i = 0; i < rows; i++)
+    char sql[AVRO_SQL_BUFFER_SIZE];
+    snprintf(sql, sizeof(sql), "PRAGMA synchronous = %s;", router->index_synchronous);
+
+    /** The write-ahead log lets the clients read the index while it is
+     * updated and turns each transaction into a sequential append */
+    if (!index_exec(router, "PRAGMA journal_mode = WAL;") || !index_exec(router, sql))
+    {
+        return false;
+    }
+
+    struct
     {
-        if (values[i])
+        const char   *sql;
+        sqlite3_stmt **stmt;
+    } stmts[] =
+    {
+        {gtid_insert_sql, &router->gtid_insert_stmt},
+        {used_table_sql, &router->used_table_stmt},
+        {progress_select_sql, &router->progress_select_stmt},
+        {progress_update_sql, &router->progress_update_stmt},
+        {progress_insert_sql, &router->progress_insert_stmt}
+    };
+
+    for (int i = 0; i < sizeof(stmts) / sizeof(stmts[0]); i++)
+    {
+        if (sqlite3_prepare_v2(router->sqlite_handle, stmts[i].sql, -1,
+                               stmts[i].stmt, NULL) != SQLITE_OK)
         {
-            *((long*)data) = strtol(values[i], NULL, 10);
-            return 0;
+            MXS_ERROR("Failed to prepare '%s' for the GTID index: %s", stmts[i].sql,
+                      sqlite3_errmsg(router->sqlite_handle));
+            return false;
         }
     }
-    return 0;
+
+    return true;
+}
+
+/**
+ * @brief Free the prepared statements of the GTID index
+ *
+ * @param router Avro router instance
+ */
+void avro_index_free(AVRO_INSTANCE *router)
+{
+    sqlite3_finalize(router->gtid_insert_stmt);
+    sqlite3_finalize(router->used_table_stmt);
+    sqlite3_finalize(router->progress_select_stmt);
+    sqlite3_finalize(router->progress_update_stmt);
+    sqlite3_finalize(router->progress_insert_stmt);
+    router->gtid_insert_stmt = NULL;
+    router->used_table_stmt = NULL;
+    router->progress_select_stmt = NULL;
+    router->progress_update_stmt = NULL;
+    router->progress_insert_stmt = NULL;
 }
 
+/**
+ * @brief Read the position up to which a file is indexed
+ *
+ * @param router Avro router instance
+ * @param name Name of the file
+ * @return The indexed position or 0 if the file is not yet indexed
+ */
+static long get_indexed_pos(AVRO_INSTANCE *router, const char *name)
+{
+    sqlite3_stmt *stmt = router->progress_select_stmt;
+    long pos = 0;
+
+    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+
+    int rc = sqlite3_step(stmt);
+
+    if (rc == SQLITE_ROW)
+    {
+        pos = sqlite3_column_int64(stmt, 0);
+    }
+    else if (rc != SQLITE_DONE)
+    {
+        MXS_ERROR("Failed to read last indexed position of file '%s': %s",
+                  name, sqlite3_errmsg(router->sqlite_handle));
+    }
+
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return pos;
+}
+
+/**
+ * @brief Store the position up to which a file is indexed
+ *
+ * @param router Avro router instance
+ * @param name Name of the file
+ * @param pos Indexed position
+ */
+static void set_indexed_pos(AVRO_INSTANCE *router, const char *name, long pos)
+{
+    sqlite3_stmt *stmt = router->progress_update_stmt;
+    sqlite3_bind_int64(stmt, 1, pos);
+    sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+
+    if (index_step(router, stmt) && sqlite3_changes(router->sqlite_handle) == 0)
+    {
+        stmt = router->progress_insert_stmt;
+        sqlite3_bind_int64(stmt, 1, pos);
+        sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+        index_step(router, stmt);
+    }
+}
+
+/**
+ * @brief Add the new GTIDs of an Avro file to the index
+ *
+ * The file is read from the position where the previous call stopped. The
+ * caller must start a transaction before calling this function.
+ *
+ * @param router Avro router instance
+ * @param filename Path to the file
+ */
 void avro_index_file(AVRO_INSTANCE *router, const char* filename)
 {
+    const char *name = strrchr(filename, '/');
+    ss_dassert(name);
+
+    if (name == NULL)
+    {
+        MXS_ERROR("Malformed filename: %s", filename);
+        return;
+    }
+
+    name++;
+    long pos = get_indexed_pos(router, name);
+    struct stat st;
+
+    if (pos > 0 && stat(filename, &st) == 0 && st.st_size <= pos)
+    {
+        /** Nothing new has been written to the file */
+        return;
+    }
+
     MAXAVRO_FILE *file = maxavro_file_open(filename);
+
     if (file)
     {
-        char *name = strrchr(filename, '/');
-        ss_dassert(name);
+        MAXAVRO_JSON_ENCODER *encoder = maxavro_file_json_encoder(file);
+        int domain = encoder ? maxavro_json_encoder_field(encoder, avro_domain) : -1;
+        int server_id = encoder ? maxavro_json_encoder_field(encoder, avro_server_id) : -1;
+        int seq = encoder ? maxavro_json_encoder_field(encoder, avro_sequence) : -1;
 
-        if (name)
+        if (domain == -1 || server_id == -1 || seq == -1)
+        {
+            MXS_ERROR("File '%s' has no GTID fields, it cannot be indexed.", filename);
+        }
+        else if (pos == 0 || maxavro_record_set_pos(file, pos))
         {
-            char sql[AVRO_SQL_BUFFER_SIZE];
-            char *errmsg;
-            long pos = -1;
-            name++;
-
-            snprintf(sql, sizeof(sql), "SELECT position FROM "INDEX_TABLE_NAME
-                     " WHERE filename=\"%s\";", name);
-            if (sqlite3_exec(router->sqlite_handle, sql, index_query_cb, &pos, &errmsg) != SQLITE_OK)
-            {
-                MXS_ERROR("Failed to read last indexed position of file '%s': %s",
-                          name, errmsg);
-            }
-            else if (pos > 0)
-            {
-                /** Continue from last position */
-                maxavro_record_set_pos(file, pos);
-            }
-            sqlite3_free(errmsg);
-            errmsg = NULL;
-
             gtid_pos_t prev_gtid = {0, 0, 0, 0, 0};
+            sqlite3_stmt *stmt = router->gtid_insert_stmt;
 
-            if (sqlite3_exec(router->sqlite_handle, "BEGIN", NULL, NULL, &errmsg) != SQLITE_OK)
-            {
-                MXS_ERROR("Failed to start transaction: %s", errmsg);
-            }
-            sqlite3_free(errmsg);
-
+            /** The positions in the index are block positions so the first
+             * GTID of each block is enough to find the block of any GTID */
             do
             {
-                json_t *row = maxavro_record_read_json(file);
-
-                if (row)
+                if (maxavro_record_encode_json(file, encoder))
                 {
-                    gtid_pos_t gtid;
-                    set_gtid(&gtid, row);
+                    gtid_pos_t gtid = {0, 0, 0, 0, 0};
+                    gtid.domain = encoder->integers[domain];
+                    gtid.server_id = encoder->integers[server_id];
+                    gtid.seq = encoder->integers[seq];
+
+                    /** Only the GTID fields of the record are needed */
+                    encoder->length = 0;
 
                     if (prev_gtid.domain != gtid.domain ||
                         prev_gtid.server_id != gtid.server_id ||
                         prev_gtid.seq != gtid.seq)
                     {
-                        snprintf(sql, sizeof(sql), insert_template, gtid.domain,
-                                 gtid.server_id, gtid.seq, name, file->block_start_pos);
-                        if (sqlite3_exec(router->sqlite_handle, sql, NULL, NULL,
-                                         &errmsg) != SQLITE_OK)
+                        sqlite3_bind_int64(stmt, 1, gtid.domain);
+                        sqlite3_bind_int64(stmt, 2, gtid.server_id);
+                        sqlite3_bind_int64(stmt, 3, gtid.seq);
+                        sqlite3_bind_text(stmt, 4, name, -1, SQLITE_STATIC);
+                        sqlite3_bind_int64(stmt, 5, file->block_start_pos);
+
+                        if (!index_step(router, stmt))
                         {
                             MXS_ERROR("Failed to insert GTID %lu-%lu-%lu for %s "
-                                      "into index database: %s", gtid.domain,
-                                      gtid.server_id, gtid.seq, name, errmsg);
-
+                                      "into index database.", gtid.domain,
+                                      gtid.server_id, gtid.seq, name);
                         }
-                        sqlite3_free(errmsg);
-                        errmsg = NULL;
                         prev_gtid = gtid;
                     }
                 }
@@ -142,25 +310,7 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
             }
             while (maxavro_next_block(file));
 
-            if (sqlite3_exec(router->sqlite_handle, "COMMIT", NULL, NULL, &errmsg) != SQLITE_OK)
-            {
-                MXS_ERROR("Failed to commit transaction: %s", errmsg);
-            }
-            sqlite3_free(errmsg);
-
-            snprintf(sql, sizeof(sql), "INSERT OR REPLACE INTO "INDEX_TABLE_NAME
-                     " values (%lu, \"%s\");", file->block_start_pos, name);
-            if (sqlite3_exec(router->sqlite_handle, sql, NULL, NULL,
-                             &errmsg) != SQLITE_OK)
-            {
-                MXS_ERROR("Failed to update indexing progress: %s", errmsg);
-            }
-            sqlite3_free(errmsg);
-            errmsg = NULL;
-        }
-        else
-        {
-            MXS_ERROR("Malformed filename: %s", filename);
+            set_indexed_pos(router, name, file->block_start_pos);
         }
 
         maxavro_file_close(file);
@@ -172,7 +322,7 @@ void avro_index_file(AVRO_INSTANCE *router, const char* filename)
  *
  * Builds an index of filenames, GTIDs and positions in the Avro file.
  * This allows all tables that contain a GTID to be fetched in an effiecent
- * manner.
+ * manner. All files are indexed in one transaction.
  * @param data The router instance
  */
 void avro_update_index(AVRO_INSTANCE* router)
@@ -181,22 +331,19 @@ void avro_update_index(AVRO_INSTANCE* router)
     snprintf(path, sizeof(path), "%s/*.avro", router->avrodir);
     glob_t files;
 
-    if (glob(path, 0, NULL, &files) != GLOB_NOMATCH)
+    if (glob(path, 0, NULL, &files) != GLOB_NOMATCH && index_exec(router, "BEGIN"))
     {
         for (int i = 0; i < files.gl_pathc; i++)
         {
             avro_index_file(router, files.gl_pathv[i]);
         }
+
+        index_exec(router, "COMMIT");
     }
 
     globfree(&files);
 }
 
-/** The SQL for the in-memory used_tables table */
-static const char *insert_sql = "INSERT OR IGNORE INTO "MEMORY_TABLE_NAME
-                                "(domain, server_id, sequence, binlog_timestamp, table_name)"
-                                " VALUES (%lu, %lu, %lu, %lu, \"%s\")";
-
 /**
  * @brief Add a used table to the current transaction
  *
@@ -206,19 +353,21 @@ static const char *insert_sql = "INSERT OR IGNORE INTO "MEMORY_TABLE_NAME
  * @param router Avro router instance
  * @param table Table to add
  */
-void add_used_table(AVRO_INSTANCE* router, char* table)
+void add_used_table(AVRO_INSTANCE* router, const char* table)
 {
-    char sql[AVRO_SQL_BUFFER_SIZE], *errmsg;
-    snprintf(sql, sizeof(sql), insert_sql, router->gtid.domain, router->gtid.server_id,
-             router->gtid.seq, router->gtid.timestamp, table);
+    sqlite3_stmt *stmt = router->used_table_stmt;
+    sqlite3_bind_int64(stmt, 1, router->gtid.domain);
+    sqlite3_bind_int64(stmt, 2, router->gtid.server_id);
+    sqlite3_bind_int64(stmt, 3, router->gtid.seq);
+    sqlite3_bind_int64(stmt, 4, router->gtid.timestamp);
+    sqlite3_bind_text(stmt, 5, table, -1, SQLITE_STATIC);
 
-    if (sqlite3_exec(router->sqlite_handle, sql, NULL, NULL, &errmsg) != SQLITE_OK)
+    if (!index_step(router, stmt))
     {
-        MXS_ERROR("Failed to add used table %s for GTID %lu-%lu-%lu: %s",
+        MXS_ERROR("Failed to add used table %s for GTID %lu-%lu-%lu.",
                   table, router->gtid.domain, router->gtid.server_id,
-                  router->gtid.seq, errmsg);
+                  router->gtid.seq);
     }
-    sqlite3_free(errmsg);
 }
 
 /**
@@ -231,19 +380,15 @@ void add_used_table(AVRO_INSTANCE* router, char* table)
  */
 void update_used_tables(AVRO_INSTANCE* router)
 {
-    char *errmsg;
-
-    if (sqlite3_exec(router->sqlite_handle, "INSERT INTO "USED_TABLES_TABLE_NAME
-                     " SELECT * FROM "MEMORY_TABLE_NAME, NULL, NULL, &errmsg) != SQLITE_OK)
+    if (index_exec(router, "BEGIN"))
     {
-        MXS_ERROR("Failed to transfer used table data from memory to disk: %s", errmsg);
-    }
-    sqlite3_free(errmsg);
+        if (!index_exec(router, "INSERT INTO "USED_TABLES_TABLE_NAME
+                        " SELECT * FROM "MEMORY_TABLE_NAME) ||
+            !index_exec(router, "DELETE FROM "MEMORY_TABLE_NAME))
+        {
+            MXS_ERROR("Failed to transfer used table data from memory to disk.");
+        }
 
-    if (sqlite3_exec(router->sqlite_handle, "DELETE FROM "MEMORY_TABLE_NAME,
-                     NULL, NULL, &errmsg) != SQLITE_OK)
-    {
-        MXS_ERROR("Failed to transfer used table data from memory to disk: %s", errmsg);
+        index_exec(router, "COMMIT");
     }
-    sqlite3_free(errmsg);
 }
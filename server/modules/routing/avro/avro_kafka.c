@@ -0,0 +1,380 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file avro_kafka.c - Kafka producer sink of the exporter
+ *
+ * The sink sends each batch to one Kafka broker as a version 0 ProduceRequest
+ * with an uncompressed message set. All messages are sent to partition 0 of the
+ * configured topic. Version 0 of the protocol is supported by all Kafka brokers
+ * and it needs no metadata requests, which keeps the producer simple enough to
+ * run in the conversion task.
+ *
+ * The connection is opened when the first batch is sent and closed on errors.
+ * The next batch reconnects to the broker.
+ */
+
+#include <avrorouter.h>
+#include <skygw_utils.h>
+#include <log_manager.h>
+#include <maxscale_crc32.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+
+/** Client ID sent to the broker */
+#define KAFKA_CLIENT_ID "maxscale"
+
+/** How long the broker waits for the acknowledgements, in milliseconds */
+#define KAFKA_ACK_TIMEOUT 10000
+
+/** Network I/O timeout in seconds */
+#define KAFKA_IO_TIMEOUT 10
+
+/** Size of the fixed part of a message in a message set: offset, message size,
+ * CRC, magic byte, attributes and the key and value lengths */
+#define KAFKA_MESSAGE_OVERHEAD (8 + 4 + 4 + 1 + 1 + 4 + 4)
+
+/** The Kafka sink */
+typedef struct
+{
+    AVRO_SINK   sink;
+    char        *host; /*< Broker host */
+    char        *port; /*< Broker port */
+    char        *topic; /*< Topic where the messages are sent */
+    int         acks; /*< Acknowledgements the broker waits for */
+    int         fd; /*< Connection to the broker, -1 if not connected */
+    int32_t     correlation_id; /*< ID of the latest request */
+    uint8_t     *buffer; /*< The encoded request */
+    size_t      size; /*< Size of the buffer */
+} KAFKA_SINK;
+
+static inline uint8_t* put16(uint8_t *ptr, uint16_t value)
+{
+    value = htons(value);
+    memcpy(ptr, &value, sizeof(value));
+    return ptr + sizeof(value);
+}
+
+static inline uint8_t* put32(uint8_t *ptr, uint32_t value)
+{
+    value = htonl(value);
+    memcpy(ptr, &value, sizeof(value));
+    return ptr + sizeof(value);
+}
+
+static inline uint8_t* put64(uint8_t *ptr, uint64_t value)
+{
+    ptr = put32(ptr, value >> 32);
+    return put32(ptr, value & 0xffffffff);
+}
+
+static inline uint8_t* put_string(uint8_t *ptr, const char *str)
+{
+    size_t len = strlen(str);
+    ptr = put16(ptr, len);
+    memcpy(ptr, str, len);
+    return ptr + len;
+}
+
+static inline uint16_t get16(const uint8_t *ptr)
+{
+    uint16_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return ntohs(value);
+}
+
+static inline uint32_t get32(const uint8_t *ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return ntohl(value);
+}
+
+static void kafka_close(KAFKA_SINK *ks)
+{
+    if (ks->fd != -1)
+    {
+        close(ks->fd);
+        ks->fd = -1;
+    }
+}
+
+static bool kafka_connect(KAFKA_SINK *ks)
+{
+    struct addrinfo hint = {.ai_socktype = SOCK_STREAM, .ai_family = AF_UNSPEC};
+    struct addrinfo *ai;
+    int rc = getaddrinfo(ks->host, ks->port, &hint, &ai);
+
+    if (rc != 0)
+    {
+        MXS_ERROR("Failed to resolve Kafka broker '%s': %s", ks->host, gai_strerror(rc));
+        return false;
+    }
+
+    struct timeval tv = {.tv_sec = KAFKA_IO_TIMEOUT};
+    int one = 1;
+
+    for (struct addrinfo *a = ai; a && ks->fd == -1; a = a->ai_next)
+    {
+        if ((ks->fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol)) != -1)
+        {
+            /** The send timeout also limits the time connect() waits */
+            setsockopt(ks->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+            setsockopt(ks->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(ks->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            if (connect(ks->fd, a->ai_addr, a->ai_addrlen) != 0)
+            {
+                kafka_close(ks);
+            }
+        }
+    }
+
+    if (ks->fd == -1)
+    {
+        char err[STRERROR_BUFLEN];
+        MXS_ERROR("Failed to connect to Kafka broker at %s:%s: %d, %s", ks->host,
+                  ks->port, errno, strerror_r(errno, err, sizeof(err)));
+    }
+
+    freeaddrinfo(ai);
+    return ks->fd != -1;
+}
+
+static bool kafka_io(KAFKA_SINK *ks, uint8_t *buf, size_t len, bool is_write)
+{
+    while (len > 0)
+    {
+        ssize_t rc = is_write ? send(ks->fd, buf, len, MSG_NOSIGNAL) : recv(ks->fd, buf, len, 0);
+
+        if (rc <= 0)
+        {
+            if (rc == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            char err[STRERROR_BUFLEN];
+            MXS_ERROR("Failed to %s Kafka broker at %s:%s: %s", is_write ? "write to" : "read from",
+                      ks->host, ks->port, rc == 0 ? "Connection closed" :
+                      strerror_r(errno, err, sizeof(err)));
+            kafka_close(ks);
+            return false;
+        }
+
+        buf += rc;
+        len -= rc;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Encode a batch as a ProduceRequest
+ *
+ * @return Length of the request or 0 if memory allocation failed
+ */
+static size_t kafka_encode(KAFKA_SINK *ks, const AVRO_EXPORT_BATCH *batch)
+{
+    size_t set_size = 0;
+
+    for (size_t i = 0; i < batch->n_msgs; i++)
+    {
+        set_size += KAFKA_MESSAGE_OVERHEAD + batch->msgs[i].key_len + batch->msgs[i].value_len;
+    }
+
+    size_t len = 4 + 2 + 2 + 4 + 2 + strlen(KAFKA_CLIENT_ID) + 2 + 4 + 4 + 2 +
+                 strlen(ks->topic) + 4 + 4 + 4 + set_size;
+
+    if (len > ks->size)
+    {
+        uint8_t *buffer = realloc(ks->buffer, len);
+
+        if (buffer == NULL)
+        {
+            MXS_ERROR("Memory allocation failed.");
+            return 0;
+        }
+
+        ks->buffer = buffer;
+        ks->size = len;
+    }
+
+    uint8_t *ptr = ks->buffer;
+    ptr = put32(ptr, len - 4);
+    ptr = put16(ptr, 0); /** ApiKey: Produce */
+    ptr = put16(ptr, 0); /** ApiVersion */
+    ptr = put32(ptr, ++ks->correlation_id);
+    ptr = put_string(ptr, KAFKA_CLIENT_ID);
+    ptr = put16(ptr, ks->acks);
+    ptr = put32(ptr, KAFKA_ACK_TIMEOUT);
+    ptr = put32(ptr, 1); /** One topic */
+    ptr = put_string(ptr, ks->topic);
+    ptr = put32(ptr, 1); /** One partition */
+    ptr = put32(ptr, 0); /** Partition 0 */
+    ptr = put32(ptr, set_size);
+
+    for (size_t i = 0; i < batch->n_msgs; i++)
+    {
+        const AVRO_EXPORT_MSG *msg = &batch->msgs[i];
+        ptr = put64(ptr, 0); /** The broker assigns the offsets */
+        ptr = put32(ptr, KAFKA_MESSAGE_OVERHEAD - 12 + msg->key_len + msg->value_len);
+        uint8_t *crc = ptr;
+        ptr += 4;
+        *ptr++ = 0; /** Magic byte */
+        *ptr++ = 0; /** Attributes: no compression */
+        ptr = put32(ptr, msg->key_len);
+        memcpy(ptr, batch->data + msg->key, msg->key_len);
+        ptr += msg->key_len;
+        ptr = put32(ptr, msg->value_len);
+        memcpy(ptr, batch->data + msg->value, msg->value_len);
+        ptr += msg->value_len;
+        put32(crc, mxs_crc32(0, crc + 4, ptr - crc - 4));
+    }
+
+    ss_dassert(ptr - ks->buffer == len);
+    return len;
+}
+
+/**
+ * @brief Read the ProduceResponse and check the error code of the partition
+ *
+ * @return True if the broker accepted the messages
+ */
+static bool kafka_read_response(KAFKA_SINK *ks)
+{
+    uint8_t hdr[4];
+
+    if (!kafka_io(ks, hdr, sizeof(hdr), false))
+    {
+        return false;
+    }
+
+    uint32_t len = get32(hdr);
+    size_t topic_len = strlen(ks->topic);
+    /** Correlation ID, topic count, topic, partition count, partition, error code */
+    size_t min_len = 4 + 4 + 2 + topic_len + 4 + 4 + 2;
+
+    if (len < min_len || len > ks->size)
+    {
+        MXS_ERROR("Invalid response of %u bytes from Kafka broker at %s:%s.", len,
+                  ks->host, ks->port);
+        kafka_close(ks);
+        return false;
+    }
+
+    /** The request was already sent so its buffer can be reused */
+    if (!kafka_io(ks, ks->buffer, len, false))
+    {
+        return false;
+    }
+
+    const uint8_t *ptr = ks->buffer;
+
+    if (get32(ptr) != (uint32_t)ks->correlation_id || get32(ptr + 4) != 1 ||
+        get16(ptr + 8) != topic_len || memcmp(ptr + 10, ks->topic, topic_len) != 0 ||
+        get32(ptr + 10 + topic_len) != 1)
+    {
+        MXS_ERROR("Unexpected response from Kafka broker at %s:%s.", ks->host, ks->port);
+        kafka_close(ks);
+        return false;
+    }
+
+    int16_t error = get16(ptr + 10 + topic_len + 8);
+
+    if (error != 0)
+    {
+        MXS_ERROR("Kafka broker at %s:%s rejected the messages to topic '%s' with error code %d.",
+                  ks->host, ks->port, ks->topic, error);
+        return false;
+    }
+
+    return true;
+}
+
+static bool kafka_sink_write(AVRO_SINK *sink, const AVRO_EXPORT_BATCH *batch)
+{
+    KAFKA_SINK *ks = (KAFKA_SINK*)sink;
+    size_t len = kafka_encode(ks, batch);
+
+    if (len == 0 || (ks->fd == -1 && !kafka_connect(ks)) ||
+        !kafka_io(ks, ks->buffer, len, true))
+    {
+        return false;
+    }
+
+    /** With no acknowledgements the broker sends no response */
+    return ks->acks == 0 || kafka_read_response(ks);
+}
+
+static void kafka_sink_free(AVRO_SINK *sink)
+{
+    KAFKA_SINK *ks = (KAFKA_SINK*)sink;
+    kafka_close(ks);
+    free(ks->buffer);
+    free(ks->host);
+    free(ks->topic);
+    free(ks);
+}
+
+/**
+ * @brief Allocate a sink that sends the messages to a Kafka broker
+ *
+ * @param broker Address of the broker in host:port format
+ * @param topic Topic where the messages are sent
+ * @param acks Acknowledgements the broker waits for: 0 for none, 1 for the
+ * leader and -1 for all in-sync replicas
+ * @return New sink or NULL on error
+ */
+AVRO_SINK* avro_kafka_sink_alloc(const char *broker, const char *topic, int acks)
+{
+    KAFKA_SINK *ks = calloc(1, sizeof(KAFKA_SINK));
+
+    if (ks == NULL || (ks->host = strdup(broker)) == NULL ||
+        (ks->topic = strdup(topic)) == NULL)
+    {
+        MXS_ERROR("Memory allocation failed.");
+
+        if (ks)
+        {
+            free(ks->host);
+            free(ks);
+        }
+        return NULL;
+    }
+
+    char *port = strrchr(ks->host, ':');
+
+    if (port == NULL || port == ks->host || port[1] == '\0')
+    {
+        MXS_ERROR("Invalid Kafka broker address, expected <host>:<port>: '%s'", broker);
+        free(ks->host);
+        free(ks->topic);
+        free(ks);
+        return NULL;
+    }
+
+    *port++ = '\0';
+    ks->port = port;
+    ks->sink.write = kafka_sink_write;
+    ks->sink.free = kafka_sink_free;
+    ks->acks = acks;
+    ks->fd = -1;
+
+    return &ks->sink;
+}
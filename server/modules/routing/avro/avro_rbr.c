@@ -64,6 +64,19 @@ static int get_event_type(uint8_t event)
     }
 }
 
+/**
+ * @brief Get the codec used for new Avro files of a table
+ *
+ * @param router Avro router instance
+ * @param table_ident Table identifier in database.table format
+ * @return Codec configured for the table or the default codec
+ */
+static const char* get_table_codec(AVRO_INSTANCE *router, const char *table_ident)
+{
+    const char *codec = hashtable_fetch(router->table_codecs, (void*)table_ident);
+    return codec ? codec : router->codec;
+}
+
 /**
  * @brief Handle a table map event
  *
@@ -102,9 +115,15 @@ bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr
                     snprintf(filepath, sizeof(filepath), "%s/%s.%06d.avro",
                              router->avrodir, table_ident, map->version);
 
+                    /** The conversion threads must not use the old file or
+                     * the old table map once they are freed */
+                    avro_wait_conversion_threads(router);
+
                     /** Close the file and open a new one */
                     hashtable_delete(router->open_tables, table_ident);
-                    AVRO_TABLE *avro_table = avro_table_alloc(filepath, json_schema);
+                    AVRO_TABLE *avro_table = avro_table_alloc(filepath, json_schema,
+                                                              get_table_codec(router, table_ident),
+                                                              router->block_size);
 
                     if (avro_table)
                     {
@@ -170,27 +189,27 @@ bool handle_table_map_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr
  * This sets the domain, server ID, sequence and event position fields of
  * the GTID. It also sets the event timestamp and event type fields.
  *
- * @param router Avro router instance
+ * @param gtid GTID of the event, the subsequence counter is incremented
  * @param hdr Replication header
  * @param event_type Event type
  * @param record Record to prepare
  */
-static void prepare_record(AVRO_INSTANCE *router, REP_HEADER *hdr,
+static void prepare_record(gtid_pos_t *gtid, REP_HEADER *hdr,
                            int event_type, avro_value_t *record)
 {
     avro_value_t field;
     avro_value_get_by_name(record, avro_domain, &field, NULL);
-    avro_value_set_int(&field, router->gtid.domain);
+    avro_value_set_int(&field, gtid->domain);
 
     avro_value_get_by_name(record, avro_server_id, &field, NULL);
-    avro_value_set_int(&field, router->gtid.server_id);
+    avro_value_set_int(&field, gtid->server_id);
 
     avro_value_get_by_name(record, avro_sequence, &field, NULL);
-    avro_value_set_int(&field, router->gtid.seq);
+    avro_value_set_int(&field, gtid->seq);
 
-    router->gtid.event_num++;
+    gtid->event_num++;
     avro_value_get_by_name(record, avro_event_number, &field, NULL);
-    avro_value_set_int(&field, router->gtid.event_num);
+    avro_value_set_int(&field, gtid->event_num);
 
     avro_value_get_by_name(record, avro_timestamp, &field, NULL);
     avro_value_set_int(&field, hdr->timestamp);
@@ -199,11 +218,87 @@ static void prepare_record(AVRO_INSTANCE *router, REP_HEADER *hdr,
     avro_value_set_enum(&field, event_type);
 }
 
+/**
+ * @brief Convert the rows of a row event into Avro records
+ *
+ * Each event has one or more rows in it. The number of rows is not known
+ * beforehand so they are processed until the end of the event is reached.
+ *
+ * @param gtid GTID of the event, the subsequence counter is incremented for
+ * each record
+ * @param hdr Replication header
+ * @param map Table map of the event
+ * @param table Avro file where the records are written
+ * @param ptr Start of the row data
+ * @param end End of the row data
+ * @param col_present Bitfield of the columns present in the event
+ */
+void avro_convert_rows(gtid_pos_t *gtid, REP_HEADER *hdr, TABLE_MAP *map, AVRO_TABLE *table,
+                       uint8_t *ptr, uint8_t *end, uint8_t *col_present)
+{
+    TABLE_CREATE *create = map->table_create;
+    int event_type = get_event_type(hdr->event_type);
+    avro_value_t record;
+    avro_generic_value_new(table->avro_writer_iface, &record);
+
+    while (ptr < end)
+    {
+        /** Add the current GTID and timestamp */
+        prepare_record(gtid, hdr, event_type, &record);
+        ptr = process_row_event_data(map, create, &record, ptr, col_present);
+        avro_file_writer_append_value(table->avro_file, &record);
+
+        /** Update rows events have the before and after images of the
+         * affected rows so we'll process them as another record with
+         * a different type */
+        if (event_type == UPDATE_EVENT)
+        {
+            prepare_record(gtid, hdr, UPDATE_EVENT_AFTER, &record);
+            ptr = process_row_event_data(map, create, &record, ptr, col_present);
+            avro_file_writer_append_value(table->avro_file, &record);
+        }
+    }
+
+    avro_value_decref(&record);
+}
+
+/**
+ * @brief Count the Avro records a row event produces
+ *
+ * The rows are only skipped, not converted. This is used to assign the GTID
+ * subsequence numbers when the rows are converted by a conversion thread.
+ *
+ * @param hdr Replication header
+ * @param map Table map of the event
+ * @param ptr Start of the row data
+ * @param end End of the row data
+ * @param col_present Bitfield of the columns present in the event
+ * @return Number of records in the event
+ */
+int avro_count_records(REP_HEADER *hdr, TABLE_MAP *map, uint8_t *ptr,
+                       uint8_t *end, uint8_t *col_present)
+{
+    int images = get_event_type(hdr->event_type) == UPDATE_EVENT ? 2 : 1;
+    int records = 0;
+
+    while (ptr < end)
+    {
+        for (int i = 0; i < images; i++)
+        {
+            ptr = process_row_event_data(map, map->table_create, NULL, ptr, col_present);
+            records++;
+        }
+    }
+
+    return records;
+}
+
 /**
  * @brief Handle a single RBR row event
  *
  * These events contain the changes in the data. This function assumes that full
- * row image is sent in every row event.
+ * row image is sent in every row event. If conversion threads are used, the
+ * event is queued for the thread that converts the rows of the table.
  *
  * @param router Avro router instance
  * @param hdr Replication header
@@ -214,6 +309,7 @@ bool handle_row_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr)
 {
     bool rval = false;
     uint8_t *start = ptr;
+    uint8_t *end = start + hdr->event_size - BINLOG_EVENT_HDR_LEN;
     uint8_t table_id_size = router->event_type_hdr_lens[hdr->event_type] == 6 ? 4 : 6;
     uint64_t table_id = 0;
 
@@ -253,18 +349,15 @@ bool handle_row_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr)
      * the future partial row images could be used if the bitfield containing
      * the columns that are present in this event is used. */
     const int coldata_size = (ncolumns + 7) / 8;
-    uint8_t col_present[coldata_size];
-    memcpy(&col_present, ptr, coldata_size);
+    uint8_t *col_present = ptr;
     ptr += coldata_size;
 
     /** Update events have the before and after images of the row. This can be
      * used to calculate a "delta" of sorts if necessary. Currently we store
      * both the before and the after images. */
-    uint8_t col_update[coldata_size];
     if (hdr->event_type == UPDATE_ROWS_EVENTv1 ||
         hdr->event_type == UPDATE_ROWS_EVENTv2)
     {
-        memcpy(&col_update, ptr, coldata_size);
         ptr += coldata_size;
     }
 
@@ -282,37 +375,42 @@ bool handle_row_event(AVRO_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr)
 
         if (table && create && ncolumns == map->columns)
         {
-            avro_value_t record;
-            avro_generic_value_new(table->avro_writer_iface, &record);
-
-            /** Each event has one or more rows in it. The number of rows is not known
-             * beforehand so we must continue processing them until we reach the end
-             * of the event. */
-            int rows = 0;
-            while (ptr - start < hdr->event_size - BINLOG_EVENT_HDR_LEN)
+            if (router->conversion_threads > 0)
             {
-                /** Add the current GTID and timestamp */
-                int event_type = get_event_type(hdr->event_type);
-                prepare_record(router, hdr, event_type, &record);
-                ptr = process_row_event_data(map, create, &record, ptr, col_present);
-                avro_file_writer_append_value(table->avro_file, &record);
-
-                /** Update rows events have the before and after images of the
-                 * affected rows so we'll process them as another record with
-                 * a different type */
-                if (event_type == UPDATE_EVENT)
+                size_t rowlen = ptr < end ? end - ptr : 0;
+                AVRO_ROW_JOB *job = malloc(sizeof(AVRO_ROW_JOB) + coldata_size + rowlen);
+
+                if (job)
                 {
-                    prepare_record(router, hdr, UPDATE_EVENT_AFTER, &record);
-                    ptr = process_row_event_data(map, create, &record, ptr, col_present);
-                    avro_file_writer_append_value(table->avro_file, &record);
+                    job->hdr = *hdr;
+                    job->gtid = router->gtid;
+                    job->map = map;
+                    job->table = table;
+                    job->col_present = (uint8_t*)(job + 1);
+                    job->rows = job->col_present + coldata_size;
+                    job->end = job->rows + rowlen;
+                    memcpy(job->col_present, col_present, coldata_size);
+                    memcpy(job->rows, ptr, rowlen);
+
+                    /** The conversion thread numbers the records starting from
+                     * the current subsequence number */
+                    router->gtid.event_num += avro_count_records(hdr, map, ptr, end, col_present);
+                    avro_queue_row_event(router, table_ident, job);
+                    rval = true;
                 }
-
-                rows++;
+                else
+                {
+                    MXS_ERROR("Failed to allocate memory for a row event of table %s.",
+                              table_ident);
+                }
+            }
+            else
+            {
+                avro_convert_rows(&router->gtid, hdr, map, table, ptr, end, col_present);
+                rval = true;
             }
 
             add_used_table(router, table_ident);
-            avro_value_decref(&record);
-            rval = true;
         }
         else if (table == NULL)
         {
@@ -453,7 +551,7 @@ int get_metadata_len(uint8_t type)
  *
  * @param map Table map event associated with this row
  * @param create Table creation associated with this row
- * @param record Avro record used for storing this row
+ * @param record Avro record used for storing this row, NULL to only skip the row
  * @param ptr Pointer to the start of the row data, should be after the row event header
  * @param columns_present The bitfield holding the columns that are present for
  * this row event. Currently this should be a bitfield which has all bits set.
@@ -478,15 +576,23 @@ uint8_t* process_row_event_data(TABLE_MAP *map, TABLE_CREATE *create, avro_value
     for (long i = 0; i < map->columns && npresent < ncolumns; i++)
     {
         ss_dassert(create->columns == map->columns);
-        avro_value_get_by_name(record, create->column_names[i], &field, NULL);
+
+        if (record)
+        {
+            avro_value_get_by_name(record, create->column_names[i], &field, NULL);
+        }
 
         if (bit_is_set(columns_present, ncolumns, i))
         {
             npresent++;
             if (bit_is_set(null_bitmap, ncolumns, i))
             {
-                avro_value_set_null(&field);
+                if (record)
+                {
+                    avro_value_set_null(&field);
+                }
             }
+
             else if (column_is_fixed_string(map->column_types[i]))
             {
                 /** ENUM and SET are stored as STRING types with the type stored
@@ -505,16 +611,23 @@ uint8_t* process_row_event_data(TABLE_MAP *map, TABLE_CREATE *create, avro_value
                         warn_large_enumset = true;
                         MXS_WARNING("ENUM/SET values larger than 255 values aren't supported.");
                     }
-                    avro_value_set_string(&field, strval);
+                    if (record)
+                    {
+                        avro_value_set_string(&field, strval);
+                    }
                     ptr += bytes;
                 }
                 else
                 {
                     uint8_t bytes = *ptr;
-                    char str[bytes + 1];
-                    memcpy(str, ptr + 1, bytes);
-                    str[bytes] = '\0';
-                    avro_value_set_string(&field, str);
+
+                    if (record)
+                    {
+                        char str[bytes + 1];
+                        memcpy(str, ptr + 1, bytes);
+                        str[bytes] = '\0';
+                        avro_value_set_string(&field, str);
+                    }
                     ptr += bytes + 1;
                 }
             }
@@ -533,7 +646,10 @@ uint8_t* process_row_event_data(TABLE_MAP *map, TABLE_CREATE *create, avro_value
                     warn_bit = true;
                     MXS_WARNING("BIT is not currently supported, values are stored as 0.");
                 }
-                avro_value_set_int(&field, value);
+                if (record)
+                {
+                    avro_value_set_int(&field, value);
+                }
                 ptr += bytes;
             }
             else if (column_is_decimal(map->column_types[i]))
@@ -557,16 +673,23 @@ uint8_t* process_row_event_data(TABLE_MAP *map, TABLE_CREATE *create, avro_value
                     warn_decimal = true;
                     MXS_WARNING("DECIMAL is not currently supported, values are stored as 0.");
                 }
-                avro_value_set_int(&field, 0);
+                if (record)
+                {
+                    avro_value_set_int(&field, 0);
+                }
             }
             else if (column_is_variable_string(map->column_types[i]))
             {
                 size_t sz;
                 char *str = lestr_consume(&ptr, &sz);
-                char buf[sz + 1];
-                memcpy(buf, str, sz);
-                buf[sz] = '\0';
-                avro_value_set_string(&field, buf);
+
+                if (record)
+                {
+                    char buf[sz + 1];
+                    memcpy(buf, str, sz);
+                    buf[sz] = '\0';
+                    avro_value_set_string(&field, buf);
+                }
             }
             else if (column_is_blob(map->column_types[i]))
             {
@@ -574,7 +697,10 @@ uint8_t* process_row_event_data(TABLE_MAP *map, TABLE_CREATE *create, avro_value
                 uint64_t len = 0;
                 memcpy(&len, ptr, bytes);
                 ptr += bytes;
-                avro_value_set_bytes(&field, ptr, len);
+                if (record)
+                {
+                    avro_value_set_bytes(&field, ptr, len);
+                }
                 ptr += len;
             }
             else if (column_is_temporal(map->column_types[i]))
@@ -582,8 +708,11 @@ uint8_t* process_row_event_data(TABLE_MAP *map, TABLE_CREATE *create, avro_value
                 char buf[80];
                 struct tm tm;
                 ptr += unpack_temporal_value(map->column_types[i], ptr, &metadata[metadata_offset], &tm);
-                format_temporal_value(buf, sizeof(buf), map->column_types[i], &tm);
-                avro_value_set_string(&field, buf);
+                if (record)
+                {
+                    format_temporal_value(buf, sizeof(buf), map->column_types[i], &tm);
+                    avro_value_set_string(&field, buf);
+                }
             }
             /** All numeric types (INT, LONG, FLOAT etc.) */
             else
@@ -592,7 +721,10 @@ uint8_t* process_row_event_data(TABLE_MAP *map, TABLE_CREATE *create, avro_value
                 memset(lval, 0, sizeof(lval));
                 ptr += unpack_numeric_field(ptr, map->column_types[i],
                                             &metadata[metadata_offset], lval);
-                set_numeric_field_value(&field, map->column_types[i], &metadata[metadata_offset], lval);
+                if (record)
+                {
+                    set_numeric_field_value(&field, map->column_types[i], &metadata[metadata_offset], lval);
+                }
             }
             ss_dassert(metadata_offset <= map->column_metadata_size);
             metadata_offset += get_metadata_len(map->column_types[i]);
@@ -0,0 +1,553 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * Tests for the export sinks. The Kafka sink is tested against a stand-in
+ * broker that checks the ProduceRequests and answers them. The exporter is
+ * tested to continue from the stored export progress.
+ */
+
+#include <avrorouter.h>
+#include <maxscale_crc32.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static const char *keys[] = {"test.t1", "test.t2", "test.t1"};
+static const char *values[] = {"{\"a\": 1}", "{\"b\": \"two\"}", "{\"a\": 3}"};
+#define NUM_MSGS (sizeof(keys) / sizeof(keys[0]))
+
+static const char *topic = "cdc";
+
+static void build_batch(AVRO_EXPORT_BATCH *batch)
+{
+    memset(batch, 0, sizeof(*batch));
+
+    for (size_t i = 0; i < NUM_MSGS; i++)
+    {
+        avro_export_batch_add(batch, keys[i], strlen(keys[i]), values[i], strlen(values[i]));
+    }
+}
+
+static size_t read_file(const char *path, char *buf, size_t size)
+{
+    FILE *f = fopen(path, "rb");
+    size_t n = 0;
+
+    if (f)
+    {
+        n = fread(buf, 1, size, f);
+        fclose(f);
+    }
+
+    return n;
+}
+
+static int test_file_sink(const AVRO_EXPORT_BATCH *batch)
+{
+    int rval = 0;
+    char path[] = "/tmp/test_export_XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+
+    AVRO_SINK *sink = avro_file_sink_alloc(path, AVRO_FORMAT_JSON);
+
+    if (!sink->write(sink, batch) || !sink->write(sink, batch))
+    {
+        printf("JSON file sink write failed\n");
+        rval++;
+    }
+
+    sink->free(sink);
+
+    char buf[1024];
+    char expected[1024] = "";
+    size_t n = read_file(path, buf, sizeof(buf));
+
+    for (int j = 0; j < 2; j++)
+    {
+        for (size_t i = 0; i < NUM_MSGS; i++)
+        {
+            strcat(expected, values[i]);
+            strcat(expected, "\n");
+        }
+    }
+
+    if (n != strlen(expected) || memcmp(buf, expected, n) != 0)
+    {
+        printf("Unexpected JSON file contents: %.*s\n", (int)n, buf);
+        rval++;
+    }
+
+    unlink(path);
+    sink = avro_file_sink_alloc(path, AVRO_FORMAT_AVRO);
+
+    if (!sink->write(sink, batch))
+    {
+        printf("Avro file sink write failed\n");
+        rval++;
+    }
+
+    sink->free(sink);
+    n = read_file(path, buf, sizeof(buf));
+    size_t pos = 0;
+
+    for (size_t i = 0; i < NUM_MSGS && rval == 0; i++)
+    {
+        uint32_t len;
+        memcpy(&len, buf + pos, 4);
+        pos += 4;
+
+        if (ntohl(len) != strlen(keys[i]) || memcmp(buf + pos, keys[i], ntohl(len)) != 0)
+        {
+            printf("Unexpected key of Avro message %lu\n", i);
+            rval++;
+        }
+
+        pos += ntohl(len);
+        memcpy(&len, buf + pos, 4);
+        pos += 4;
+
+        if (ntohl(len) != strlen(values[i]) || memcmp(buf + pos, values[i], ntohl(len)) != 0)
+        {
+            printf("Unexpected value of Avro message %lu\n", i);
+            rval++;
+        }
+
+        pos += ntohl(len);
+    }
+
+    if (pos != n)
+    {
+        printf("Avro file is %lu bytes, expected %lu\n", n, pos);
+        rval++;
+    }
+
+    unlink(path);
+
+    /** A named pipe without a reader does not accept the batch */
+    mkfifo(path, 0600);
+    sink = avro_file_sink_alloc(path, AVRO_FORMAT_JSON);
+
+    if (sink->write(sink, batch))
+    {
+        printf("Write to a pipe without a reader succeeded\n");
+        rval++;
+    }
+
+    sink->free(sink);
+    unlink(path);
+
+    return rval;
+}
+
+/** The stand-in Kafka broker */
+typedef struct
+{
+    int listener;
+    int error_code; /*< Error code sent in the responses */
+    int requests; /*< Number of valid requests received */
+    int errors; /*< Number of invalid requests received */
+} BROKER;
+
+static bool read_all(int fd, uint8_t *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t rc = read(fd, buf, len);
+
+        if (rc <= 0)
+        {
+            return false;
+        }
+
+        buf += rc;
+        len -= rc;
+    }
+
+    return true;
+}
+
+static uint32_t get32(const uint8_t *ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, 4);
+    return ntohl(value);
+}
+
+static uint16_t get16(const uint8_t *ptr)
+{
+    uint16_t value;
+    memcpy(&value, ptr, 2);
+    return ntohs(value);
+}
+
+/**
+ * Check that a ProduceRequest contains the test messages
+ *
+ * @return The correlation ID or -1 if the request is invalid
+ */
+static int32_t check_request(const uint8_t *ptr, const uint8_t *end)
+{
+    if (get16(ptr) != 0 || get16(ptr + 2) != 0)
+    {
+        return -1;
+    }
+
+    int32_t id = get32(ptr + 4);
+    ptr += 8;
+    ptr += 2 + get16(ptr); /** Client ID */
+
+    if (get16(ptr) != 1 || get32(ptr + 6) != 1 || get16(ptr + 10) != strlen(topic) ||
+        memcmp(ptr + 12, topic, strlen(topic)) != 0)
+    {
+        return -1;
+    }
+
+    ptr += 12 + strlen(topic);
+
+    if (get32(ptr) != 1 || get32(ptr + 4) != 0 || ptr + 12 + get32(ptr + 8) != end)
+    {
+        return -1;
+    }
+
+    ptr += 12;
+
+    for (size_t i = 0; i < NUM_MSGS; i++)
+    {
+        uint32_t size = get32(ptr + 8);
+        const uint8_t *msg = ptr + 12;
+
+        if (get32(msg) != mxs_crc32(0, msg + 4, size - 4) || msg[4] != 0 || msg[5] != 0 ||
+            get32(msg + 6) != strlen(keys[i]) || memcmp(msg + 10, keys[i], strlen(keys[i])) != 0)
+        {
+            return -1;
+        }
+
+        msg += 10 + strlen(keys[i]);
+
+        if (get32(msg) != strlen(values[i]) || memcmp(msg + 4, values[i], strlen(values[i])) != 0)
+        {
+            return -1;
+        }
+
+        ptr += 12 + size;
+    }
+
+    return ptr == end ? id : -1;
+}
+
+static void* broker_main(void *data)
+{
+    BROKER *broker = (BROKER*)data;
+    int fd;
+
+    while ((fd = accept(broker->listener, NULL, NULL)) != -1)
+    {
+        uint8_t buf[4096];
+
+        while (read_all(fd, buf, 4))
+        {
+            uint32_t len = get32(buf);
+
+            if (len > sizeof(buf) || !read_all(fd, buf, len))
+            {
+                break;
+            }
+
+            int32_t id = check_request(buf, buf + len);
+
+            if (id == -1)
+            {
+                broker->errors++;
+                break;
+            }
+
+            broker->requests++;
+
+            uint8_t *ptr = buf;
+            uint32_t v;
+            uint16_t s;
+            size_t resp_len = 4 + 4 + 2 + strlen(topic) + 4 + 4 + 2 + 8;
+            v = htonl(resp_len);
+            memcpy(ptr, &v, 4);
+            v = htonl(id);
+            memcpy(ptr + 4, &v, 4);
+            v = htonl(1);
+            memcpy(ptr + 8, &v, 4);
+            s = htons(strlen(topic));
+            memcpy(ptr + 12, &s, 2);
+            memcpy(ptr + 14, topic, strlen(topic));
+            ptr += 14 + strlen(topic);
+            v = htonl(1);
+            memcpy(ptr, &v, 4);
+            v = htonl(0);
+            memcpy(ptr + 4, &v, 4);
+            s = htons(broker->error_code);
+            memcpy(ptr + 8, &s, 2);
+            memset(ptr + 10, 0, 8);
+
+            if (write(fd, buf, resp_len + 4) != resp_len + 4)
+            {
+                break;
+            }
+        }
+
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static int test_kafka_sink(const AVRO_EXPORT_BATCH *batch)
+{
+    int rval = 0;
+    BROKER broker = {.error_code = 0};
+    struct sockaddr_in addr = {.sin_family = AF_INET};
+    socklen_t addrlen = sizeof(addr);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    broker.listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (bind(broker.listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(broker.listener, 5) != 0 ||
+        getsockname(broker.listener, (struct sockaddr*)&addr, &addrlen) != 0)
+    {
+        printf("Failed to start the broker\n");
+        return 1;
+    }
+
+    pthread_t thr;
+    pthread_create(&thr, NULL, broker_main, &broker);
+
+    char address[64];
+    snprintf(address, sizeof(address), "127.0.0.1:%d", ntohs(addr.sin_port));
+    AVRO_SINK *sink = avro_kafka_sink_alloc(address, topic, 1);
+
+    if (!sink->write(sink, batch) || !sink->write(sink, batch))
+    {
+        printf("Kafka sink write failed\n");
+        rval++;
+    }
+
+    if (broker.requests != 2 || broker.errors != 0)
+    {
+        printf("Broker received %d valid and %d invalid requests, expected 2 and 0\n",
+               broker.requests, broker.errors);
+        rval++;
+    }
+
+    /** NOT_LEADER_FOR_PARTITION */
+    broker.error_code = 6;
+
+    if (sink->write(sink, batch))
+    {
+        printf("Kafka sink write succeeded when the broker returned an error\n");
+        rval++;
+    }
+
+    broker.error_code = 0;
+
+    if (!sink->write(sink, batch))
+    {
+        printf("Kafka sink write failed after the error was fixed\n");
+        rval++;
+    }
+
+    shutdown(broker.listener, SHUT_RDWR);
+    close(broker.listener);
+    sink->free(sink);
+    pthread_join(thr, NULL);
+
+    /** The broker is no longer listening */
+    sink = avro_kafka_sink_alloc(address, topic, 1);
+
+    if (sink->write(sink, batch))
+    {
+        printf("Kafka sink write succeeded without a broker\n");
+        rval++;
+    }
+
+    sink->free(sink);
+
+    if (avro_kafka_sink_alloc("127.0.0.1", topic, 1))
+    {
+        printf("Broker address without a port was accepted\n");
+        rval++;
+    }
+
+    return rval;
+}
+
+static size_t encode_integer(uint8_t *dest, int64_t val)
+{
+    uint64_t encval = ((uint64_t)val << 1) ^ (uint64_t)(val >> 63);
+    size_t n = 0;
+
+    while (encval & ~0x7fUL)
+    {
+        dest[n++] = 0x80 | (encval & 0x7f);
+        encval >>= 7;
+    }
+
+    dest[n++] = encval;
+    return n;
+}
+
+static size_t encode_string(uint8_t *dest, const char *str)
+{
+    size_t len = strlen(str);
+    size_t n = encode_integer(dest, len);
+    memcpy(dest + n, str, len);
+    return n + len;
+}
+
+/**
+ * Write an Avro file with blocks of two records with the values 1 to
+ * 2 * @c n_blocks. The offsets of the blocks are stored in @c offsets.
+ */
+static bool write_avro_file(const char *path, int n_blocks, long *offsets)
+{
+    static const uint8_t sync[SYNC_MARKER_SIZE] = "0123456789abcdef";
+    uint8_t buf[512];
+    size_t n = 0;
+    FILE *file = fopen(path, "wb");
+
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    memcpy(buf, "Obj\x01", 4);
+    n += 4;
+    n += encode_integer(buf + n, 2);
+    n += encode_string(buf + n, "avro.codec");
+    n += encode_string(buf + n, "null");
+    n += encode_string(buf + n, "avro.schema");
+    n += encode_string(buf + n, "{\"type\": \"record\", \"name\": \"ChangeRecord\", "
+                       "\"fields\": [{\"name\": \"a\", \"type\": \"int\"}]}");
+    n += encode_integer(buf + n, 0);
+    memcpy(buf + n, sync, SYNC_MARKER_SIZE);
+    n += SYNC_MARKER_SIZE;
+
+    for (int i = 0; i < n_blocks; i++)
+    {
+        uint8_t data[16];
+        size_t len = encode_integer(data, 2 * i + 1);
+        len += encode_integer(data + len, 2 * i + 2);
+
+        offsets[i] = n;
+        n += encode_integer(buf + n, 2);
+        n += encode_integer(buf + n, len);
+        memcpy(buf + n, data, len);
+        n += len;
+        memcpy(buf + n, sync, SYNC_MARKER_SIZE);
+        n += SYNC_MARKER_SIZE;
+    }
+
+    bool rval = fwrite(buf, 1, n, file) == n;
+    return fclose(file) == 0 && rval;
+}
+
+static int test_resume()
+{
+    int rval = 0;
+    char dir[] = "/tmp/test_export_XXXXXX";
+    char avro[PATH_MAX];
+    char checkpoint[PATH_MAX];
+    char output[PATH_MAX];
+    long offsets[3];
+
+    if (mkdtemp(dir) == NULL)
+    {
+        printf("Failed to create a directory\n");
+        return 1;
+    }
+
+    snprintf(avro, sizeof(avro), "%s/test.t1.000001.avro", dir);
+    snprintf(checkpoint, sizeof(checkpoint), "%s/" AVRO_EXPORT_PROGRESS_FILE, dir);
+    snprintf(output, sizeof(output), "%s/output", dir);
+
+    FILE *file = fopen(checkpoint, "wb");
+
+    if (!write_avro_file(avro, 3, offsets) || file == NULL)
+    {
+        printf("Failed to create the test files\n");
+        return 1;
+    }
+
+    /** The first block was accepted by the sink before the restart */
+    fprintf(file, "[%s]\nposition=%ld\n", avro, offsets[1]);
+    fclose(file);
+
+    AVRO_EXPORT_OPTIONS options = {.sink = "file", .path = output, .format = AVRO_FORMAT_JSON,
+                                   .batch_size = 1, .linger = 0};
+    AVRO_EXPORTER *exporter = avro_exporter_alloc("test", &options, dir);
+
+    if (exporter == NULL || !avro_exporter_start(exporter))
+    {
+        printf("Failed to start the exporter\n");
+        return 1;
+    }
+
+    char buf[1024];
+    const char expected[] = "{\"table\": \"test.t1\", \"a\": 3}\n"
+                            "{\"table\": \"test.t1\", \"a\": 4}\n"
+                            "{\"table\": \"test.t1\", \"a\": 5}\n"
+                            "{\"table\": \"test.t1\", \"a\": 6}\n";
+    size_t n = 0;
+
+    for (int i = 0; i < 50 && n < sizeof(expected) - 1; i++)
+    {
+        usleep(100000);
+        n = read_file(output, buf, sizeof(buf));
+    }
+
+    avro_exporter_free(exporter);
+
+    if (n != sizeof(expected) - 1 || memcmp(buf, expected, n) != 0)
+    {
+        printf("Resumed export wrote '%.*s', expected '%s'\n", (int)n, buf, expected);
+        rval++;
+    }
+
+    /** The table is not open, so the file is forgotten once it is exported */
+    n = read_file(checkpoint, buf, sizeof(buf));
+
+    if (n != 0)
+    {
+        printf("Export progress not cleared: '%.*s'\n", (int)n, buf);
+        rval++;
+    }
+
+    unlink(avro);
+    unlink(checkpoint);
+    unlink(output);
+    rmdir(dir);
+    return rval;
+}
+
+int main(int argc, char **argv)
+{
+    AVRO_EXPORT_BATCH batch;
+    build_batch(&batch);
+
+    int rval = test_file_sink(&batch) + test_kafka_sink(&batch) + test_resume();
+
+    avro_export_batch_free(&batch);
+    return rval;
+}
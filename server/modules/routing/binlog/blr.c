@@ -81,6 +81,7 @@ static char *version_str = "V2.0.0";
 /* The router entry points */
 static  ROUTER  *createInstance(SERVICE *service, char **options);
 static void free_instance(ROUTER_INSTANCE *instance);
+static unsigned long blr_parse_size(const char *value);
 static  void    *newSession(ROUTER *instance, SESSION *session);
 static  void    closeSession(ROUTER *instance, void *router_session);
 static  void    freeSession(ROUTER *instance, void *router_session);
@@ -255,6 +256,16 @@ createInstance(SERVICE *service, char **options)
     inst->short_burst = DEF_SHORT_BURST;
     inst->long_burst = DEF_LONG_BURST;
     inst->burst_size = DEF_BURST_SIZE;
+    inst->write_buffer_size = DEF_WRITE_BUFFER_SIZE;
+    inst->write_buffer_len = 0;
+    inst->write_buffer_interval = DEF_WRITE_BUFFER_INTERVAL;
+    inst->write_buffer_start = 0;
+    inst->write_buffer = NULL;
+    inst->index = NULL;
+    inst->index_interval = DEF_INDEX_INTERVAL;
+    inst->sync_method = BLR_SYNC_FSYNC;
+    inst->sync_interval = 0;
+    inst->last_sync = 0;
     inst->retry_backoff = 1;
     inst->binlogdir = NULL;
     inst->heartbeat = BLR_HEARTBEAT_DEFAULT_INTERVAL;
@@ -427,29 +438,48 @@ createInstance(SERVICE *service, char **options)
                 }
                 else if (strcmp(options[i], "burstsize") == 0)
                 {
-                    unsigned long size = atoi(value);
-                    char    *ptr = value;
-                    while (*ptr && isdigit(*ptr))
+                    inst->burst_size = blr_parse_size(value);
+                }
+                else if (strcmp(options[i], "write_buffer_size") == 0)
+                {
+                    inst->write_buffer_size = blr_parse_size(value);
+                }
+                else if (strcmp(options[i], "write_buffer_interval") == 0)
+                {
+                    inst->write_buffer_interval = strtoul(value, NULL, 10);
+                }
+                else if (strcmp(options[i], "sync_method") == 0)
+                {
+                    if (strcmp(value, "fsync") == 0)
                     {
-                        ptr++;
+                        inst->sync_method = BLR_SYNC_FSYNC;
                     }
-                    switch (*ptr)
+                    else if (strcmp(value, "fdatasync") == 0)
                     {
-                    case 'G':
-                    case 'g':
-                        size = size * 1024 * 1000 * 1000;
-                        break;
-                    case 'M':
-                    case 'm':
-                        size = size * 1024 * 1000;
-                        break;
-                    case 'K':
-                    case 'k':
-                        size = size * 1024;
-                        break;
+                        inst->sync_method = BLR_SYNC_FDATASYNC;
                     }
-                    inst->burst_size = size;
-
+                    else if (strcmp(value, "sync_file_range") == 0)
+                    {
+                        inst->sync_method = BLR_SYNC_FILE_RANGE;
+                    }
+                    else if (strcmp(value, "none") == 0)
+                    {
+                        inst->sync_method = BLR_SYNC_NONE;
+                    }
+                    else
+                    {
+                        MXS_WARNING("Invalid sync_method '%s'. Using the default "
+                                    "value 'fsync'. Valid values are fsync, "
+                                    "fdatasync, sync_file_range and none.", value);
+                    }
+                }
+                else if (strcmp(options[i], "sync_interval") == 0)
+                {
+                    inst->sync_interval = strtoul(value, NULL, 10);
+                }
+                else if (strcmp(options[i], "index_interval") == 0)
+                {
+                    inst->index_interval = strtoul(value, NULL, 10);
                 }
                 else if (strcmp(options[i], "heartbeat") == 0)
                 {
@@ -499,6 +529,7 @@ createInstance(SERVICE *service, char **options)
     inst->rotating = 0;
     inst->residual = NULL;
     inst->slaves = NULL;
+    inst->slave_array = NULL;
     inst->next = NULL;
     inst->lastEventTimestamp = 0;
 
@@ -518,6 +549,15 @@ createInstance(SERVICE *service, char **options)
         return NULL;
     }
 
+    if (inst->write_buffer_size &&
+        (inst->write_buffer = malloc(inst->write_buffer_size)) == NULL)
+    {
+        MXS_ERROR("Service %s, failed to allocate a binlog write buffer of %lu bytes.",
+                  service->name, inst->write_buffer_size);
+        free_instance(inst);
+        return NULL;
+    }
+
     if (inst->serverid <= 0)
     {
         MXS_ERROR("Service %s, server-id is not configured. "
@@ -744,9 +784,52 @@ free_instance(ROUTER_INSTANCE *instance)
     free(instance->set_master_hostname);
     free(instance->fileroot);
     free(instance->binlogdir);
+    free(instance->write_buffer);
+
+    if (instance->index)
+    {
+        blr_index_close(instance->index);
+    }
+
     free(instance);
 }
 
+/**
+ * Parse a size value that can have a K, M or G suffix
+ *
+ * @param value The value to parse
+ * @return The size in bytes
+ */
+static unsigned long
+blr_parse_size(const char *value)
+{
+    unsigned long size = atoi(value);
+    const char *ptr = value;
+
+    while (*ptr && isdigit(*ptr))
+    {
+        ptr++;
+    }
+
+    switch (*ptr)
+    {
+    case 'G':
+    case 'g':
+        size = size * 1024 * 1000 * 1000;
+        break;
+    case 'M':
+    case 'm':
+        size = size * 1024 * 1000;
+        break;
+    case 'K':
+    case 'k':
+        size = size * 1024;
+        break;
+    }
+
+    return size;
+}
+
 /**
  * Associate a new session with this instance of the router.
  *
@@ -801,6 +884,7 @@ newSession(ROUTER *instance, SESSION *session)
     slave->mariadb10_compat = false;
     slave->heartbeat = 0;
     slave->lastEventReceived = 0;
+    slave->refcount = 1;
 
     /**
          * Add this session to the list of active sessions.
@@ -841,6 +925,136 @@ static void freeSession(ROUTER* router_instance,
      * Remove the slave session form the list of slaves that are using the
      * router currently.
      */
+    blr_slave_remove(router, slave);
+
+    MXS_DEBUG("%lu [freeSession] Unlinked router_client_session %p from "
+              "router %p. Connections : %d. ",
+              pthread_self(),
+              slave,
+              router,
+              prev_val - 1);
+
+    /** The slave is freed once the master thread no longer uses it */
+    blr_slave_release(slave);
+}
+
+/**
+ * Replace the snapshot of dumping slaves with a new one built from the
+ * list of slaves. The caller must hold the router lock.
+ *
+ * @param router The router instance
+ */
+static void
+blr_slave_array_update(ROUTER_INSTANCE *router)
+{
+    BLR_SLAVE_ARRAY *array = NULL;
+    ROUTER_SLAVE *slave;
+    int n = 0;
+
+    for (slave = router->slaves; slave; slave = slave->next)
+    {
+        if (slave->state == BLRS_DUMPING)
+        {
+            n++;
+        }
+    }
+
+    if (n > 0)
+    {
+        if ((array = malloc(sizeof(BLR_SLAVE_ARRAY) + n * sizeof(ROUTER_SLAVE *))) == NULL)
+        {
+            MXS_ERROR("%s: Failed to allocate memory for the list of slaves.",
+                      router->service->name);
+            return;
+        }
+
+        array->refcount = 1;
+        array->n_slaves = 0;
+
+        for (slave = router->slaves; slave; slave = slave->next)
+        {
+            if (slave->state == BLRS_DUMPING)
+            {
+                atomic_add(&slave->refcount, 1);
+                array->slaves[array->n_slaves++] = slave;
+            }
+        }
+    }
+
+    BLR_SLAVE_ARRAY *old = router->slave_array;
+    router->slave_array = array;
+
+    if (old)
+    {
+        blr_slave_array_release(old);
+    }
+}
+
+/**
+ * Get the current snapshot of dumping slaves. The snapshot must be released
+ * with blr_slave_array_release() when it is no longer used.
+ *
+ * @param router The router instance
+ * @return The snapshot or NULL if no slaves are dumping
+ */
+BLR_SLAVE_ARRAY *
+blr_slave_array_acquire(ROUTER_INSTANCE *router)
+{
+    BLR_SLAVE_ARRAY *array;
+
+    spinlock_acquire(&router->lock);
+    if ((array = router->slave_array) != NULL)
+    {
+        atomic_add(&array->refcount, 1);
+    }
+    spinlock_release(&router->lock);
+
+    return array;
+}
+
+/**
+ * Release a snapshot of dumping slaves
+ *
+ * @param array The snapshot to release
+ */
+void
+blr_slave_array_release(BLR_SLAVE_ARRAY *array)
+{
+    if (atomic_add(&array->refcount, -1) == 1)
+    {
+        for (int i = 0; i < array->n_slaves; i++)
+        {
+            blr_slave_release(array->slaves[i]);
+        }
+        free(array);
+    }
+}
+
+/**
+ * Move a slave into the dumping state in which it receives the binlog
+ * events distributed by the master thread.
+ *
+ * @param router The router instance
+ * @param slave  The slave that starts dumping
+ */
+void
+blr_slave_start_dumping(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
+{
+    spinlock_acquire(&router->lock);
+    slave->state = BLRS_DUMPING;
+    blr_slave_array_update(router);
+    spinlock_release(&router->lock);
+}
+
+/**
+ * Remove a slave from the list of slaves of the router
+ *
+ * @param router The router instance
+ * @param slave  The slave to remove
+ */
+void
+blr_slave_remove(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
+{
     spinlock_acquire(&router->lock);
     if (router->slaves == slave)
     {
@@ -860,28 +1074,26 @@ static void freeSession(ROUTER* router_instance,
             ptr->next = slave->next;
         }
     }
+    blr_slave_array_update(router);
     spinlock_release(&router->lock);
+}
 
-    MXS_DEBUG("%lu [freeSession] Unlinked router_client_session %p from "
-              "router %p. Connections : %d. ",
-              pthread_self(),
-              slave,
-              router,
-              prev_val - 1);
-
-    if (slave->hostname)
+/**
+ * Release a reference to a slave. The slave is freed when the last
+ * reference is released.
+ *
+ * @param slave The slave to release
+ */
+void
+blr_slave_release(ROUTER_SLAVE *slave)
+{
+    if (atomic_add(&slave->refcount, -1) == 1)
     {
         free(slave->hostname);
-    }
-    if (slave->user)
-    {
         free(slave->user);
-    }
-    if (slave->passwd)
-    {
         free(slave->passwd);
+        free(slave);
     }
-    free(slave);
 }
 
 
@@ -1154,6 +1366,21 @@ diagnostics(ROUTER *router, DCB *dcb)
     dcb_printf(dcb, "\tAverage events per packet:                   %.1f\n",
                router_inst->stats.n_reads != 0 ?
                ((double)router_inst->stats.n_binlogs / router_inst->stats.n_reads) : 0);
+    dcb_printf(dcb, "\tBinlog write buffer size:                    %lu\n",
+               router_inst->write_buffer_size);
+    dcb_printf(dcb, "\tBinlog write buffer interval (msec):         %lu\n",
+               router_inst->write_buffer_interval);
+    dcb_printf(dcb, "\tNumber of binlog file writes:                %lu\n",
+               router_inst->stats.n_binlog_writes);
+    dcb_printf(dcb, "\tNumber of binlog file syncs:                 %lu\n",
+               router_inst->stats.n_binlog_syncs);
+    dcb_printf(dcb, "\tAverage binlog file sync time (usec):        %.1f\n",
+               router_inst->stats.n_binlog_syncs != 0 ?
+               ((double)router_inst->stats.sync_time_total / router_inst->stats.n_binlog_syncs) : 0);
+    dcb_printf(dcb, "\tMaximum binlog file sync time (usec):        %lu\n",
+               router_inst->stats.sync_time_max);
+    dcb_printf(dcb, "\tBinlog index interval:                       %u\n",
+               router_inst->index_interval);
 
     spinlock_acquire(&router_inst->lock);
     if (router_inst->stats.lastReply)
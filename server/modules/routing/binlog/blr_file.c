@@ -41,6 +41,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
@@ -60,7 +61,25 @@
 #include <log_manager.h>
 
 static int  blr_file_create(ROUTER_INSTANCE *router, char *file);
+static void blr_file_open_index(ROUTER_INSTANCE *router, const char *path, uint64_t size);
 static void blr_log_header(int priority, char *msg, uint8_t *ptr);
+static void blr_file_sync(ROUTER_INSTANCE *router, bool force);
+static uint64_t blr_time_usec();
+
+/** Size of the read-ahead buffer used when a whole binlog file is read */
+#define BLR_SCAN_BUFFER_SIZE (4 * 1024 * 1024)
+
+/** Read-ahead buffer for reading a whole binlog file */
+typedef struct
+{
+    uint8_t            *data;   /*< The buffered data */
+    size_t             size;    /*< Size of the buffer */
+    size_t             len;     /*< Length of the buffered data */
+    unsigned long long pos;     /*< File position of the buffered data */
+} BLR_READ_BUFFER;
+
+static int blr_read_events(ROUTER_INSTANCE *router, int fix, int debug,
+                           BLR_READ_BUFFER *rbuf, BLR_INDEX *index);
 void blr_cache_read_master_data(ROUTER_INSTANCE *router);
 int blr_file_get_next_binlogname(ROUTER_INSTANCE *router);
 int blr_file_new_binlog(ROUTER_INSTANCE *router, char *file);
@@ -187,6 +206,50 @@ blr_file_init(ROUTER_INSTANCE *router)
     return 1;
 }
 
+/**
+ * Find the number of the oldest binlog file in the binlog directory
+ *
+ * @param router The router instance
+ * @return The file number or 0 if no binlog files were found
+ */
+int
+blr_file_first_binlog(ROUTER_INSTANCE *router)
+{
+    char filename[BINLOG_FNAMELEN + 1];
+    int root_len = strlen(router->fileroot);
+    int first = 0;
+    DIR *dirp;
+    struct dirent *dp;
+
+    if ((dirp = opendir(router->binlogdir)) == NULL)
+    {
+        char err_msg[BLRM_STRERROR_R_MSG_SIZE];
+        MXS_ERROR("%s: Unable to read the binlog directory %s, %s.",
+                  router->service->name, router->binlogdir,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+        return 0;
+    }
+
+    while ((dp = readdir(dirp)) != NULL)
+    {
+        if (strncmp(dp->d_name, router->fileroot, root_len) == 0 &&
+            dp->d_name[root_len] == '.')
+        {
+            int i = atoi(dp->d_name + root_len + 1);
+            snprintf(filename, sizeof(filename), BINLOG_NAMEFMT, router->fileroot, i);
+
+            /** Skip the index files and other files that are not binlogs */
+            if (i > 0 && strcmp(filename, dp->d_name) == 0 && (first == 0 || i < first))
+            {
+                first = i;
+            }
+        }
+    }
+
+    closedir(dirp);
+    return first;
+}
+
 int
 blr_file_rotate(ROUTER_INSTANCE *router, char *file, uint64_t pos)
 {
@@ -212,6 +275,29 @@ blr_file_add_magic(int fd)
 }
 
 
+/**
+ * Replace the index of the previous binlog file with the index of the
+ * binlog file the router starts writing.
+ *
+ * @param router The router instance
+ * @param path   Path to the binlog file
+ * @param size   Current size of the binlog file
+ */
+static void
+blr_file_open_index(ROUTER_INSTANCE *router, const char *path, uint64_t size)
+{
+    if (router->index)
+    {
+        blr_index_close(router->index);
+        router->index = NULL;
+    }
+
+    if (router->index_interval > 0)
+    {
+        router->index = blr_index_open(path, size, router->index_interval);
+    }
+}
+
 /**
  * Create a new binlog file for the router to use.
  *
@@ -237,6 +323,8 @@ blr_file_create(ROUTER_INSTANCE *router, char *file)
     {
         if (blr_file_add_magic(fd))
         {
+            blr_file_flush_buffer(router);
+            blr_file_sync(router, true);
             close(router->binlog_fd);
             spinlock_acquire(&router->binlog_lock);
             strncpy(router->binlog_name, file, BINLOG_FNAMELEN);
@@ -247,6 +335,8 @@ blr_file_create(ROUTER_INSTANCE *router, char *file)
             router->last_written = BINLOG_MAGIC_SIZE;
             spinlock_release(&router->binlog_lock);
 
+            blr_file_open_index(router, path, BINLOG_MAGIC_SIZE);
+
             created = 1;
         }
         else
@@ -294,6 +384,7 @@ blr_file_append(ROUTER_INSTANCE *router, char *file)
         return;
     }
     fsync(fd);
+    blr_file_flush_buffer(router);
     close(router->binlog_fd);
     spinlock_acquire(&router->binlog_lock);
     memmove(router->binlog_name, file, BINLOG_FNAMELEN);
@@ -327,11 +418,19 @@ blr_file_append(ROUTER_INSTANCE *router, char *file)
     }
     router->binlog_fd = fd;
     spinlock_release(&router->binlog_lock);
+
+    blr_file_open_index(router, path, router->current_pos);
 }
 
 /**
  * Write a binlog entry to disk.
  *
+ * If a write buffer is configured the event is only copied into it and
+ * the buffer is written out with a single call once it fills up or when
+ * blr_file_flush_buffer() is called. Events larger than the buffer are
+ * written directly after the buffered ones. Use blr_file_buffer_expired()
+ * to check whether the buffered events have waited too long.
+ *
  * @param router The router instance
  * @param buf    The binlog record
  * @param len    The length of the binlog record
@@ -342,8 +441,25 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
 {
     int n;
 
-    if ((n = pwrite(router->binlog_fd, buf, size,
-                    router->last_written)) != size)
+    if (router->write_buffer_len + size > router->write_buffer_size &&
+        !blr_file_flush_buffer(router))
+    {
+        return 0;
+    }
+
+    if (size <= router->write_buffer_size)
+    {
+        if (router->write_buffer_len == 0)
+        {
+            router->write_buffer_start = blr_time_usec() / 1000;
+        }
+
+        memcpy(router->write_buffer + router->write_buffer_len, buf, size);
+        router->write_buffer_len += size;
+        n = size;
+    }
+    else if ((n = pwrite(router->binlog_fd, buf, size,
+                         router->last_written)) != size)
     {
         char err_msg[STRERROR_BUFLEN];
         MXS_ERROR("%s: Failed to write binlog record at %lu of %s, %s. "
@@ -361,6 +477,11 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
         }
         return 0;
     }
+    else
+    {
+        router->stats.n_binlog_writes++;
+    }
+
     spinlock_acquire(&router->binlog_lock);
     router->current_pos = hdr->next_pos;
     router->last_written += size;
@@ -369,15 +490,150 @@ blr_write_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint32_t size,
     return n;
 }
 
+/**
+ * Write the events stored in the write buffer into the binlog file.
+ *
+ * This must be done before any of the buffered events are made visible to
+ * the slaves as they read the events from the binlog file. If the write
+ * fails, the buffered events are discarded and the binlog position is
+ * moved back to the end of the file so that the events are requested
+ * again from the master.
+ *
+ * @param router The router instance
+ * @return       1 on success, 0 if the write failed
+ */
+int
+blr_file_flush_buffer(ROUTER_INSTANCE *router)
+{
+    if (router->write_buffer_len == 0)
+    {
+        return 1;
+    }
+
+    uint64_t file_end = router->last_written - router->write_buffer_len;
+    ssize_t n = pwrite(router->binlog_fd, router->write_buffer,
+                       router->write_buffer_len, file_end);
+
+    router->stats.n_binlog_writes++;
+
+    if (n != router->write_buffer_len)
+    {
+        char err_msg[STRERROR_BUFLEN];
+        MXS_ERROR("%s: Failed to write %lu buffered bytes at %lu of %s, %s. "
+                  "Truncating to previous record.",
+                  router->service->name, router->write_buffer_len, file_end,
+                  router->binlog_name,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+
+        if (ftruncate(router->binlog_fd, file_end))
+        {
+            MXS_ERROR("%s: Failed to truncate binlog record at %lu of %s, %s. ",
+                      router->service->name, file_end,
+                      router->binlog_name,
+                      strerror_r(errno, err_msg, sizeof(err_msg)));
+        }
+
+        spinlock_acquire(&router->binlog_lock);
+        router->current_pos = file_end;
+        router->last_written = file_end;
+        spinlock_release(&router->binlog_lock);
+        router->write_buffer_len = 0;
+        return 0;
+    }
+
+    router->write_buffer_len = 0;
+    return 1;
+}
+
+/**
+ * Check whether the oldest event in the write buffer has been there for
+ * longer than the write_buffer_interval router option allows.
+ *
+ * @param router The router instance
+ * @return       True if the buffer should be written out
+ */
+bool
+blr_file_buffer_expired(ROUTER_INSTANCE *router)
+{
+    return router->write_buffer_len &&
+        blr_time_usec() / 1000 - router->write_buffer_start >= router->write_buffer_interval;
+}
+
+/**
+ * Return the current value of the monotonic clock in microseconds.
+ */
+static uint64_t
+blr_time_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Synchronise the binlog file to disk with the configured sync method.
+ *
+ * @param router The router instance
+ * @param force  Sync even if the sync interval has not yet elapsed
+ */
+static void
+blr_file_sync(ROUTER_INSTANCE *router, bool force)
+{
+    if (router->sync_method == BLR_SYNC_NONE || router->binlog_fd == -1)
+    {
+        return;
+    }
+
+    uint64_t start = blr_time_usec();
+
+    if (!force && router->sync_interval &&
+        start / 1000 - router->last_sync < router->sync_interval)
+    {
+        return;
+    }
+
+    switch (router->sync_method)
+    {
+    case BLR_SYNC_FDATASYNC:
+        fdatasync(router->binlog_fd);
+        break;
+
+    case BLR_SYNC_FILE_RANGE:
+        /** Start the writeback of all dirty pages but don't wait for it */
+        sync_file_range(router->binlog_fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+        break;
+
+    default:
+        fsync(router->binlog_fd);
+        break;
+    }
+
+    uint64_t end = blr_time_usec();
+    uint64_t elapsed = end - start;
+
+    router->last_sync = end / 1000;
+    router->stats.n_binlog_syncs++;
+    router->stats.sync_time_total += elapsed;
+
+    if (elapsed > router->stats.sync_time_max)
+    {
+        router->stats.sync_time_max = elapsed;
+    }
+}
+
 /**
  * Flush the content of the binlog file to disk.
  *
+ * The file is synced according to the sync_method and sync_interval
+ * router options. Events in the write buffer are not affected, they
+ * are written by blr_file_flush_buffer().
+ *
  * @param   router  The binlog router
  */
 void
 blr_file_flush(ROUTER_INSTANCE *router)
 {
-    fsync(router->binlog_fd);
+    blr_file_sync(router, false);
 }
 
 /**
@@ -930,6 +1186,57 @@ blr_file_next_exists(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
     return 1;
 }
 
+/**
+ * Read data from a binlog file through a read-ahead buffer
+ *
+ * Reads that are not satisfied by the buffer refill it with one large read
+ * starting at the requested position. Reads larger than the buffer bypass it.
+ *
+ * @param fd   File descriptor
+ * @param rbuf Read-ahead buffer, the data member is NULL if not in use
+ * @param dest Destination buffer
+ * @param n    Number of bytes to read
+ * @param pos  Position in the file
+ * @return Number of bytes read or -1 on error
+ */
+static ssize_t
+blr_scan_read(int fd, BLR_READ_BUFFER *rbuf, uint8_t *dest, size_t n, unsigned long long pos)
+{
+    if (rbuf->data == NULL || n > rbuf->size)
+    {
+        return pread(fd, dest, n, pos);
+    }
+
+    if (pos < rbuf->pos || pos + n > rbuf->pos + rbuf->len)
+    {
+        size_t len = 0;
+        ssize_t rc = 0;
+
+        while (len < rbuf->size &&
+               (rc = pread(fd, rbuf->data + len, rbuf->size - len, pos + len)) > 0)
+        {
+            len += rc;
+        }
+
+        if (len == 0 && rc == -1)
+        {
+            rbuf->len = 0;
+            return -1;
+        }
+
+        rbuf->pos = pos;
+        rbuf->len = len;
+
+        if (n > len)
+        {
+            n = len;
+        }
+    }
+
+    memcpy(dest, rbuf->data + (pos - rbuf->pos), n);
+    return n;
+}
+
 /**
  * Read all replication events from a binlog file.
  *
@@ -942,6 +1249,45 @@ blr_file_next_exists(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
  */
 int
 blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
+{
+    return blr_read_events_index(router, fix, debug, NULL);
+}
+
+/**
+ * Read all replication events from a binlog file and optionally index them.
+ *
+ * The file is read in BLR_SCAN_BUFFER_SIZE blocks instead of reading every
+ * event header and body separately.
+ *
+ * @param router  The router instance
+ * @param fix     Whether to fix or not errors
+ * @param debug   Whether to enable or not the debug for events
+ * @param index   Index to add the event groups to or NULL for no index
+ * @return        0 on success, >0 on failure
+ */
+int
+blr_read_events_index(ROUTER_INSTANCE *router, int fix, int debug, BLR_INDEX *index)
+{
+    BLR_READ_BUFFER rbuf = {0};
+
+    /** Fall back to reading the events one by one if the allocation fails */
+    if ((rbuf.data = malloc(BLR_SCAN_BUFFER_SIZE)))
+    {
+        rbuf.size = BLR_SCAN_BUFFER_SIZE;
+    }
+
+    int rval = blr_read_events(router, fix, debug, &rbuf, index);
+
+    free(rbuf.data);
+    return rval;
+}
+
+/**
+ * The event reading loop of blr_read_events_index()
+ */
+static int
+blr_read_events(ROUTER_INSTANCE *router, int fix, int debug,
+                BLR_READ_BUFFER *rbuf, BLR_INDEX *index)
 {
     unsigned long filelen = 0;
     struct stat statb;
@@ -998,7 +1344,7 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
     {
 
         /* Read the header information from the file */
-        if ((n = pread(router->binlog_fd, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
+        if ((n = blr_scan_read(router->binlog_fd, rbuf, hdbuf, BINLOG_EVENT_HDR_LEN, pos)) != BINLOG_EVENT_HDR_LEN)
         {
             switch (n)
             {
@@ -1263,9 +1609,9 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
         memcpy(data, hdbuf, BINLOG_EVENT_HDR_LEN);// Copy the header in
 
         /* Read event data */
-        if ((n = pread(router->binlog_fd, &data[BINLOG_EVENT_HDR_LEN],
-                       hdr.event_size - BINLOG_EVENT_HDR_LEN,
-                       pos + BINLOG_EVENT_HDR_LEN)) != hdr.event_size - BINLOG_EVENT_HDR_LEN)
+        if ((n = blr_scan_read(router->binlog_fd, rbuf, &data[BINLOG_EVENT_HDR_LEN],
+                               hdr.event_size - BINLOG_EVENT_HDR_LEN,
+                               pos + BINLOG_EVENT_HDR_LEN)) != hdr.event_size - BINLOG_EVENT_HDR_LEN)
         {
             if (n == -1)
             {
@@ -1419,6 +1765,63 @@ blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug)
             }
         }
 
+        /* Verify the event checksum */
+        if (found_chksum && hdr.event_size >= BINLOG_EVENT_HDR_LEN + MYSQL_CHECKSUM_LEN)
+        {
+            /** The server calculates the checksum of the Format Description
+             * event with the in-use flag cleared, the flag is set while the
+             * file is open and left set by a crash */
+            uint8_t header[BINLOG_EVENT_HDR_LEN];
+            memcpy(header, data, BINLOG_EVENT_HDR_LEN);
+
+            if (hdr.event_type == FORMAT_DESCRIPTION_EVENT)
+            {
+                header[17] &= ~LOG_EVENT_BINLOG_IN_USE_F;
+            }
+
+            uint32_t size = hdr.event_size - MYSQL_CHECKSUM_LEN;
+            uint32_t chksum = mxs_crc32(mxs_crc32(0, header, BINLOG_EVENT_HDR_LEN),
+                                        data + BINLOG_EVENT_HDR_LEN,
+                                        size - BINLOG_EVENT_HDR_LEN);
+            uint32_t event_chksum = extract_field(data + size, 32);
+
+            if (chksum != event_chksum)
+            {
+                MXS_ERROR("Checksum mismatch for event type %d at %llu in %s: "
+                          "calculated 0x%08x, found 0x%08x.",
+                          hdr.event_type, pos, router->binlog_name,
+                          chksum, event_chksum);
+
+                gwbuf_free(result);
+
+                router->binlog_position = last_known_commit;
+                router->current_safe_event = last_known_commit;
+                router->current_pos = pos;
+
+                MXS_WARNING("an error has been found. "
+                            "Setting safe pos to %lu, current pos %lu",
+                            router->binlog_position, router->current_pos);
+
+                /** A checksum mismatch alone does not show where the valid
+                 * events end so the file is not truncated */
+                if (fix)
+                {
+                    MXS_WARNING("Binlog file %s is not truncated because of a "
+                                "checksum mismatch, check the file manually.",
+                                router->binlog_name);
+                }
+
+                return 1;
+            }
+        }
+
+        /* Index the start of an event group */
+        if (index)
+        {
+            blr_index_event(index, router->mariadb10_compat, pos,
+                            pending_transaction == 0, &hdr, ptr);
+        }
+
         /* set last event time, pos and type */
         last_event.event_time = (unsigned long)hdr.timestamp;
         last_event.event_type = hdr.event_type;
@@ -0,0 +1,770 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file blr_index.c - binlog index files
+ *
+ * An index file is stored next to the binlog file it describes, with the
+ * BLR_INDEX_SUFFIX appended to the binlog file name. It maps the positions
+ * of event groups to their timestamps and GTIDs so that a position can be
+ * found without reading the binlog file from the start.
+ *
+ * The file starts with the BLR_INDEX_MAGIC string followed by the format
+ * version as a 4 byte integer. The rest of the file consists of
+ * BLR_INDEX_ENTRY_LEN byte entries in ascending position order:
+ *
+ * @verbatim
+ *   8 bytes   position
+ *   8 bytes   GTID sequence number
+ *   4 bytes   GTID domain
+ *   4 bytes   server ID
+ *   4 bytes   timestamp
+ * @endverbatim
+ *
+ * All integers are stored in little-endian byte order.
+ *
+ * The router appends to the index of the binlog file it is writing and uses
+ * the indexes to find the binlog position of a GTID when a MariaDB 10 slave
+ * connects with GTID.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <blr.h>
+#include <log_manager.h>
+
+extern uint32_t extract_field(uint8_t *src, int bits);
+
+static void
+encode_field(uint8_t *dest, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        dest[i] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+/**
+ * Read the valid entries of an index file
+ *
+ * Entries that point beyond the end of the binlog file, which can happen
+ * if the binlog file was truncated, and entries that are not in ascending
+ * position order are ignored along with all entries after them.
+ *
+ * @param path        Path to the index file
+ * @param binlog_size Size of the binlog file
+ * @param entries     Pointer where the entries are stored, must be freed by the caller
+ * @param n_entries   Pointer where the number of entries is stored
+ * @return True if the index file exists and has a valid header
+ */
+static bool
+blr_index_read(const char *path, uint64_t binlog_size, BLR_INDEX_ENTRY **entries, int *n_entries)
+{
+    FILE *file = fopen(path, "rb");
+
+    *entries = NULL;
+    *n_entries = 0;
+
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    bool rval = false;
+    uint8_t hdr[BLR_INDEX_HDR_LEN];
+
+    if (fread(hdr, 1, sizeof(hdr), file) == sizeof(hdr) &&
+        memcmp(hdr, BLR_INDEX_MAGIC, BLR_INDEX_MAGIC_LEN) == 0 &&
+        extract_field(hdr + BLR_INDEX_MAGIC_LEN, 32) == BLR_INDEX_VERSION)
+    {
+        struct stat statb;
+        int max_entries = 0;
+
+        if (fstat(fileno(file), &statb) == 0 && statb.st_size > BLR_INDEX_HDR_LEN)
+        {
+            max_entries = (statb.st_size - BLR_INDEX_HDR_LEN) / BLR_INDEX_ENTRY_LEN;
+        }
+
+        BLR_INDEX_ENTRY *list = max_entries ? malloc(sizeof(BLR_INDEX_ENTRY) * max_entries) : NULL;
+        uint8_t buf[BLR_INDEX_ENTRY_LEN];
+        int n = 0;
+
+        while (n < max_entries && fread(buf, 1, sizeof(buf), file) == sizeof(buf))
+        {
+            BLR_INDEX_ENTRY *entry = &list[n];
+            entry->pos = extract_field(buf, 64);
+            entry->seq = extract_field(buf + 8, 64);
+            entry->domain = extract_field(buf + 16, 32);
+            entry->server_id = extract_field(buf + 20, 32);
+            entry->timestamp = extract_field(buf + 24, 32);
+
+            if (entry->pos >= binlog_size || (n > 0 && entry->pos <= list[n - 1].pos))
+            {
+                break;
+            }
+            n++;
+        }
+
+        if (max_entries == 0 || list)
+        {
+            *entries = list;
+            *n_entries = n;
+            rval = true;
+        }
+    }
+
+    fclose(file);
+    return rval;
+}
+
+/**
+ * Create a new index file for a binlog file
+ *
+ * The index is written to a temporary file which replaces the index file
+ * of the binlog when blr_index_close() is called.
+ *
+ * @param binlog_path Path to the binlog file
+ * @param interval    Minimum number of events between index entries
+ * @return The new index or NULL on error
+ */
+BLR_INDEX *
+blr_index_create(const char *binlog_path, unsigned int interval)
+{
+    size_t len = strlen(binlog_path) + sizeof(BLR_INDEX_SUFFIX);
+    BLR_INDEX *index = calloc(1, sizeof(BLR_INDEX));
+    char *path = malloc(len);
+    char *tmp_path = malloc(len + sizeof(".tmp"));
+
+    if (index == NULL || path == NULL || tmp_path == NULL)
+    {
+        MXS_ERROR("Memory allocation failed when creating the index for %s.", binlog_path);
+        free(index);
+        free(path);
+        free(tmp_path);
+        return NULL;
+    }
+
+    sprintf(path, "%s%s", binlog_path, BLR_INDEX_SUFFIX);
+    sprintf(tmp_path, "%s.tmp", path);
+
+    uint8_t hdr[BLR_INDEX_HDR_LEN];
+    memcpy(hdr, BLR_INDEX_MAGIC, BLR_INDEX_MAGIC_LEN);
+    encode_field(hdr + BLR_INDEX_MAGIC_LEN, BLR_INDEX_VERSION, 4);
+
+    FILE *file = fopen(tmp_path, "wb");
+
+    if (file == NULL || fwrite(hdr, 1, sizeof(hdr), file) != sizeof(hdr))
+    {
+        char err_msg[BLRM_STRERROR_R_MSG_SIZE];
+        MXS_ERROR("Failed to create binlog index file %s: %s", tmp_path,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+
+        if (file)
+        {
+            fclose(file);
+            unlink(tmp_path);
+        }
+
+        free(index);
+        free(path);
+        free(tmp_path);
+        return NULL;
+    }
+
+    index->path = path;
+    index->tmp_path = tmp_path;
+    index->file = file;
+    index->interval = interval;
+
+    return index;
+}
+
+/**
+ * Add an entry to the index
+ *
+ * The entry is only written if at least @c interval events have been
+ * counted in @c n_events since the previous entry. The first entry is
+ * always written.
+ *
+ * @param index Index being written
+ * @param entry The entry to add
+ */
+void
+blr_index_add(BLR_INDEX *index, const BLR_INDEX_ENTRY *entry)
+{
+    if (index->error || (index->n_entries > 0 && index->n_events < index->interval))
+    {
+        return;
+    }
+
+    uint8_t buf[BLR_INDEX_ENTRY_LEN];
+    encode_field(buf, entry->pos, 8);
+    encode_field(buf + 8, entry->seq, 8);
+    encode_field(buf + 16, entry->domain, 4);
+    encode_field(buf + 20, entry->server_id, 4);
+    encode_field(buf + 24, entry->timestamp, 4);
+
+    /** Entries of the binlog being written must be visible to the lookups */
+    if (fwrite(buf, 1, sizeof(buf), index->file) != sizeof(buf) ||
+        (index->tmp_path == NULL && fflush(index->file) != 0))
+    {
+        char err_msg[BLRM_STRERROR_R_MSG_SIZE];
+        MXS_ERROR("Failed to write to binlog index file %s: %s",
+                  index->tmp_path ? index->tmp_path : index->path,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+        index->error = true;
+    }
+
+    index->n_events = 0;
+    index->n_entries++;
+}
+
+/**
+ * Open the index of a binlog file for appending
+ *
+ * This is used for the binlog file the router is writing. Entries that do
+ * not match the current binlog file are removed and a missing or invalid
+ * index file is replaced with an empty one.
+ *
+ * @param binlog_path Path to the binlog file
+ * @param binlog_size Current size of the binlog file
+ * @param interval    Minimum number of events between index entries
+ * @return The opened index or NULL on error
+ */
+BLR_INDEX *
+blr_index_open(const char *binlog_path, uint64_t binlog_size, unsigned int interval)
+{
+    BLR_INDEX *index = calloc(1, sizeof(BLR_INDEX));
+    char *path = malloc(strlen(binlog_path) + sizeof(BLR_INDEX_SUFFIX));
+
+    if (index == NULL || path == NULL)
+    {
+        MXS_ERROR("Memory allocation failed when opening the index for %s.", binlog_path);
+        free(index);
+        free(path);
+        return NULL;
+    }
+
+    sprintf(path, "%s%s", binlog_path, BLR_INDEX_SUFFIX);
+
+    BLR_INDEX_ENTRY *entries;
+    int n_entries;
+    FILE *file;
+
+    if (blr_index_read(path, binlog_size, &entries, &n_entries) &&
+        truncate(path, BLR_INDEX_HDR_LEN + n_entries * BLR_INDEX_ENTRY_LEN) == 0)
+    {
+        file = fopen(path, "ab");
+    }
+    else if ((file = fopen(path, "wb")))
+    {
+        uint8_t hdr[BLR_INDEX_HDR_LEN];
+        memcpy(hdr, BLR_INDEX_MAGIC, BLR_INDEX_MAGIC_LEN);
+        encode_field(hdr + BLR_INDEX_MAGIC_LEN, BLR_INDEX_VERSION, 4);
+        n_entries = 0;
+
+        if (fwrite(hdr, 1, sizeof(hdr), file) != sizeof(hdr) || fflush(file) != 0)
+        {
+            fclose(file);
+            file = NULL;
+        }
+    }
+
+    free(entries);
+
+    if (file == NULL)
+    {
+        char err_msg[BLRM_STRERROR_R_MSG_SIZE];
+        MXS_ERROR("Failed to open binlog index file %s: %s", path,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+        free(index);
+        free(path);
+        return NULL;
+    }
+
+    index->path = path;
+    index->file = file;
+    index->interval = interval;
+    index->n_entries = n_entries;
+
+    return index;
+}
+
+/**
+ * Count an event and add it to the index if it starts an event group
+ *
+ * MariaDB 10 event groups are indexed by their GTID event so that the
+ * entries have a GTID. Otherwise any event except the format description
+ * event that starts at a safe position can be indexed.
+ *
+ * @param index     The index
+ * @param mariadb10 Whether the binlog has MariaDB 10 events
+ * @param pos       Position of the event
+ * @param safe      Whether no transaction is open at @c pos
+ * @param hdr       The event header
+ * @param body      The event data following the header
+ */
+void
+blr_index_event(BLR_INDEX *index, bool mariadb10, uint64_t pos, bool safe,
+                REP_HEADER *hdr, uint8_t *body)
+{
+    index->n_events++;
+
+    if (safe && (mariadb10 ? hdr->event_type == MARIADB10_GTID_EVENT :
+                 hdr->event_type != FORMAT_DESCRIPTION_EVENT))
+    {
+        BLR_INDEX_ENTRY entry = {0};
+        entry.pos = pos;
+        entry.server_id = hdr->serverid;
+        entry.timestamp = hdr->timestamp;
+
+        if (hdr->event_type == MARIADB10_GTID_EVENT)
+        {
+            entry.seq = extract_field(body, 64);
+            entry.domain = extract_field(body + 8, 32);
+        }
+
+        blr_index_add(index, &entry);
+    }
+}
+
+/**
+ * Close the index and replace the old index file with it
+ *
+ * An index opened with blr_index_open() is only closed.
+ *
+ * @param index Index to close, freed by this function
+ * @return True if the index file was written
+ */
+bool
+blr_index_close(BLR_INDEX *index)
+{
+    bool rval = false;
+
+    if (fclose(index->file) != 0)
+    {
+        char err_msg[BLRM_STRERROR_R_MSG_SIZE];
+        MXS_ERROR("Failed to write to binlog index file %s: %s",
+                  index->tmp_path ? index->tmp_path : index->path,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+        index->error = true;
+    }
+
+    if (index->tmp_path == NULL)
+    {
+        rval = !index->error;
+    }
+    else if (index->error)
+    {
+        unlink(index->tmp_path);
+    }
+    else if (rename(index->tmp_path, index->path) != 0)
+    {
+        char err_msg[BLRM_STRERROR_R_MSG_SIZE];
+        MXS_ERROR("Failed to rename binlog index file %s to %s: %s",
+                  index->tmp_path, index->path,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+        unlink(index->tmp_path);
+    }
+    else
+    {
+        rval = true;
+    }
+
+    free(index->path);
+    free(index->tmp_path);
+    free(index);
+
+    return rval;
+}
+
+/**
+ * Read an entry of an index file
+ *
+ * @param fd    Index file
+ * @param i     Offset of the entry
+ * @param entry Where the entry is stored
+ * @return True if the entry was read
+ */
+static bool
+blr_index_read_entry(int fd, long i, BLR_INDEX_ENTRY *entry)
+{
+    uint8_t buf[BLR_INDEX_ENTRY_LEN];
+
+    if (pread(fd, buf, sizeof(buf), BLR_INDEX_HDR_LEN + (off_t)i * BLR_INDEX_ENTRY_LEN) != sizeof(buf))
+    {
+        return false;
+    }
+
+    entry->pos = extract_field(buf, 64);
+    entry->seq = extract_field(buf + 8, 64);
+    entry->domain = extract_field(buf + 16, 32);
+    entry->server_id = extract_field(buf + 20, 32);
+    entry->timestamp = extract_field(buf + 24, 32);
+    return true;
+}
+
+/**
+ * Find the last index entry of a GTID domain with a sequence number that
+ * is not larger than @c seq
+ *
+ * The GTIDs of a domain are in ascending order in the binlog which allows
+ * the entries to be binary searched in the index file. When the entry in
+ * the middle belongs to another domain, the search continues from the next
+ * entry of the domain. Entries that point beyond @c end are treated as
+ * being after all other entries.
+ *
+ * @param path  Path to the index file
+ * @param end   Size of the binlog file
+ * @param domain GTID domain
+ * @param seq   GTID sequence number
+ * @param start Pointer where the position of the found entry is stored
+ * @param next  Pointer where the position of the next entry of the domain
+ *              is stored, or @c end if there is none
+ * @return 1 if the entry was found, 0 if there is no such entry and -1 if
+ *         the index file does not exist or is invalid
+ */
+static int
+blr_index_search(const char *path, uint64_t end, uint32_t domain, uint64_t seq,
+                 uint64_t *start, uint64_t *next)
+{
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    uint8_t hdr[BLR_INDEX_HDR_LEN];
+    struct stat statb;
+
+    if (pread(fd, hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        memcmp(hdr, BLR_INDEX_MAGIC, BLR_INDEX_MAGIC_LEN) != 0 ||
+        extract_field(hdr + BLR_INDEX_MAGIC_LEN, 32) != BLR_INDEX_VERSION ||
+        fstat(fd, &statb) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    long low = 0;
+    long high = (statb.st_size - BLR_INDEX_HDR_LEN) / BLR_INDEX_ENTRY_LEN - 1;
+    int rval = 0;
+
+    *next = end;
+
+    while (low <= high)
+    {
+        long mid = low + (high - low) / 2;
+        long i = mid;
+        BLR_INDEX_ENTRY entry;
+        bool found = false;
+
+        /** Skip the entries of other domains */
+        while (i <= high && blr_index_read_entry(fd, i, &entry) &&
+               entry.pos >= BINLOG_MAGIC_SIZE && entry.pos < end)
+        {
+            if (entry.seq > 0 && entry.domain == domain)
+            {
+                found = true;
+                break;
+            }
+            i++;
+        }
+
+        if (found && entry.seq <= seq)
+        {
+            *start = entry.pos;
+            rval = 1;
+            low = i + 1;
+        }
+        else
+        {
+            if (found)
+            {
+                *next = entry.pos;
+            }
+            high = mid - 1;
+        }
+    }
+
+    close(fd);
+    return rval;
+}
+
+/**
+ * Read the binlog file from a position to find the first event group of a
+ * GTID domain with a sequence number larger than @c seq
+ *
+ * @param path   Path to the binlog file
+ * @param start  Position where to start
+ * @param end    Position where to stop
+ * @param domain GTID domain
+ * @param seq    GTID sequence number
+ * @param pos    Pointer where the position of the found GTID event or the
+ *               position where the reading stopped is stored
+ * @param seen   Set to true if a GTID of the domain not larger than @c seq was seen
+ * @param found  If not NULL, set to the sequence number of the found GTID
+ * @param budget Number of events that can still be read, decremented for each
+ *               event read
+ * @return 1 if the event was found, 0 if not and -1 on error or if the
+ *         budget ran out
+ */
+static int
+blr_index_scan(const char *path, uint64_t start, uint64_t end, uint32_t domain,
+               uint64_t seq, uint64_t *pos, bool *seen, uint64_t *found, long *budget)
+{
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1)
+    {
+        char err_msg[BLRM_STRERROR_R_MSG_SIZE];
+        MXS_ERROR("Failed to open binlog file %s: %s", path,
+                  strerror_r(errno, err_msg, sizeof(err_msg)));
+        return -1;
+    }
+
+    uint8_t buf[BINLOG_EVENT_HDR_LEN + 8 + 4];
+    int rval = 0;
+
+    while (start + BINLOG_EVENT_HDR_LEN <= end)
+    {
+        if (*budget <= 0)
+        {
+            MXS_ERROR("Stopped reading %s at %lu after reading %d events without "
+                      "finding the GTID. Create the missing binlog indexes with "
+                      "'maxbinlogcheck --index'.", path, start, BLR_INDEX_SCAN_LIMIT);
+            rval = -1;
+            break;
+        }
+
+        (*budget)--;
+
+        ssize_t n = pread(fd, buf, sizeof(buf), start);
+
+        if (n < BINLOG_EVENT_HDR_LEN)
+        {
+            MXS_ERROR("Failed to read the event at %lu in %s.", start, path);
+            rval = -1;
+            break;
+        }
+
+        uint32_t event_size = EXTRACT32(buf + 9);
+
+        if (event_size < BINLOG_EVENT_HDR_LEN)
+        {
+            MXS_ERROR("Invalid event size %u at %lu in %s.", event_size, start, path);
+            rval = -1;
+            break;
+        }
+
+        if (buf[4] == MARIADB10_GTID_EVENT && n == sizeof(buf) &&
+            extract_field(buf + BINLOG_EVENT_HDR_LEN + 8, 32) == domain)
+        {
+            uint64_t event_seq = extract_field(buf + BINLOG_EVENT_HDR_LEN, 64);
+
+            if (event_seq > seq)
+            {
+                if (found)
+                {
+                    *found = event_seq;
+                }
+                rval = 1;
+                break;
+            }
+
+            *seen = true;
+        }
+
+        start += event_size;
+    }
+
+    *pos = start;
+    close(fd);
+    return rval;
+}
+
+/**
+ * Find the binlog position where a slave that has replicated a GTID
+ * should continue
+ *
+ * The indexes are searched starting from the newest binlog file to find the
+ * last indexed event group at or before the GTID. The binlog file is then
+ * read from that event group up to the next indexed event group of the
+ * domain to find the first event group after the GTID.
+ *
+ * Binlog files without an index are only read up to their first GTID of
+ * the domain when looking for the file to start from. As this is done in
+ * the thread that registers the slave, at most BLR_INDEX_SCAN_LIMIT events
+ * are read in total and the lookup fails if that is not enough.
+ *
+ * A GTID with a sequence number of 0 finds the start of the oldest binlog.
+ *
+ * @param router The router instance
+ * @param domain GTID domain
+ * @param seq    GTID sequence number
+ * @param file   Buffer of BINLOG_FNAMELEN + 1 bytes where the file name is stored
+ * @param pos    Pointer where the position is stored
+ * @return True if the position was found
+ */
+bool
+blr_index_find_gtid(ROUTER_INSTANCE *router, uint32_t domain, uint64_t seq,
+                    char *file, uint64_t *pos)
+{
+    char current[BINLOG_FNAMELEN + 1];
+    char path[PATH_MAX + 1];
+    uint64_t current_end;
+
+    spinlock_acquire(&router->binlog_lock);
+    strcpy(current, router->binlog_name);
+    current_end = router->binlog_position;
+    spinlock_release(&router->binlog_lock);
+
+    const char *sptr = strrchr(current, '.');
+    int last = sptr ? atoi(sptr + 1) : 0;
+    int first = blr_file_first_binlog(router);
+    int start_file = -1;
+    int oldest = last;
+    uint64_t start_pos = BINLOG_MAGIC_SIZE;
+    uint64_t start_next = 0;
+    long budget = BLR_INDEX_SCAN_LIMIT;
+    bool seen = false;
+
+    if (first <= 0 || first > last)
+    {
+        first = last;
+    }
+
+    if (seq == 0)
+    {
+        snprintf(file, BINLOG_FNAMELEN + 1, BINLOG_NAMEFMT, router->fileroot, first);
+        *pos = BINLOG_MAGIC_SIZE;
+        return true;
+    }
+
+    /** Find the indexed event group to start reading from */
+    for (int i = last; i >= first && start_file == -1; i--)
+    {
+        struct stat statb;
+        uint64_t end = current_end;
+
+        snprintf(path, sizeof(path), "%s/" BINLOG_NAMEFMT, router->binlogdir, router->fileroot, i);
+
+        if (i != last)
+        {
+            if (stat(path, &statb) == -1)
+            {
+                break;
+            }
+            end = statb.st_size;
+        }
+
+        char idx_path[PATH_MAX + sizeof(BLR_INDEX_SUFFIX)];
+        snprintf(idx_path, sizeof(idx_path), "%s%s", path, BLR_INDEX_SUFFIX);
+
+        int rc = blr_index_search(idx_path, end, domain, seq, &start_pos, &start_next);
+
+        if (rc == 1)
+        {
+            start_file = i;
+            seen = true;
+        }
+        else if (rc == -1)
+        {
+            uint64_t gtid_pos;
+            uint64_t first_seq;
+            bool unused = false;
+
+            /** The file has GTIDs up to the target if its first GTID of the domain is */
+            rc = blr_index_scan(path, BINLOG_MAGIC_SIZE, end, domain, 0,
+                                &gtid_pos, &unused, &first_seq, &budget);
+
+            if (rc == -1 && budget <= 0)
+            {
+                return false;
+            }
+            else if (rc == 1 && first_seq <= seq)
+            {
+                start_file = i;
+                start_pos = gtid_pos;
+                start_next = 0;
+            }
+        }
+
+        if (start_file == -1)
+        {
+            oldest = i;
+        }
+    }
+
+    if (start_file == -1)
+    {
+        start_file = oldest;
+        start_pos = BINLOG_MAGIC_SIZE;
+        start_next = 0;
+    }
+
+    /** Read forward from the start position to the next event group */
+    for (int i = start_file; i <= last; i++)
+    {
+        struct stat statb;
+        uint64_t end = current_end;
+
+        snprintf(path, sizeof(path), "%s/" BINLOG_NAMEFMT, router->binlogdir, router->fileroot, i);
+
+        if (i != last)
+        {
+            if (stat(path, &statb) == -1)
+            {
+                MXS_ERROR("%s: Binlog file %s is missing.", router->service->name, path);
+                return false;
+            }
+            end = statb.st_size;
+        }
+
+        /** The next indexed GTID of the domain is the answer if nothing is found before it */
+        bool bounded = i == start_file && start_next > start_pos && start_next < end;
+        int rc = blr_index_scan(path, i == start_file ? start_pos : BINLOG_MAGIC_SIZE,
+                                bounded ? start_next : end, domain, seq, pos, &seen,
+                                NULL, &budget);
+
+        if (rc == -1)
+        {
+            return false;
+        }
+        else if (rc == 1 || bounded || i == last)
+        {
+            if (rc == 0 && bounded)
+            {
+                *pos = start_next;
+            }
+            snprintf(file, BINLOG_FNAMELEN + 1, BINLOG_NAMEFMT, router->fileroot, i);
+            break;
+        }
+    }
+
+    if (!seen)
+    {
+        MXS_ERROR("%s: GTID %u-%lu is older than the oldest binlog file.",
+                  router->service->name, domain, seq);
+        return false;
+    }
+
+    return true;
+}
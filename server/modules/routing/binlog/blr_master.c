@@ -1057,7 +1057,7 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                     }
 
                     /** Prepare the checksum variables for this event */
-                    router->stored_checksum = crc32(0L, NULL, 0);
+                    router->stored_checksum = 0;
                     router->checksum_size = hdr.event_size - MYSQL_CHECKSUM_LEN;
                     router->partial_checksum_bytes = 0;
                 }
@@ -1122,9 +1122,9 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                     {
                         uint32_t size = (len - extra_bytes) < router->checksum_size ?
                             len - extra_bytes : router->checksum_size;
-                        router->stored_checksum = crc32(router->stored_checksum,
-                                                        ptr + offset,
-                                                        size);
+                        router->stored_checksum = mxs_crc32(router->stored_checksum,
+                                                            ptr + offset,
+                                                            size);
                         router->checksum_size -= size;
 
                         if (router->checksum_size == 0 && size < len - offset)
@@ -1172,9 +1172,9 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
 
                 if (router->checksum_size > 0)
                 {
-                    router->stored_checksum = crc32(router->stored_checksum,
-                                                    ptr + offset,
-                                                    size);
+                    router->stored_checksum = mxs_crc32(router->stored_checksum,
+                                                        ptr + offset,
+                                                        size);
                     router->checksum_size -= size;
                 }
 
@@ -1214,7 +1214,8 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                 router->lastEventTimestamp = hdr.timestamp;
 
                 /**
-                 * Check for an open transaction, if the option is set
+                 * Check for an open transaction, if the option is set or
+                 * the events are buffered.
                  * Only complete transactions should be sent to sleves
                  *
                  * If a trasaction is pending router->binlog_position
@@ -1222,7 +1223,7 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                  */
 
                 spinlock_acquire(&router->binlog_lock);
-                if (router->trx_safe == 0 || (router->trx_safe && router->pending_transaction == 0))
+                if (!BLR_HOLDS_TRANSACTIONS(router) || router->pending_transaction == 0)
                 {
                     /* no pending transaction: set current_pos to binlog_position */
                     router->binlog_position = router->current_pos;
@@ -1240,7 +1241,7 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                   * This marks the transaction starts instead of
                   * QUERY_EVENT with "BEGIN"
                  */
-                if (router->trx_safe && router->master_event_state == BLR_EVENT_DONE)
+                if (BLR_HOLDS_TRANSACTIONS(router) && router->master_event_state == BLR_EVENT_DONE)
                 {
                     if (router->mariadb10_compat)
                     {
@@ -1405,6 +1406,19 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                         {
                             router->stats.lastReply = time(0);
                         }
+
+                        /** Don't keep a stalled transaction in memory for too long */
+                        if (blr_file_buffer_expired(router) &&
+                            blr_file_flush_buffer(router) == 0)
+                        {
+                            while ((pkt = gwbuf_consume(pkt, GWBUF_LENGTH(pkt))) != NULL)
+                            {
+                                ;
+                            }
+                            blr_master_close(router);
+                            blr_master_delayed_connect(router);
+                            return;
+                        }
                     }
                     else if (hdr.flags != LOG_EVENT_ARTIFICIAL_F)
                     {
@@ -1448,6 +1462,17 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                             return;
                         }
 
+                        /* Index the first packet of the event */
+                        if (router->index &&
+                            (router->master_event_state == BLR_EVENT_STARTED ||
+                             router->master_event_state == BLR_EVENT_DONE))
+                        {
+                            uint64_t event_pos = hdr.next_pos - hdr.event_size;
+                            blr_index_event(router->index, router->mariadb10_compat, event_pos,
+                                            event_pos == router->binlog_position, &hdr,
+                                            ptr + BINLOG_EVENT_HDR_LEN);
+                        }
+
                         /* Check for rotete event */
                         if (hdr.event_type == ROTATE_EVENT)
                         {
@@ -1469,6 +1494,25 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                             }
                         }
 
+                        /**
+                         * Slaves read the events from the binlog file: write
+                         * out the buffered events before they are distributed.
+                         * The events of an open transaction stay buffered
+                         * until the transaction is complete, the buffer is
+                         * full or write_buffer_interval has passed.
+                         */
+                        if ((router->pending_transaction != 1 || blr_file_buffer_expired(router)) &&
+                            blr_file_flush_buffer(router) == 0)
+                        {
+                            while ((pkt = gwbuf_consume(pkt, GWBUF_LENGTH(pkt))) != NULL)
+                            {
+                                ;
+                            }
+                            blr_master_close(router);
+                            blr_master_delayed_connect(router);
+                            return;
+                        }
+
                         /**
                          * Distributing binlog events to slaves
                          * may depend on pending transaction
@@ -1476,7 +1520,7 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
 
                         spinlock_acquire(&router->binlog_lock);
 
-                        if (router->trx_safe == 0 || (router->trx_safe && router->pending_transaction == 0))
+                        if (!BLR_HOLDS_TRANSACTIONS(router) || router->pending_transaction == 0)
                         {
                             router->binlog_position = router->current_pos;
                             router->current_safe_event = router->last_event_pos;
@@ -1523,9 +1567,14 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                              * 3) set router->binlog_position to
                              *    router->current_pos
                              *
+                             * Without transaction safety the buffered events
+                             * of an open transaction are also distributed as
+                             * soon as they are written to the binlog file.
                              */
+                            uint64_t file_end = router->last_written - router->write_buffer_len;
 
-                            if (router->pending_transaction > 1)
+                            if (router->pending_transaction > 1 ||
+                                (!router->trx_safe && router->binlog_position < file_end))
                             {
                                 unsigned long long pos;
                                 unsigned long long end_pos;
@@ -1534,7 +1583,7 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                                 REP_HEADER new_hdr;
 
                                 pos = router->binlog_position;
-                                end_pos = router->current_pos;
+                                end_pos = file_end;
 
                                 spinlock_release(&router->binlog_lock);
 
@@ -1576,7 +1625,7 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                                 }
 
                                 /* Check whether binlog records has been read in previous loop */
-                                if (pos < router->current_pos)
+                                if (pos < end_pos)
                                 {
                                     char err_message[BINLOG_ERROR_MSG_LEN + 1];
 
@@ -1617,8 +1666,12 @@ blr_handle_binlog_record(ROUTER_INSTANCE *router, GWBUF *pkt)
                                 /* update binlog_position and set pending to 0 */
                                 spinlock_acquire(&router->binlog_lock);
 
-                                router->binlog_position = router->current_pos;
-                                router->pending_transaction = 0;
+                                router->binlog_position = end_pos;
+
+                                if (router->pending_transaction > 1)
+                                {
+                                    router->pending_transaction = 0;
+                                }
 
                                 spinlock_release(&router->binlog_lock);
                             }
@@ -1831,6 +1884,10 @@ typedef enum
 /**
  * Distribute the binlog record we have just received to all the registered slaves.
  *
+ * The slaves are read from the snapshot of dumping slaves which means that
+ * the router lock is not held while the event is distributed. The binlog
+ * position of the router is also read only once for all the slaves.
+ *
  * @param   router      The router instance
  * @param   hdr     The replication event header
  * @param   ptr     The raw replication event data
@@ -1840,16 +1897,42 @@ blr_distribute_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint8_t *
                              blr_thread_role_t role)
 {
     ROUTER_SLAVE *slave;
+    BLR_SLAVE_ARRAY *array;
     int action;
     unsigned int cstate;
+    char router_binlog[BINLOG_FNAMELEN + 1];
+    char router_prevbinlog[BINLOG_FNAMELEN + 1];
+    uint64_t current_pos, current_safe_event, last_event_pos;
 
-    spinlock_acquire(&router->lock);
-    slave = router->slaves;
-    while (slave)
+    if ((array = blr_slave_array_acquire(router)) == NULL)
     {
+        return;
+    }
+
+    /** Only the master thread updates these values */
+    spinlock_acquire(&router->binlog_lock);
+    strcpy(router_binlog, router->binlog_name);
+    strcpy(router_prevbinlog, router->prevbinlog);
+    current_pos = router->current_pos;
+    current_safe_event = router->current_safe_event;
+    last_event_pos = router->last_event_pos;
+    spinlock_release(&router->binlog_lock);
+
+    for (int i = 0; i < array->n_slaves; i++)
+    {
+        bool close_dcb = false;
+        slave = array->slaves[i];
+
+        /**
+         * The snapshot keeps the slave alive but not its DCB. closeSession()
+         * marks the slave as unregistered under rses_lock before the DCB is
+         * closed so holding the lock while the DCB is used keeps it alive.
+         */
+        spinlock_acquire(&slave->rses_lock);
+
         if (slave->state != BLRS_DUMPING)
         {
-            slave = slave->next;
+            spinlock_release(&slave->rses_lock);
             continue;
         }
         spinlock_acquire(&slave->catch_lock);
@@ -1888,21 +1971,19 @@ blr_distribute_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint8_t *
 
         if (action == 1)
         {
-            spinlock_acquire(&router->binlog_lock);
-
             slave_event_action_t slave_action = SLAVE_FORCE_CATCHUP;
-            const bool same_file = strcmp(slave->binlogfile, router->binlog_name) == 0;
+            const bool same_file = strcmp(slave->binlogfile, router_binlog) == 0;
             const bool rotate = hdr->event_type == ROTATE_EVENT &&
-                strcmp(slave->binlogfile, router->prevbinlog) == 0;
+                strcmp(slave->binlogfile, router_prevbinlog) == 0;
 
-            if (router->trx_safe && (same_file || rotate) &&
-                slave->binlog_pos == router->current_safe_event)
+            if (BLR_HOLDS_TRANSACTIONS(router) && (same_file || rotate) &&
+                slave->binlog_pos == current_safe_event)
             {
                 /** Slave needs the current event being distributed */
                 slave_action = SLAVE_SEND_EVENT;
             }
-            else if (!router->trx_safe && (same_file || rotate) &&
-                     slave->binlog_pos == router->last_event_pos)
+            else if (!BLR_HOLDS_TRANSACTIONS(router) && (same_file || rotate) &&
+                     slave->binlog_pos == last_event_pos)
             {
                 /** Transaction safety is off */
                 slave_action = SLAVE_SEND_EVENT;
@@ -1942,7 +2023,7 @@ blr_distribute_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint8_t *
                           "from the master. Slave is using '%s' with position %d "
                           "when master binlog file is '%s'.", slave->dcb->remote,
                           ntohs((slave->dcb->ipv4).sin_port), slave->serverid,
-                          slave->binlogfile, slave->binlog_pos, router->binlog_name);
+                          slave->binlogfile, slave->binlog_pos, router_binlog);
             }
             else
             {
@@ -1951,12 +2032,10 @@ blr_distribute_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint8_t *
                           "position %d. Master binlog file is '%s' at position %lu "
                           "with last safe event at %lu.", slave->dcb->remote,
                           ntohs((slave->dcb->ipv4).sin_port), slave->serverid,
-                          slave->binlogfile, slave->binlog_pos, router->binlog_name,
-                          router->current_pos, router->current_safe_event);
+                          slave->binlogfile, slave->binlog_pos, router_binlog,
+                          current_pos, current_safe_event);
             }
 
-            spinlock_release(&router->binlog_lock);
-
             /*
              * If slave_action is SLAVE_FORCE_CATCHUP then
              * the slave is not at the position it should be. Force it into
@@ -2021,7 +2100,7 @@ blr_distribute_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint8_t *
                                 binlog_name,
                                 binlog_pos);
                     slave->state = BLRS_ERRORED;
-                    dcb_close(slave->dcb);
+                    close_dcb = true;
                 }
                 break;
 
@@ -2073,9 +2152,16 @@ blr_distribute_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint8_t *
             }
         }
 
-        slave = slave->next;
+        spinlock_release(&slave->rses_lock);
+
+        /** Closing the DCB calls closeSession() which takes rses_lock */
+        if (close_dcb)
+        {
+            dcb_close(slave->dcb);
+        }
     }
-    spinlock_release(&router->lock);
+
+    blr_slave_array_release(array);
 }
 
 /**
@@ -2589,6 +2675,14 @@ blr_write_data_into_binlog(ROUTER_INSTANCE *router, uint32_t data_len, uint8_t *
 {
     int n;
 
+    /** Large events are written directly, after any buffered events */
+    if (blr_file_flush_buffer(router) == 0)
+    {
+        return 0;
+    }
+
+    router->stats.n_binlog_writes++;
+
     if ((n = pwrite(router->binlog_fd, buf, data_len,
                     router->last_written)) != data_len)
     {
@@ -82,7 +82,6 @@
 #include <skygw_utils.h>
 #include <log_manager.h>
 #include <version.h>
-#include <zlib.h>
 
 extern int load_mysql_users(SERVICE *service);
 extern void blr_master_close(ROUTER_INSTANCE* router);
@@ -98,6 +97,7 @@ static void blr_slave_send_error(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, c
 static int blr_slave_send_timestamp(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave);
 static int blr_slave_register(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue);
 static int blr_slave_binlog_dump(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue);
+static int blr_slave_send_binary_logs(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave);
 int blr_slave_catchup(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, bool large);
 uint8_t *blr_build_header(GWBUF *pkt, REP_HEADER *hdr);
 int blr_slave_callback(DCB *dcb, DCB_REASON reason, void *data);
@@ -619,6 +619,28 @@ blr_slave_query(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue)
                 MXS_ERROR("%s: Expected LIKE clause in SHOW VARIABLES.",
                           router->service->name);
         }
+        else if (strcasecmp(word, "BINARY") == 0)
+        {
+            if ((word = strtok_r(NULL, sep, &brkb)) == NULL || strcasecmp(word, "LOGS") != 0)
+            {
+                MXS_ERROR("%s: Expected SHOW BINARY LOGS command",
+                          router->service->name);
+            }
+            else
+            {
+                free(query_text);
+
+                /* if state is BLRM_UNCONFIGURED return empty result */
+                if (router->master_state > BLRM_UNCONFIGURED)
+                {
+                    return blr_slave_send_binary_logs(router, slave);
+                }
+                else
+                {
+                    return blr_slave_send_ok(router, slave);
+                }
+            }
+        }
         else if (strcasecmp(word, "MASTER") == 0)
         {
             if ((word = strtok_r(NULL, sep, &brkb)) == NULL)
@@ -768,6 +790,57 @@ blr_slave_query(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue)
             free(query_text);
             return blr_slave_replay(router, slave, router->saved_master.chksum1);
         }
+        else if (strcasecmp(word, "@slave_connect_state") == 0)
+        {
+            char *state = strtok_r(NULL, sep, &brkb);
+            unsigned int domain = 0, server_id = 0;
+            unsigned long seq = 0;
+            int len = state ? strlen(state) : 0;
+
+            /* Remove the quotes, an empty state is '' */
+            if (len > 0 && state[len - 1] == '\'')
+            {
+                state[len - 1] = '\0';
+            }
+            if (len > 0 && state[0] == '\'')
+            {
+                state++;
+            }
+
+            if (!router->mariadb10_compat)
+            {
+                free(query_text);
+                blr_slave_send_error(router, slave,
+                                     "GTID based replication requires the mariadb10-compatibility option");
+                return 1;
+            }
+            else if (state == NULL ||
+                     (*state && sscanf(state, "%u-%u-%lu", &domain, &server_id, &seq) != 3) ||
+                     strtok_r(NULL, sep, &brkb) != NULL)
+            {
+                /* Only one GTID domain is supported */
+                MXS_ERROR("%s: Unsupported @slave_connect_state from slave %s.",
+                          router->service->name, slave->dcb->remote);
+                free(query_text);
+                blr_slave_send_error(router, slave,
+                                     "Only a single GTID domain is supported in @slave_connect_state");
+                return 1;
+            }
+
+            slave->use_gtid = true;
+            slave->gtid_domain = domain;
+            slave->gtid_server_id = server_id;
+            slave->gtid_seq = seq;
+
+            free(query_text);
+            return blr_slave_send_ok(router, slave);
+        }
+        else if (strcasecmp(word, "@slave_gtid_strict_mode") == 0 ||
+                 strcasecmp(word, "@slave_gtid_ignore_duplicates") == 0)
+        {
+            free(query_text);
+            return blr_slave_send_ok(router, slave);
+        }
         else if (strcasecmp(word, "@slave_uuid") == 0)
         {
             if ((word = strtok_r(NULL, sep, &brkb)) != NULL)
@@ -1827,6 +1900,91 @@ blr_slave_send_slave_hosts(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
     return blr_slave_send_eof(router, slave, seqno);
 }
 
+/**
+ * Send the response to the SQL command "SHOW BINARY LOGS"
+ *
+ * The file sizes are read from the file system, the binlog files are
+ * not read.
+ *
+ * @param   router      The binlog router instance
+ * @param   slave       The slave server to which we are sending the response
+ * @return  Non-zero if data was sent
+ */
+static int
+blr_slave_send_binary_logs(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
+{
+    GWBUF *pkt;
+    char current[BINLOG_FNAMELEN + 1];
+    char log_name[BINLOG_FNAMELEN + 1];
+    char file_size[40];
+    char path[PATH_MAX + 1];
+    uint64_t current_size;
+    uint8_t *ptr;
+    int len, seqno;
+
+    spinlock_acquire(&router->binlog_lock);
+    strcpy(current, router->binlog_name);
+    current_size = router->binlog_position;
+    spinlock_release(&router->binlog_lock);
+
+    char *sptr = strrchr(current, '.');
+    int last = sptr ? atoi(sptr + 1) : 0;
+    int first = blr_file_first_binlog(router);
+
+    if (first <= 0 || first > last)
+    {
+        first = last;
+    }
+
+    blr_slave_send_fieldcount(router, slave, 2);
+    blr_slave_send_columndef(router, slave, "Log_name", BLR_TYPE_STRING, 40, 2);
+    blr_slave_send_columndef(router, slave, "File_size", BLR_TYPE_STRING, 40, 3);
+    blr_slave_send_eof(router, slave, 4);
+
+    seqno = 5;
+
+    for (int i = first; i <= last; i++)
+    {
+        struct stat statb;
+
+        snprintf(log_name, sizeof(log_name), BINLOG_NAMEFMT, router->fileroot, i);
+
+        if (i == last)
+        {
+            sprintf(file_size, "%lu", (unsigned long)current_size);
+        }
+        else
+        {
+            snprintf(path, sizeof(path), "%s/%s", router->binlogdir, log_name);
+
+            if (stat(path, &statb) == -1)
+            {
+                continue;
+            }
+            sprintf(file_size, "%lu", (unsigned long)statb.st_size);
+        }
+
+        len = 4 + strlen(log_name) + strlen(file_size) + 2;
+        if ((pkt = gwbuf_alloc(len)) == NULL)
+        {
+            return 0;
+        }
+        ptr = GWBUF_DATA(pkt);
+        encode_value(ptr, len - 4, 24);         // Add length of data packet
+        ptr += 3;
+        *ptr++ = seqno++;                       // Sequence number in response
+        *ptr++ = strlen(log_name);              // Length of result string
+        memcpy(ptr, log_name, strlen(log_name)); // Result string
+        ptr += strlen(log_name);
+        *ptr++ = strlen(file_size);             // Length of result string
+        memcpy(ptr, file_size, strlen(file_size)); // Result string
+        ptr += strlen(file_size);
+        slave->dcb->func.write(slave->dcb, pkt);
+    }
+
+    return blr_slave_send_eof(router, slave, seqno);
+}
+
 /**
  * Process a slave replication registration message.
  *
@@ -1942,6 +2100,40 @@ blr_slave_binlog_dump(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue
     strncpy(slave->binlogfile, (char *)ptr, binlognamelen);
     slave->binlogfile[binlognamelen] = 0;
 
+    /* A MariaDB 10 slave that set @slave_connect_state is positioned by GTID */
+    if (slave->use_gtid)
+    {
+        char file[BINLOG_FNAMELEN + 1];
+        uint64_t pos;
+
+        if (!blr_index_find_gtid(router, slave->gtid_domain, slave->gtid_seq, file, &pos))
+        {
+            char errmsg[BINLOG_ERROR_MSG_LEN + 1];
+            snprintf(errmsg, BINLOG_ERROR_MSG_LEN,
+                     "Could not find GTID %u-%u-%lu in the binlog files",
+                     slave->gtid_domain, slave->gtid_server_id, slave->gtid_seq);
+
+            slave->state = BLRS_ERRORED;
+            blr_send_custom_error(slave->dcb, 1, 0, errmsg, "HY000", 1236);
+
+            MXS_ERROR("%s: Slave %s, server-id %d: %s",
+                      router->service->name, slave->dcb->remote,
+                      slave->serverid, errmsg);
+
+            dcb_close(slave->dcb);
+            return 1;
+        }
+
+        strcpy(slave->binlogfile, file);
+        slave->binlog_pos = pos;
+        binlognamelen = strlen(file);
+
+        MXS_INFO("%s: Slave %s, server-id %d, GTID %u-%u-%lu found at binlog '%s' position %lu.",
+                 router->service->name, slave->dcb->remote, slave->serverid,
+                 slave->gtid_domain, slave->gtid_server_id, slave->gtid_seq,
+                 file, (unsigned long)pos);
+    }
+
     if (router->trx_safe)
     {
         /**
@@ -2027,8 +2219,7 @@ blr_slave_binlog_dump(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue
          * include the length, sequence number and ok byte that makes up the first
          * 5 bytes of the message. We also do not include the 4 byte checksum itself.
          */
-        chksum = crc32(0L, NULL, 0);
-        chksum = crc32(chksum, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
+        chksum = mxs_crc32(0, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
         encode_value(ptr, chksum, 32);
     }
 
@@ -2058,7 +2249,7 @@ blr_slave_binlog_dump(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, GWBUF *queue
 
     dcb_add_callback(slave->dcb, DCB_REASON_DRAINED, blr_slave_callback, slave);
 
-    slave->state = BLRS_DUMPING;
+    blr_slave_start_dumping(router, slave);
 
     MXS_NOTICE("%s: Slave %s:%d, server id %d requested binlog file %s from position %lu",
                router->service->name, slave->dcb->remote,
@@ -2763,8 +2954,7 @@ blr_slave_fake_rotate(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave, BLFILE** fil
          * include the length, sequence number and ok byte that makes up the first
          * 5 bytes of the message. We also do not include the 4 byte checksum itself.
          */
-        chksum = crc32(0L, NULL, 0);
-        chksum = crc32(chksum, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
+        chksum = mxs_crc32(0, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
         encode_value(ptr, chksum, 32);
     }
 
@@ -2831,8 +3021,7 @@ blr_slave_send_fde(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
      * and write it into the header
      */
     ptr = GWBUF_DATA(record) + hdr.event_size - 4;
-    chksum = crc32(0L, NULL, 0);
-    chksum = crc32(chksum, GWBUF_DATA(record), hdr.event_size - 4);
+    chksum = mxs_crc32(0, GWBUF_DATA(record), hdr.event_size - 4);
     encode_value(ptr, chksum, 32);
 
     slave->dcb->func.write(slave->dcb, head);
@@ -3773,6 +3962,7 @@ int blr_handle_change_master(ROUTER_INSTANCE* router, char *command, char *error
             router->current_safe_event = 4;
 
             /* close current file binlog file, next start slave will create the new one */
+            blr_file_flush_buffer(router);
             fsync(router->binlog_fd);
             close(router->binlog_fd);
             router->binlog_fd = -1;
@@ -5267,8 +5457,7 @@ blr_slave_send_heartbeat(ROUTER_INSTANCE *router, ROUTER_SLAVE *slave)
     /* Add the CRC32 */
     if (!slave->nocrc)
     {
-        chksum = crc32(0L, NULL, 0);
-        chksum = crc32(chksum, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
+        chksum = mxs_crc32(0, GWBUF_DATA(resp) + 5, hdr.event_size - 4);
         encode_value(ptr, chksum, 32);
     }
 
@@ -30,6 +30,10 @@
  *                  with flags = 0
  *
  * @endverbatim
+ *
+ * Multiple binlog files can be given on the command line. With the --threads
+ * option the files are checked concurrently and with the --index option a
+ * binlog index file is written for each checked file.
  */
 
 #include <stdio.h>
@@ -56,11 +60,11 @@
 #include <ini.h>
 #include <sys/stat.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include <version.h>
 #include <gwdirs.h>
 
-extern int blr_read_events_all_events(ROUTER_INSTANCE *router, int fix, int debug);
 extern uint32_t extract_field(uint8_t *src, int bits);
 static void printVersion(const char *progname);
 static void printUsage(const char *progname);
@@ -71,11 +75,28 @@ static struct option long_options[] =
     {"version",   no_argument,        0,  'V'},
     {"fix",   no_argument,        0,  'f'},
     {"mariadb10", no_argument,        0,  'M'},
+    {"threads",   required_argument,  0,  'j'},
+    {"index", no_argument,        0,  'i'},
+    {"index-interval", required_argument,  0,  'I'},
     {"help",  no_argument,        0,  '?'},
     {0, 0, 0, 0}
 };
 
-char *binlog_check_version = "1.1.0";
+char *binlog_check_version = "1.2.0";
+
+/** The files to check and the options shared by the checking threads */
+typedef struct
+{
+    char **files;           /*< Binlog files to check */
+    int n_files;            /*< Number of files */
+    int next_file;          /*< Index of the next file to check */
+    int n_errors;           /*< Number of files with errors */
+    int debug_out;
+    int fix_file;
+    int mariadb10_compat;
+    int write_index;
+    unsigned int index_interval;
+} CHECK_JOB;
 
 int
 maxscale_uptime()
@@ -83,70 +104,32 @@ maxscale_uptime()
     return 1;
 }
 
-int main(int argc, char **argv)
+/**
+ * Check one binlog file
+ *
+ * @param job  The check job
+ * @param path Path to the binlog file
+ * @return The return value of blr_read_events_index() or -1 if the
+ *         file could not be checked or its index could not be written
+ */
+static int
+check_file(CHECK_JOB *job, const char *path)
 {
     ROUTER_INSTANCE *inst;
+    BLR_INDEX *index = NULL;
     int fd;
     int ret;
-    char *ptr;
-    char path[PATH_MAX + 1] = "";
+    const char *ptr;
     unsigned long filelen = 0;
     struct  stat statb;
-    char c;
-    int option_index = 0;
-    int num_args = 0;
-    int debug_out = 0;
-    int fix_file = 0;
-    int mariadb10_compat = 0;
-
-    while ((c = getopt_long(argc, argv, "dVfM?", long_options, &option_index)) >= 0)
-    {
-        switch (c)
-        {
-        case 'd':
-            debug_out = 1;
-            break;
-        case 'V':
-            printVersion(*argv);
-            exit(EXIT_SUCCESS);
-            break;
-        case 'f':
-            fix_file = 1;
-            break;
-        case 'M':
-            mariadb10_compat = 1;
-            break;
-        case '?':
-            printUsage(*argv);
-            exit(optopt ? EXIT_FAILURE : EXIT_SUCCESS);
-        }
-    }
-
-    num_args = optind;
-
-    mxs_log_init(NULL, NULL, MXS_LOG_TARGET_DEFAULT);
-    mxs_log_set_augmentation(0);
-    mxs_log_set_priority_enabled(LOG_DEBUG, debug_out);
 
     if ((inst = calloc(1, sizeof(ROUTER_INSTANCE))) == NULL)
     {
         MXS_ERROR("Memory allocation failed for ROUTER_INSTANCE");
-
-        mxs_log_flush_sync();
-        mxs_log_finish();
-
-        return 1;
+        return -1;
     }
 
-    if (argv[num_args] == NULL)
-    {
-        printf("ERROR: No binlog file was specified\n");
-        exit(EXIT_FAILURE);
-    }
-
-    strncpy(path, argv[num_args], PATH_MAX);
-
-    if (fix_file)
+    if (job->fix_file)
     {
         fd = open(path, O_RDWR, 0666);
     }
@@ -160,17 +143,14 @@ int main(int argc, char **argv)
         MXS_ERROR("Failed to open binlog file %s: %s",
                   path, strerror(errno));
 
-        mxs_log_flush_sync();
-        mxs_log_finish();
-
         free(inst);
 
-        return 1;
+        return -1;
     }
 
     inst->binlog_fd = fd;
 
-    if (mariadb10_compat == 1)
+    if (job->mariadb10_compat == 1)
     {
         inst->mariadb10_compat = 1;
     }
@@ -185,8 +165,6 @@ int main(int argc, char **argv)
         strncpy(inst->binlog_name, path, BINLOG_FNAMELEN);
     }
 
-    MXS_NOTICE("maxbinlogcheck %s", binlog_check_version);
-
     if (fstat(inst->binlog_fd, &statb) == 0)
     {
         filelen = statb.st_size;
@@ -194,21 +172,175 @@ int main(int argc, char **argv)
 
     MXS_NOTICE("Checking %s (%s), size %lu bytes", path, inst->binlog_name, filelen);
 
+    if (job->write_index)
+    {
+        index = blr_index_create(path, job->index_interval);
+    }
+
     /* read binary log */
-    ret = blr_read_events_all_events(inst, fix_file, debug_out);
+    ret = blr_read_events_index(inst, job->fix_file, job->debug_out, index);
 
     close(inst->binlog_fd);
 
-    mxs_log_flush_sync();
+    if (index)
+    {
+        unsigned long n_entries = index->n_entries;
+
+        if (blr_index_close(index))
+        {
+            MXS_NOTICE("Wrote %lu index entries for %s", n_entries, inst->binlog_name);
+        }
+        else if (ret == 0)
+        {
+            ret = -1;
+        }
+    }
 
     MXS_NOTICE("Check retcode: %i, Binlog Pos = %lu", ret, inst->binlog_position);
 
+    free(inst);
+
+    return ret;
+}
+
+/**
+ * Check files until all files of the job have been checked
+ *
+ * @param data The check job
+ * @return NULL
+ */
+static void *
+check_thread(void *data)
+{
+    CHECK_JOB *job = (CHECK_JOB *)data;
+    int i;
+
+    while ((i = atomic_add(&job->next_file, 1)) < job->n_files)
+    {
+        if (check_file(job, job->files[i]) != 0)
+        {
+            atomic_add(&job->n_errors, 1);
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    CHECK_JOB job;
+    char c;
+    int option_index = 0;
+    int num_args = 0;
+    int n_threads = 1;
+
+    memset(&job, 0, sizeof(job));
+    job.index_interval = DEF_INDEX_INTERVAL;
+
+    while ((c = getopt_long(argc, argv, "dVfMj:iI:?", long_options, &option_index)) >= 0)
+    {
+        switch (c)
+        {
+        case 'd':
+            job.debug_out = 1;
+            break;
+        case 'V':
+            printVersion(*argv);
+            exit(EXIT_SUCCESS);
+            break;
+        case 'f':
+            job.fix_file = 1;
+            break;
+        case 'M':
+            job.mariadb10_compat = 1;
+            break;
+        case 'j':
+            n_threads = atoi(optarg);
+            if (n_threads < 1)
+            {
+                printf("ERROR: Invalid number of threads: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'i':
+            job.write_index = 1;
+            break;
+        case 'I':
+            if (atoi(optarg) < 1)
+            {
+                printf("ERROR: Invalid index interval: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            job.index_interval = atoi(optarg);
+            break;
+        case '?':
+            printUsage(*argv);
+            exit(optopt ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+    }
+
+    num_args = optind;
+
+    if (argv[num_args] == NULL)
+    {
+        printf("ERROR: No binlog file was specified\n");
+        exit(EXIT_FAILURE);
+    }
+
+    job.files = argv + num_args;
+    job.n_files = argc - num_args;
+
+    if (n_threads > job.n_files)
+    {
+        n_threads = job.n_files;
+    }
+
+    mxs_log_init(NULL, NULL, MXS_LOG_TARGET_DEFAULT);
+    mxs_log_set_augmentation(0);
+    mxs_log_set_priority_enabled(LOG_DEBUG, job.debug_out);
+
+    MXS_NOTICE("maxbinlogcheck %s", binlog_check_version);
+
+    if (n_threads == 1)
+    {
+        check_thread(&job);
+    }
+    else
+    {
+        pthread_t threads[n_threads];
+        int started = 0;
+
+        for (int i = 0; i < n_threads; i++)
+        {
+            if (pthread_create(&threads[i], NULL, check_thread, &job) != 0)
+            {
+                MXS_ERROR("Failed to start a checking thread: %s", strerror(errno));
+                break;
+            }
+            started++;
+        }
+
+        /** Check the files in this thread if no threads could be started */
+        if (started == 0)
+        {
+            check_thread(&job);
+        }
+
+        for (int i = 0; i < started; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    if (job.n_files > 1)
+    {
+        MXS_NOTICE("Checked %d binlog files, %d files had errors", job.n_files, job.n_errors);
+    }
+
     mxs_log_flush_sync();
     mxs_log_finish();
 
-    free(inst);
-
-    return 0;
+    return job.n_errors ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 /**
@@ -229,10 +361,13 @@ printUsage(const char *progname)
     printVersion(progname);
 
     printf("The MaxScale binlog check utility.\n\n");
-    printf("Usage: %s [-f] [-d] [-v] [<binlog file>]\n\n", progname);
+    printf("Usage: %s [-f] [-d] [-v] [-j <threads>] [-i] [<binlog file> ...]\n\n", progname);
     printf("  -f|--fix		Fix binlog file, require write permissions (truncate)\n");
     printf("  -d|--debug		Print debug messages\n");
     printf("  -M|--mariadb10	MariaDB 10 binlog compatibility\n");
+    printf("  -j|--threads=N	Check N binlog files concurrently\n");
+    printf("  -i|--index		Write an index file <binlog file>%s for each file\n", BLR_INDEX_SUFFIX);
+    printf("  -I|--index-interval=N	Add an index entry every N events, default %d\n", DEF_INDEX_INTERVAL);
     printf("  -V|--version          print version information and exit\n");
     printf("  -?|--help             Print this help text\n");
 }
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2016 MariaDB Corporation Ab
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file and at www.mariadb.com/bsl.
+ *
+ * Change Date: 2019-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2 or later of the General
+ * Public License.
+ */
+
+/**
+ * @file testdistribute.c - Benchmark of binlog event distribution to a large
+ * number of slaves
+ *
+ * The test distributes events to 500 slaves while another thread keeps
+ * connecting and disconnecting slaves. None of the slaves is in a state
+ * where the event would be written to the network so the test measures
+ * the cost of walking the slaves.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <blr.h>
+#include <spinlock.h>
+#include <skygw_debug.h>
+#include <log_manager.h>
+
+#define N_SLAVES    500
+#define N_EVENTS    100000
+
+extern void blr_distribute_binlog_record(ROUTER_INSTANCE *router, REP_HEADER *hdr, uint8_t *ptr,
+                                         blr_thread_role_t role);
+
+static volatile bool running = true;
+
+static ROUTER_SLAVE *
+create_slave(ROUTER_INSTANCE *router, unsigned int cstate)
+{
+    ROUTER_SLAVE *slave = calloc(1, sizeof(ROUTER_SLAVE));
+    ss_info_dassert(slave, "Slave allocation should succeed");
+
+#if defined(SS_DEBUG)
+    slave->rses_chk_top = CHK_NUM_ROUTER_SES;
+    slave->rses_chk_tail = CHK_NUM_ROUTER_SES;
+#endif
+    slave->refcount = 1;
+    slave->cstate = cstate;
+    slave->router = router;
+    spinlock_init(&slave->catch_lock);
+    strcpy(slave->binlogfile, router->binlog_name);
+
+    spinlock_acquire(&router->lock);
+    slave->next = router->slaves;
+    router->slaves = slave;
+    spinlock_release(&router->lock);
+
+    blr_slave_start_dumping(router, slave);
+    return slave;
+}
+
+/**
+ * Simulate slaves that connect and disconnect while events are distributed
+ */
+static void *
+churn_slaves(void *data)
+{
+    ROUTER_INSTANCE *router = (ROUTER_INSTANCE *)data;
+    int n = 0;
+
+    while (running)
+    {
+        ROUTER_SLAVE *slave = create_slave(router, CS_EXPECTCB);
+        slave->state = BLRS_UNREGISTERED;
+        blr_slave_remove(router, slave);
+        blr_slave_release(slave);
+        n++;
+    }
+
+    printf("Connected and disconnected %d slaves\n", n);
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    ROUTER_INSTANCE router;
+    ROUTER_SLAVE *slaves[N_SLAVES];
+    REP_HEADER hdr;
+    uint8_t event[BINLOG_EVENT_HDR_LEN] = {0};
+    struct timespec start, end;
+    pthread_t thr;
+    int rval = 0;
+
+    mxs_log_init(NULL, NULL, MXS_LOG_TARGET_DEFAULT);
+
+    memset(&router, 0, sizeof(router));
+    spinlock_init(&router.lock);
+    spinlock_init(&router.binlog_lock);
+    strcpy(router.binlog_name, "mysql-bin.000001");
+
+    /** Half of the slaves are catching up, the rest are up to date and busy */
+    for (int i = 0; i < N_SLAVES; i++)
+    {
+        slaves[i] = create_slave(&router, i % 2 ? CS_EXPECTCB : CS_UPTODATE | CS_BUSY);
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.event_type = QUERY_EVENT;
+    hdr.event_size = sizeof(event);
+
+    pthread_create(&thr, NULL, churn_slaves, &router);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < N_EVENTS; i++)
+    {
+        hdr.next_pos = BINLOG_MAGIC_SIZE + (i + 1) * sizeof(event);
+        blr_distribute_binlog_record(&router, &hdr, event, BLR_THREAD_ROLE_MASTER_NOTRX);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    running = false;
+    pthread_join(thr, NULL);
+
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+    printf("Distributed %d events to %d slaves in %.3f seconds: %.0f events/s, %.2f us/event\n",
+           N_EVENTS, N_SLAVES, secs, N_EVENTS / secs, secs * 1000000.0 / N_EVENTS);
+
+    for (int i = 0; i < N_SLAVES; i++)
+    {
+        int n = slaves[i]->stats.n_actions[0] + slaves[i]->stats.n_actions[1] +
+            slaves[i]->stats.n_actions[2];
+
+        if (n != N_EVENTS)
+        {
+            printf("Slave %d saw %d events instead of %d\n", i, n, N_EVENTS);
+            rval = 1;
+        }
+
+        blr_slave_remove(&router, slaves[i]);
+        blr_slave_release(slaves[i]);
+    }
+
+    if (router.slave_array != NULL)
+    {
+        printf("The slave snapshot should be empty after all slaves are removed\n");
+        rval = 1;
+    }
+
+    mxs_log_finish();
+    return rval;
+}
@@ -28,6 +28,7 @@
 #include <spinlock.h>
 #include <modinfo.h>
 #include <modutil.h>
+#include <monitor.h>
 #include <mysql_client_server_protocol.h>
 #include <mysqld_error.h>
 
@@ -4274,6 +4275,12 @@ static void handleError(ROUTER *instance, void *router_session,
         {
             case ERRACT_NEW_CONNECTION:
             {
+                /** Let the monitor check the server now instead of at its next interval */
+                if (problem_dcb->server)
+                {
+                    monitor_request_probe(problem_dcb->server);
+                }
+
                 if (!rses_begin_locked_router_action(rses))
                 {
                     *succp = false;